@@ -0,0 +1,55 @@
+/**
+ * @file       Arduino.cpp
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+#include "Arduino.h"
+#include <time.h>
+
+static uint64_t monotonicMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// Both counters start at 0 when the program does, and wrap like Arduino's
+static const uint64_t startMicros = monotonicMicros();
+
+unsigned long millis() {
+  return (unsigned long)((monotonicMicros() - startMicros) / 1000);
+}
+
+unsigned long micros() {
+  return (unsigned long)(monotonicMicros() - startMicros);
+}
+
+void delay(unsigned long ms) {
+  struct timespec ts;
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (ms % 1000) * 1000000L;
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+}
+
+void delayMicroseconds(unsigned int us) {
+  struct timespec ts;
+  ts.tv_sec = us / 1000000;
+  ts.tv_nsec = (us % 1000000) * 1000L;
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+}
+
+// Stream::timedRead() and friends call this while they wait for input
+void yield() {
+  PosixSerial::waitAny(1);
+}
+
+static const char* portPath(const char* env, const char* fallback) {
+  const char* path = getenv(env);
+  return path && *path ? path : fallback;
+}
+
+HardwareSerial Serial(STDIN_FILENO, STDOUT_FILENO);
+HardwareSerial Serial1(portPath("TINY_GSM_SERIAL1", "/dev/ttyUSB0"));
+HardwareSerial Serial2(portPath("TINY_GSM_SERIAL2", "/dev/ttyUSB1"));
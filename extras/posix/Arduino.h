@@ -0,0 +1,65 @@
+/**
+ * @file       Arduino.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+#ifndef Arduino_h
+#define Arduino_h
+
+// Just enough of the Arduino core to build TinyGSM and its sketches on
+// Linux and other POSIX hosts.  See CMakeLists.txt in the repository root.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "WString.h"
+#include "Print.h"
+#include "Stream.h"
+
+typedef bool     boolean;
+typedef uint8_t  byte;
+typedef uint16_t word;
+
+#define HIGH   1
+#define LOW    0
+#define INPUT  0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+// Templates rather than the usual macros, so that <algorithm> still works
+template <class A, class B>
+inline auto min(A a, B b) -> decltype(a < b ? a : b) { return a < b ? a : b; }
+template <class A, class B>
+inline auto max(A a, B b) -> decltype(a > b ? a : b) { return a > b ? a : b; }
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+// There are no pins to drive on a host
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int  digitalRead(uint8_t) { return LOW; }
+
+#include "HardwareSerial.h"
+
+// The library's busy-wait loops sleep in poll() on the serial ports instead,
+// waking as soon as a byte arrives
+#ifndef TINY_GSM_POSIX_WAIT_MS
+  #define TINY_GSM_POSIX_WAIT_MS 10
+#endif
+
+#ifndef TINY_GSM_YIELD
+  #define TINY_GSM_YIELD() { PosixSerial::waitAny(TINY_GSM_POSIX_WAIT_MS); }
+#endif
+
+#endif
@@ -0,0 +1,15 @@
+/**
+ * @file       Client.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+#ifndef posix_Client_h
+#define posix_Client_h
+
+#include "Arduino.h"
+#include <ArduinoCompat/Client.h>
+
+#endif
@@ -0,0 +1,284 @@
+/**
+ * @file       HardwareSerial.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+#ifndef HardwareSerial_h
+#define HardwareSerial_h
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <errno.h>
+#include "Stream.h"
+
+#define SERIAL_8N1 0x06
+
+#ifndef POSIX_SERIAL_RX_BUFFER
+  #define POSIX_SERIAL_RX_BUFFER 512
+#endif
+
+#ifndef POSIX_SERIAL_MAX_PORTS
+  #define POSIX_SERIAL_MAX_PORTS 8
+#endif
+
+// A Stream on a POSIX serial device (or pty) using termios.  Reads never
+// block: available() takes whatever the kernel has already buffered.
+//
+//   PosixSerial modemPort("/dev/ttyUSB0");
+//   modemPort.begin(115200);
+//   TinyGsm modem(modemPort);
+//
+// It can also wrap descriptors that are already open, e.g. stdin/stdout for
+// the debug console; those are used as they are and never reconfigured.
+class PosixSerial : public Stream
+{
+public:
+  explicit PosixSerial(const char* path)
+    : path(path), fd_in(-1), fd_out(-1), owned(true), rx_head(0), rx_tail(0)
+  {}
+
+  PosixSerial(int fd_in, int fd_out)
+    : path(NULL), fd_in(fd_in), fd_out(fd_out), owned(false), rx_head(0), rx_tail(0)
+  {
+    attach();
+  }
+
+  virtual ~PosixSerial() {
+    end();
+    detach();
+  }
+
+  // Opens the device (if not already open) raw at 8N1, with RTS/CTS flow
+  // control if asked for
+  bool begin(unsigned long baud, bool rtscts = false) {
+    if (!owned) {
+      return fd_in >= 0;
+    }
+    if (fd_in < 0) {
+      if (!path) return false;
+      int fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+      if (fd < 0) return false;
+      fd_in = fd_out = fd;
+      attach();
+    }
+    return configure(baud, rtscts);
+  }
+
+  void end() {
+    if (owned && fd_in >= 0) {
+      detach();
+      ::close(fd_in);
+      fd_in = fd_out = -1;
+    }
+    rx_head = rx_tail = 0;
+  }
+
+  bool configure(unsigned long baud, bool rtscts) {
+    struct termios tio;
+    speed_t speed = toSpeed(baud);
+    if (fd_in < 0 || !speed || tcgetattr(fd_in, &tio) != 0) {
+      return false;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSTOPB | PARENB);
+#if defined(CRTSCTS)
+    if (rtscts) tio.c_cflag |= CRTSCTS;
+    else tio.c_cflag &= ~CRTSCTS;
+#else
+    if (rtscts) return false;
+#endif
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    return tcsetattr(fd_in, TCSANOW, &tio) == 0;
+  }
+
+  virtual int available() {
+    fill();
+    return rx_tail - rx_head;
+  }
+
+  virtual int read() {
+    if (rx_head == rx_tail && !fill()) {
+      return -1;
+    }
+    return rx[rx_head++];
+  }
+
+  virtual int peek() {
+    if (rx_head == rx_tail && !fill()) {
+      return -1;
+    }
+    return rx[rx_head];
+  }
+
+  virtual size_t write(uint8_t c) {
+    return write(&c, 1);
+  }
+
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t sent = 0;
+    while (fd_out >= 0 && sent < size) {
+      ssize_t n = ::write(fd_out, buffer + sent, size - sent);
+      if (n > 0) {
+        sent += n;
+      } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        struct pollfd pfd = { fd_out, POLLOUT, 0 };
+        ::poll(&pfd, 1, 100);
+      } else {
+        break;
+      }
+    }
+    return sent;
+  }
+
+  using Print::write;
+
+  virtual void flush() {
+    if (fd_out >= 0 && isatty(fd_out)) {
+      tcdrain(fd_out);
+    }
+  }
+
+  operator bool() const { return fd_in >= 0; }
+
+  int fd() const { return fd_in; }
+
+  // Sleeps until this port has input or timeout_ms has passed
+  bool waitReadable(uint32_t timeout_ms) {
+    if (rx_head != rx_tail) return true;
+    if (fd_in < 0) return false;
+    struct pollfd pfd = { fd_in, POLLIN, 0 };
+    return ::poll(&pfd, 1, timeout_ms) > 0;
+  }
+
+  // Sleeps until any open port has input or timeout_ms has passed; this is
+  // what TINY_GSM_YIELD() and yield() do on the host
+  static void waitAny(uint32_t timeout_ms) {
+    struct pollfd pfds[POSIX_SERIAL_MAX_PORTS];
+    nfds_t n = 0;
+    for (int i = 0; i < POSIX_SERIAL_MAX_PORTS; i++) {
+      PosixSerial* port = ports()[i];
+      if (!port || port->fd_in < 0) continue;
+      if (port->rx_head != port->rx_tail) return;
+      pfds[n].fd = port->fd_in;
+      pfds[n].events = POLLIN;
+      pfds[n].revents = 0;
+      n++;
+    }
+    ::poll(pfds, n, timeout_ms);
+  }
+
+private:
+  bool fill() {
+    if (fd_in < 0) return false;
+    if (rx_head == rx_tail) {
+      rx_head = rx_tail = 0;
+    }
+    if (rx_tail == sizeof(rx)) {
+      return rx_head != rx_tail;
+    }
+    // A descriptor we didn't open may be blocking, so look before reading
+    if (!owned) {
+      struct pollfd pfd = { fd_in, POLLIN, 0 };
+      if (::poll(&pfd, 1, 0) <= 0) return rx_head != rx_tail;
+    }
+    ssize_t n = ::read(fd_in, rx + rx_tail, sizeof(rx) - rx_tail);
+    if (n > 0) {
+      rx_tail += n;
+    } else if (n == 0 && !owned) {
+      // End of file (e.g. stdin redirected from /dev/null): stop polling it
+      detach();
+      fd_in = -1;
+    }
+    return rx_head != rx_tail;
+  }
+
+  static speed_t toSpeed(unsigned long baud) {
+    switch (baud) {
+      case 1200:   return B1200;
+      case 2400:   return B2400;
+      case 4800:   return B4800;
+      case 9600:   return B9600;
+      case 19200:  return B19200;
+      case 38400:  return B38400;
+      case 57600:  return B57600;
+      case 115200: return B115200;
+      case 230400: return B230400;
+#if defined(B460800)
+      case 460800: return B460800;
+#endif
+#if defined(B921600)
+      case 921600: return B921600;
+#endif
+      default:     return 0;
+    }
+  }
+
+  static PosixSerial** ports() {
+    static PosixSerial* list[POSIX_SERIAL_MAX_PORTS];
+    return list;
+  }
+
+  void attach() {
+    for (int i = 0; i < POSIX_SERIAL_MAX_PORTS; i++) {
+      if (ports()[i] == this) return;
+    }
+    for (int i = 0; i < POSIX_SERIAL_MAX_PORTS; i++) {
+      if (!ports()[i]) {
+        ports()[i] = this;
+        return;
+      }
+    }
+  }
+
+  void detach() {
+    for (int i = 0; i < POSIX_SERIAL_MAX_PORTS; i++) {
+      if (ports()[i] == this) ports()[i] = NULL;
+    }
+  }
+
+  const char* path;
+  int         fd_in;
+  int         fd_out;
+  bool        owned;
+  uint8_t     rx[POSIX_SERIAL_RX_BUFFER];
+  size_t      rx_head;
+  size_t      rx_tail;
+};
+
+// The sketches' Serial, Serial1, ... : Serial is the console, the others
+// open the device named by $TINY_GSM_SERIAL1, $TINY_GSM_SERIAL2, ...
+// (default /dev/ttyUSB0, /dev/ttyUSB1, ...) in begin()
+class HardwareSerial : public PosixSerial
+{
+public:
+  HardwareSerial(int fd_in, int fd_out)
+    : PosixSerial(fd_in, fd_out)
+  {}
+
+  explicit HardwareSerial(const char* path)
+    : PosixSerial(path)
+  {}
+
+  bool begin(unsigned long baud) {
+    return PosixSerial::begin(baud);
+  }
+
+  bool begin(unsigned long baud, uint32_t /*config*/, int8_t /*rxPin*/ = -1, int8_t /*txPin*/ = -1) {
+    return PosixSerial::begin(baud);
+  }
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+
+#endif
@@ -0,0 +1,74 @@
+/**
+ * @file       Print.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+#ifndef Print_h
+#define Print_h
+
+#include <stdint.h>
+#include <stdarg.h>
+#include "WString.h"
+#include "Printable.h"
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class Print
+{
+public:
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) {
+      if (!write(*buffer++)) break;
+      n++;
+    }
+    return n;
+  }
+  size_t write(const char* str) {
+    return str ? write((const uint8_t*)str, strlen(str)) : 0;
+  }
+  size_t write(const char* buffer, size_t size) {
+    return write((const uint8_t*)buffer, size);
+  }
+
+  virtual int availableForWrite() { return 0; }
+  virtual void flush() {}
+
+  size_t print(const String& s) { return write(s.c_str(), s.length()); }
+  size_t print(const char* str) { return write(str); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char n, int base = DEC) { return print(String(n, base)); }
+  size_t print(int n, int base = DEC) { return print(String(n, base)); }
+  size_t print(unsigned int n, int base = DEC) { return print(String(n, base)); }
+  size_t print(long n, int base = DEC) { return print(String(n, base)); }
+  size_t print(unsigned long n, int base = DEC) { return print(String(n, base)); }
+  size_t print(double n, int digits = 2) { return print(String(n, digits)); }
+  size_t print(const Printable& x) { return x.printTo(*this); }
+
+  size_t println() { return write("\r\n"); }
+  template <typename T>
+  size_t println(const T& x) { size_t n = print(x); return n + println(); }
+  template <typename T>
+  size_t println(const T& x, int format) { size_t n = print(x, format); return n + println(); }
+
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (len < 0) return 0;
+    return write(buf, std::min<size_t>(len, sizeof(buf) - 1));
+  }
+};
+
+#endif
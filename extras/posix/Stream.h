@@ -0,0 +1,142 @@
+/**
+ * @file       Stream.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+#ifndef Stream_h
+#define Stream_h
+
+#include "Print.h"
+
+unsigned long millis();
+void yield();
+
+class Stream : public Print
+{
+public:
+  Stream() : _timeout(1000) {}
+
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long timeout) { _timeout = timeout; }
+  unsigned long getTimeout() const { return _timeout; }
+
+  bool find(const char* target) { return findUntil(target, NULL); }
+  bool findUntil(const char* target, const char* terminator) {
+    size_t tlen = strlen(target);
+    size_t tindex = 0, termindex = 0;
+    if (!tlen) return true;
+    int c;
+    while ((c = timedRead()) >= 0) {
+      tindex = (c == target[tindex]) ? tindex + 1 : (c == target[0] ? 1 : 0);
+      if (tindex >= tlen) return true;
+      if (terminator && *terminator) {
+        termindex = (c == terminator[termindex]) ? termindex + 1 : 0;
+        if (!terminator[termindex]) return false;
+      }
+    }
+    return false;
+  }
+
+  long parseInt() {
+    int c = peekNumber(false);
+    if (c < 0) return 0;
+    bool negative = false;
+    long value = 0;
+    do {
+      if (c == '-') negative = true;
+      else value = value * 10 + c - '0';
+      read();
+      c = timedPeek();
+    } while (c >= '0' && c <= '9');
+    return negative ? -value : value;
+  }
+
+  float parseFloat() {
+    int c = peekNumber(true);
+    if (c < 0) return 0;
+    String num;
+    do {
+      num += (char)c;
+      read();
+      c = timedPeek();
+    } while ((c >= '0' && c <= '9') || c == '.');
+    return num.toFloat();
+  }
+
+  size_t readBytes(char* buffer, size_t length) {
+    size_t count = 0;
+    while (count < length) {
+      int c = timedRead();
+      if (c < 0) break;
+      buffer[count++] = (char)c;
+    }
+    return count;
+  }
+  size_t readBytes(uint8_t* buffer, size_t length) {
+    return readBytes((char*)buffer, length);
+  }
+
+  size_t readBytesUntil(char terminator, char* buffer, size_t length) {
+    size_t index = 0;
+    while (index < length) {
+      int c = timedRead();
+      if (c < 0 || c == terminator) break;
+      buffer[index++] = (char)c;
+    }
+    return index;
+  }
+
+  String readString() {
+    String ret;
+    int c;
+    while ((c = timedRead()) >= 0) ret += (char)c;
+    return ret;
+  }
+
+  String readStringUntil(char terminator) {
+    String ret;
+    int c;
+    while ((c = timedRead()) >= 0 && c != terminator) ret += (char)c;
+    return ret;
+  }
+
+protected:
+  int timedRead() {
+    unsigned long start = millis();
+    do {
+      int c = read();
+      if (c >= 0) return c;
+      yield();
+    } while (millis() - start < _timeout);
+    return -1;
+  }
+
+  int timedPeek() {
+    unsigned long start = millis();
+    do {
+      int c = peek();
+      if (c >= 0) return c;
+      yield();
+    } while (millis() - start < _timeout);
+    return -1;
+  }
+
+  // Skips to the first character that can start a number
+  int peekNumber(bool decimal) {
+    for (;;) {
+      int c = timedPeek();
+      if (c < 0 || c == '-' || (c >= '0' && c <= '9') || (decimal && c == '.')) return c;
+      read();
+    }
+  }
+
+  unsigned long _timeout;
+};
+
+#endif
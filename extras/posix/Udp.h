@@ -0,0 +1,15 @@
+/**
+ * @file       Udp.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+#ifndef posix_Udp_h
+#define posix_Udp_h
+
+#include "Arduino.h"
+#include <ArduinoCompat/Udp.h>
+
+#endif
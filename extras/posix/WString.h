@@ -0,0 +1,177 @@
+/**
+ * @file       WString.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+#ifndef WString_h
+#define WString_h
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string>
+#include <algorithm>
+
+// Strings live in RAM on the host, so F() is a no-op
+class __FlashStringHelper;
+#define F(string_literal) (string_literal)
+
+// The Arduino String, on top of std::string
+class String
+{
+public:
+  String(const char* cstr = "") : s(cstr ? cstr : "") {}
+  String(const std::string& str) : s(str) {}
+  explicit String(char c) : s(1, c) {}
+  explicit String(unsigned char value, unsigned char base = 10) { fromUnsigned(value, base); }
+  explicit String(int value, unsigned char base = 10) { fromSigned(value, base); }
+  explicit String(unsigned int value, unsigned char base = 10) { fromUnsigned(value, base); }
+  explicit String(long value, unsigned char base = 10) { fromSigned(value, base); }
+  explicit String(unsigned long value, unsigned char base = 10) { fromUnsigned(value, base); }
+  explicit String(float value, unsigned char decimals = 2) { fromDouble(value, decimals); }
+  explicit String(double value, unsigned char decimals = 2) { fromDouble(value, decimals); }
+
+  unsigned int length() const { return s.size(); }
+  bool reserve(unsigned int size) { s.reserve(size); return true; }
+  const char* c_str() const { return s.c_str(); }
+
+  String& operator=(const char* cstr) { s = cstr ? cstr : ""; return *this; }
+
+  bool concat(const String& str) { s += str.s; return true; }
+  bool concat(const char* cstr) { if (cstr) s += cstr; return true; }
+  bool concat(char c) { s += c; return true; }
+  bool concat(unsigned char num) { return concat(String(num)); }
+  bool concat(int num) { return concat(String(num)); }
+  bool concat(unsigned int num) { return concat(String(num)); }
+  bool concat(long num) { return concat(String(num)); }
+  bool concat(unsigned long num) { return concat(String(num)); }
+  bool concat(float num) { return concat(String(num)); }
+  bool concat(double num) { return concat(String(num)); }
+
+  template <typename T>
+  String& operator+=(const T& rhs) { concat(rhs); return *this; }
+
+  int compareTo(const String& str) const { return s.compare(str.s); }
+  bool equals(const String& str) const { return s == str.s; }
+  bool equals(const char* cstr) const { return s == (cstr ? cstr : ""); }
+  bool equalsIgnoreCase(const String& str) const {
+    if (s.size() != str.s.size()) return false;
+    for (size_t i = 0; i < s.size(); i++) {
+      if (tolower((unsigned char)s[i]) != tolower((unsigned char)str.s[i])) return false;
+    }
+    return true;
+  }
+  bool operator==(const String& rhs) const { return equals(rhs); }
+  bool operator==(const char* cstr) const { return equals(cstr); }
+  bool operator!=(const String& rhs) const { return !equals(rhs); }
+  bool operator!=(const char* cstr) const { return !equals(cstr); }
+  bool operator<(const String& rhs) const { return s < rhs.s; }
+
+  bool startsWith(const String& prefix) const {
+    return s.compare(0, prefix.s.size(), prefix.s) == 0;
+  }
+  bool startsWith(const String& prefix, unsigned int offset) const {
+    return offset <= s.size() && s.compare(offset, prefix.s.size(), prefix.s) == 0;
+  }
+  bool endsWith(const String& suffix) const {
+    return s.size() >= suffix.s.size() &&
+           s.compare(s.size() - suffix.s.size(), suffix.s.size(), suffix.s) == 0;
+  }
+
+  char charAt(unsigned int index) const { return index < s.size() ? s[index] : 0; }
+  void setCharAt(unsigned int index, char c) { if (index < s.size()) s[index] = c; }
+  char operator[](unsigned int index) const { return charAt(index); }
+  char& operator[](unsigned int index) { return s[index]; }
+  void getBytes(unsigned char* buf, unsigned int bufsize, unsigned int index = 0) const {
+    toCharArray((char*)buf, bufsize, index);
+  }
+  void toCharArray(char* buf, unsigned int bufsize, unsigned int index = 0) const {
+    if (!bufsize || !buf) return;
+    size_t n = index < s.size() ? std::min<size_t>(bufsize - 1, s.size() - index) : 0;
+    memcpy(buf, s.data() + index, n);
+    buf[n] = '\0';
+  }
+
+  int indexOf(char ch, unsigned int fromIndex = 0) const { return found(s.find(ch, fromIndex)); }
+  int indexOf(const String& str, unsigned int fromIndex = 0) const { return found(s.find(str.s, fromIndex)); }
+  int lastIndexOf(char ch) const { return found(s.rfind(ch)); }
+  int lastIndexOf(char ch, unsigned int fromIndex) const { return found(s.rfind(ch, fromIndex)); }
+  int lastIndexOf(const String& str) const { return found(s.rfind(str.s)); }
+  int lastIndexOf(const String& str, unsigned int fromIndex) const { return found(s.rfind(str.s, fromIndex)); }
+
+  String substring(unsigned int beginIndex) const {
+    return beginIndex < s.size() ? String(s.substr(beginIndex)) : String();
+  }
+  String substring(unsigned int beginIndex, unsigned int endIndex) const {
+    if (beginIndex > endIndex) std::swap(beginIndex, endIndex);
+    if (beginIndex >= s.size()) return String();
+    return String(s.substr(beginIndex, endIndex - beginIndex));
+  }
+
+  void replace(char find, char replace) { std::replace(s.begin(), s.end(), find, replace); }
+  void replace(const String& find, const String& replace) {
+    if (find.s.empty()) return;
+    size_t pos = 0;
+    while ((pos = s.find(find.s, pos)) != std::string::npos) {
+      s.replace(pos, find.s.size(), replace.s);
+      pos += replace.s.size();
+    }
+  }
+  void remove(unsigned int index) { if (index < s.size()) s.erase(index); }
+  void remove(unsigned int index, unsigned int count) { if (index < s.size()) s.erase(index, count); }
+  void toLowerCase() { for (size_t i = 0; i < s.size(); i++) s[i] = tolower((unsigned char)s[i]); }
+  void toUpperCase() { for (size_t i = 0; i < s.size(); i++) s[i] = toupper((unsigned char)s[i]); }
+  void trim() {
+    size_t first = s.find_first_not_of(" \t\r\n\f\v");
+    if (first == std::string::npos) { s.clear(); return; }
+    size_t last = s.find_last_not_of(" \t\r\n\f\v");
+    s = s.substr(first, last - first + 1);
+  }
+
+  long toInt() const { return atol(s.c_str()); }
+  float toFloat() const { return atof(s.c_str()); }
+  double toDouble() const { return atof(s.c_str()); }
+
+private:
+  static int found(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+
+  void fromUnsigned(unsigned long value, unsigned char base) {
+    char buf[8 * sizeof(long) + 1];
+    char* p = &buf[sizeof(buf) - 1];
+    *p = '\0';
+    if (base < 2) base = 10;
+    do {
+      unsigned long d = value % base;
+      *--p = d < 10 ? '0' + d : 'A' + d - 10;
+      value /= base;
+    } while (value);
+    s = p;
+  }
+
+  void fromSigned(long value, unsigned char base) {
+    if (value < 0 && base == 10) {
+      fromUnsigned(-(unsigned long)value, base);
+      s.insert(0, 1, '-');
+    } else {
+      fromUnsigned((unsigned long)value, base);
+    }
+  }
+
+  void fromDouble(double value, unsigned char decimals) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+    s = buf;
+  }
+
+  std::string s;
+};
+
+template <typename T>
+inline String operator+(const String& lhs, const T& rhs) { String r(lhs); r += rhs; return r; }
+inline String operator+(const char* lhs, const String& rhs) { String r(lhs); r += rhs; return r; }
+
+#endif
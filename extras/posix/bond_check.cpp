@@ -0,0 +1,228 @@
+/**
+ * @file       bond_check.cpp
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+// Uploads and downloads a file over three links with TinyGsmBond, against
+// bond_receiver.py:
+//   bond_receiver.py -- ./tinygsm_bond_check
+// The links are plain TCP sockets standing in for modem clients; one of
+// them is paced, and one silently loses data and then fails part way
+// through the upload, as a modem dropping its connection would.
+
+#include <Arduino.h>
+#include <Client.h>
+#include <TinyGsmBond.h>
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+class TcpClient : public Client
+{
+public:
+  TcpClient()
+    : fd(-1), sent(0), loseAfter(0), failAfter(0)
+  {}
+
+  ~TcpClient() {
+    stop();
+  }
+
+  // After `lose` bytes, writes are accepted but thrown away; after `fail`
+  // more the connection closes
+  void fault(size_t lose, size_t fail) {
+    loseAfter = lose;
+    failAfter = lose + fail;
+  }
+
+  virtual int connect(IPAddress ip, uint16_t port) {
+    char host[16];
+    return connect(TinyGsmIpToChars(ip, host), port);
+  }
+
+  virtual int connect(const char* host, uint16_t port) {
+    stop();
+    struct addrinfo hints = {};
+    struct addrinfo* res = NULL;
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, service, &hints, &res) != 0) {
+      return 0;
+    }
+    fd = ::socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0 && ::connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+      ::close(fd);
+      fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+      return 0;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    sent = 0;
+    return 1;
+  }
+
+  virtual size_t write(uint8_t c) {
+    return write(&c, 1);
+  }
+
+  virtual size_t write(const uint8_t* buf, size_t size) {
+    if (fd < 0) return 0;
+    if (failAfter && sent + size > failAfter) {
+      stop();
+      return 0;
+    }
+    size_t done = 0;
+    while (done < size) {
+      size_t n = size - done;
+      if (loseAfter && sent + done + n > loseAfter) {
+        n = sent + done < loseAfter ? loseAfter - (sent + done) : 0;
+      }
+      if (!n) break;
+      ssize_t w = ::send(fd, buf + done, n, MSG_NOSIGNAL);
+      if (w <= 0) {
+        stop();
+        return done;
+      }
+      done += w;
+    }
+    sent += size;
+    return size;
+  }
+
+  virtual int available() {
+    if (fd < 0) return 0;
+    ssize_t n = ::recv(fd, rx, sizeof(rx), MSG_PEEK | MSG_DONTWAIT);
+    return n > 0 ? n : 0;
+  }
+
+  virtual int read() {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+  }
+
+  virtual int read(uint8_t* buf, size_t size) {
+    if (fd < 0) return -1;
+    ssize_t n = ::recv(fd, buf, size, MSG_DONTWAIT);
+    if (n == 0) {
+      stop();
+    }
+    return n > 0 ? n : -1;
+  }
+
+  virtual int peek() {
+    uint8_t c;
+    if (fd < 0 || ::recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) != 1) return -1;
+    return c;
+  }
+
+  virtual void flush() {}
+
+  virtual void stop() {
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+
+  virtual uint8_t connected() {
+    if (fd < 0) return 0;
+    uint8_t c;
+    ssize_t n = ::recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n == 0) {
+      stop();
+      return 0;
+    }
+    return 1;
+  }
+
+  virtual operator bool() {
+    return fd >= 0;
+  }
+
+private:
+  int     fd;
+  size_t  sent;
+  size_t  loseAfter;
+  size_t  failAfter;
+  uint8_t rx[1024];
+};
+
+static const uint32_t SIZE = 100000;
+static uint8_t source[SIZE];
+static uint8_t copy[SIZE];
+
+static int readSource(uint32_t offset, uint8_t* buf, size_t len, void*) {
+  memcpy(buf, source + offset, len);
+  return len;
+}
+
+static bool writeCopy(uint32_t offset, const uint8_t* buf, size_t len, void*) {
+  if (offset + len > SIZE) return false;
+  memcpy(copy + offset, buf, len);
+  return true;
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+  Serial.print(ok ? "ok   " : "FAIL ");
+  Serial.println(what);
+  if (!ok) failures++;
+}
+
+int main() {
+  const char* portEnv = getenv("TINY_GSM_BOND_PORT");
+  if (!portEnv) {
+    Serial.println("$TINY_GSM_BOND_PORT is not set");
+    return 2;
+  }
+  uint16_t port = atoi(portEnv);
+
+  uint32_t x = 2463534242UL;
+  for (uint32_t i = 0; i < SIZE; i++) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    source[i] = x;
+  }
+
+  TcpClient links[3];
+  links[2].fault(20000, 5000);
+  TinyGsmBond bond;
+  bond.addLink(links[0]);
+  bond.addLink(links[1], 200000);
+  bond.addLink(links[2]);
+
+  uint32_t start = millis();
+  check(bond.upload("127.0.0.1", port, 0x1234, SIZE, readSource, NULL, 30000L), "upload");
+  check(bond.linkBytes(0) > 0 && bond.linkBytes(1) > 0 && bond.linkBytes(2) > 0, "upload used every link");
+  Serial.print(millis() - start);
+  Serial.println(" ms");
+
+  links[2].fault(0, 0);
+  start = millis();
+  int32_t size = bond.download("127.0.0.1", port, "/00001234.bin", writeCopy, NULL, 30000L);
+  check(size == (int32_t)SIZE, "download size");
+  check(memcmp(source, copy, SIZE) == 0, "download matches upload");
+  check(bond.linkBytes(0) > 0 && bond.linkBytes(1) > 0 && bond.linkBytes(2) > 0, "download used every link");
+  Serial.print(millis() - start);
+  Serial.println(" ms");
+
+  // The server only sends part of each stripe; the rest is asked for again
+  memset(copy, 0, SIZE);
+  size = bond.download("127.0.0.1", port, "/00001234.bin?max=3000", writeCopy, NULL, 30000L);
+  check(size == (int32_t)SIZE && memcmp(source, copy, SIZE) == 0, "download with short ranges");
+
+  check(bond.download("127.0.0.1", port, "/missing.bin", writeCopy, NULL, 5000L) < 0, "missing file");
+  return failures ? 1 : 0;
+}
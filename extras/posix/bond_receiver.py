@@ -0,0 +1,219 @@
+#!/usr/bin/env python3
+"""The far end of TinyGsmBond, for testing striped transfers on a host.
+
+    bond_receiver.py [--port N] [--dir DIR]                serve until killed
+    bond_receiver.py [--port N] [--dir DIR] -- PROGRAM ... run PROGRAM with
+                          $TINY_GSM_BOND_PORT set and exit with its status
+
+Uploads are written to DIR/<session>.bin, the session id as 8 hex digits.
+Plain HTTP requests on the same port are answered from DIR, honouring
+single "Range: bytes=first-last" headers, so an upload can be downloaded
+again with TinyGsmBond::download().  A "?max=N" after the file name caps a
+range answer at N bytes, as some servers do.  The protocol is described in
+src/TinyGsmBond.h.
+"""
+
+import argparse
+import asyncio
+import os
+import struct
+import sys
+import tempfile
+
+MAGIC = b"TGSB"
+END = 0xFFFFFFFF
+GAPS = 8
+
+
+class Session:
+    def __init__(self, sid, size, chunk, links, directory):
+        self.sid = sid
+        self.size = size
+        self.chunk = chunk
+        self.links = links
+        self.path = os.path.join(directory, "%08x.bin" % sid)
+        self.chunks = (size + chunk - 1) // chunk
+        self.data = bytearray(size)
+        self.have = bytearray(self.chunks)
+        self.seen = 0
+        self.ended = {}  # writer -> end frame received since the last report
+        self.done = False
+
+    def store(self, seq, payload):
+        if seq >= self.chunks:
+            return
+        offset = seq * self.chunk
+        if len(payload) != min(self.chunk, self.size - offset):
+            return
+        self.data[offset:offset + len(payload)] = payload
+        self.have[seq] = 1
+
+    def missing(self):
+        gaps = []
+        seq = 0
+        while seq < self.chunks and len(gaps) < GAPS:
+            if self.have[seq]:
+                seq += 1
+                continue
+            first = seq
+            while seq < self.chunks and not self.have[seq]:
+                seq += 1
+            gaps.append((first, seq))
+        return gaps
+
+    async def maybe_report(self):
+        # Only once every link has joined and all open ones have finished
+        if self.done or self.seen < self.links or not self.ended:
+            return
+        if not all(self.ended.values()):
+            return
+        gaps = self.missing()
+        report = struct.pack(">H", len(gaps))
+        for first, end in gaps:
+            report += struct.pack(">II", first, end)
+        for writer in list(self.ended):
+            self.ended[writer] = False
+            writer.write(report)
+        if not gaps:
+            self.done = True
+            with open(self.path, "wb") as f:
+                f.write(self.data)
+            print("session %08x: %d bytes" % (self.sid, self.size), flush=True)
+        for writer in list(self.ended):
+            try:
+                await writer.drain()
+            except ConnectionError:
+                pass
+
+
+class Receiver:
+    def __init__(self, directory):
+        self.directory = directory
+        self.sessions = {}
+
+    async def handle(self, reader, writer):
+        try:
+            first = await reader.readexactly(4)
+        except (asyncio.IncompleteReadError, ConnectionError):
+            writer.close()
+            return
+        if first == MAGIC:
+            await self.bond(reader, writer)
+        else:
+            await self.http(first, reader, writer)
+        writer.close()
+
+    async def bond(self, reader, writer):
+        try:
+            sid, size, chunk, _index, links = struct.unpack(">IIHBB", await reader.readexactly(12))
+        except (asyncio.IncompleteReadError, ConnectionError):
+            return
+        session = self.sessions.get(sid)
+        if session is None or session.done or session.size != size:
+            session = Session(sid, size, chunk, links, self.directory)
+            self.sessions[sid] = session
+        session.seen += 1
+        session.ended[writer] = False
+        try:
+            while True:
+                seq, length = struct.unpack(">IH", await reader.readexactly(6))
+                if seq == END:
+                    session.ended[writer] = True
+                    await session.maybe_report()
+                else:
+                    session.store(seq, await reader.readexactly(length))
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+        finally:
+            session.ended.pop(writer, None)
+            await session.maybe_report()
+
+    async def http(self, first, reader, writer):
+        pending = first
+        while True:
+            try:
+                head = pending + await reader.readuntil(b"\r\n\r\n")
+            except (asyncio.IncompleteReadError, asyncio.LimitOverrunError, ConnectionError):
+                return
+            pending = b""
+            lines = head.decode("latin-1").split("\r\n")
+            parts = lines[0].split(" ")
+            headers = {}
+            for line in lines[1:]:
+                if ":" in line:
+                    name, value = line.split(":", 1)
+                    headers[name.strip().lower()] = value.strip()
+
+            target, _, query = (parts[1] if len(parts) > 1 else "").partition("?")
+            name = os.path.basename(target)
+            cap = int(query[4:]) if query.startswith("max=") else 0
+            path = os.path.join(self.directory, name)
+            if parts[0] != "GET" or not name or not os.path.isfile(path):
+                writer.write(b"HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n")
+                await writer.drain()
+                continue
+            with open(path, "rb") as f:
+                body = f.read()
+
+            wanted = headers.get("range", "")
+            if wanted.startswith("bytes=") and "-" in wanted:
+                first_s, last_s = wanted[6:].split("-", 1)
+                start = int(first_s or 0)
+                last = int(last_s) if last_s else len(body) - 1
+                if start >= len(body):
+                    writer.write(("HTTP/1.1 416 Range Not Satisfiable\r\n"
+                                  "Content-Range: bytes */%d\r\nContent-Length: 0\r\n\r\n"
+                                  % len(body)).encode())
+                    await writer.drain()
+                    continue
+                last = min(last, len(body) - 1)
+                if cap:
+                    last = min(last, start + cap - 1)
+                part = body[start:last + 1]
+                writer.write(("HTTP/1.1 206 Partial Content\r\n"
+                              "Content-Range: bytes %d-%d/%d\r\nContent-Length: %d\r\n\r\n"
+                              % (start, last, len(body), len(part))).encode() + part)
+            else:
+                writer.write(("HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n"
+                              % len(body)).encode() + body)
+            try:
+                await writer.drain()
+            except ConnectionError:
+                return
+
+
+async def run(args, argv):
+    receiver = Receiver(args.dir)
+    server = await asyncio.start_server(receiver.handle, "127.0.0.1", args.port)
+    port = server.sockets[0].getsockname()[1]
+    if not argv:
+        print(port, flush=True)
+        async with server:
+            await server.serve_forever()
+    env = dict(os.environ, TINY_GSM_BOND_PORT=str(port))
+    child = await asyncio.create_subprocess_exec(*argv, env=env, stdin=asyncio.subprocess.DEVNULL)
+    status = await child.wait()
+    server.close()
+    return status
+
+
+def main():
+    argv = sys.argv[1:]
+    program = []
+    if "--" in argv:
+        program = argv[argv.index("--") + 1:]
+        argv = argv[:argv.index("--")]
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--port", type=int, default=0)
+    parser.add_argument("--dir", default=None)
+    args = parser.parse_args(argv)
+    if args.dir is None:
+        args.dir = tempfile.mkdtemp(prefix="tinygsm_bond_")
+    try:
+        return asyncio.run(run(args, program))
+    except KeyboardInterrupt:
+        return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
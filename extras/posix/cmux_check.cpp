@@ -0,0 +1,116 @@
+/**
+ * @file       cmux_check.cpp
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+// Runs TinyGsmCmux against the loopback channels of modem_sim.py:
+//   modem_sim.py -- ./tinygsm_cmux_check
+// The simulator drops frames with a bad FCS, so every echo also checks
+// ours.
+
+#include <Arduino.h>
+#include <TinyGsmCmux.h>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+  Serial.print(ok ? "ok   " : "FAIL ");
+  Serial.println(what);
+  if (!ok) failures++;
+}
+
+// Reads what the channel has until `len` bytes are in or nothing comes
+static String readFor(Stream& s, size_t len, uint32_t timeout_ms = 1000L) {
+  String res;
+  uint32_t startMillis = millis();
+  while (res.length() < len && millis() - startMillis < timeout_ms) {
+    int c = s.read();
+    if (c < 0) {
+      delay(1);
+      continue;
+    }
+    res += (char)c;
+  }
+  return res;
+}
+
+// Keeps the multiplexer busy without reading anything
+static void pollFor(Stream& s, uint32_t ms) {
+  for (uint32_t startMillis = millis(); millis() - startMillis < ms; ) {
+    s.available();
+    delay(1);
+  }
+}
+
+int main() {
+  if (!Serial1.begin(115200)) {
+    Serial.println("cannot open $TINY_GSM_SERIAL1");
+    return 2;
+  }
+  TinyGsmCmux cmux(Serial1);
+  Stream& one = cmux.channel(1);
+  Stream& two = cmux.channel(2);
+
+  uint32_t start = millis();
+  check(cmux.begin() && cmux.channel(1).isOpen() && cmux.channel(2).isOpen(), "begin");
+
+  one.print("hello one");
+  two.print("hello two");
+  one.flush();
+  two.flush();
+  check(readFor(two, 9) == "hello two" && readFor(one, 9) == "hello one", "echo per channel");
+
+  // More than one frame's worth
+  String longer;
+  for (int i = 0; i < 100; i++) {
+    longer += (char)('a' + i % 26);
+  }
+  one.print(longer);
+  one.flush();
+  check(readFor(one, longer.length()) == longer, "echo across frames");
+
+  // The data of a frame with a bad FCS never shows up
+  one.print("BAD");
+  one.flush();
+  check(readFor(one, 4) == "GOOD", "bad FCS dropped");
+
+  // The modem stops us for 0.5 s with an MSC
+  one.print("STOP");
+  one.flush();
+  pollFor(one, 50);
+  uint32_t stopStart = millis();
+  one.print("x");
+  one.flush();
+  check(millis() - stopStart >= 300 && readFor(one, 1) == "x", "MSC from the modem stops sending");
+
+  // Once half the fifo is full we stop the modem; what it has to send
+  // waits until the fifo has been read
+  String first(longer.substring(0, 80));
+  first += longer.substring(0, 80);
+  two.print(first);
+  two.flush();
+  pollFor(two, 200);
+  two.print("held back");
+  two.flush();
+  pollFor(two, 200);
+  check(two.available() == (int)first.length(), "MSC to the modem stops it");
+  check(readFor(two, first.length()) == first && readFor(two, 9) == "held back", "MSC to the modem restarts it");
+
+  // After CLD the modem takes AT commands again
+  cmux.end();
+  delay(100);
+  while (Serial1.available()) {
+    Serial1.read();
+  }
+  Serial1.print("AT\r\n");
+  Serial1.flush();
+  Serial1.setTimeout(1000);
+  check(Serial1.find("OK"), "end");
+
+  Serial.print(millis() - start);
+  Serial.println(" ms");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,188 @@
+/**
+ * @file       lock_check.cpp
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+// Shares one modem between tasks, built with TINY_GSM_LOCK_STD:
+//   modem_sim.py -- ./tinygsm_lock_check
+// The main task works a socket on the simulator's echo server while another
+// one keeps asking for the signal quality, and then while TinyGsmPump runs
+// on a third.  A transaction that is left open keeps the other tasks
+// waiting, and one that is broken into garbles both answers.
+
+#define TINY_GSM_MODEM_SIM800
+
+#include <TinyGsmClient.h>
+#include <TinyGsmPump.h>
+#include <atomic>
+#include <thread>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+  Serial.print(ok ? "ok   " : "FAIL ");
+  Serial.println(what);
+  if (!ok) failures++;
+}
+
+// The second task: takes the signal quality as often as it is asked to
+class OtherTask
+{
+public:
+  explicit OtherTask(TinyGsm& modem)
+    : modem(modem), asked(0), answered(0), good(true), quit(false),
+      thread(&OtherTask::run, this)
+  {}
+
+  // Asks for n more readings without waiting for them
+  void ask(int n) {
+    asked += n;
+  }
+
+  // Waits until every reading asked for is in, and all were right
+  bool caughtUp(uint32_t timeout_ms = 3000L) {
+    for (uint32_t startMillis = millis(); answered < asked && millis() - startMillis < timeout_ms; ) {
+      delay(1);
+    }
+    return answered == asked && good;
+  }
+
+  // A task still waiting for the modem can't be joined
+  bool stop() {
+    if (!caughtUp()) {
+      return false;
+    }
+    quit = true;
+    thread.join();
+    return true;
+  }
+
+private:
+  void run() {
+    while (!quit) {
+      if (answered == asked) {
+        delay(1);
+        continue;
+      }
+      if (modem.getSignalQuality(0) != 21) {
+        good = false;
+      }
+      answered++;
+    }
+  }
+
+  TinyGsm&          modem;
+  std::atomic<int>  asked;
+  std::atomic<int>  answered;
+  std::atomic<bool> good;
+  std::atomic<bool> quit;
+  std::thread       thread;
+};
+
+// Runs TinyGsmPump every TINY_GSM_PUMP_PERIOD_MS, as its ESP32 task does
+class PumpTask
+{
+public:
+  explicit PumpTask(TinyGsmPump<TinyGsm>& pump)
+    : pump(pump), quit(false), thread(&PumpTask::run, this)
+  {}
+
+  ~PumpTask() {
+    quit = true;
+    thread.join();
+  }
+
+private:
+  void run() {
+    while (!quit) {
+      pump.poll();
+      delay(TINY_GSM_PUMP_PERIOD_MS);
+    }
+  }
+
+  TinyGsmPump<TinyGsm>& pump;
+  std::atomic<bool>     quit;
+  std::thread           thread;
+};
+
+static std::atomic<int> dataEvents(0);
+
+static void onData(Client&) {
+  dataEvents++;
+}
+
+// Reads what the socket has until `len` bytes are in or nothing comes
+static String readFor(TinyGsmClient& client, size_t len, uint32_t timeout_ms = 3000L) {
+  String res;
+  uint32_t startMillis = millis();
+  while (res.length() < len && millis() - startMillis < timeout_ms) {
+    int c = client.read();
+    if (c < 0) {
+      delay(1);
+      continue;
+    }
+    res += (char)c;
+  }
+  return res;
+}
+
+int main() {
+  if (!Serial1.begin(115200)) {
+    Serial.println("cannot open $TINY_GSM_SERIAL1");
+    return 2;
+  }
+  TinyGsmPumpStream pumped(Serial1);
+  TinyGsm modem(pumped);
+  TinyGsmPump<TinyGsm> pump(modem, pumped);
+  TinyGsmClient client(modem);
+
+  uint32_t start = millis();
+  check(modem.init() && modem.gprsConnect("simnet"), "init and gprsConnect");
+  OtherTask other(modem);
+
+  // Both at once
+  other.ask(20);
+  check(client.connect("echo.example", 7), "connect");
+  client.print("hello");
+  check(readFor(client, 5) == "hello", "echo");
+  check(other.caughtUp(), "commands from two tasks");
+
+  // Each of these ends on something other than OK or ERROR
+  IPAddress ip;
+  check(modem.resolveHost("other.example", ip) && ip == IPAddress(10, 0, 0, 9), "resolveHost");
+  other.ask(1);
+  check(other.caughtUp(), "other task after +CDNSGIP");
+  client.print("again");
+  other.ask(1);
+  check(other.caughtUp(), "other task after DATA ACCEPT");
+  check(readFor(client, 5) == "again", "echo again");
+
+  check(other.stop(), "other task done");
+
+  // The echo of "later" comes 1.5 s after the write, well after the
+  // +CIPSTATUS that available() sends once the socket has been quiet for
+  // TINY_GSM_SOCK_STATE_MS; from then on only the pump is looking
+  client.onData(onData);
+  {
+    PumpTask pumpTask(pump);
+    client.print("later");
+    delay(TINY_GSM_SOCK_STATE_MS + 100);
+    check(client.available() == 0, "+CIPSTATUS refresh");
+    for (uint32_t waitStart = millis(); !dataEvents && millis() - waitStart < 3000; ) {
+      delay(1);
+    }
+    check(dataEvents > 0, "pump after a write and a +CIPSTATUS refresh");
+  }
+  check(readFor(client, 5) == "later", "echo later");
+
+  client.stop();
+
+  Serial.print(millis() - start);
+  Serial.println(" ms");
+  // Exit without unwinding if the other task is stuck on the modem
+  fflush(stdout);
+  _exit(failures ? 1 : 0);
+}
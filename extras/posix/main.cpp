@@ -0,0 +1,19 @@
+/**
+ * @file       main.cpp
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+// Runs an Arduino sketch as a host program
+
+void setup();
+void loop();
+
+int main() {
+  setup();
+  for (;;) {
+    loop();
+  }
+}
@@ -0,0 +1,686 @@
+#!/usr/bin/env python3
+"""A minimal AT modem on a pseudo-terminal, for running TinyGSM on a host.
+
+    modem_sim.py                 print the pty path and serve until killed
+    modem_sim.py -- PROGRAM ...  run PROGRAM with $TINY_GSM_SERIAL1 set to
+                                 the pty and exit with its status
+
+It answers like a registered SIM800 with a good signal, keeps the state of
+the GPRS bearer and IP stack, and gives anything it does not know a plain OK.
+After AT+CFUN=1 it reads the SIM and registers again a little later, with
++CPIN: and +CREG: URCs as a real one would; AT+CFUN=1,1 also reboots it:
+it still answers a bare AT for a moment, then goes deaf for a while and
+announces itself with RDY, back in SMS PDU mode.  AT#PDPDEACT (not a
+real command) makes the network drop the PDP context; AT#PDPDEACT=NEXT
+does it after the first line of the next answer that has more than OK,
+and AT#PDPDEACT=STATE right after the next STATE: line.  AT#SIMURC=NEXT
+puts a +CPIN: READY URC in front of the answer to the next command.  TCP connections
+(+CIPSTART with multi-IP, data fetched with +CIPRXGET, or in transparent
+mode, left with +++ and 0.8 s of quiet) and UDP ones go to an echo server,
+which pushes each datagram back with +RECEIVE after AT+CIPRXGET=0, and
+answers data starting with "later" only after 1.5 s; host names resolve (+CDNSGIP) to 10.0.0.9.  It finds nothing in the phonebook
+(+CME ERROR: 22).  It follows the host's rate until AT+IPR=N, then only
+talks at N: what the host sends at another rate is lost and what it gets
+is corrupted; AT#LOSTIPR? (not a real command) counts the +IPR commands
+lost that way.  With --max-baud N, whatever it sends while the port
+is set faster than N is corrupted, as if the host could not keep up; the
+limit is passed on to PROGRAM as $TINY_GSM_SIM_MAX_BAUD.  With --ipr-max N
+it takes a faster +IPR with OK but stays where it is, passed on as
+$TINY_GSM_SIM_IPR_MAX.  With --ppp COMMAND,
+ATD*99# answers CONNECT and runs COMMAND (e.g. pppd notty ...) with its
+stdin and stdout on another pty, passing everything through until it exits.
+AT+CMUX=0 switches to 27.010 framing, with every channel a loopback (see Mux).
+"""
+
+import os
+import pty
+import select
+import shlex
+import subprocess
+import sys
+import termios
+import time
+import tty
+
+IMEI = "867856030000001"
+CCID = "8944500000000000001"
+
+RESPONSES = {
+    "ATI": ["SIM800 R14.18"],
+    "AT+GSN": [IMEI],
+    "AT+CCID": [CCID],
+    "AT+CSQ": ["+CSQ: 21,0"],
+    "AT+CGREG?": ["+CGREG: 0,1"],
+    "AT+COPS?": ['+COPS: 0,0,"SimNet"'],
+    "AT+CBC": ["+CBC: 0,80,4100"],
+}
+
+# Settings that survive between runs of the program, as in a modem that
+# stays powered while its host sleeps
+DEFAULTS = {
+    "CIPMUX": "0",
+    "CIPRXGET": "0",
+    "CIPQSEND": "0",
+    "CIPMODE": "0",
+    "CMGF": "0",
+    "DNS1": "0.0.0.0",
+    "DNS2": "0.0.0.0",
+}
+
+
+SPEEDS = dict((getattr(termios, "B%d" % rate), rate)
+              for rate in (9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600)
+              if hasattr(termios, "B%d" % rate))
+
+
+class Modem:
+    def __init__(self, fd, max_baud=0, ppp=None, ipr_max=0):
+        self.fd = fd
+        self.max_baud = max_baud
+        self.ipr_max = ipr_max
+        self.baud = 0  # 0 follows the host, as autobauding does
+        self.new_baud = None  # taken on once +IPR has been answered
+        self.lost_ipr = 0
+        self.wrong = b""  # a line sent at the wrong rate
+        self.ppp = ppp  # the command at the other end of a data call
+        self.peer = None
+        self.peer_fd = None
+        self.mux = None  # the multiplexer, after AT+CMUX=0
+        self.echo = True
+        self.line = b""
+        self.settings = dict(DEFAULTS)
+        self.after = []  # lines that follow the final OK
+        self.final = "OK"  # or None for a command that answers otherwise
+        self.sockets = {}  # mux -> data the echo server has sent back
+        self.sending = None  # [mux, bytes to come, data, at line end] after +CIPSEND
+        self.transparent = False  # in data mode on a +CIPMODE=1 connection
+        self.plus = b""  # a +++ that may end data mode
+        self.last_in = None  # when data mode last got a byte
+        self.held = b""  # data mode bytes waiting to be echoed
+        self.deact_on = None  # "NEXT" or "STATE", to drop the PDP context there
+        self.sim_urc_next = False  # +CPIN: READY before the next answer
+        self.sim = "READY"
+        self.reg = 1
+        self.timers = []  # (due, function)
+        self.booting = 0  # input is ignored until then...
+        self.resetting = 0  # ...but a bare AT is still answered until this
+        self.power_on()
+
+    def power_on(self):
+        self.attached = True
+        self.bearer = False
+        self.apn = "CMNET"
+        self.user = ""
+        self.pwd = ""
+        self.bearer_params = {"APN": "", "USER": "", "PWD": ""}
+        self.state = "IP INITIAL"
+        self.creg = 0  # +CREG URC mode
+
+    def host_baud(self):
+        return SPEEDS.get(termios.tcgetattr(self.fd)[5], 0)
+
+    def write(self, data):
+        host = self.host_baud()
+        if (self.max_baud and host > self.max_baud) or (self.baud and host != self.baud):
+            data = bytes(b ^ 0x55 for b in data)
+        os.write(self.fd, data)
+
+    def send(self, text):
+        self.write(text.encode())
+
+    def feed(self, data):
+        if self.peer:
+            os.write(self.peer_fd, data)
+            return
+        if self.mux:
+            self.mux.feed(data)
+            return
+        if self.resetting <= time.monotonic() < self.booting:
+            return
+        if self.baud and self.host_baud() != self.baud:
+            for b in data:
+                if b == 13:
+                    self.lost_ipr += b"+IPR" in self.wrong.upper()
+                    self.wrong = b""
+                else:
+                    self.wrong += bytes([b])
+            return
+        for b in data:
+            c = bytes([b])
+            if self.transparent:
+                self.take_transparent(c)
+                continue
+            if self.sending:
+                if c == b"\n" and not self.sending[2] and self.sending[3]:
+                    self.sending[3] = False  # the end of the command line
+                else:
+                    self.take(c)
+                continue
+            if self.echo:
+                self.write(c)
+            if c == b"\r":
+                self.command(self.line.decode(errors="replace").strip())
+                self.line = b""
+            elif c != b"\n":
+                self.line += c
+
+    def dial(self):
+        master, slave = pty.openpty()
+        tty.setraw(slave, termios.TCSANOW)
+        self.send("\r\nCONNECT\r\n")
+        self.peer = subprocess.Popen(self.ppp, stdin=slave, stdout=slave)
+        self.peer_fd = master
+        os.close(slave)
+
+    def hang_up(self):
+        self.peer.wait()
+        os.close(self.peer_fd)
+        self.peer = None
+        self.peer_fd = None
+        self.send("\r\nNO CARRIER\r\n")
+
+    def later(self, delay, function):
+        self.timers.append((time.monotonic() + delay, function))
+
+    def tick(self):
+        now = time.monotonic()
+        due = [t for t in self.timers if t[0] <= now]
+        self.timers = [t for t in self.timers if t[0] > now]
+        for _, function in sorted(due, key=lambda t: t[0]):
+            function()
+
+    def set_sim(self, sim):
+        self.sim = sim
+        self.send("\r\n+CPIN: %s\r\n" % sim)
+
+    def set_reg(self, reg):
+        self.reg = reg
+        if self.creg == 1:
+            self.send("\r\n+CREG: %d\r\n" % reg)
+        elif self.creg == 2:
+            self.send('\r\n+CREG: %d,"00A1","1B2C"\r\n' % reg)
+
+    def reboot(self):
+        self.timers = []
+        self.sim = "NOT READY"
+        self.reg = 0
+        self.booting = time.monotonic() + 1.2
+        self.resetting = time.monotonic() + 0.6
+        self.later(1.2, self.booted)
+
+    def booted(self):
+        self.echo = True
+        self.settings = dict(DEFAULTS)
+        self.power_on()
+        self.send("\r\nRDY\r\n\r\n+CFUN: 1\r\n")
+        self.later(0.2, lambda: self.set_sim("READY"))
+        self.later(0.4, lambda: self.send("\r\nCall Ready\r\n\r\nSMS Ready\r\n"))
+        self.later(0.5, lambda: self.set_reg(2))
+        self.later(0.8, lambda: self.set_reg(1))
+
+    def command(self, cmd):
+        if not cmd.upper().startswith("AT"):
+            return
+        if time.monotonic() < self.booting and cmd.upper() != "AT":
+            return
+        if cmd.upper() == "ATD*99#" and self.ppp:
+            self.dial()
+            return
+        if cmd.upper() == "AT+CMUX=0":
+            self.send("\r\nOK\r\n")
+            self.mux = Mux(self)
+            return
+        lines = []
+        self.after = []
+        self.final = "OK"
+        armed = self.deact_on == "NEXT"
+        if self.sim_urc_next:
+            self.sim_urc_next = False
+            self.send("\r\n+CPIN: READY\r\n")
+        for part in cmd[2:].split(";"):
+            result = self.execute(part.strip())
+            if result is None:
+                self.send("\r\nERROR\r\n")
+                return
+            lines += result
+        for i, line in enumerate(lines):
+            if isinstance(line, bytes):
+                self.write(line)  # data, straight after the line before
+            else:
+                self.send("\r\n" + line + "\r\n")
+            if i == 0 and armed:
+                self.deact_now()
+        if self.final:
+            self.send("\r\n" + self.final + "\r\n")
+        for line in self.after:
+            self.send("\r\n" + line + "\r\n")
+            if line.startswith("STATE:") and self.deact_on == "STATE":
+                self.deact_now()
+        if self.new_baud is not None:
+            self.baud, self.new_baud = self.new_baud, None
+
+    def execute(self, part):
+        """Runs one command of a ';' separated line, returning its lines"""
+        upper = part.upper()
+        if "&F" in upper:
+            self.settings = dict(DEFAULTS)
+            self.echo = "E0" not in upper
+            return []
+        if upper in ("E0", "E1"):
+            self.echo = upper == "E1"
+            return []
+        for name in ("CIPMUX", "CIPRXGET", "CIPQSEND", "CIPMODE", "CMGF"):
+            if upper == "+%s?" % name:
+                return ["+%s: %s" % (name, self.settings[name])]
+            if upper in ("+%s=0" % name, "+%s=1" % name):
+                if name in ("CIPMUX", "CIPMODE") and self.state != "IP INITIAL":
+                    return None
+                self.settings[name] = upper[-1]
+                return []
+        if upper == "+CDNSCFG?":
+            return ["PrimaryDns: " + self.settings["DNS1"], "SecondaryDns: " + self.settings["DNS2"]]
+        if upper.startswith("+CDNSCFG="):
+            servers = part.split("=", 1)[1].replace('"', "").split(",")
+            self.settings["DNS1"] = servers[0]
+            self.settings["DNS2"] = servers[1] if len(servers) > 1 else "0.0.0.0"
+            return []
+        if upper == "+IPR?":
+            return ["+IPR: %d" % self.baud]
+        if upper.startswith("+IPR="):
+            baud = int(upper[5:])
+            if self.ipr_max and baud > self.ipr_max:
+                baud = self.baud or self.host_baud()  # stays where it is
+            self.new_baud = baud
+            return []
+        if upper == "#LOSTIPR?":
+            return ["#LOSTIPR: %d" % self.lost_ipr]
+        if upper.startswith("+CPBF="):
+            self.final = "+CME ERROR: 22"
+            return []
+        if upper == "+CPIN?":
+            return ["+CPIN: " + self.sim]
+        if upper == "+CREG?":
+            return ["+CREG: %d,%d" % (self.creg, self.reg)]
+        if upper in ("+CREG=0", "+CREG=1", "+CREG=2"):
+            self.creg = int(upper[-1])
+            return []
+        if upper == "+CFUN=0":
+            self.timers = []
+            self.sim = "NOT READY"
+            self.reg = 0
+            return []
+        if upper == "+CFUN=1,1":
+            self.reboot()
+            return []
+        if upper == "+CFUN=1":
+            self.later(1.0, lambda: self.set_sim("READY"))
+            self.later(1.5, lambda: self.set_reg(2))
+            self.later(2.0, lambda: self.set_reg(1))
+            return []
+        gprs = self.gprs(part, upper)
+        if gprs is not False:
+            return gprs
+        socket = self.socket(part, upper)
+        if socket is not False:
+            return socket
+        return RESPONSES.get("AT" + upper, [])
+
+    def gprs(self, part, upper):
+        """The bearer, attach and IP stack commands, or False for others"""
+        if upper == "+CGATT?":
+            return ["+CGATT: %d" % self.attached]
+        if upper in ("+CGATT=0", "+CGATT=1"):
+            if upper.endswith("1") and not self.attached:
+                time.sleep(1)  # so is attaching
+            self.attached = upper.endswith("1")
+            if not self.attached:
+                self.bearer = False
+                if self.state != "IP INITIAL":
+                    self.state = "PDP DEACT"
+            return []
+        if upper == "+SAPBR=1,1":
+            self.bearer = self.attached
+            return [] if self.bearer else None
+        if upper == "+SAPBR=0,1":
+            self.bearer = False
+            return []
+        if upper.startswith("+SAPBR=3,1,"):
+            name, value = part.split(",", 3)[2:]
+            name = name.strip('"').upper()
+            if name in self.bearer_params:
+                if self.bearer:
+                    return None
+                self.bearer_params[name] = value.strip('"')
+            return []
+        if upper == "+SAPBR=4,1":
+            return ["+SAPBR:", "CONTYPE: GPRS"] + \
+                ["%s: %s" % (k, self.bearer_params[k]) for k in ("APN", "USER", "PWD")]
+        if upper == "+SAPBR=2,1":
+            return ['+SAPBR: 1,1,"10.0.0.3"' if self.bearer else '+SAPBR: 1,3,"0.0.0.0"']
+        if upper == "+CSTT?":
+            return ['+CSTT: "%s","%s","%s"' % (self.apn, self.user, self.pwd)]
+        if upper.startswith("+CSTT="):
+            if self.state != "IP INITIAL":
+                return None
+            task = [f.strip('"') for f in part.split("=", 1)[1].split(",")] + ["", ""]
+            self.apn, self.user, self.pwd = task[:3]
+            self.state = "IP START"
+            return []
+        if upper == "+CIICR":
+            if self.state != "IP START" or not self.attached:
+                return None
+            time.sleep(1)  # a real one takes seconds
+            self.state = "IP GPRSACT"
+            return []
+        if upper == "+CIFSR":
+            if self.state not in ("IP GPRSACT", "IP STATUS"):
+                return None
+            self.state = "IP STATUS"
+            return ["10.0.0.2"]
+        if upper == "#PDPDEACT":
+            if self.state != "IP INITIAL":
+                self.state = "PDP DEACT"
+                self.after = ["+PDP: DEACT"]
+            return []
+        if upper == "#SIMURC=NEXT":
+            self.sim_urc_next = True
+            return []
+        if upper in ("#PDPDEACT=NEXT", "#PDPDEACT=STATE"):
+            self.deact_on = upper.split("=")[1]
+            return []
+        if upper == "+CIPSHUT":
+            self.state = "IP INITIAL"
+            self.sockets = {}
+            return []
+        if upper == "+CIPSTATUS":
+            self.after = ["STATE: " + self.state]
+            if self.settings["CIPMUX"] == "1":
+                self.after += [self.connection(n) for n in range(6)]
+            return []
+        return False
+
+    def connection(self, n):
+        if n in self.sockets:
+            return 'C: %d,0,"TCP","10.0.0.9","7","CONNECTED"' % n
+        return 'C: %d,,"","","","INITIAL"' % n
+
+    def deact_now(self):
+        """The PDP context drop asked for by AT#PDPDEACT=NEXT or =STATE"""
+        if self.state == "IP INITIAL":
+            return
+        self.deact_on = None
+        self.state = "PDP DEACT"
+        self.send("\r\n+PDP: DEACT\r\n")
+
+    def socket(self, part, upper):
+        """The multi-IP TCP commands and +CDNSGIP, or False for others"""
+        args = [a.strip().strip('"') for a in part.split("=", 1)[-1].split(",")]
+        if upper.startswith("+CDNSGIP="):
+            if self.state not in ("IP STATUS", "IP PROCESSING"):
+                return None
+            self.after = ['+CDNSGIP: 1,"%s","10.0.0.9"' % args[0]]
+            return []
+        if upper.startswith("+CIPSTART=") and len(args) == 3 and args[0] == "TCP":
+            if self.settings["CIPMODE"] != "1" or self.state not in ("IP STATUS", "IP PROCESSING"):
+                return None
+            self.state = "CONNECT OK"
+            self.transparent = True
+            self.last_in = None  # the \n of the command line is still to come
+            self.after = ["CONNECT"]
+            return []
+        if upper == "+CIPCLOSE=1" and self.state == "CONNECT OK":
+            self.state = "IP CLOSE"
+            self.final = None
+            return ["CLOSE OK"]
+        if upper.startswith("+CIPSTART=") and len(args) == 4 and args[1] in ("TCP", "UDP"):
+            mux = int(args[0])
+            if self.settings["CIPMUX"] != "1" or self.state not in ("IP STATUS", "IP PROCESSING"):
+                return None
+            if mux in self.sockets:
+                return ["ALREADY CONNECT"]
+            self.sockets[mux] = b""
+            self.state = "IP PROCESSING"
+            self.after = ["%d, CONNECT OK" % mux]
+            return []
+        if upper.startswith("+CIPSEND=") and len(args) == 2:
+            mux = int(args[0])
+            if mux not in self.sockets:
+                return None
+            self.sending = [mux, int(args[1]), b"", True]
+            self.final = None
+            self.send("\r\n> ")
+            return []
+        if upper.startswith("+CIPRXGET=2,") or upper.startswith("+CIPRXGET=4,"):
+            mux = int(args[1])
+            if mux not in self.sockets:
+                return None
+            data = self.sockets[mux]
+            if args[0] == "4":
+                return ["+CIPRXGET: 4,%d,%d" % (mux, len(data))]
+            data, self.sockets[mux] = data[:int(args[2])], data[int(args[2]):]
+            return ["+CIPRXGET: 2,%d,%d,%d" % (mux, len(data), len(self.sockets[mux])), data]
+        if upper.startswith("+CIPSTATUS="):
+            mux = int(args[0])
+            state = "CONNECTED" if mux in self.sockets else "INITIAL"
+            return ['+CIPSTATUS: %d,0,"TCP","10.0.0.9","7","%s"' % (mux, state)]
+        if upper.startswith("+CIPCLOSE="):
+            mux = int(args[0])
+            if self.sockets.pop(mux, None) is None:
+                return None
+            self.final = None
+            return ["%d, CLOSE OK" % mux]
+        return False
+
+    def take(self, c):
+        """One byte of the data promised by +CIPSEND"""
+        self.sending[1] -= 1
+        self.sending[2] += c
+        if self.sending[1] > 0:
+            return
+        mux, _, data, _ = self.sending
+        self.sending = None
+        if self.settings["CIPQSEND"] == "1":
+            self.send("\r\nDATA ACCEPT:%d,%d\r\n" % (mux, len(data)))
+        else:
+            self.send("\r\n%d, SEND OK\r\n" % mux)
+        if data.startswith(b"later"):
+            self.later(1.5, lambda: self.echo_back(mux, data))
+        else:
+            self.echo_back(mux, data)
+
+    def take_transparent(self, c):
+        """One byte in data mode: socket data, or part of a +++ escape"""
+        now = time.monotonic()
+        if self.last_in is None and c == b"\n":
+            self.last_in = now
+            return
+        quiet = now - (self.last_in or 0)
+        self.last_in = now
+        if c == b"+" and len(self.plus) < 3 and (self.plus or quiet >= 0.5):
+            self.plus += c
+            if len(self.plus) == 3:
+                self.later(0.8, lambda: self.escape(now))
+            return
+        if not self.held:
+            self.later(0.05, self.echo_transparent)
+        self.held += self.plus + c
+        self.plus = b""
+
+    def escape(self, at):
+        """Back to command mode after +++ and 0.8 s without anything else"""
+        if self.plus == b"+++" and self.last_in == at:
+            self.plus = b""
+            self.transparent = False
+            self.send("\r\nOK\r\n")
+
+    def echo_transparent(self):
+        data, self.held = self.held, b""
+        if data.startswith(b"later"):
+            self.later(1.5, lambda: self.transparent and self.write(data))
+        else:
+            self.write(data)
+
+    def echo_back(self, mux, data):
+        if mux not in self.sockets:
+            return
+        if self.settings["CIPRXGET"] == "0":
+            self.write(b"\r\n+RECEIVE,%d,%d:\r\n" % (mux, len(data)) + data)
+            return
+        if not self.sockets[mux]:
+            self.send("\r\n+CIPRXGET: 1,%d\r\n" % mux)
+        self.sockets[mux] += data
+
+
+def cmux_fcs(header):
+    """The 27.010 FCS: the reversed CRC-8 of the header, complemented"""
+    fcs = 0xFF
+    for c in header:
+        fcs ^= c
+        for _ in range(8):
+            fcs = (fcs >> 1) ^ 0xE0 if fcs & 1 else fcs >> 1
+    return 0xFF - fcs
+
+
+class Mux:
+    """27.010 basic option, as far as TinyGsmCmux uses it.
+
+    SABM and DISC get a UA, frames with a bad FCS are ignored, and what comes
+    in on a channel is sent straight back on it, except while the host has
+    stopped that channel with an MSC.  Two payloads are special: STOP makes
+    the modem stop the host on that channel for 0.5 s, and BAD comes back
+    with a broken FCS followed by GOOD.  CLD ends it, back to AT commands.
+    """
+
+    SABM, UA, DISC, UIH, PF = 0x2F, 0x63, 0x43, 0xEF, 0x10
+    MSC, CLD, CR, FC = 0xE1, 0xC1, 0x02, 0x02
+    V24 = 0x8D  # RTC, RTR and DV
+
+    def __init__(self, modem):
+        self.modem = modem
+        self.buf = b""
+        self.stopped = set()  # channels the host has stopped
+        self.held = {}  # what they would have sent back meanwhile
+
+    def send(self, dlci, control, data=b"", bad=False):
+        header = bytes([(dlci << 2) | 1, control, (len(data) << 1) | 1])
+        fcs = cmux_fcs(header) ^ (0x55 if bad else 0)
+        self.modem.write(b"\xf9" + header + data + bytes([fcs, 0xF9]))
+
+    def msc(self, dlci, v24):
+        self.send(0, self.UIH, bytes([self.MSC | self.CR, 5, (dlci << 2) | 3, v24]))
+
+    def feed(self, data):
+        self.buf += data
+        while True:
+            start = self.buf.find(b"\xf9")  # anything before it is noise
+            if start < 0:
+                self.buf = b""
+                return
+            body = self.buf[start:].lstrip(b"\xf9")
+            self.buf = b"\xf9" + body
+            if len(body) < 3:
+                return
+            if not body[2] & 1:  # a long frame, which TinyGsmCmux never sends
+                self.buf = body
+                continue
+            size = body[2] >> 1
+            if len(body) < 4 + size:
+                return
+            frame, self.buf = body[:4 + size], body[4 + size:]
+            if cmux_fcs(frame[:3]) == frame[-1]:
+                self.frame(frame[0] >> 2, frame[1] & ~self.PF, frame[3:-1])
+
+    def frame(self, dlci, control, data):
+        if control in (self.SABM, self.DISC):
+            self.send(dlci, self.UA | self.PF)
+        elif control == self.UIH and dlci == 0:
+            self.control(data)
+        elif control == self.UIH and data == b"STOP":
+            self.msc(dlci, self.V24 | self.FC)
+            self.modem.later(0.5, lambda: self.msc(dlci, self.V24))
+        elif control == self.UIH and data == b"BAD":
+            self.send(dlci, self.UIH, data, bad=True)
+            self.send(dlci, self.UIH, b"GOOD")
+        elif control == self.UIH and dlci in self.stopped:
+            self.held[dlci] = self.held.get(dlci, b"") + data
+        elif control == self.UIH:
+            self.send(dlci, self.UIH, data)
+
+    def control(self, msg):
+        if len(msg) < 2 or not msg[0] & self.CR:
+            return  # an answer to one of ours
+        self.send(0, self.UIH, bytes([msg[0] & ~self.CR]) + msg[1:])
+        if msg[0] & ~self.CR == self.MSC and len(msg) >= 4:
+            dlci = msg[2] >> 2
+            if msg[3] & self.FC:
+                self.stopped.add(dlci)
+            else:
+                self.stopped.discard(dlci)
+                held = self.held.pop(dlci, b"")
+                for i in range(0, len(held), 31):
+                    self.send(dlci, self.UIH, held[i:i + 31])
+        elif msg[0] & ~self.CR == self.CLD:
+            self.modem.mux = None
+
+
+def serve(master, child=None, max_baud=0, ppp=None, ipr_max=0):
+    modem = Modem(master, max_baud, ppp, ipr_max)
+    while True:
+        if child is not None and child.poll() is not None:
+            return child.returncode
+        fds = [master] + ([modem.peer_fd] if modem.peer else [])
+        ready, _, _ = select.select(fds, [], [], 0.05)
+        modem.tick()
+        if master in ready:
+            try:
+                data = os.read(master, 1024)
+            except OSError:
+                data = b""
+            if data:
+                modem.feed(data)
+        if modem.peer and modem.peer_fd in ready:
+            try:
+                data = os.read(modem.peer_fd, 1024)
+            except OSError:
+                data = b""  # the peer has closed its end
+            if data:
+                modem.write(data)
+            else:
+                modem.hang_up()
+
+
+def main():
+    master, slave = pty.openpty()
+    tty.setraw(slave, termios.TCSANOW)
+    path = os.ttyname(slave)
+    argv = sys.argv[1:]
+    max_baud = 0
+    ipr_max = 0
+    ppp = None
+    while len(argv) >= 2 and argv[0] in ("--max-baud", "--ipr-max", "--ppp"):
+        if argv[0] == "--max-baud":
+            max_baud = int(argv[1])
+        elif argv[0] == "--ipr-max":
+            ipr_max = int(argv[1])
+        else:
+            ppp = shlex.split(argv[1])
+        argv = argv[2:]
+    if argv and argv[0] == "--":
+        argv = argv[1:]
+    if not argv:
+        print(path, flush=True)
+        try:
+            serve(master, None, max_baud, ppp, ipr_max)
+        except KeyboardInterrupt:
+            return 0
+    env = dict(os.environ, TINY_GSM_SERIAL1=path)
+    if max_baud:
+        env["TINY_GSM_SIM_MAX_BAUD"] = str(max_baud)
+    if ipr_max:
+        env["TINY_GSM_SIM_IPR_MAX"] = str(ipr_max)
+    child = subprocess.Popen(argv, env=env, stdin=subprocess.DEVNULL)
+    return serve(master, child, max_baud, ppp, ipr_max)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,58 @@
+/**
+ * @file       multi_build.cpp
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+// Builds every driver into one program, with two modems of the same type on
+// different ports.  Nothing here talks to real hardware; it only has to
+// compile and link.
+
+#include <TinyGsmClientSIM800.h>
+#include <TinyGsmClientSIM808.h>
+#include <TinyGsmClientSIM7000.h>
+#include <TinyGsmClientUBLOX.h>
+#include <TinyGsmClientSaraR4.h>
+#include <TinyGsmClientM95.h>
+#include <TinyGsmClientBG96.h>
+#include <TinyGsmClientA6.h>
+#include <TinyGsmClientM590.h>
+#include <TinyGsmClientMC60.h>
+#include <TinyGsmClientESP8266.h>
+#include <TinyGsmClientXBee.h>
+#include <TinyGsmClientXBeeAPI.h>
+#include <TinyGsmClientSequansMonarch.h>
+
+TinyGsmSim800 cellA(Serial1);
+TinyGsmSim800 cellB(Serial2);
+TinyGsmUBLOX  ublox(Serial2);
+TinyGsmXBee   xbee(Serial2);
+TinyGsmESP8266 wifi(Serial2);
+
+TinyGsmSim800::GsmClient  clientA(cellA, 0);
+TinyGsmSim800::GsmClient  clientB(cellB, 0);
+TinyGsmUBLOX::GsmClient   clientU(ublox, 1);
+TinyGsmXBee::GsmClient    clientX(xbee);
+TinyGsmESP8266::GsmClient clientW(wifi, 2);
+
+int main() {
+  // Each driver keeps its own registration states...
+  TinyGsmSim800::RegStatus a = cellA.getRegistrationStatus();
+  TinyGsmXBee::RegStatus   x = xbee.getRegistrationStatus();
+  TinyGsmESP8266::RegStatus w = wifi.getRegistrationStatus();
+  // ...and the first one included is also available unqualified
+  RegStatus b = cellB.getRegistrationStatus();
+  SimStatus s = ublox.getSimStatus();
+
+  bool ok = a == TinyGsmSim800::REG_OK_HOME && b == REG_OK_HOME &&
+            x == TinyGsmXBee::REG_OK && w == TinyGsmESP8266::REG_OK_IP &&
+            s == SIM_READY;
+  clientA.connect("example.com", 80);
+  clientB.connect("example.com", 80);
+  clientU.connect("example.com", 80);
+  clientX.connect("example.com", 80);
+  clientW.connect("example.com", 80);
+  return ok ? 0 : 1;
+}
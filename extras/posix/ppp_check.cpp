@@ -0,0 +1,139 @@
+/**
+ * @file       ppp_check.cpp
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+// Dials up with TinyGsmPpp and pings the far end of the link, against a real
+// pppd behind modem_sim.py:
+//   modem_sim.py --ppp "pppd_peer.sh /usr/sbin/pppd" -- ./tinygsm_ppp_check
+// pppd asks for PAP, so a link that comes up has been through LCP, PAP and
+// IPCP; the ping is answered by the kernel on pppd's side.
+
+#include <Arduino.h>
+#include <TinyGsmPpp.h>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+  Serial.print(ok ? "ok   " : "FAIL ");
+  Serial.println(what);
+  if (!ok) failures++;
+}
+
+// Counts the ICMP echo replies that carry the payload we sent
+class PingNetif : public TinyGsmPppNetif
+{
+public:
+  PingNetif()
+    : up(false), replies(0)
+  {}
+
+  void pppInput(const uint8_t* packet, uint16_t len) {
+    if (len < 28 || (packet[0] >> 4) != 4) {
+      return;
+    }
+    uint8_t ihl = (packet[0] & 0x0F) * 4;
+    const uint8_t* icmp = packet + ihl;
+    if (packet[9] == 1 && len >= ihl + 8 + sizeof(payload) && icmp[0] == 0 &&
+        memcmp(icmp + 8, payload, sizeof(payload)) == 0)
+    {
+      replies++;
+    }
+  }
+
+  void pppUp(IPAddress local, IPAddress dns) {
+    up = true;
+    this->local = local;
+    this->dns = dns;
+  }
+
+  void pppDown() {
+    up = false;
+  }
+
+  // Builds an ICMP echo request from our address to `to`
+  uint16_t echoRequest(uint8_t* p, IPAddress to, uint16_t seq) {
+    uint16_t len = 20 + 8 + sizeof(payload);
+    memset(p, 0, len);
+    p[0] = 0x45;
+    p[2] = len >> 8;
+    p[3] = len & 0xFF;
+    p[8] = 64;  // TTL
+    p[9] = 1;   // ICMP
+    for (uint8_t i = 0; i < 4; i++) {
+      p[12 + i] = local[i];
+      p[16 + i] = to[i];
+    }
+    putChecksum(p, 20, p + 10);
+    uint8_t* icmp = p + 20;
+    icmp[0] = 8;  // echo request
+    icmp[4] = 0x54;
+    icmp[5] = 0x47;
+    icmp[6] = seq >> 8;
+    icmp[7] = seq & 0xFF;
+    memcpy(icmp + 8, payload, sizeof(payload));
+    putChecksum(icmp, 8 + sizeof(payload), icmp + 2);
+    return len;
+  }
+
+  bool      up;
+  int       replies;
+  IPAddress local;
+  IPAddress dns;
+
+private:
+  static void putChecksum(const uint8_t* p, uint16_t len, uint8_t* out) {
+    uint32_t sum = 0;
+    for (uint16_t i = 0; i + 1 < len; i += 2) {
+      sum += ((uint16_t)p[i] << 8) | p[i + 1];
+    }
+    if (len & 1) {
+      sum += (uint16_t)p[len - 1] << 8;
+    }
+    while (sum >> 16) {
+      sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    sum = ~sum & 0xFFFF;
+    out[0] = sum >> 8;
+    out[1] = sum & 0xFF;
+  }
+
+  const uint8_t payload[16] = { 'T', 'i', 'n', 'y', 'G', 'S', 'M', ' ',
+                                'P', 'P', 'P', ' ', 'p', 'i', 'n', 'g' };
+};
+
+int main() {
+  if (!Serial1.begin(115200)) {
+    Serial.println("cannot open $TINY_GSM_SERIAL1");
+    return 2;
+  }
+  TinyGsmPpp ppp(Serial1);
+  PingNetif netif;
+  ppp.setNetif(&netif);
+
+  uint32_t start = millis();
+  check(ppp.connect("internet", "tinygsm", "tinygsm"), "connect (LCP, PAP, IPCP)");
+  check(netif.up && ppp.isConnected(), "pppUp");
+  check(ppp.localIP() == IPAddress(10, 64, 64, 2) && netif.local == ppp.localIP(), "localIP");
+  check(ppp.dnsIP() == IPAddress(10, 64, 64, 1) && netif.dns == ppp.dnsIP(), "dnsIP");
+
+  uint8_t packet[64];
+  for (uint16_t seq = 1; seq <= 3 && !netif.replies; seq++) {
+    check(ppp.send(packet, netif.echoRequest(packet, ppp.dnsIP(), seq)), "send");
+    for (uint32_t sent = millis(); !netif.replies && millis() - sent < 1000; ) {
+      ppp.maintain();
+      delay(1);
+    }
+  }
+  check(netif.replies > 0, "ping round trip");
+
+  ppp.disconnect();
+  check(!ppp.isConnected() && !netif.up, "disconnect");
+
+  Serial.print(millis() - start);
+  Serial.println(" ms");
+  return failures ? 1 : 0;
+}
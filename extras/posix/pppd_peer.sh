@@ -0,0 +1,31 @@
+#!/bin/sh
+# The network end of the data call for ppp_check.cpp, which modem_sim.py
+# --ppp starts on ATD*99#: pppd on stdin/stdout, asking for PAP as
+# tinygsm/tinygsm, handing out 10.64.64.2 and naming itself (10.64.64.1) as
+# the DNS server.  Needs root and /dev/ppp; the PAP secret is only there
+# while it runs.
+#
+#   pppd_peer.sh /usr/sbin/pppd
+
+secrets=/etc/ppp/pap-secrets
+entry='tinygsm * tinygsm *'
+
+added=
+if ! grep -qxF "$entry" "$secrets" 2>/dev/null; then
+  mkdir -p /etc/ppp && echo "$entry" >> "$secrets" && added=1
+fi
+
+"$1" notty nodetach noccp novj nodefaultroute noproxyarp \
+  require-pap 10.64.64.1:10.64.64.2 ms-dns 10.64.64.1
+status=$?
+
+if [ -n "$added" ]; then
+  grep -vxF "$entry" "$secrets" > "$secrets.tmp"
+  if [ -s "$secrets.tmp" ]; then
+    cat "$secrets.tmp" > "$secrets"
+  else
+    rm -f "$secrets"
+  fi
+  rm -f "$secrets.tmp"
+fi
+exit $status
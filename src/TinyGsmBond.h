@@ -0,0 +1,570 @@
+/**
+ * @file       TinyGsmBond.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+#ifndef TinyGsmBond_h
+#define TinyGsmBond_h
+
+#include <TinyGsmCommon.h>
+
+// Most connections one transfer is spread over
+#if !defined(TINY_GSM_BOND_LINKS)
+  #define TINY_GSM_BOND_LINKS 4
+#endif
+
+// Payload bytes per upload chunk
+#if !defined(TINY_GSM_BOND_CHUNK)
+  #define TINY_GSM_BOND_CHUNK 512
+#endif
+
+// Bytes asked for by each HTTP range request when downloading
+#if !defined(TINY_GSM_BOND_STRIPE)
+  #define TINY_GSM_BOND_STRIPE 8192
+#endif
+
+// Longest HTTP response header line that is parsed (longer ones are cut)
+#if !defined(TINY_GSM_BOND_LINE)
+  #define TINY_GSM_BOND_LINE 64
+#endif
+
+// Most missing ranges the receiver lists in one report
+#define TINY_GSM_BOND_GAPS 8
+
+#define TINY_GSM_BOND_END 0xFFFFFFFFUL
+
+// Fills buf with len bytes of the upload, starting at offset.  Chunks are
+// read in order the first time, but a chunk that was lost is read again.
+// Returns the number of bytes read.
+typedef int (*TinyGsmBondReader)(uint32_t offset, uint8_t* buf, size_t len, void* ctx);
+
+// Stores len bytes of the download at offset.  Stripes arrive on several
+// links at once, so offsets are not in order.  Returns false to abort.
+typedef bool (*TinyGsmBondWriter)(uint32_t offset, const uint8_t* buf, size_t len, void* ctx);
+
+// Spreads one transfer over several connections, usually one per modem, so
+// that a slow cellular uplink is not the limit:
+//
+//   TinyGsmSim800::GsmClient link1(modem1);
+//   TinyGsmBG96::GsmClient   link2(modem2);
+//   TinyGsmBond bond;
+//   bond.addLink(link1);
+//   bond.addLink(link2, 4000);  // at most 4000 bytes/s on this one
+//   bond.upload("logs.example.com", 9000, sessionId, size, readArchive, &file);
+//
+// Uploads go to a bonding receiver (see extras/posix/bond_receiver.py).
+// Each link connects, sends a 16 byte header
+//   "TGSB", session (u32), size (u32), chunk size (u16), link index (u8),
+//   link count (u8)
+// and then frames of
+//   sequence number (u32), length (u16), payload
+// where chunk n holds bytes n * chunk size onwards.  Chunks go out on
+// whichever link is next in turn and allowed by its pacing.  Once every
+// chunk has been sent, each link sends an end frame (sequence 0xFFFFFFFF,
+// length 0).  When the receiver has seen the end on every link, it answers
+// on each one with a report: a count (u16) and then up to
+// TINY_GSM_BOND_GAPS ranges of missing chunks (first, end as u32).  Those
+// chunks are sent again, until a report comes back empty.  A link that
+// fails is dropped and its chunk goes out on another.  All numbers are big
+// endian.
+//
+// Downloads come from any HTTP/1.1 server that supports range requests.
+// Each link asks for the next TINY_GSM_BOND_STRIPE bytes in turn, and the
+// links are read as their data arrives.
+//
+// The drivers block while a modem takes data for sending, so uploads gain
+// most when each link is on its own modem.  Downloads gain anyway, since
+// the modems receive at the same time.
+class TinyGsmBond
+{
+public:
+  TinyGsmBond()
+    : count(0), cursor(0)
+  {}
+
+  bool addLink(Client& client, uint32_t bytes_per_s = 0) {
+    if (count >= TINY_GSM_BOND_LINKS) {
+      return false;
+    }
+    Link& l = link[count++];
+    l.client = &client;
+    l.rate = bytes_per_s;
+    l.up = false;
+    l.bytes = 0;
+    return true;
+  }
+
+  // Changes a link's pacing, 0 for none
+  void setRate(uint8_t i, uint32_t bytes_per_s) {
+    if (i < count) {
+      link[i].rate = bytes_per_s;
+    }
+  }
+
+  // Links that are still connected
+  uint8_t linksUp() const {
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < count; i++) {
+      if (link[i].up) n++;
+    }
+    return n;
+  }
+
+  // Bytes that link i carried in the last transfer
+  uint32_t linkBytes(uint8_t i) const {
+    return i < count ? link[i].bytes : 0;
+  }
+
+  bool upload(const char* host, uint16_t port, uint32_t session, uint32_t size,
+              TinyGsmBondReader reader, void* ctx, uint32_t timeout_ms = 300000L)
+  {
+    uint32_t startMillis = millis();
+    uint8_t up = connectAll(host, port);
+    if (!up) {
+      return false;
+    }
+
+    // Every link must be known to the receiver before it can tell that all
+    // of them have finished, so a header that can't be sent fails the upload
+    uint8_t index = 0;
+    for (uint8_t i = 0; i < count; i++) {
+      if (!link[i].up) continue;
+      memcpy(buf, "TGSB", 4);
+      put32(buf + 4, session);
+      put32(buf + 8, size);
+      put16(buf + 12, TINY_GSM_BOND_CHUNK);
+      buf[14] = index++;
+      buf[15] = up;
+      if (!send(link[i], buf, 16)) {
+        stopAll();
+        return false;
+      }
+    }
+
+    uint32_t chunks = (size + TINY_GSM_BOND_CHUNK - 1) / TINY_GSM_BOND_CHUNK;
+    Gap gaps[TINY_GSM_BOND_GAPS];
+    uint16_t ngaps = 0;
+    if (chunks) {
+      gaps[0].first = 0;
+      gaps[0].end = chunks;
+      ngaps = 1;
+    }
+
+    while (true) {
+      for (uint16_t g = 0; g < ngaps; g++) {
+        for (uint32_t seq = gaps[g].first; seq < gaps[g].end && seq < chunks; seq++) {
+          if (!sendChunk(seq, size, reader, ctx, startMillis, timeout_ms)) {
+            stopAll();
+            return false;
+          }
+        }
+      }
+
+      put32(buf, TINY_GSM_BOND_END);
+      put16(buf + 4, 0);
+      for (uint8_t i = 0; i < count; i++) {
+        if (link[i].up && !send(link[i], buf, 6)) {
+          drop(link[i]);
+        }
+      }
+
+      // Every link gets the same report; read them all so none is left
+      // unread, and use whichever arrives
+      bool reported = false;
+      for (uint8_t i = 0; i < count; i++) {
+        if (!link[i].up) continue;
+        if (readReport(link[i], gaps, ngaps, startMillis, timeout_ms)) {
+          reported = true;
+        } else {
+          drop(link[i]);
+        }
+      }
+      if (!reported) {
+        stopAll();
+        return false;
+      }
+      if (!ngaps) {
+        stopAll();
+        return true;
+      }
+    }
+  }
+
+  // Returns the size of the file, or -1 if the download failed
+  int32_t download(const char* host, uint16_t port, const char* path,
+                   TinyGsmBondWriter writer, void* ctx, uint32_t timeout_ms = 300000L)
+  {
+    uint32_t startMillis = millis();
+    if (!connectAll(host, port)) {
+      return -1;
+    }
+
+    int32_t  total = -1;   // unknown until the first response
+    uint32_t next = 0;     // start of the next stripe nobody has asked for
+    uint32_t done = 0;
+    Gap      retry[RETRY_MAX];
+    uint8_t  nretry = 0;
+
+    for (uint8_t i = 0; i < count; i++) {
+      link[i].state = LINK_IDLE;
+    }
+
+    while (total < 0 || done < (uint32_t)total) {
+      if (millis() - startMillis > timeout_ms || !linksUp()) {
+        stopAll();
+        return -1;
+      }
+      bool busy = false;
+      for (uint8_t i = 0; i < count; i++) {
+        Link& l = link[i];
+        if (!l.up) continue;
+
+        if (l.state == LINK_IDLE) {
+          if (nretry) {
+            l.from = retry[--nretry].first;
+            l.to = retry[nretry].end;
+          } else if (total < 0 && next == 0) {
+            // Only one request until the size is known
+            l.from = 0;
+            l.to = TINY_GSM_BOND_STRIPE;
+            next = l.to;
+          } else if (total >= 0 && next < (uint32_t)total) {
+            l.from = next;
+            l.to = TinyGsmMin(next + TINY_GSM_BOND_STRIPE, (uint32_t)total);
+            next = l.to;
+          } else {
+            continue;
+          }
+          if (!request(l, host, port, path)) {
+            retry[nretry].first = l.from;
+            retry[nretry++].end = l.to;
+            drop(l);
+            continue;
+          }
+          busy = true;
+        }
+
+        if (l.state == LINK_HEAD) {
+          int r = readHead(l, total, next, retry, nretry);
+          if (r < 0) {
+            stopAll();
+            return -1;
+          }
+          if (r > 0) busy = true;
+        }
+
+        if (l.state == LINK_BODY) {
+          while (l.from < l.to && l.client->available() > 0) {
+            int n = l.client->read(buf, TinyGsmMin((uint32_t)sizeof(buf), l.to - l.from));
+            if (n <= 0) break;
+            if (!writer(l.from, buf, n, ctx)) {
+              stopAll();
+              return -1;
+            }
+            l.from += n;
+            l.bytes += n;
+            done += n;
+            busy = true;
+          }
+          if (l.from >= l.to) {
+            l.state = LINK_IDLE;
+          }
+        }
+
+        // The connection went away mid-response: someone else asks again
+        // for the rest, while this link reconnects for its next stripe
+        if (l.state != LINK_IDLE && !l.client->connected() && l.client->available() <= 0) {
+          retry[nretry].first = l.from;
+          retry[nretry++].end = l.to;
+          l.state = LINK_IDLE;
+          l.client->stop();
+        }
+      }
+      if (!busy) {
+        TINY_GSM_YIELD();
+      }
+    }
+    stopAll();
+    return total;
+  }
+
+private:
+  enum LinkState {
+    LINK_IDLE,
+    LINK_HEAD,
+    LINK_BODY,
+  };
+
+  struct Gap {
+    uint32_t first;
+    uint32_t end;
+  };
+
+  // Stripes waiting to be asked for again: one per link that failed, plus
+  // one per link that got a short range answer
+  enum { RETRY_MAX = 2 * TINY_GSM_BOND_LINKS };
+
+  struct Link {
+    Client*   client;
+    uint32_t  rate;     // bytes/s, 0 for no limit
+    uint32_t  credit;   // bytes that may be sent now
+    uint32_t  stamp;    // when credit was last topped up
+    uint32_t  bytes;
+    bool      up;
+    // Download state: the range still to come, and the response headers
+    LinkState state;
+    uint32_t  from;
+    uint32_t  to;
+    int       status;
+    int32_t   length;
+    int32_t   rangeStart;
+    int32_t   rangeTotal;
+    uint8_t   lineLen;
+    char      line[TINY_GSM_BOND_LINE];
+  };
+
+  static void put16(uint8_t* p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v;
+  }
+
+  static void put32(uint8_t* p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+  }
+
+  static uint32_t get32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+  }
+
+  uint8_t connectAll(const char* host, uint16_t port) {
+    uint8_t up = 0;
+    for (uint8_t i = 0; i < count; i++) {
+      Link& l = link[i];
+      l.bytes = 0;
+      l.credit = 0;
+      l.stamp = millis();
+      l.up = l.client->connect(host, port) > 0;
+      if (l.up) up++;
+    }
+    return up;
+  }
+
+  void drop(Link& l) {
+    l.client->stop();
+    l.up = false;
+  }
+
+  void stopAll() {
+    for (uint8_t i = 0; i < count; i++) {
+      if (link[i].up) drop(link[i]);
+    }
+  }
+
+  bool send(Link& l, const uint8_t* data, size_t len) {
+    if (l.client->write(data, len) != len) {
+      return false;
+    }
+    l.bytes += len;
+    return true;
+  }
+
+  // Token bucket: a link may send once it has earned credit for the frame,
+  // and never saves up more than two frames' worth
+  bool paced(Link& l, uint32_t len) {
+    if (!l.rate) {
+      return true;
+    }
+    uint32_t now = millis();
+    uint32_t earned = (uint32_t)((uint64_t)(now - l.stamp) * l.rate / 1000);
+    if (earned) {
+      l.credit = TinyGsmMin(l.credit + earned, (uint32_t)(2 * (TINY_GSM_BOND_CHUNK + 6)));
+      l.stamp = now;
+    }
+    return l.credit >= len;
+  }
+
+  bool sendChunk(uint32_t seq, uint32_t size, TinyGsmBondReader reader, void* ctx,
+                 uint32_t startMillis, uint32_t timeout_ms)
+  {
+    uint32_t offset = seq * TINY_GSM_BOND_CHUNK;
+    uint16_t len = TinyGsmMin(size - offset, (uint32_t)TINY_GSM_BOND_CHUNK);
+    if (reader(offset, buf + 6, len, ctx) != len) {
+      return false;
+    }
+    put32(buf, seq);
+    put16(buf + 4, len);
+
+    while (millis() - startMillis < timeout_ms) {
+      bool any = false;
+      for (uint8_t n = 0; n < count; n++) {
+        Link& l = link[cursor];
+        cursor = (cursor + 1) % count;
+        if (!l.up) continue;
+        any = true;
+        if (!paced(l, len + 6)) continue;
+        if (!send(l, buf, len + 6)) {
+          drop(l);
+          continue;
+        }
+        if (l.rate) {
+          l.credit -= len + 6;
+        }
+        return true;
+      }
+      if (!any) {
+        return false;
+      }
+      TINY_GSM_YIELD();
+    }
+    return false;
+  }
+
+  bool readFully(Link& l, uint8_t* p, size_t len, uint32_t startMillis, uint32_t timeout_ms) {
+    size_t got = 0;
+    while (got < len) {
+      if (l.client->available() > 0) {
+        int n = l.client->read(p + got, len - got);
+        if (n > 0) {
+          got += n;
+          continue;
+        }
+      }
+      if (!l.client->connected() || millis() - startMillis > timeout_ms) {
+        return false;
+      }
+      TINY_GSM_YIELD();
+    }
+    return true;
+  }
+
+  bool readReport(Link& l, Gap* gaps, uint16_t& ngaps, uint32_t startMillis, uint32_t timeout_ms) {
+    uint8_t b[8];
+    if (!readFully(l, b, 2, startMillis, timeout_ms)) {
+      return false;
+    }
+    uint16_t n = (b[0] << 8) | b[1];
+    if (n > TINY_GSM_BOND_GAPS) {
+      return false;
+    }
+    for (uint16_t g = 0; g < n; g++) {
+      if (!readFully(l, b, 8, startMillis, timeout_ms)) {
+        return false;
+      }
+      gaps[g].first = get32(b);
+      gaps[g].end = get32(b + 4);
+    }
+    ngaps = n;
+    return true;
+  }
+
+  bool request(Link& l, const char* host, uint16_t port, const char* path) {
+    if (!l.client->connected() && l.client->connect(host, port) <= 0) {
+      return false;
+    }
+    int len = snprintf((char*)buf, sizeof(buf),
+                       "GET %s HTTP/1.1\r\nHost: %s\r\nRange: bytes=%lu-%lu\r\n\r\n",
+                       path, host, (unsigned long)l.from, (unsigned long)(l.to - 1));
+    if (len <= 0 || len >= (int)sizeof(buf) || !send(l, buf, len)) {
+      return false;
+    }
+    l.state = LINK_HEAD;
+    l.status = 0;
+    l.length = -1;
+    l.rangeStart = -1;
+    l.rangeTotal = -1;
+    l.lineLen = 0;
+    return true;
+  }
+
+  static const char* headerValue(const char* line, const char* name) {
+    size_t n = strlen(name);
+    for (size_t i = 0; i < n; i++) {
+      if (tolower(line[i]) != name[i]) return NULL;
+    }
+    line += n;
+    while (*line == ' ') line++;
+    return line;
+  }
+
+  // Reads response headers as they arrive.  Returns -1 if the download
+  // can't go on, 1 if anything was read and 0 otherwise.
+  int readHead(Link& l, int32_t& total, uint32_t& next, Gap* retry, uint8_t& nretry) {
+    int r = 0;
+    while (l.state == LINK_HEAD && l.client->available() > 0) {
+      int c = l.client->read();
+      if (c < 0) break;
+      r = 1;
+      if (c == '\r') continue;
+      if (c != '\n') {
+        if (l.lineLen < TINY_GSM_BOND_LINE - 1) {
+          l.line[l.lineLen++] = c;
+        }
+        continue;
+      }
+      l.line[l.lineLen] = '\0';
+      l.lineLen = 0;
+      const char* v;
+      if (!l.status) {
+        v = strchr(l.line, ' ');
+        l.status = v ? atoi(v + 1) : -1;
+      } else if ((v = headerValue(l.line, "content-length:")) != NULL) {
+        l.length = atol(v);
+      } else if ((v = headerValue(l.line, "content-range:")) != NULL) {
+        // "bytes first-last/total", or "bytes */total" for a bad range
+        const char* s = strchr(v, ' ');
+        const char* t = strchr(v, '/');
+        l.rangeStart = (s && s[1] != '*') ? atol(s + 1) : -1;
+        l.rangeTotal = (t && t[1] != '*') ? atol(t + 1) : -1;
+      } else if (!l.line[0]) {
+        if (!startBody(l, total, next, retry, nretry)) return -1;
+      }
+    }
+    return r;
+  }
+
+  bool startBody(Link& l, int32_t& total, uint32_t& next, Gap* retry, uint8_t& nretry) {
+    if (l.status == 206 && l.length >= 0 && l.rangeStart == (int32_t)l.from) {
+      if (total < 0) {
+        if (l.rangeTotal < 0) return false;
+        total = l.rangeTotal;
+        next = TinyGsmMin(next, (uint32_t)total);
+        l.to = TinyGsmMin(l.to, (uint32_t)total);
+      }
+      // A server may send less than was asked for; the rest is asked for
+      // again, by whichever link is free first
+      uint32_t end = l.from + l.length;
+      if (end < l.to) {
+        if (nretry >= RETRY_MAX) return false;
+        retry[nretry].first = end;
+        retry[nretry++].end = l.to;
+      }
+      l.to = end;
+    } else if (l.status == 200 && l.length >= 0 && l.from == 0 && total < 0) {
+      // The server ignores ranges: the whole file comes on this link
+      total = l.length;
+      next = total;
+      l.to = total;
+    } else if (l.status == 416 && total < 0 && l.rangeTotal == 0) {
+      total = 0;
+      next = 0;
+      l.to = 0;
+    } else {
+      return false;
+    }
+    l.state = LINK_BODY;
+    return true;
+  }
+
+  Link     link[TINY_GSM_BOND_LINKS];
+  uint8_t  count;
+  uint8_t  cursor;
+  uint8_t  buf[TINY_GSM_BOND_CHUNK + 6];
+};
+
+#endif
@@ -11,29 +11,56 @@
 
 #if defined(TINY_GSM_MODEM_SIM800)
   #define TINY_GSM_MODEM_HAS_GPRS
+  #define TINY_GSM_MODEM_HAS_NETWORK_EVENTS
+  #define TINY_GSM_MODEM_HAS_PPP
+  #define TINY_GSM_MODEM_HAS_CMUX
+  #define TINY_GSM_MODEM_HAS_TRANSPARENT
   #define TINY_GSM_MODEM_HAS_SSL
+  #define TINY_GSM_MODEM_HAS_UDP
+  #define TINY_GSM_MODEM_HAS_WARM_START
   #include <TinyGsmClientSIM800.h>
   typedef TinyGsmSim800 TinyGsm;
   typedef TinyGsmSim800::GsmClient TinyGsmClient;
   typedef TinyGsmSim800::GsmClientSecure TinyGsmClientSecure;
+  typedef TinyGsmSim800::GsmUdp TinyGsmUdp;
+  typedef TinyGsmSim800::GsmClientTransparent TinyGsmClientTransparent;
 
 #elif defined(TINY_GSM_MODEM_SIM808) || defined(TINY_GSM_MODEM_SIM868)
   #define TINY_GSM_MODEM_HAS_GPRS
+  #define TINY_GSM_MODEM_HAS_NETWORK_EVENTS
+  #define TINY_GSM_MODEM_HAS_PPP
+  #define TINY_GSM_MODEM_HAS_CMUX
+  #define TINY_GSM_MODEM_HAS_TRANSPARENT
   #define TINY_GSM_MODEM_HAS_SSL
   #define TINY_GSM_MODEM_HAS_GPS
+  #define TINY_GSM_MODEM_HAS_UDP
+  #define TINY_GSM_MODEM_HAS_WARM_START
   #include <TinyGsmClientSIM808.h>
   typedef TinyGsmSim808 TinyGsm;
   typedef TinyGsmSim808::GsmClient TinyGsmClient;
   typedef TinyGsmSim808::GsmClientSecure TinyGsmClientSecure;
+  typedef TinyGsmSim808::GsmUdp TinyGsmUdp;
+  typedef TinyGsmSim808::GsmClientTransparent TinyGsmClientTransparent;
 
 #elif defined(TINY_GSM_MODEM_SIM900)
   #define TINY_GSM_MODEM_HAS_GPRS
+  #define TINY_GSM_MODEM_HAS_NETWORK_EVENTS
+  #define TINY_GSM_MODEM_HAS_PPP
+  #define TINY_GSM_MODEM_HAS_CMUX
+  #define TINY_GSM_MODEM_HAS_TRANSPARENT
+  #define TINY_GSM_MODEM_HAS_UDP
+  #define TINY_GSM_MODEM_HAS_WARM_START
   #include <TinyGsmClientSIM800.h>
   typedef TinyGsmSim800 TinyGsm;
   typedef TinyGsmSim800::GsmClient TinyGsmClient;
+  typedef TinyGsmSim800::GsmUdp TinyGsmUdp;
+  typedef TinyGsmSim800::GsmClientTransparent TinyGsmClientTransparent;
 
 #elif defined(TINY_GSM_MODEM_SIM7000)
   #define TINY_GSM_MODEM_HAS_GPRS
+  #define TINY_GSM_MODEM_HAS_NETWORK_EVENTS
+  #define TINY_GSM_MODEM_HAS_PPP
+  #define TINY_GSM_MODEM_HAS_CMUX
   #define TINY_GSM_MODEM_HAS_GPS
   #include <TinyGsmClientSIM7000.h>
   typedef TinyGsmSim7000 TinyGsm;
@@ -42,40 +69,58 @@
 
 #elif defined(TINY_GSM_MODEM_UBLOX)
   #define TINY_GSM_MODEM_HAS_GPRS
+  #define TINY_GSM_MODEM_HAS_NETWORK_EVENTS
+  #define TINY_GSM_MODEM_HAS_PPP
+  #define TINY_GSM_MODEM_HAS_CMUX
   #define TINY_GSM_MODEM_HAS_SSL
+  #define TINY_GSM_MODEM_HAS_UDP
   #include <TinyGsmClientUBLOX.h>
   typedef TinyGsmUBLOX TinyGsm;
   typedef TinyGsmUBLOX::GsmClient TinyGsmClient;
   typedef TinyGsmUBLOX::GsmClientSecure TinyGsmClientSecure;
+  typedef TinyGsmUBLOX::GsmUdp TinyGsmUdp;
 
 #elif defined(TINY_GSM_MODEM_SARAR4)
   #define TINY_GSM_MODEM_HAS_GPRS
+  #define TINY_GSM_MODEM_HAS_NETWORK_EVENTS
+  #define TINY_GSM_MODEM_HAS_PPP
+  #define TINY_GSM_MODEM_HAS_CMUX
   #define TINY_GSM_MODEM_HAS_SSL
+  #define TINY_GSM_MODEM_HAS_UDP
   #include <TinyGsmClientSaraR4.h>
   typedef TinyGsmSaraR4 TinyGsm;
   typedef TinyGsmSaraR4::GsmClient TinyGsmClient;
   typedef TinyGsmSaraR4::GsmClientSecure TinyGsmClientSecure;
+  typedef TinyGsmSaraR4::GsmUdp TinyGsmUdp;
 
 #elif defined(TINY_GSM_MODEM_M95)
   #define TINY_GSM_MODEM_HAS_GPRS
+  #define TINY_GSM_MODEM_HAS_PPP
   #include <TinyGsmClientM95.h>
   typedef TinyGsmM95 TinyGsm;
   typedef TinyGsmM95::GsmClient TinyGsmClient;
 
 #elif defined(TINY_GSM_MODEM_BG96)
   #define TINY_GSM_MODEM_HAS_GPRS
+  #define TINY_GSM_MODEM_HAS_NETWORK_EVENTS
+  #define TINY_GSM_MODEM_HAS_PPP
+  #define TINY_GSM_MODEM_HAS_CMUX
+  #define TINY_GSM_MODEM_HAS_UDP
   #include <TinyGsmClientBG96.h>
   typedef TinyGsmBG96 TinyGsm;
   typedef TinyGsmBG96::GsmClient TinyGsmClient;
+  typedef TinyGsmBG96::GsmUdp TinyGsmUdp;
 
 #elif defined(TINY_GSM_MODEM_A6) || defined(TINY_GSM_MODEM_A7)
   #define TINY_GSM_MODEM_HAS_GPRS
+  #define TINY_GSM_MODEM_HAS_PPP
   #include <TinyGsmClientA6.h>
   typedef TinyGsmA6 TinyGsm;
   typedef TinyGsmA6::GsmClient TinyGsmClient;
 
 #elif defined(TINY_GSM_MODEM_M590)
   #define TINY_GSM_MODEM_HAS_GPRS
+  #define TINY_GSM_MODEM_HAS_PPP
   #include <TinyGsmClientM590.h>
   typedef TinyGsmM590 TinyGsm;
   typedef TinyGsmM590::GsmClient TinyGsmClient;
@@ -83,6 +128,7 @@
 #elif defined(TINY_GSM_MODEM_MC60) || defined(TINY_GSM_MODEM_MC60E)
   #include <TinyGsmClientMC60.h>
   #define TINY_GSM_MODEM_HAS_GPRS
+  #define TINY_GSM_MODEM_HAS_PPP
   #define TINY_GSM_MODEM_HAS_GPS
   typedef TinyGsmMC60 TinyGsm;
   typedef TinyGsmMC60::GsmClient TinyGsmClient;
@@ -90,10 +136,12 @@
 #elif defined(TINY_GSM_MODEM_ESP8266)
   #define TINY_GSM_MODEM_HAS_WIFI
   #define TINY_GSM_MODEM_HAS_SSL
+  #define TINY_GSM_MODEM_HAS_UDP
   #include <TinyGsmClientESP8266.h>
   typedef TinyGsmESP8266 TinyGsm;
   typedef TinyGsmESP8266::GsmClient TinyGsmClient;
   typedef TinyGsmESP8266::GsmClientSecure TinyGsmClientSecure;
+  typedef TinyGsmESP8266::GsmUdp TinyGsmUdp;
 
 #elif defined(TINY_GSM_MODEM_XBEE)
   #define TINY_GSM_MODEM_HAS_GPRS
@@ -104,8 +152,19 @@
   typedef TinyGsmXBee::GsmClient TinyGsmClient;
   typedef TinyGsmXBee::GsmClientSecure TinyGsmClientSecure;
 
+#elif defined(TINY_GSM_MODEM_XBEE_API)
+  #define TINY_GSM_MODEM_HAS_GPRS
+  #define TINY_GSM_MODEM_HAS_SSL
+  #include <TinyGsmClientXBeeAPI.h>
+  typedef TinyGsmXBeeAPI TinyGsm;
+  typedef TinyGsmXBeeAPI::GsmClient TinyGsmClient;
+  typedef TinyGsmXBeeAPI::GsmClientSecure TinyGsmClientSecure;
+
 #elif defined(TINY_GSM_MODEM_SEQUANS_MONARCH)
   #define TINY_GSM_MODEM_HAS_GPRS
+  #define TINY_GSM_MODEM_HAS_NETWORK_EVENTS
+  #define TINY_GSM_MODEM_HAS_PPP
+  #define TINY_GSM_MODEM_HAS_CMUX
   #define TINY_GSM_MODEM_HAS_SSL
   #include <TinyGsmClientSequansMonarch.h>
   typedef TinyGsmSequansMonarch TinyGsm;
@@ -12,23 +12,22 @@
 
 //#define TINY_GSM_DEBUG Serial
 
-#if !defined(TINY_GSM_RX_BUFFER)
-  #define TINY_GSM_RX_BUFFER 256
-#endif
-
-#define TINY_GSM_MUX_COUNT 8
-
 #include <TinyGsmCommon.h>
 
+#undef GSM_NL
+#undef GSM_OK
+#undef GSM_ERROR
 #define GSM_NL "\r\n"
-static const char GSM_OK[] TINY_GSM_PROGMEM = "OK" GSM_NL;
-static const char GSM_ERROR[] TINY_GSM_PROGMEM = "ERROR" GSM_NL;
+#define GSM_OK GSM_CRLF_OK
+#define GSM_ERROR GSM_CRLF_ERROR
 
-enum SimStatus {
-  SIM_ERROR = 0,
-  SIM_READY = 1,
-  SIM_LOCKED = 2,
-};
+
+class TinyGsmA6
+{
+
+public:
+
+enum { MUX_COUNT = 8 };
 
 enum RegStatus {
   REG_UNREGISTERED = 0,
@@ -39,16 +38,10 @@ enum RegStatus {
   REG_UNKNOWN      = 4,
 };
 
-
-class TinyGsmA6
-{
-
-public:
-
 class GsmClient : public Client
 {
   friend class TinyGsmA6;
-  typedef TinyGsmFifo<uint8_t, TINY_GSM_RX_BUFFER> RxFifo;
+  typedef TinyGsmLockedFifo<uint8_t, TINY_GSM_RX_BUFFER_OR(256)> RxFifo;
 
 public:
   GsmClient() {}
@@ -74,7 +67,7 @@ public:
     sock_connected = at->modemConnect(host, port, &newMux, timeout_s);
     if (sock_connected) {
       mux = newMux;
-      at->sockets[mux] = this;
+      at->modemSetSocket(mux, this);
     }
     return sock_connected;
   }
@@ -97,6 +90,8 @@ TINY_GSM_CLIENT_READ_NO_MODEM_FIFO()
 
 TINY_GSM_CLIENT_PEEK_FLUSH_CONNECTED()
 
+TINY_GSM_CLIENT_EVENTS()
+
   /*
    * Extended API
    */
@@ -108,6 +103,7 @@ private:
   uint8_t         mux;
   bool            sock_connected;
   RxFifo          rx;
+  TinyGsmClientEvents events;
 };
 
 
@@ -128,10 +124,12 @@ public:
    }
 
   bool init(const char* pin = NULL) {
+    TinyGsmTransaction transaction(at_lock);
     DBG(GF("### TinyGSM Version:"), TINYGSM_VERSION);
     if (!testAT()) {
       return false;
     }
+    settings.clear();
     sendAT(GF("&FZE0"));  // Factory + Reset + Echo Off
     if (waitResponse() != 1) {
       return false;
@@ -145,7 +143,7 @@ public:
     return true;
   }
 
-  String getModemName() {
+  String modemGetName() {
     #if defined(TINY_GSM_MODEM_A6)
       return "AI-Thinker A6";
     #elif defined(TINY_GSM_MODEM_A7)
@@ -160,7 +158,12 @@ TINY_GSM_MODEM_TEST_AT()
 
 TINY_GSM_MODEM_MAINTAIN_LISTEN()
 
+TINY_GSM_MODEM_POLL_SOCKS_NO_MODEM_FIFO()
+
+TINY_GSM_MODEM_EVENTS_NO_MODEM_FIFO()
+
   bool factoryDefault() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("&FZE0&W"));  // Factory + Reset + Echo Off + Write
     waitResponse();
     sendAT(GF("&W"));       // Write configuration
@@ -185,16 +188,25 @@ TINY_GSM_MODEM_GET_INFO_ATI()
    * Power functions
    */
 
+TINY_GSM_MODEM_WAIT_FOR_READY()
+
   bool restart() {
+    TinyGsmTransaction transaction(at_lock);
+    identity.clear();
+    metrics.clear();
+    settings.clear();
     if (!testAT()) {
       return false;
     }
     sendAT(GF("+RST=1"));
-    delay(3000);
+    if (!waitForReady()) {
+      return false;
+    }
     return init();
   }
 
   bool poweroff() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CPOF"));
     return waitResponse() == 1;
   }
@@ -209,7 +221,8 @@ TINY_GSM_MODEM_GET_INFO_ATI()
 
 TINY_GSM_MODEM_SIM_UNLOCK_CPIN()
 
-  String getSimCCID() {
+  String modemGetSimCCID() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CCID"));
     if (waitResponse(GF(GSM_NL "+SCID: SIM Card ID:")) != 1) {
       return "";
@@ -222,7 +235,10 @@ TINY_GSM_MODEM_SIM_UNLOCK_CPIN()
 
 TINY_GSM_MODEM_GET_IMEI_GSN()
 
+TINY_GSM_MODEM_IDENTITY()
+
   SimStatus getSimStatus(unsigned long timeout_ms = 10000L) {
+    TinyGsmTransaction transaction(at_lock);
     for (unsigned long start = millis(); millis() - start < timeout_ms; ) {
       sendAT(GF("+CPIN?"));
       if (waitResponse(GF(GSM_NL "+CPIN:")) != 1) {
@@ -244,6 +260,7 @@ TINY_GSM_MODEM_GET_IMEI_GSN()
 TINY_GSM_MODEM_GET_REGISTRATION_XREG(CREG)
 
   String getOperator() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+COPS=3,0")); // Set format
     waitResponse();
 
@@ -275,6 +292,8 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
    */
 
   bool gprsConnect(const char* apn, const char* user = NULL, const char* pwd = NULL) {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
     gprsDisconnect();
 
     sendAT(GF("+CGATT=1"));
@@ -305,6 +324,8 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   bool gprsDisconnect() {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
     // Shut the TCP/IP connection
     sendAT(GF("+CIPSHUT"));
     if (waitResponse(60000L) != 1)
@@ -319,7 +340,8 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     return false;
   }
 
-  bool isGprsConnected() {
+  bool modemIsGprsConnected() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CGATT?"));
     if (waitResponse(GF(GSM_NL "+CGATT:")) != 1) {
       return false;
@@ -329,11 +351,14 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     return (res == 1);
   }
 
+TINY_GSM_MODEM_CACHED_GPRS()
+
   /*
    * IP Address functions
    */
 
   String getLocalIP() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CIFSR"));
     String res;
     if (waitResponse(10000L, res) != 1) {
@@ -349,6 +374,8 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     return TinyGsmIpFromString(getLocalIP());
   }
 
+TINY_GSM_MODEM_DNS_CACHE()
+
   /*
    * Phone Call functions
    */
@@ -356,12 +383,14 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   bool setGsmBusy(bool busy = true) TINY_GSM_ATTR_NOT_AVAILABLE;
 
   bool callAnswer() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("A"));
     return waitResponse() == 1;
   }
 
   // Returns true on pick-up, false on error/busy
   bool callNumber(const String& number) {
+    TinyGsmTransaction transaction(at_lock);
     if (number == GF("last")) {
       sendAT(GF("DLST"));
     } else {
@@ -390,12 +419,14 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   bool callHangup() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("H"));
     return waitResponse() == 1;
   }
 
   // 0-9,*,#,A,B,C,D
   bool dtmfSend(char cmd, unsigned duration_ms = 100) {
+    TinyGsmTransaction transaction(at_lock);
     duration_ms = constrain(duration_ms, 100, 1000);
 
     // The duration parameter is not working, so we simulate it using delay..
@@ -417,16 +448,19 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
    */
 
   bool audioSetHeadphones() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+SNFS=0"));
     return waitResponse() == 1;
   }
 
   bool audioSetSpeaker() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+SNFS=1"));
     return waitResponse() == 1;
   }
 
   bool audioMuteMic(bool mute) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CMUT="), mute);
     return waitResponse() == 1;
   }
@@ -436,10 +470,9 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
    */
 
   String sendUSSD(const String& code) {
-    sendAT(GF("+CMGF=1"));
-    waitResponse();
-    sendAT(GF("+CSCS=\"HEX\""));
-    waitResponse();
+    TinyGsmTransaction transaction(at_lock);
+    modemSet(settings.cmgf, 1, GF("+CMGF=1"));
+    modemSet(settings.cscs, TinyGsmSettings::CSCS_HEX, GF("+CSCS=\"HEX\""));
     sendAT(GF("+CUSD=1,\""), code, GF("\",15"));
     if (waitResponse(10000L) != 1) {
       return "";
@@ -462,8 +495,8 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   bool sendSMS(const String& number, const String& text) {
-    sendAT(GF("+CMGF=1"));
-    waitResponse();
+    TinyGsmTransaction transaction(at_lock);
+    modemSet(settings.cmgf, 1, GF("+CMGF=1"));
     sendAT(GF("+CMGS=\""), number, GF("\""));
     if (waitResponse(GF(">")) != 1) {
       return false;
@@ -488,6 +521,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   uint16_t getBattVoltage() TINY_GSM_ATTR_NOT_AVAILABLE;
 
   int8_t getBattPercent() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CBC?"));
     if (waitResponse(GF(GSM_NL "+CBC:")) != 1) {
       return false;
@@ -501,6 +535,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   uint8_t getBattChargeState() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CBC?"));
     if (waitResponse(GF(GSM_NL "+CBC:")) != 1) {
       return false;
@@ -513,6 +548,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   bool getBattStats(uint8_t &chargeState, int8_t &percent, uint16_t &milliVolts) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CBC?"));
     if (waitResponse(GF(GSM_NL "+CBC:")) != 1) {
       return false;
@@ -534,11 +570,15 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
 protected:
 
   bool modemConnect(const char* host, uint16_t port, uint8_t* mux, int timeout_s = 75) {
+    TinyGsmTransaction transaction(at_lock);
     unsigned long startMillis = millis();
     uint32_t timeout_ms = ((uint32_t)timeout_s)*1000;
 
-    sendAT(GF("+CIPSTART="),  GF("\"TCP"), GF("\",\""), host, GF("\","), port);
+    char ipBuf[16];
+    const char* target = resolvedHost(host, ipBuf);
+    sendAT(GF("+CIPSTART="),  GF("\"TCP"), GF("\",\""), target, GF("\","), port);
     if (waitResponse(timeout_ms, GF(GSM_NL "+CIPNUM:")) != 1) {
+      dnsCache.remove(host);  // The address may have moved
       return false;
     }
     int newMux = stream.readStringUntil('\n').toInt();
@@ -552,10 +592,39 @@ protected:
     }
     *mux = newMux;
 
+    if (rsp != 1 && target != host) {
+      dnsCache.remove(host);
+    }
     return (1 == rsp);
   }
 
+  String dnsIpQuery(const char* host) {
+    TinyGsmTransaction transaction(at_lock);
+    sendAT(GF("+CDNSGIP="), host);
+    String res;
+    if (waitResponse(10000L, res) != 1) {
+      return "";
+    }
+    // +CDNSGIP: 1,"host","ip"[,"ip2"]
+    int start = res.indexOf("+CDNSGIP:");
+    if (start < 0 || res.substring(start + 9).toInt() != 1) {
+      return "";
+    }
+    start = res.indexOf(',', start);       // Before the quoted host name
+    if (start >= 0) start = res.indexOf(',', start + 1);  // Before the address
+    if (start < 0) {
+      return "";
+    }
+    res = res.substring(start + 1, res.indexOf('\r', start));
+    int end = res.indexOf(',');            // Drop any secondary address
+    if (end >= 0) res = res.substring(0, end);
+    res.replace("\"", "");
+    res.trim();
+    return res;
+  }
+
   int16_t modemSend(const void* buff, size_t len, uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CIPSEND="), mux, ',', len);
     if (waitResponse(2000L, GF(GSM_NL ">")) != 1) {
       return 0;
@@ -569,6 +638,7 @@ protected:
   }
 
   bool modemGetConnected(uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CIPSTATUS")); //TODO mux?
     int res = waitResponse(GF(",\"CONNECTED\""), GF(",\"CLOSED\""), GF(",\"CLOSING\""), GF(",\"INITIAL\""));
     waitResponse();
@@ -594,6 +664,7 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
     String r4s(r4); r4s.trim();
     String r5s(r5); r5s.trim();
     DBG("### ..:", r1s, ",", r2s, ",", r3s, ",", r4s, ",", r5s);*/
+    at_lock.begin();
     data.reserve(64);
     int index = 0;
     unsigned long startMillis = millis();
@@ -637,7 +708,7 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
           data = "";
         } else if (data.endsWith(GF("+TCPCLOSED:"))) {
           int mux = stream.readStringUntil('\n').toInt();
-          if (mux >= 0 && mux < TINY_GSM_MUX_COUNT) {
+          if (mux >= 0 && mux < MUX_COUNT) {
             sockets[mux]->sock_connected = false;
           }
           data = "";
@@ -646,6 +717,7 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
       }
     } while (millis() - startMillis < timeout_ms);
 finish:
+    TINY_GSM_MODEM_END_TRANSACTION();
     if (!index) {
       data.trim();
       if (data.length()) {
@@ -676,7 +748,26 @@ public:
   Stream&       stream;
 
 protected:
-  GsmClient*    sockets[TINY_GSM_MUX_COUNT];
+  GsmClient*    sockets[MUX_COUNT];
+  TinyGsmModemEvents events;
+  TinyGsmIdentity    identity;
+  TinyGsmMetrics     metrics;
+  TinyGsmSettings    settings;
+  TinyGsmDnsCache<TINY_GSM_DNS_CACHE_SIZE> dnsCache;
+  TinyGsmTransactionLock at_lock;
 };
 
+// The first driver included also provides its registration states
+// unqualified, as when only one driver could be built
+#if !defined(TINY_GSM_REG_STATUS_DEFINED)
+#define TINY_GSM_REG_STATUS_DEFINED
+typedef TinyGsmA6::RegStatus RegStatus;
+static const RegStatus REG_UNREGISTERED = TinyGsmA6::REG_UNREGISTERED;
+static const RegStatus REG_SEARCHING    = TinyGsmA6::REG_SEARCHING;
+static const RegStatus REG_DENIED       = TinyGsmA6::REG_DENIED;
+static const RegStatus REG_OK_HOME      = TinyGsmA6::REG_OK_HOME;
+static const RegStatus REG_OK_ROAMING   = TinyGsmA6::REG_OK_ROAMING;
+static const RegStatus REG_UNKNOWN      = TinyGsmA6::REG_UNKNOWN;
+#endif
+
 #endif
@@ -13,23 +13,22 @@
 //#define TINY_GSM_DEBUG Serial
 //#define TINY_GSM_USE_HEX
 
-#if !defined(TINY_GSM_RX_BUFFER)
-  #define TINY_GSM_RX_BUFFER 64
-#endif
-
-#define TINY_GSM_MUX_COUNT 12
-
 #include <TinyGsmCommon.h>
 
+#undef GSM_NL
+#undef GSM_OK
+#undef GSM_ERROR
 #define GSM_NL "\r\n"
-static const char GSM_OK[] TINY_GSM_PROGMEM = "OK" GSM_NL;
-static const char GSM_ERROR[] TINY_GSM_PROGMEM = "ERROR" GSM_NL;
+#define GSM_OK GSM_CRLF_OK
+#define GSM_ERROR GSM_CRLF_ERROR
 
-enum SimStatus {
-  SIM_ERROR = 0,
-  SIM_READY = 1,
-  SIM_LOCKED = 2,
-};
+
+class TinyGsmBG96
+{
+
+public:
+
+enum { MUX_COUNT = 12 };
 
 enum RegStatus {
   REG_UNREGISTERED = 0,
@@ -40,16 +39,13 @@ enum RegStatus {
   REG_UNKNOWN      = 4,
 };
 
-
-class TinyGsmBG96
-{
-
-public:
+class GsmUdp;
 
 class GsmClient : public Client
 {
   friend class TinyGsmBG96;
-  typedef TinyGsmFifo<uint8_t, TINY_GSM_RX_BUFFER> RxFifo;
+  friend class GsmUdp;
+  typedef TinyGsmLockedFifo<uint8_t, TINY_GSM_RX_BUFFER_OR(64)> RxFifo;
 
 public:
   GsmClient() {}
@@ -66,7 +62,7 @@ public:
     sock_connected = false;
     got_data = false;
 
-    at->sockets[mux] = this;
+    at->modemSetSocket(mux, this);
 
     return true;
   }
@@ -109,6 +105,8 @@ TINY_GSM_CLIENT_READ_WITH_BUFFER_CHECK()
 
 TINY_GSM_CLIENT_PEEK_FLUSH_CONNECTED()
 
+TINY_GSM_CLIENT_EVENTS()
+
   /*
    * Extended API
    */
@@ -123,6 +121,7 @@ private:
   bool            sock_connected;
   bool            got_data;
   RxFifo          rx;
+  TinyGsmClientEvents events;
 };
 
 
@@ -146,11 +145,61 @@ private:
 // };
 
 
+class GsmUdp : public UDP
+{
+  friend class TinyGsmBG96;
+
+public:
+  GsmUdp() {}
+
+  GsmUdp(TinyGsmBG96& modem, uint8_t mux = 1) {
+    init(&modem, mux);
+  }
+
+  bool init(TinyGsmBG96* modem, uint8_t mux = 1) {
+    this->at = modem;
+    peer_port = 0;
+    local_port = 0;
+    tx_len = 0;
+    tx_overflow = false;
+    rx_left = 0;
+    return sock.init(modem, mux);
+  }
+
+TINY_GSM_UDP_PACKET_FUNCTIONS()
+
+private:
+  // The socket is a "UDP SERVICE" one, which isn't tied to the peer: each
+  // datagram is sent to it by name
+  bool connectPeer(const char *host, uint16_t port) {
+    sock.rx.clear();
+    sock.sock_connected = at->modemConnect(host, port, sock.mux, false, 20,
+                                           true, local_port);
+    return sock.sock_connected;
+  }
+
+  int16_t sendDatagram(const uint8_t* buf, size_t len) {
+    return at->modemSendTo(buf, len, sock.mux, peer_host.c_str(), peer_port);
+  }
+
+  TinyGsmBG96*    at;
+  GsmClient       sock;
+  String          peer_host;
+  uint16_t        peer_port;
+  uint16_t        local_port;
+  uint16_t        tx_len;
+  bool            tx_overflow;
+  uint16_t        rx_left;
+  uint8_t         tx[TINY_GSM_UDP_TX_BUFFER];
+};
+
+
 public:
 
   TinyGsmBG96(Stream& stream)
     : stream(stream)
   {
+    prev_state_check = 0;
     memset(sockets, 0, sizeof(sockets));
   }
 
@@ -163,10 +212,12 @@ public:
   }
 
   bool init(const char* pin = NULL) {
+    TinyGsmTransaction transaction(at_lock);
     DBG(GF("### TinyGSM Version:"), TINYGSM_VERSION);
     if (!testAT()) {
       return false;
     }
+    settings.clear();
     sendAT(GF("&FZE0"));  // Factory + Reset + Echo Off
     if (waitResponse() != 1) {
       return false;
@@ -176,7 +227,7 @@ public:
     return true;
   }
 
-  String getModemName() {
+  String modemGetName() {
     return "Quectel BG96";
   }
 
@@ -186,7 +237,12 @@ TINY_GSM_MODEM_TEST_AT()
 
 TINY_GSM_MODEM_MAINTAIN_CHECK_SOCKS()
 
+TINY_GSM_MODEM_POLL_SOCKS()
+
+TINY_GSM_MODEM_EVENTS()
+
   bool factoryDefault() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("&FZE0&W"));  // Factory + Reset + Echo Off + Write
     waitResponse();
     sendAT(GF("+IPR=0"));   // Auto-baud
@@ -213,7 +269,13 @@ TINY_GSM_MODEM_GET_INFO_ATI()
    * Power functions
    */
 
+TINY_GSM_MODEM_WAIT_FOR_READY()
+
   bool restart() {
+    TinyGsmTransaction transaction(at_lock);
+    identity.clear();
+    metrics.clear();
+    settings.clear();
     if (!testAT()) {
       return false;
     }
@@ -221,22 +283,26 @@ TINY_GSM_MODEM_GET_INFO_ATI()
     if (waitResponse(60000L, GF("POWERED DOWN")) != 1) {
       return false;
     }
-    delay(3000);
+    if (!waitForReady()) {
+      return false;
+    }
     return init();
   }
 
   bool poweroff() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+QPOWD=1"));
     waitResponse(300);  // returns OK first
     return waitResponse(300, GF("POWERED DOWN")) == 1;
   }
 
   bool radioOff() {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.clear();
     sendAT(GF("+CFUN=0"));
     if (waitResponse(10000L) != 1) {
       return false;
     }
-    delay(3000);
     return true;
   }
 
@@ -246,7 +312,8 @@ TINY_GSM_MODEM_GET_INFO_ATI()
 
 TINY_GSM_MODEM_SIM_UNLOCK_CPIN()
 
-  String getSimCCID() {
+  String modemGetSimCCID() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+QCCID"));
     if (waitResponse(GF(GSM_NL "+QCCID:")) != 1) {
       return "";
@@ -259,27 +326,14 @@ TINY_GSM_MODEM_SIM_UNLOCK_CPIN()
 
 TINY_GSM_MODEM_GET_IMEI_GSN()
 
-  SimStatus getSimStatus(unsigned long timeout_ms = 10000L) {
-    for (unsigned long start = millis(); millis() - start < timeout_ms; ) {
-      sendAT(GF("+CPIN?"));
-      if (waitResponse(GF(GSM_NL "+CPIN:")) != 1) {
-        delay(1000);
-        continue;
-      }
-      int status = waitResponse(GF("READY"), GF("SIM PIN"), GF("SIM PUK"), GF("NOT INSERTED"));
-      waitResponse();
-      switch (status) {
-        case 2:
-        case 3:  return SIM_LOCKED;
-        case 1:  return SIM_READY;
-        default: return SIM_ERROR;
-      }
-    }
-    return SIM_ERROR;
-  }
+TINY_GSM_MODEM_IDENTITY()
+
+TINY_GSM_MODEM_GET_SIM_STATUS_CPIN()
 
 TINY_GSM_MODEM_GET_REGISTRATION_XREG(CREG)
 
+TINY_GSM_MODEM_NETWORK_EVENTS(CREG)
+
 TINY_GSM_MODEM_GET_OPERATOR_COPS()
 
   /*
@@ -293,13 +347,15 @@ TINY_GSM_MODEM_GET_CSQ()
     return (s == REG_OK_HOME || s == REG_OK_ROAMING);
   }
 
-TINY_GSM_MODEM_WAIT_FOR_NETWORK()
+TINY_GSM_MODEM_WAIT_FOR_NETWORK_URC(CREG)
 
   /*
    * GPRS functions
    */
 
   bool gprsConnect(const char* apn, const char* user = NULL, const char* pwd = NULL) {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
     gprsDisconnect();
 
     //Configure the TCPIP Context
@@ -324,6 +380,8 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   bool gprsDisconnect() {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
     sendAT(GF("+QIDEACT=1"));  // Deactivate the bearer context
     if (waitResponse(40000L) != 1)
       return false;
@@ -338,6 +396,7 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
    */
 
   String getLocalIP() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+QILOCIP"));
     stream.readStringUntil('\n');
     String res = stream.readStringUntil('\n');
@@ -351,6 +410,8 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
     return TinyGsmIpFromString(getLocalIP());
   }
 
+TINY_GSM_MODEM_DNS_CACHE()
+
   /*
    * Phone Call functions
    */
@@ -358,6 +419,7 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
   bool setGsmBusy(bool busy = true) TINY_GSM_ATTR_NOT_AVAILABLE;
 
   bool callAnswer() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("A"));
     return waitResponse() == 1;
   }
@@ -366,6 +428,7 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
   bool callNumber(const String& number) TINY_GSM_ATTR_NOT_IMPLEMENTED;
 
   bool callHangup() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("H"));
     return waitResponse() == 1;
   }
@@ -388,11 +451,10 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
   String sendUSSD(const String& code) TINY_GSM_ATTR_NOT_IMPLEMENTED;
 
   bool sendSMS(const String& number, const String& text) {
-    sendAT(GF("+CMGF=1"));
-    waitResponse();
+    TinyGsmTransaction transaction(at_lock);
+    modemSet(settings.cmgf, 1, GF("+CMGF=1"));
     //Set GSM 7 bit default alphabet (3GPP TS 23.038)
-    sendAT(GF("+CSCS=\"GSM\""));
-    waitResponse();
+    modemSet(settings.cscs, TinyGsmSettings::CSCS_GSM, GF("+CSCS=\"GSM\""));
     sendAT(GF("+CMGS=\""), number, GF("\""));
     if (waitResponse(GF(">")) != 1) {
       return false;
@@ -404,12 +466,10 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
   }
 
   bool sendSMS_UTF16(const String& number, const void* text, size_t len) {
-    sendAT(GF("+CMGF=1"));
-    waitResponse();
-    sendAT(GF("+CSCS=\"HEX\""));
-    waitResponse();
-    sendAT(GF("+CSMP=17,167,0,8"));
-    waitResponse();
+    TinyGsmTransaction transaction(at_lock);
+    modemSet(settings.cmgf, 1, GF("+CMGF=1"));
+    modemSet(settings.cscs, TinyGsmSettings::CSCS_HEX, GF("+CSCS=\"HEX\""));
+    modemSet(settings.csmp, 8, GF("+CSMP=17,167,0,8"));
 
     sendAT(GF("+CMGS=\""), number, GF("\""));
     if (waitResponse(GF(">")) != 1) {
@@ -441,48 +501,9 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
    * Battery & temperature functions
    */
 
-  // Use: float vBatt = modem.getBattVoltage() / 1000.0;
-  uint16_t getBattVoltage() {
+  bool modemGetBattStats(uint8_t &chargeState, int8_t &percent, uint16_t &milliVolts) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CBC"));
-    if (waitResponse(GF(GSM_NL "+CBC:")) != 1) {
-      return 0;
-    }
-    streamSkipUntil(','); // Skip battery charge status
-    streamSkipUntil(','); // Skip battery charge level
-    // return voltage in mV
-    uint16_t res = stream.readStringUntil(',').toInt();
-    // Wait for final OK
-    waitResponse();
-    return res;
-  }
-
-  int8_t getBattPercent() {
-    sendAT(GF("+CBC"));
-    if (waitResponse(GF(GSM_NL "+CBC:")) != 1) {
-      return false;
-    }
-    streamSkipUntil(','); // Skip battery charge status
-    // Read battery charge level
-    int res = stream.readStringUntil(',').toInt();
-    // Wait for final OK
-    waitResponse();
-    return res;
-  }
-
-  uint8_t getBattChargeState() {
-    sendAT(GF("+CBC?"));
-    if (waitResponse(GF(GSM_NL "+CBC:")) != 1) {
-      return false;
-    }
-    // Read battery charge status
-    int res = stream.readStringUntil(',').toInt();
-    // Wait for final OK
-    waitResponse();
-    return res;
-  }
-
-  bool getBattStats(uint8_t &chargeState, int8_t &percent, uint16_t &milliVolts) {
-    sendAT(GF("+CBC?"));
     if (waitResponse(GF(GSM_NL "+CBC:")) != 1) {
       return false;
     }
@@ -494,6 +515,8 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
     return true;
   }
 
+TINY_GSM_MODEM_CACHED_BATT()
+
   float getTemperature() TINY_GSM_ATTR_NOT_AVAILABLE;
 
   /*
@@ -503,14 +526,27 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
 protected:
 
   bool modemConnect(const char* host, uint16_t port, uint8_t mux,
-                    bool ssl = false, int timeout_s = 20)
+                    bool ssl = false, int timeout_s = 20,
+                    bool udp = false, uint16_t localPort = 0)
  {
+    TinyGsmTransaction transaction(at_lock);
     int rsp;
     uint32_t timeout_ms = ((uint32_t)timeout_s)*1000;
 
     // <PDPcontextID>(1-16), <connectID>(0-11),"TCP/UDP/TCP LISTENER/UDP SERVICE",
     // "<IP_address>/<domain_name>",<remote_port>,<local_port>,<access_mode>(0-2 0=buffer)
-    sendAT(GF("+QIOPEN=1,"), mux, ',', GF("\"TCP"), GF("\",\""), host, GF("\","), port, GF(",0,0"));
+    char ipBuf[16];
+    const char* target = host;
+    if (udp) {
+      // A "UDP SERVICE" socket reads back a single datagram at a time; the
+      // peer is given with each +QISEND, and the local port is required
+      sendAT(GF("+QIOPEN=1,"), mux, GF(",\"UDP SERVICE\",\"127.0.0.1\",0,"),
+             localPort ? localPort : 49152 + mux, GF(",0"));
+    } else {
+      target = resolvedHost(host, ipBuf);
+      sendAT(GF("+QIOPEN=1,"), mux, GF(",\"TCP\",\""), target, GF("\","), port,
+             GF(",0,0"));
+    }
     rsp = waitResponse();
 
     if (waitResponse(timeout_ms, GF(GSM_NL "+QIOPEN:")) != 1) {
@@ -523,10 +559,42 @@ protected:
     // Read status
     rsp = stream.readStringUntil('\n').toInt();
 
+    if (rsp != 0 && target != host) {
+      dnsCache.remove(host);  // The address may have moved
+    }
     return (0 == rsp);
   }
 
+  String dnsIpQuery(const char* host) {
+    TinyGsmTransaction transaction(at_lock);
+    sendAT(GF("+QIDNSGIP=1,\""), host, GF("\""));
+    if (waitResponse() != 1) {
+      return "";
+    }
+    // +QIURC: "dnsgip",<err>,<IP_count>,<DNS_ttl>
+    if (waitResponse(60000L, GF(GSM_NL "+QIURC:")) != 1) {
+      return "";
+    }
+    streamSkipUntil(',');
+    int err = stream.readStringUntil(',').toInt();
+    streamSkipUntil('\n');
+    if (err != 0) {
+      return "";
+    }
+    // +QIURC: "dnsgip","<hostIPaddr>" for each address, the first is used
+    // and the rest are dropped by waitResponse later on
+    if (waitResponse(1000L, GF(GSM_NL "+QIURC:")) != 1) {
+      return "";
+    }
+    streamSkipUntil(',');
+    streamSkipUntil('"');
+    String res = stream.readStringUntil('"');
+    streamSkipUntil('\n');
+    return res;
+  }
+
   int16_t modemSend(const void* buff, size_t len, uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+QISEND="), mux, ',', len);
     if (waitResponse(GF(">")) != 1) {
       return 0;
@@ -540,7 +608,26 @@ protected:
     return len;
   }
 
+  // Sends one datagram from a "UDP SERVICE" socket
+  int16_t modemSendTo(const void* buff, size_t len, uint8_t mux,
+                      const char* host, uint16_t port) {
+    TinyGsmTransaction transaction(at_lock);
+    char ipBuf[16];
+    sendAT(GF("+QISEND="), mux, ',', len, GF(",\""), resolvedHost(host, ipBuf),
+           GF("\","), port);
+    if (waitResponse(GF(">")) != 1) {
+      return 0;
+    }
+    stream.write((uint8_t*)buff, len);
+    stream.flush();
+    if (waitResponse(GF(GSM_NL "SEND OK")) != 1) {
+      return 0;
+    }
+    return len;
+  }
+
   size_t modemRead(size_t size, uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+QIRD="), mux, ',', size);
     if (waitResponse(GF("+QIRD:")) != 1) {
       return 0;
@@ -557,6 +644,7 @@ protected:
   }
 
   size_t modemGetAvailable(uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+QIRD="), mux, GF(",0"));
     size_t result = 0;
     if (waitResponse(GF("+QIRD:")) == 1) {
@@ -567,12 +655,51 @@ protected:
       waitResponse();
     }
     if (!result) {
-      sockets[mux]->sock_connected = modemGetConnected(mux);
+      modemCheckConnected();
     }
     return result;
   }
 
+  // Hands over the next datagram of a "UDP SERVICE" socket: +QIRD without a
+  // length returns exactly one, with its sender.  What doesn't fit in the
+  // fifo is dropped, as a datagram can't be read in parts.
+  size_t modemReadDatagram(uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
+    GsmClient* sock = sockets[mux % MUX_COUNT];
+    if (!sock) {
+      return 0;
+    }
+    maintain();
+    if (!sock->sock_available || sock->rx.size()) {
+      return 0;
+    }
+    // +QIRD: <len>,"<remote IP>",<remote port>
+    sendAT(GF("+QIRD="), mux);
+    if (waitResponse(GF("+QIRD:")) != 1) {
+      return 0;
+    }
+    size_t len = stream.readStringUntil('\n').toInt();
+    size_t kept = 0;
+    for (size_t i = 0; i < len; i++) {
+      uint32_t startMillis = millis();
+      while (!stream.available() && millis() - startMillis < sock->_timeout) {
+        TINY_GSM_YIELD();
+      }
+      char c = stream.read();
+      if (sock->rx.put(c)) {
+        kept++;
+      }
+    }
+    waitResponse();
+    if (kept < len) {
+      DBG("### Datagram too long, dropped", len - kept, "bytes");
+    }
+    sock->sock_available = modemGetAvailable(mux);
+    return kept;
+  }
+
   bool modemGetConnected(uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+QISTATE=1,"), mux);
     //+QISTATE: 0,"TCP","151.139.237.11",80,5087,4,1,0,0,"uart1"
 
@@ -592,6 +719,37 @@ protected:
     return 2 == res;
   }
 
+  // +QISTATE? lists every open connection; the ones left out are closed
+  void modemGetConnectedAll() {
+    TinyGsmTransaction transaction(at_lock);
+    bool connected[MUX_COUNT] = { false };
+    sendAT(GF("+QISTATE?"));
+    int res;
+    while ((res = waitResponse(GFP(GSM_OK), GFP(GSM_ERROR), GF(GSM_NL "+QISTATE:"))) == 3) {
+      int mux = stream.readStringUntil(',').toInt();
+      streamSkipUntil(','); // Skip socket type
+      streamSkipUntil(','); // Skip remote ip
+      streamSkipUntil(','); // Skip remote port
+      streamSkipUntil(','); // Skip local port
+      int state = stream.readStringUntil(',').toInt();
+      streamSkipUntil('\n');
+      // 0 Initial, 1 Opening, 2 Connected, 3 Listening, 4 Closing
+      if (mux >= 0 && mux < MUX_COUNT) {
+        connected[mux] = (2 == state);
+      }
+    }
+    if (res != 1) {
+      return;
+    }
+    for (int mux = 0; mux < MUX_COUNT; mux++) {
+      if (sockets[mux]) {
+        sockets[mux]->sock_connected = connected[mux];
+      }
+    }
+  }
+
+TINY_GSM_MODEM_CHECK_CONNECTED_THROTTLED()
+
 public:
 
   /*
@@ -611,6 +769,7 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
     String r4s(r4); r4s.trim();
     String r5s(r5); r5s.trim();
     DBG("### ..:", r1s, ",", r2s, ",", r3s, ",", r4s, ",", r5s);*/
+    at_lock.begin();
     data.reserve(64);
     int index = 0;
     unsigned long startMillis = millis();
@@ -643,23 +802,35 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
           if (urc == "recv") {
             int mux = stream.readStringUntil('\n').toInt();
             DBG("### URC RECV:", mux);
-            if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
+            if (mux >= 0 && mux < MUX_COUNT && sockets[mux]) {
               sockets[mux]->got_data = true;
             }
           } else if (urc == "closed") {
             int mux = stream.readStringUntil('\n').toInt();
             DBG("### URC CLOSE:", mux);
-            if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
+            if (mux >= 0 && mux < MUX_COUNT && sockets[mux]) {
               sockets[mux]->sock_connected = false;
             }
+          } else if (urc == "pdpdeact") {
+            modemPdpDeactivatedUrc();
           } else {
             stream.readStringUntil('\n');
           }
           data = "";
+        } else if (data.endsWith(GF(GSM_NL "+CREG:"))) {
+          modemRegistrationUrc();
+          data = "";
+        } else if (data.endsWith(GF(GSM_NL "+CPIN:"))) {
+          modemSimUrc();
+          data = "";
+        } else if (data.endsWith(GF(GSM_NL "RDY" GSM_NL))) {
+          modemBootUrc();
+          data = "";
         }
       }
     } while (millis() - startMillis < timeout_ms);
 finish:
+    TINY_GSM_MODEM_END_TRANSACTION();
     if (!index) {
       data.trim();
       if (data.length()) {
@@ -690,7 +861,27 @@ public:
   Stream&       stream;
 
 protected:
-  GsmClient*    sockets[TINY_GSM_MUX_COUNT];
+  GsmClient*    sockets[MUX_COUNT];
+  TinyGsmModemEvents events;
+  TinyGsmIdentity    identity;
+  TinyGsmMetrics     metrics;
+  TinyGsmSettings    settings;
+  TinyGsmDnsCache<TINY_GSM_DNS_CACHE_SIZE> dnsCache;
+  TinyGsmTransactionLock at_lock;
+  uint32_t      prev_state_check;
 };
 
+// The first driver included also provides its registration states
+// unqualified, as when only one driver could be built
+#if !defined(TINY_GSM_REG_STATUS_DEFINED)
+#define TINY_GSM_REG_STATUS_DEFINED
+typedef TinyGsmBG96::RegStatus RegStatus;
+static const RegStatus REG_UNREGISTERED = TinyGsmBG96::REG_UNREGISTERED;
+static const RegStatus REG_SEARCHING    = TinyGsmBG96::REG_SEARCHING;
+static const RegStatus REG_DENIED       = TinyGsmBG96::REG_DENIED;
+static const RegStatus REG_OK_HOME      = TinyGsmBG96::REG_OK_HOME;
+static const RegStatus REG_OK_ROAMING   = TinyGsmBG96::REG_OK_ROAMING;
+static const RegStatus REG_UNKNOWN      = TinyGsmBG96::REG_UNKNOWN;
+#endif
+
 #endif
@@ -12,17 +12,14 @@
 
 //#define TINY_GSM_DEBUG Serial
 
-#if !defined(TINY_GSM_RX_BUFFER)
-  #define TINY_GSM_RX_BUFFER 512
-#endif
-
-#define TINY_GSM_MUX_COUNT 5
-
 #include <TinyGsmCommon.h>
 
+#undef GSM_NL
+#undef GSM_OK
+#undef GSM_ERROR
 #define GSM_NL "\r\n"
-static const char GSM_OK[] TINY_GSM_PROGMEM = "OK" GSM_NL;
-static const char GSM_ERROR[] TINY_GSM_PROGMEM = "ERROR" GSM_NL;
+#define GSM_OK GSM_CRLF_OK
+#define GSM_ERROR GSM_CRLF_ERROR
 static unsigned TINY_GSM_TCP_KEEP_ALIVE = 120;
 
 // <stat> status of ESP8266 station interface
@@ -30,6 +27,15 @@ static unsigned TINY_GSM_TCP_KEEP_ALIVE = 120;
 // 3 : ESP8266 station created a TCP or UDP transmission
 // 4 : the TCP or UDP transmission of ESP8266 station disconnected
 // 5 : ESP8266 station did NOT connect to an AP
+
+
+class TinyGsmESP8266
+{
+
+public:
+
+enum { MUX_COUNT = 5 };
+
 enum RegStatus {
   REG_OK_IP        = 2,
   REG_OK_TCP       = 3,
@@ -38,17 +44,14 @@ enum RegStatus {
   REG_UNKNOWN      = 6,
 };
 
-
-
-class TinyGsmESP8266
-{
-
-public:
+class GsmUdp;
 
 class GsmClient : public Client
 {
   friend class TinyGsmESP8266;
-  typedef TinyGsmFifo<uint8_t, TINY_GSM_RX_BUFFER> RxFifo;
+  friend class GsmUdp;
+  typedef TinyGsmLockedFifo<uint8_t, TINY_GSM_RX_BUFFER_OR(512)> RxFifo;
+  typedef TinyGsmLockedFifo<uint16_t, TINY_GSM_UDP_PACKETS+1> PacketFifo;
 
 public:
   GsmClient() {}
@@ -61,8 +64,9 @@ public:
     this->at = modem;
     this->mux = mux;
     sock_connected = false;
+    sock_udp = false;
 
-    at->sockets[mux] = this;
+    at->modemSetSocket(mux, this);
 
     return true;
   }
@@ -72,6 +76,7 @@ public:
     stop();
     TINY_GSM_YIELD();
     rx.clear();
+    sock_udp = false;
     sock_connected = at->modemConnect(host, port, mux, false, timeout_s);
     return sock_connected;
   }
@@ -84,6 +89,7 @@ TINY_GSM_CLIENT_CONNECT_OVERLOADS()
     sock_connected = false;
     at->waitResponse(5000L);
     rx.clear();
+    packets.clear();
   }
 
 TINY_GSM_CLIENT_WRITE()
@@ -94,6 +100,8 @@ TINY_GSM_CLIENT_READ_NO_MODEM_FIFO()
 
 TINY_GSM_CLIENT_PEEK_FLUSH_CONNECTED()
 
+TINY_GSM_CLIENT_EVENTS()
+
   /*
    * Extended API
    */
@@ -104,7 +112,10 @@ private:
   TinyGsmESP8266* at;
   uint8_t         mux;
   bool            sock_connected;
+  bool            sock_udp;
   RxFifo          rx;
+  TinyGsmClientEvents events;
+  PacketFifo      packets;  // lengths of the datagrams in rx, UDP only
 };
 
 
@@ -122,12 +133,62 @@ public:
     stop();
     TINY_GSM_YIELD();
     rx.clear();
+    sock_udp = false;
     sock_connected = at->modemConnect(host, port, mux, true, timeout_s);
     return sock_connected;
   }
 };
 
 
+class GsmUdp : public UDP
+{
+  friend class TinyGsmESP8266;
+
+public:
+  GsmUdp() {}
+
+  GsmUdp(TinyGsmESP8266& modem, uint8_t mux = 1) {
+    init(&modem, mux);
+  }
+
+  bool init(TinyGsmESP8266* modem, uint8_t mux = 1) {
+    this->at = modem;
+    peer_port = 0;
+    local_port = 0;
+    tx_len = 0;
+    tx_overflow = false;
+    rx_left = 0;
+    return sock.init(modem, mux);
+  }
+
+TINY_GSM_UDP_PACKET_FUNCTIONS()
+
+private:
+  bool connectPeer(const char *host, uint16_t port) {
+    sock.rx.clear();
+    sock.packets.clear();
+    sock.sock_udp = true;
+    sock.sock_connected = at->modemConnect(host, port, sock.mux, false, 75,
+                                           true, local_port);
+    return sock.sock_connected;
+  }
+
+  int16_t sendDatagram(const uint8_t* buf, size_t len) {
+    return at->modemSend(buf, len, sock.mux);
+  }
+
+  TinyGsmESP8266* at;
+  GsmClient       sock;
+  String          peer_host;
+  uint16_t        peer_port;
+  uint16_t        local_port;
+  uint16_t        tx_len;
+  bool            tx_overflow;
+  uint16_t        rx_left;
+  uint8_t         tx[TINY_GSM_UDP_TX_BUFFER];
+};
+
+
 public:
 
   TinyGsmESP8266(Stream& stream)
@@ -145,10 +206,12 @@ public:
   }
 
   bool init(const char* pin = NULL) {
+    TinyGsmTransaction transaction(at_lock);
     DBG(GF("### TinyGSM Version:"), TINYGSM_VERSION);
     if (!testAT()) {
       return false;
     }
+    settings.clear();
     sendAT(GF("E0"));   // Echo Off
     if (waitResponse() != 1) {
       return false;
@@ -170,6 +233,7 @@ public:
   }
 
   void setBaud(unsigned long baud) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+UART_CUR="), baud, "8,1,0,0");
   }
 
@@ -177,12 +241,18 @@ TINY_GSM_MODEM_TEST_AT()
 
 TINY_GSM_MODEM_MAINTAIN_LISTEN()
 
+TINY_GSM_MODEM_POLL_SOCKS_NO_MODEM_FIFO()
+
+TINY_GSM_MODEM_EVENTS_NO_MODEM_FIFO()
+
   bool factoryDefault() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+RESTORE"));
     return waitResponse() == 1;
   }
 
   String getModemInfo() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+GMR"));
     String res;
     if (waitResponse(1000L, res) != 1) {
@@ -211,6 +281,9 @@ TINY_GSM_MODEM_MAINTAIN_LISTEN()
    */
 
   bool restart() {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.clear();
+    settings.clear();
     if (!testAT()) {
       return false;
     }
@@ -226,6 +299,7 @@ TINY_GSM_MODEM_MAINTAIN_LISTEN()
   }
 
   bool poweroff() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+GSLP=0"));  // Power down indefinitely - until manually reset!
     return waitResponse() == 1;
   }
@@ -239,6 +313,7 @@ TINY_GSM_MODEM_MAINTAIN_LISTEN()
    */
 
   RegStatus getRegistrationStatus() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CIPSTATUS"));
     if (waitResponse(3000, GF("STATUS:")) != 1) return REG_UNKNOWN;
     int status = waitResponse(GFP(GSM_ERROR), GF("2"), GF("3"), GF("4"), GF("5"));
@@ -250,7 +325,8 @@ TINY_GSM_MODEM_MAINTAIN_LISTEN()
    * Generic network functions
    */
 
-  int16_t getSignalQuality() {
+  int16_t modemGetSignalQuality() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CWJAP_CUR?"));
     int res1 = waitResponse(GF("No AP"), GF("+CWJAP_CUR:"));
     if (res1 != 2) {
@@ -265,12 +341,15 @@ TINY_GSM_MODEM_MAINTAIN_LISTEN()
     return res2;
   }
 
+TINY_GSM_MODEM_CACHED_CSQ(0)
+
   bool isNetworkConnected()  {
     RegStatus s = getRegistrationStatus();
     return (s == REG_OK_IP || s == REG_OK_TCP);
   }
 
   bool waitForNetwork(unsigned long timeout_ms = 60000L) {
+    TinyGsmTransaction transaction(at_lock);
     for (unsigned long start = millis(); millis() - start < timeout_ms; ) {
       sendAT(GF("+CIPSTATUS"));
       int res1 = waitResponse(3000, GF("busy p..."), GF("STATUS:"));
@@ -291,6 +370,7 @@ TINY_GSM_MODEM_MAINTAIN_LISTEN()
    */
 
   bool networkConnect(const char* ssid, const char* pwd) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CWJAP_CUR=\""), ssid, GF("\",\""), pwd, GF("\""));
     if (waitResponse(30000L, GFP(GSM_OK), GF(GSM_NL "FAIL" GSM_NL)) != 1) {
       return false;
@@ -300,6 +380,7 @@ TINY_GSM_MODEM_MAINTAIN_LISTEN()
   }
 
   bool networkDisconnect() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CWQAP"));
     bool retVal = waitResponse(10000L) == 1;
     waitResponse(GF("WIFI DISCONNECT"));
@@ -311,6 +392,7 @@ TINY_GSM_MODEM_MAINTAIN_LISTEN()
    */
 
   String getLocalIP() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CIPSTA_CUR??"));
     int res1 = waitResponse(GF("ERROR"), GF("+CWJAP_CUR:"));
     if (res1 != 2) {
@@ -325,6 +407,8 @@ TINY_GSM_MODEM_MAINTAIN_LISTEN()
     return TinyGsmIpFromString(getLocalIP());
   }
 
+TINY_GSM_MODEM_DNS_CACHE()
+
   /*
    * Battery & temperature functions
    */
@@ -343,25 +427,57 @@ TINY_GSM_MODEM_MAINTAIN_LISTEN()
 protected:
 
   bool modemConnect(const char* host, uint16_t port, uint8_t mux,
-                    bool ssl = false, int timeout_s = 75)
+                    bool ssl = false, int timeout_s = 75,
+                    bool udp = false, uint16_t localPort = 0)
  {
+    TinyGsmTransaction transaction(at_lock);
     uint32_t timeout_ms = ((uint32_t)timeout_s)*1000;
     if (ssl) {
-      sendAT(GF("+CIPSSLSIZE=4096"));
-      waitResponse();
+      modemSet(settings.ssl_size, 1, GF("+CIPSSLSIZE=4096"));
+    }
+    // Secure connections keep the host name for the certificate check
+    char ipBuf[16];
+    const char* target = ssl ? host : resolvedHost(host, ipBuf);
+    if (udp && localPort) {
+      // The last parameter fixes the remote end to the given host and port
+      sendAT(GF("+CIPSTART="), mux, GF(",\"UDP\",\""), target, GF("\","), port,
+             ',', localPort, GF(",0"));
+    } else if (udp) {
+      sendAT(GF("+CIPSTART="), mux, GF(",\"UDP\",\""), target, GF("\","), port);
+    } else {
+      sendAT(GF("+CIPSTART="), mux, ',', ssl ? GF("\"SSL") : GF("\"TCP"),
+             GF("\",\""), target, GF("\","), port, GF(","), TINY_GSM_TCP_KEEP_ALIVE);
     }
-    sendAT(GF("+CIPSTART="), mux, ',', ssl ? GF("\"SSL") : GF("\"TCP"),
-           GF("\",\""), host, GF("\","), port, GF(","), TINY_GSM_TCP_KEEP_ALIVE);
     // TODO: Check mux
     int rsp = waitResponse(timeout_ms,
                            GFP(GSM_OK),
                            GFP(GSM_ERROR),
                            GF("ALREADY CONNECT"));
     // if (rsp == 3) waitResponse();  // May return "ERROR" after the "ALREADY CONNECT"
+    if (rsp != 1 && target != host) {
+      dnsCache.remove(host);  // The address may have moved
+    }
     return (1 == rsp);
   }
 
+  String dnsIpQuery(const char* host) {
+    TinyGsmTransaction transaction(at_lock);
+    sendAT(GF("+CIPDOMAIN=\""), host, GF("\""));
+    int rsp = waitResponse(10000L, GF("+CIPDOMAIN:"), GF("DNS Fail"), GFP(GSM_ERROR));
+    if (rsp == 2) {
+      waitResponse();  // "DNS Fail" is followed by ERROR
+    }
+    if (rsp != 1) {
+      return "";
+    }
+    String res = stream.readStringUntil('\n');
+    res.trim();
+    waitResponse();
+    return res;
+  }
+
   int16_t modemSend(const void* buff, size_t len, uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CIPSEND="), mux, ',', len);
     if (waitResponse(GF(">")) != 1) {
       return 0;
@@ -374,6 +490,20 @@ protected:
     return len;
   }
 
+  size_t modemReadDatagram(uint8_t mux) {
+    GsmClient* sock = sockets[mux];
+    if (!sock) {
+      return 0;
+    }
+    // Datagrams are pushed to us with +IPD, which maintain() picks up
+    if (!sock->packets.readable()) {
+      maintain();
+    }
+    uint16_t len = 0;
+    sock->packets.get(&len);
+    return len;
+  }
+
   bool modemGetConnected(uint8_t mux) {
     RegStatus s = getRegistrationStatus();
     return (s == REG_OK_IP || s == REG_OK_TCP);
@@ -398,6 +528,7 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
     String r4s(r4); r4s.trim();
     String r5s(r5); r5s.trim();
     DBG("### ..:", r1s, ",", r2s, ",", r3s, ",", r4s, ",", r5s);*/
+    at_lock.begin();
     data.reserve(64);
     int index = 0;
     unsigned long startMillis = millis();
@@ -427,6 +558,18 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
           int mux = stream.readStringUntil(',').toInt();
           int len = stream.readStringUntil(':').toInt();
           int len_orig = len;
+          if (sockets[mux]->sock_udp && (len > sockets[mux]->rx.free() ||
+                                         !sockets[mux]->packets.writeable())) {
+            // A datagram is delivered whole or not at all
+            DBG("### Datagram dropped: ", len, "on", mux);
+            while (len--) {
+              uint32_t startMillis = millis();
+              while (!stream.available() && (millis() - startMillis < sockets[mux]->_timeout)) { TINY_GSM_YIELD(); }
+              stream.read();
+            }
+            data = "";
+            continue;
+          }
           if (len > sockets[mux]->rx.free()) {
             DBG("### Buffer overflow: ", len, "received vs", sockets[mux]->rx.free(), "available");
           } else {
@@ -435,7 +578,9 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
           while (len--) {
             TINY_GSM_MODEM_STREAM_TO_MUX_FIFO_WITH_DOUBLE_TIMEOUT
           }
-          if (len_orig > sockets[mux]->available()) { // TODO
+          if (sockets[mux]->sock_udp) {
+            sockets[mux]->packets.put(len_orig);
+          } else if (len_orig > sockets[mux]->available()) { // TODO
             DBG("### Fewer characters received than expected: ", sockets[mux]->available(), " vs ", len_orig);
           }
           data = "";
@@ -443,7 +588,7 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
           int muxStart = max(0,data.lastIndexOf(GSM_NL, data.length()-8));
           int coma = data.indexOf(',', muxStart);
           int mux = data.substring(muxStart, coma).toInt();
-          if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
+          if (mux >= 0 && mux < MUX_COUNT && sockets[mux]) {
             sockets[mux]->sock_connected = false;
           }
           data = "";
@@ -452,6 +597,7 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
       }
     } while (millis() - startMillis < timeout_ms);
 finish:
+    TINY_GSM_MODEM_END_TRANSACTION();
     if (!index) {
       data.trim();
       if (data.length()) {
@@ -482,7 +628,24 @@ public:
   Stream&       stream;
 
 protected:
-  GsmClient*    sockets[TINY_GSM_MUX_COUNT];
+  GsmClient*    sockets[MUX_COUNT];
+  TinyGsmModemEvents events;
+  TinyGsmSettings    settings;
+  TinyGsmMetrics     metrics;
+  TinyGsmDnsCache<TINY_GSM_DNS_CACHE_SIZE> dnsCache;
+  TinyGsmTransactionLock at_lock;
 };
 
+// The first driver included also provides its registration states
+// unqualified, as when only one driver could be built
+#if !defined(TINY_GSM_REG_STATUS_DEFINED)
+#define TINY_GSM_REG_STATUS_DEFINED
+typedef TinyGsmESP8266::RegStatus RegStatus;
+static const RegStatus REG_OK_IP        = TinyGsmESP8266::REG_OK_IP;
+static const RegStatus REG_OK_TCP       = TinyGsmESP8266::REG_OK_TCP;
+static const RegStatus REG_UNREGISTERED = TinyGsmESP8266::REG_UNREGISTERED;
+static const RegStatus REG_DENIED       = TinyGsmESP8266::REG_DENIED;
+static const RegStatus REG_UNKNOWN      = TinyGsmESP8266::REG_UNKNOWN;
+#endif
+
 #endif
@@ -12,23 +12,22 @@
 
 //#define TINY_GSM_DEBUG Serial
 
-#if !defined(TINY_GSM_RX_BUFFER)
-  #define TINY_GSM_RX_BUFFER 256
-#endif
-
-#define TINY_GSM_MUX_COUNT 2
-
 #include <TinyGsmCommon.h>
 
+#undef GSM_NL
+#undef GSM_OK
+#undef GSM_ERROR
 #define GSM_NL "\r\n"
-static const char GSM_OK[] TINY_GSM_PROGMEM = "OK" GSM_NL;
-static const char GSM_ERROR[] TINY_GSM_PROGMEM = "ERROR" GSM_NL;
+#define GSM_OK GSM_CRLF_OK
+#define GSM_ERROR GSM_CRLF_ERROR
 
-enum SimStatus {
-  SIM_ERROR = 0,
-  SIM_READY = 1,
-  SIM_LOCKED = 2,
-};
+
+class TinyGsmM590
+{
+
+public:
+
+enum { MUX_COUNT = 2 };
 
 enum RegStatus {
   REG_UNREGISTERED = 0,
@@ -39,16 +38,10 @@ enum RegStatus {
   REG_UNKNOWN      = 4,
 };
 
-
-class TinyGsmM590
-{
-
-public:
-
 class GsmClient : public Client
 {
   friend class TinyGsmM590;
-  typedef TinyGsmFifo<uint8_t, TINY_GSM_RX_BUFFER> RxFifo;
+  typedef TinyGsmLockedFifo<uint8_t, TINY_GSM_RX_BUFFER_OR(256)> RxFifo;
 
 public:
   GsmClient() {}
@@ -62,7 +55,7 @@ public:
     this->mux = mux;
     sock_connected = false;
 
-    at->sockets[mux] = this;
+    at->modemSetSocket(mux, this);
 
     return true;
   }
@@ -95,6 +88,8 @@ TINY_GSM_CLIENT_READ_NO_MODEM_FIFO()
 
 TINY_GSM_CLIENT_PEEK_FLUSH_CONNECTED()
 
+TINY_GSM_CLIENT_EVENTS()
+
   /*
    * Extended API
    */
@@ -106,6 +101,7 @@ private:
   uint8_t         mux;
   bool            sock_connected;
   RxFifo          rx;
+  TinyGsmClientEvents events;
 };
 
 
@@ -126,10 +122,12 @@ public:
   }
 
   bool init(const char* pin = NULL) {
+    TinyGsmTransaction transaction(at_lock);
     DBG(GF("### TinyGSM Version:"), TINYGSM_VERSION);
     if (!testAT()) {
       return false;
     }
+    settings.clear();
     sendAT(GF("&FZE0"));  // Factory + Reset + Echo Off
     if (waitResponse() != 1) {
       return false;
@@ -143,7 +141,7 @@ public:
     return true;
   }
 
-  String getModemName() {
+  String modemGetName() {
     return "Neoway M590";
   }
 
@@ -153,7 +151,12 @@ TINY_GSM_MODEM_TEST_AT()
 
 TINY_GSM_MODEM_MAINTAIN_LISTEN()
 
+TINY_GSM_MODEM_POLL_SOCKS_NO_MODEM_FIFO()
+
+TINY_GSM_MODEM_EVENTS_NO_MODEM_FIFO()
+
   bool factoryDefault() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("&FZE0&W"));  // Factory + Reset + Echo Off + Write
     waitResponse();
     sendAT(GF("+ICF=3,1")); // 8 data 0 parity 1 stop
@@ -185,6 +188,10 @@ TINY_GSM_MODEM_GET_INFO_ATI()
    */
 
   bool restart() {
+    TinyGsmTransaction transaction(at_lock);
+    identity.clear();
+    metrics.clear();
+    settings.clear();
     if (!testAT()) {
       return false;
     }
@@ -198,6 +205,7 @@ TINY_GSM_MODEM_GET_INFO_ATI()
   }
 
   bool poweroff() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CPWROFF"));
     return waitResponse(3000L) == 1;
   }
@@ -205,6 +213,7 @@ TINY_GSM_MODEM_GET_INFO_ATI()
   bool radioOff() TINY_GSM_ATTR_NOT_IMPLEMENTED;
 
   bool sleepEnable(bool enable = true) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+ENPWRSAVE="), enable);
     return waitResponse() == 1;
   }
@@ -219,7 +228,10 @@ TINY_GSM_MODEM_GET_SIMCCID_CCID()
 
 TINY_GSM_MODEM_GET_IMEI_GSN()
 
+TINY_GSM_MODEM_IDENTITY()
+
   SimStatus getSimStatus(unsigned long timeout_ms = 10000L) {
+    TinyGsmTransaction transaction(at_lock);
     for (unsigned long start = millis(); millis() - start < timeout_ms; ) {
       sendAT(GF("+CPIN?"));
       if (waitResponse(GF(GSM_NL "+CPIN:")) != 1) {
@@ -260,6 +272,8 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
    */
 
   bool gprsConnect(const char* apn, const char* user = NULL, const char* pwd = NULL) {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
     gprsDisconnect();
 
     sendAT(GF("+XISP=0"));
@@ -278,7 +292,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
 
     const unsigned long timeout_ms = 60000L;
     for (unsigned long start = millis(); millis() - start < timeout_ms; ) {
-      if (isGprsConnected()) {
+      if (modemIsGprsConnected()) {
         //goto set_dns; // TODO
         return true;
       }
@@ -297,12 +311,14 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   bool gprsDisconnect() {
+    metrics.expire(TinyGsmMetrics::GPRS);
     // TODO: There is no command in AT command set
     // XIIC=0 does not work
     return true;
   }
 
-  bool isGprsConnected() {
+  bool modemIsGprsConnected() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+XIIC?"));
     if (waitResponse(GF(GSM_NL "+XIIC:")) != 1) {
       return false;
@@ -312,11 +328,14 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     return res == 1;
   }
 
+TINY_GSM_MODEM_CACHED_GPRS()
+
   /*
    * IP Address functions
    */
 
   String getLocalIP() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+XIIC?"));
     if (waitResponse(GF(GSM_NL "+XIIC:")) != 1) {
       return "";
@@ -332,6 +351,8 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     return TinyGsmIpFromString(getLocalIP());
   }
 
+TINY_GSM_MODEM_DNS_CACHE()
+
   /*
    * Phone Call functions
    */
@@ -349,10 +370,9 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
    */
 
   String sendUSSD(const String& code) {
-    sendAT(GF("+CMGF=1"));
-    waitResponse();
-    sendAT(GF("+CSCS=\"HEX\""));
-    waitResponse();
+    TinyGsmTransaction transaction(at_lock);
+    modemSet(settings.cmgf, 1, GF("+CMGF=1"));
+    modemSet(settings.cscs, TinyGsmSettings::CSCS_HEX, GF("+CSCS=\"HEX\""));
     sendAT(GF("D"), code);
     if (waitResponse(10000L, GF(GSM_NL "+CUSD:")) != 1) {
       return "";
@@ -376,10 +396,9 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   bool sendSMS(const String& number, const String& text) {
-    sendAT(GF("+CSCS=\"GSM\""));
-    waitResponse();
-    sendAT(GF("+CMGF=1"));
-    waitResponse();
+    TinyGsmTransaction transaction(at_lock);
+    modemSet(settings.cscs, TinyGsmSettings::CSCS_GSM, GF("+CSCS=\"GSM\""));
+    modemSet(settings.cmgf, 1, GF("+CMGF=1"));
     sendAT(GF("+CMGS=\""), number, GF("\""));
     if (waitResponse(GF(">")) != 1) {
       return false;
@@ -416,9 +435,12 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
 protected:
 
   bool modemConnect(const char* host, uint16_t port, uint8_t mux, int timeout_s = 75) {
+    TinyGsmTransaction transaction(at_lock);
     uint32_t timeout_ms = ((uint32_t)timeout_s)*1000;
     for (int i=0; i<3; i++) { // TODO: no need for loop?
-      String ip = dnsIpQuery(host);
+      // The modem only connects by IP; retries look the host up afresh
+      char ipBuf[16];
+      const char* ip = resolvedHost(host, ipBuf);
 
       sendAT(GF("+TCPSETUP="), mux, GF(","), ip, GF(","), port);
       int rsp = waitResponse(timeout_ms,
@@ -427,7 +449,9 @@ protected:
                             GF("+TCPSETUP:Error" GSM_NL));
       if (1 == rsp) {
         return true;
-      } else if (3 == rsp) {
+      }
+      dnsCache.remove(host);
+      if (3 == rsp) {
         sendAT(GF("+TCPCLOSE="), mux);
         waitResponse();
       }
@@ -437,6 +461,7 @@ protected:
   }
 
   int16_t modemSend(const void* buff, size_t len, uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+TCPSEND="), mux, ',', len);
     if (waitResponse(GF(">")) != 1) {
       return 0;
@@ -452,6 +477,7 @@ protected:
   }
 
   bool modemGetConnected(uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CIPSTATUS="), mux);
     int res = waitResponse(GF(",\"CONNECTED\""), GF(",\"CLOSED\""), GF(",\"CLOSING\""), GF(",\"INITIAL\""));
     waitResponse();
@@ -459,6 +485,7 @@ protected:
   }
 
   String dnsIpQuery(const char* host) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+DNS=\""), host, GF("\""));
     if (waitResponse(10000L, GF(GSM_NL "+DNS:")) != 1) {
       return "";
@@ -488,6 +515,7 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
     String r4s(r4); r4s.trim();
     String r5s(r5); r5s.trim();
     DBG("### ..:", r1s, ",", r2s, ",", r3s, ",", r4s, ",", r5s);*/
+    at_lock.begin();
     data.reserve(64);
     int index = 0;
     unsigned long startMillis = millis();
@@ -532,7 +560,7 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
         } else if (data.endsWith(GF("+TCPCLOSE:"))) {
           int mux = stream.readStringUntil(',').toInt();
           stream.readStringUntil('\n');
-          if (mux >= 0 && mux < TINY_GSM_MUX_COUNT) {
+          if (mux >= 0 && mux < MUX_COUNT) {
             sockets[mux]->sock_connected = false;
           }
           data = "";
@@ -541,6 +569,7 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
       }
     } while (millis() - startMillis < timeout_ms);
 finish:
+    TINY_GSM_MODEM_END_TRANSACTION();
     if (!index) {
       data.trim();
       if (data.length()) {
@@ -571,7 +600,26 @@ public:
   Stream&       stream;
 
 protected:
-  GsmClient*    sockets[TINY_GSM_MUX_COUNT];
+  GsmClient*    sockets[MUX_COUNT];
+  TinyGsmModemEvents events;
+  TinyGsmIdentity    identity;
+  TinyGsmMetrics     metrics;
+  TinyGsmSettings    settings;
+  TinyGsmDnsCache<TINY_GSM_DNS_CACHE_SIZE> dnsCache;
+  TinyGsmTransactionLock at_lock;
 };
 
+// The first driver included also provides its registration states
+// unqualified, as when only one driver could be built
+#if !defined(TINY_GSM_REG_STATUS_DEFINED)
+#define TINY_GSM_REG_STATUS_DEFINED
+typedef TinyGsmM590::RegStatus RegStatus;
+static const RegStatus REG_UNREGISTERED = TinyGsmM590::REG_UNREGISTERED;
+static const RegStatus REG_SEARCHING    = TinyGsmM590::REG_SEARCHING;
+static const RegStatus REG_DENIED       = TinyGsmM590::REG_DENIED;
+static const RegStatus REG_OK_HOME      = TinyGsmM590::REG_OK_HOME;
+static const RegStatus REG_OK_ROAMING   = TinyGsmM590::REG_OK_ROAMING;
+static const RegStatus REG_UNKNOWN      = TinyGsmM590::REG_UNKNOWN;
+#endif
+
 #endif
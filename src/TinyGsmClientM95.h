@@ -13,23 +13,26 @@
 //#define TINY_GSM_DEBUG Serial
 //#define TINY_GSM_USE_HEX
 
-#if !defined(TINY_GSM_RX_BUFFER)
-  #define TINY_GSM_RX_BUFFER 64
+#if !defined(TINY_GSM_ACK_CHECK_MS)
+  #define TINY_GSM_ACK_CHECK_MS 1000
 #endif
 
-#define TINY_GSM_MUX_COUNT 6
-
 #include <TinyGsmCommon.h>
 
+#undef GSM_NL
+#undef GSM_OK
+#undef GSM_ERROR
 #define GSM_NL "\r\n"
-static const char GSM_OK[] TINY_GSM_PROGMEM = "OK" GSM_NL;
-static const char GSM_ERROR[] TINY_GSM_PROGMEM = "ERROR" GSM_NL;
+#define GSM_OK GSM_CRLF_OK
+#define GSM_ERROR GSM_CRLF_ERROR
 
-enum SimStatus {
-  SIM_ERROR = 0,
-  SIM_READY = 1,
-  SIM_LOCKED = 2,
-};
+
+class TinyGsmM95
+{
+
+public:
+
+enum { MUX_COUNT = 6 };
 
 enum RegStatus {
   REG_UNREGISTERED = 0,
@@ -40,16 +43,10 @@ enum RegStatus {
   REG_UNKNOWN      = 4,
 };
 
-
-class TinyGsmM95
-{
-
-public:
-
 class GsmClient : public Client
 {
   friend class TinyGsmM95;
-  typedef TinyGsmFifo<uint8_t, TINY_GSM_RX_BUFFER> RxFifo;
+  typedef TinyGsmLockedFifo<uint8_t, TINY_GSM_RX_BUFFER_OR(64)> RxFifo;
 
 public:
   GsmClient() {}
@@ -62,10 +59,12 @@ public:
     this->at = modem;
     this->mux = mux;
     sock_available = 0;
+    sock_unacked = 0;
+    prev_ack_check = 0;
     sock_connected = false;
     got_data = false;
 
-    at->sockets[mux] = this;
+    at->modemSetSocket(mux, this);
 
     return true;
   }
@@ -75,6 +74,7 @@ public:
     stop();
     TINY_GSM_YIELD();
     rx.clear();
+    sock_unacked = 0;
     sock_connected = at->modemConnect(host, port, mux, false, timeout_s);
     return sock_connected;
   }
@@ -97,6 +97,7 @@ TINY_GSM_CLIENT_CONNECT_OVERLOADS()
     }
     at->sendAT(GF("+QICLOSE="), mux);
     sock_connected = false;
+    sock_unacked = 0;
     at->waitResponse(60000L, GF("CLOSED"), GF("CLOSE OK"), GF("ERROR"));
   }
 
@@ -108,19 +109,44 @@ TINY_GSM_CLIENT_READ_NO_BUFFER_CHECK()
 
 TINY_GSM_CLIENT_PEEK_FLUSH_CONNECTED()
 
+TINY_GSM_CLIENT_EVENTS()
+
   /*
    * Extended API
    */
 
   String remoteIP() TINY_GSM_ATTR_NOT_IMPLEMENTED;
 
+  // Number of bytes handed to the modem that the peer has not yet
+  // acknowledged.  Asks the modem again if anything is still outstanding.
+  uint16_t unackedBytes() {
+    if (sock_unacked) {
+      sock_unacked = at->modemGetUnacked(mux);
+    }
+    return sock_unacked;
+  }
+
+  // Blocks until the peer has acknowledged everything written so far
+  bool waitAcked(uint32_t timeout_ms = 60000L) {
+    for (uint32_t start = millis(); millis() - start < timeout_ms; ) {
+      if (!unackedBytes()) {
+        return true;
+      }
+      at->waitResponse(TinyGsmMin(timeout_ms, (uint32_t)TINY_GSM_ACK_CHECK_MS), NULL, NULL);
+    }
+    return false;
+  }
+
 private:
   TinyGsmM95*     at;
   uint8_t         mux;
   uint16_t        sock_available;
+  uint16_t        sock_unacked;
+  uint32_t        prev_ack_check;
   bool            sock_connected;
   bool            got_data;
   RxFifo          rx;
+  TinyGsmClientEvents events;
 };
 
 
@@ -161,10 +187,12 @@ public:
   }
 
   bool init(const char* pin = NULL) {
+    TinyGsmTransaction transaction(at_lock);
     DBG(GF("### TinyGSM Version:"), TINYGSM_VERSION);
     if (!testAT()) {
       return false;
     }
+    settings.clear();
     sendAT(GF("&FZE0"));  // Factory + Reset + Echo Off
     if (waitResponse() != 1) {
       return false;
@@ -178,7 +206,7 @@ public:
     return true;
   }
 
-  String getModemName() {
+  String modemGetName() {
     return "Quectel M95";
   }
 
@@ -186,9 +214,27 @@ TINY_GSM_MODEM_SET_BAUD_IPR()
 
 TINY_GSM_MODEM_TEST_AT()
 
-TINY_GSM_MODEM_MAINTAIN_LISTEN()
+  // Listens for URC's, and periodically refreshes the count of sent but
+  // unacknowledged bytes for any socket that still has some outstanding
+  void maintain() {
+    TinyGsmTransaction transaction(at_lock);
+    for (int mux = 0; mux < MUX_COUNT; mux++) {
+      GsmClient* sock = sockets[mux];
+      if (sock && sock->sock_unacked &&
+          millis() - sock->prev_ack_check > TINY_GSM_ACK_CHECK_MS) {
+        sock->sock_unacked = modemGetUnacked(mux);
+      }
+    }
+    waitResponse(100, NULL, NULL);
+    modemDispatchEvents();
+  }
+
+TINY_GSM_MODEM_POLL_SOCKS()
+
+TINY_GSM_MODEM_EVENTS()
 
   bool factoryDefault() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("&FZE0&W"));  // Factory + Reset + Echo Off + Write
     waitResponse();
     sendAT(GF("+IPR=0"));   // Auto-baud
@@ -215,7 +261,13 @@ TINY_GSM_MODEM_GET_INFO_ATI()
    * Power functions
    */
 
+TINY_GSM_MODEM_WAIT_FOR_READY()
+
   bool restart() {
+    TinyGsmTransaction transaction(at_lock);
+    identity.clear();
+    metrics.clear();
+    settings.clear();
     if (!testAT()) {
       return false;
     }
@@ -231,16 +283,18 @@ TINY_GSM_MODEM_GET_INFO_ATI()
   }
 
   bool poweroff() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+QPOWD=1"));
     return waitResponse(300, GF("NORMAL POWER DOWN")) == 1;
   }
 
   bool radioOff() {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.clear();
     sendAT(GF("+CFUN=0"));
     if (waitResponse(10000L) != 1) {
       return false;
     }
-    delay(3000);
     return true;
   }
 
@@ -252,7 +306,8 @@ TINY_GSM_MODEM_GET_INFO_ATI()
 
 TINY_GSM_MODEM_SIM_UNLOCK_CPIN()
 
-  String getSimCCID() {
+  String modemGetSimCCID() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+QCCID"));
     if (waitResponse(GF(GSM_NL "+QCCID:")) != 1) {
       return "";
@@ -265,7 +320,10 @@ TINY_GSM_MODEM_SIM_UNLOCK_CPIN()
 
 TINY_GSM_MODEM_GET_IMEI_GSN()
 
+TINY_GSM_MODEM_IDENTITY()
+
   SimStatus getSimStatus(unsigned long timeout_ms = 10000L) {
+    TinyGsmTransaction transaction(at_lock);
     for (unsigned long start = millis(); millis() - start < timeout_ms; ) {
       sendAT(GF("+CPIN?"));
       if (waitResponse(GF(GSM_NL "+CPIN:")) != 1) {
@@ -300,6 +358,7 @@ TINY_GSM_MODEM_GET_CSQ()
   }
 
   void setHostFormat( bool useDottedQuad ) {
+    TinyGsmTransaction transaction(at_lock);
     if ( useDottedQuad ) {
       sendAT(GF("+QIDNSIP=0"));
     } else {
@@ -315,6 +374,8 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
    */
 
   bool gprsConnect(const char* apn, const char* user = NULL, const char* pwd = NULL) {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
     gprsDisconnect();
 
     // select foreground context 0 = VIRTUAL_UART_1
@@ -363,6 +424,8 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   bool gprsDisconnect() {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
     sendAT(GF("+QIDEACT"));
     return waitResponse(60000L, GF("DEACT OK"), GF("ERROR")) == 1;
   }
@@ -374,6 +437,7 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
    */
 
   String getLocalIP() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+QILOCIP"));
     stream.readStringUntil('\n');
     String res = stream.readStringUntil('\n');
@@ -385,15 +449,16 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
     return TinyGsmIpFromString(getLocalIP());
   }
 
+TINY_GSM_MODEM_DNS_CACHE()
+
   /*
    * Messaging functions
    */
 
   String sendUSSD(const String& code) {
-    sendAT(GF("+CMGF=1"));
-    waitResponse();
-    sendAT(GF("+CSCS=\"HEX\""));
-    waitResponse();
+    TinyGsmTransaction transaction(at_lock);
+    modemSet(settings.cmgf, 1, GF("+CMGF=1"));
+    modemSet(settings.cscs, TinyGsmSettings::CSCS_HEX, GF("+CSCS=\"HEX\""));
     sendAT(GF("+CUSD=1,\""), code, GF("\""));
     if (waitResponse(10000L, GF(GSM_NL "+CUSD:")) != 1) {
       return "";
@@ -417,11 +482,10 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
   }
 
   bool sendSMS(const String& number, const String& text) {
-    sendAT(GF("+CMGF=1"));
-    waitResponse();
+    TinyGsmTransaction transaction(at_lock);
+    modemSet(settings.cmgf, 1, GF("+CMGF=1"));
     //Set GSM 7 bit default alphabet (3GPP TS 23.038)
-    sendAT(GF("+CSCS=\"GSM\""));
-    waitResponse();
+    modemSet(settings.cscs, TinyGsmSettings::CSCS_GSM, GF("+CSCS=\"GSM\""));
     sendAT(GF("+CMGS=\""), number, GF("\""));
     if (waitResponse(GF(">")) != 1) {
       return false;
@@ -433,12 +497,10 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
   }
 
   bool sendSMS_UTF16(const String& number, const void* text, size_t len) {
-    sendAT(GF("+CMGF=1"));
-    waitResponse();
-    sendAT(GF("+CSCS=\"HEX\""));
-    waitResponse();
-    sendAT(GF("+CSMP=17,167,0,8"));
-    waitResponse();
+    TinyGsmTransaction transaction(at_lock);
+    modemSet(settings.cmgf, 1, GF("+CMGF=1"));
+    modemSet(settings.cscs, TinyGsmSettings::CSCS_HEX, GF("+CSCS=\"HEX\""));
+    modemSet(settings.csmp, 8, GF("+CSMP=17,167,0,8"));
 
     sendAT(GF("+CMGS=\""), number, GF("\""));
     if (waitResponse(GF(">")) != 1) {
@@ -461,6 +523,7 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
 
   /** Delete all SMS */
   bool deleteAllSMS() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+QMGDA=6"));
     if (waitResponse(waitResponse(60000L, GF("OK"), GF("ERROR")) == 1) ) {
       return true;
@@ -487,48 +550,9 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
    * Battery & temperature functions
    */
 
-  // Use: float vBatt = modem.getBattVoltage() / 1000.0;
-  uint16_t getBattVoltage() {
+  bool modemGetBattStats(uint8_t &chargeState, int8_t &percent, uint16_t &milliVolts) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CBC"));
-    if (waitResponse(GF(GSM_NL "+CBC:")) != 1) {
-      return 0;
-    }
-    streamSkipUntil(','); // Skip battery charge status
-    streamSkipUntil(','); // Skip battery charge level
-    // return voltage in mV
-    uint16_t res = stream.readStringUntil(',').toInt();
-    // Wait for final OK
-    waitResponse();
-    return res;
-  }
-
-  int8_t getBattPercent() {
-    sendAT(GF("+CBC"));
-    if (waitResponse(GF(GSM_NL "+CBC:")) != 1) {
-      return false;
-    }
-    streamSkipUntil(','); // Skip battery charge status
-    // Read battery charge level
-    int res = stream.readStringUntil(',').toInt();
-    // Wait for final OK
-    waitResponse();
-    return res;
-  }
-
-  uint8_t getBattChargeState() {
-    sendAT(GF("+CBC?"));
-    if (waitResponse(GF(GSM_NL "+CBC:")) != 1) {
-      return false;
-    }
-    // Read battery charge status
-    int res = stream.readStringUntil(',').toInt();
-    // Wait for final OK
-    waitResponse();
-    return res;
-  }
-
-  bool getBattStats(uint8_t &chargeState, int8_t &percent, uint16_t &milliVolts) {
-    sendAT(GF("+CBC?"));
     if (waitResponse(GF(GSM_NL "+CBC:")) != 1) {
       return false;
     }
@@ -540,7 +564,10 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
     return true;
   }
 
+TINY_GSM_MODEM_CACHED_BATT()
+
   float getTemperature() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+QTEMP"));
     if (waitResponse(GF(GSM_NL "+QTEMP:")) != 1) {
       return (float)-9999;
@@ -564,16 +591,39 @@ protected:
   bool modemConnect(const char* host, uint16_t port, uint8_t mux,
                     bool ssl = false, int timeout_s = 75)
  {
+    TinyGsmTransaction transaction(at_lock);
     uint32_t timeout_ms = ((uint32_t)timeout_s)*1000;
-    sendAT(GF("+QIOPEN="), mux, GF("\"TCP"), GF("\",\""), host, GF("\","), port);
+    char ipBuf[16];
+    const char* target = resolvedHost(host, ipBuf);
+    sendAT(GF("+QIOPEN="), mux, GF("\"TCP"), GF("\",\""), target, GF("\","), port);
     int rsp = waitResponse(timeout_ms,
                            GF("CONNECT OK" GSM_NL),
                            GF("CONNECT FAIL" GSM_NL),
                            GF("ALREADY CONNECT" GSM_NL));
+    if (rsp != 1 && target != host) {
+      dnsCache.remove(host);  // The address may have moved
+    }
     return (1 == rsp);
   }
 
+  String dnsIpQuery(const char* host) {
+    TinyGsmTransaction transaction(at_lock);
+    sendAT(GF("+QIDNSGIP=\""), host, GF("\""));
+    if (waitResponse() != 1) {
+      return "";
+    }
+    // The address (or "ERROR: <err>") follows on its own line
+    String res;
+    uint32_t startMillis = millis();
+    while (!res.length() && millis() - startMillis < 14000L) {
+      res = stream.readStringUntil('\n');
+      res.trim();
+    }
+    return res;
+  }
+
   int16_t modemSend(const void* buff, size_t len, uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+QISEND="), mux, ',', len);
     if (waitResponse(GF(">")) != 1) {
       return 0;
@@ -583,29 +633,30 @@ protected:
     if (waitResponse(GF(GSM_NL "SEND OK")) != 1) {
       return 0;
     }
+    // Don't wait for the peer to acknowledge the data, just note that it's
+    // outstanding; maintain() and unackedBytes() will check in on it later
+    sockets[mux]->sock_unacked = TinyGsmMin((uint32_t)0xFFFF,
+                                   (uint32_t)(sockets[mux]->sock_unacked + len));
+    return len;
+  }
 
-    bool allAcknowledged = false;
-    // bool failed = false;
-    while ( !allAcknowledged ) {
-      sendAT( GF("+QISACK"));
-      if (waitResponse(5000L, GF(GSM_NL "+QISACK:")) != 1) {
-        return -1;
-      } else {
-        streamSkipUntil(','); /** Skip total */
-        streamSkipUntil(','); /** Skip acknowledged data size */
-        if ( stream.readStringUntil('\n').toInt() == 0 ) {
-          allAcknowledged = true;
-        }
-      }
+  uint16_t modemGetUnacked(uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
+    sockets[mux]->prev_ack_check = millis();
+    sendAT(GF("+QISACK="), mux);
+    //+QISACK: <sent>,<acked>,<nAcked>
+    if (waitResponse(5000L, GF(GSM_NL "+QISACK:")) != 1) {
+      return sockets[mux]->sock_unacked;
     }
-    waitResponse(5000L);
-
-    // streamSkipUntil(','); // Skip mux
-    // return stream.readStringUntil('\n').toInt();
-    return len;  // TODO
+    streamSkipUntil(','); // Skip total sent
+    streamSkipUntil(','); // Skip acknowledged data size
+    uint16_t res = stream.readStringUntil('\n').toInt();
+    waitResponse();
+    return res;
   }
 
   size_t modemRead(size_t size, uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     // TODO:  Does this work????
     // AT+QIRD=<id>,<sc>,<sid>,<len>
     // id = GPRS context number - 0, set in GPRS connect
@@ -632,6 +683,7 @@ protected:
   }
 
   bool modemGetConnected(uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+QISTATE=1,"), mux);
     //+QISTATE: 0,"TCP","151.139.237.11",80,5087,4,1,0,0,"uart1"
 
@@ -670,6 +722,7 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
     String r4s(r4); r4s.trim();
     String r5s(r5); r5s.trim();
     DBG("### ..:", r1s, ",", r2s, ",", r3s, ",", r4s, ",", r5s);*/
+    at_lock.begin();
     data.reserve(64);
     int index = 0;
     unsigned long startMillis = millis();
@@ -700,14 +753,14 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
           streamSkipUntil(',');  // Skip the role
           int mux = stream.readStringUntil('\n').toInt();
           DBG("### Got Data:", mux);
-          if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
+          if (mux >= 0 && mux < MUX_COUNT && sockets[mux]) {
             sockets[mux]->got_data = true;
           }
         } else if (data.endsWith(GF("CLOSED" GSM_NL))) {
           int nl = data.lastIndexOf(GSM_NL, data.length()-8);
           int coma = data.indexOf(',', nl+2);
           int mux = data.substring(nl+2, coma).toInt();
-          if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
+          if (mux >= 0 && mux < MUX_COUNT && sockets[mux]) {
             sockets[mux]->sock_connected = false;
           }
           data = "";
@@ -716,6 +769,7 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
       }
     } while (millis() - startMillis < timeout_ms);
 finish:
+    TINY_GSM_MODEM_END_TRANSACTION();
     if (!index) {
       data.trim();
       if (data.length()) {
@@ -746,7 +800,26 @@ public:
   Stream&       stream;
 
 protected:
-  GsmClient*    sockets[TINY_GSM_MUX_COUNT];
+  GsmClient*    sockets[MUX_COUNT];
+  TinyGsmModemEvents events;
+  TinyGsmIdentity    identity;
+  TinyGsmMetrics     metrics;
+  TinyGsmSettings    settings;
+  TinyGsmDnsCache<TINY_GSM_DNS_CACHE_SIZE> dnsCache;
+  TinyGsmTransactionLock at_lock;
 };
 
+// The first driver included also provides its registration states
+// unqualified, as when only one driver could be built
+#if !defined(TINY_GSM_REG_STATUS_DEFINED)
+#define TINY_GSM_REG_STATUS_DEFINED
+typedef TinyGsmM95::RegStatus RegStatus;
+static const RegStatus REG_UNREGISTERED = TinyGsmM95::REG_UNREGISTERED;
+static const RegStatus REG_SEARCHING    = TinyGsmM95::REG_SEARCHING;
+static const RegStatus REG_DENIED       = TinyGsmM95::REG_DENIED;
+static const RegStatus REG_OK_HOME      = TinyGsmM95::REG_OK_HOME;
+static const RegStatus REG_OK_ROAMING   = TinyGsmM95::REG_OK_ROAMING;
+static const RegStatus REG_UNKNOWN      = TinyGsmM95::REG_UNKNOWN;
+#endif
+
 #endif
@@ -12,23 +12,21 @@
 // #define TINY_GSM_DEBUG Serial
 //#define TINY_GSM_USE_HEX
 
-#if !defined(TINY_GSM_RX_BUFFER)
-  #define TINY_GSM_RX_BUFFER 64
-#endif
-
-#define TINY_GSM_MUX_COUNT 8
-
 #include <TinyGsmCommon.h>
 
+#undef GSM_NL
+#undef GSM_OK
+#undef GSM_ERROR
 #define GSM_NL "\r\n"
-static const char GSM_OK[] TINY_GSM_PROGMEM = "OK" GSM_NL;
-static const char GSM_ERROR[] TINY_GSM_PROGMEM = "ERROR" GSM_NL;
+#define GSM_OK GSM_CRLF_OK
+#define GSM_ERROR GSM_CRLF_ERROR
 
-enum SimStatus {
-  SIM_ERROR = 0,
-  SIM_READY = 1,
-  SIM_LOCKED = 2,
-};
+class TinyGsmSim7000
+{
+
+public:
+
+enum { MUX_COUNT = 8 };
 
 enum RegStatus {
   REG_UNREGISTERED = 0,
@@ -39,21 +37,10 @@ enum RegStatus {
   REG_UNKNOWN      = 4,
 };
 
-enum TinyGSMDateTimeFormat {
-  DATE_FULL = 0,
-  DATE_TIME = 1,
-  DATE_DATE = 2
-};
-
-class TinyGsmSim7000
-{
-
-public:
-
 class GsmClient : public Client
 {
   friend class TinyGsmSim7000;
-  typedef TinyGsmFifo<uint8_t, TINY_GSM_RX_BUFFER> RxFifo;
+  typedef TinyGsmLockedFifo<uint8_t, TINY_GSM_RX_BUFFER_OR(64)> RxFifo;
 
 public:
   GsmClient() {}
@@ -70,7 +57,7 @@ public:
     sock_connected = false;
     got_data = false;
 
-    at->sockets[mux] = this;
+    at->modemSetSocket(mux, this);
 
     return true;
   }
@@ -113,6 +100,8 @@ TINY_GSM_CLIENT_READ_WITH_BUFFER_CHECK()
 
 TINY_GSM_CLIENT_PEEK_FLUSH_CONNECTED()
 
+TINY_GSM_CLIENT_EVENTS()
+
   /*
    * Extended API
    */
@@ -127,6 +116,7 @@ private:
   bool            sock_connected;
   bool            got_data;
   RxFifo          rx;
+  TinyGsmClientEvents events;
 };
 
 
@@ -155,6 +145,7 @@ public:
   TinyGsmSim7000(Stream& stream)
     : stream(stream)
   {
+    prev_state_check = 0;
     memset(sockets, 0, sizeof(sockets));
   }
 
@@ -167,10 +158,12 @@ public:
   }
 
   bool init(const char* pin = NULL) {
+    TinyGsmTransaction transaction(at_lock);
     DBG(GF("### TinyGSM Version:"), TINYGSM_VERSION);
     if (!testAT()) {
       return false;
     }
+    settings.clear();
     sendAT(GF("E0"));   // Echo Off
     if (waitResponse() != 1) {
       return false;
@@ -180,7 +173,8 @@ public:
     return true;
   }
 
-  String getModemName() {
+  String modemGetName() {
+    TinyGsmTransaction transaction(at_lock);
     String name =  "SIMCom SIM7000";
 
     sendAT(GF("+GMM"));
@@ -203,6 +197,10 @@ TINY_GSM_MODEM_TEST_AT()
 
 TINY_GSM_MODEM_MAINTAIN_CHECK_SOCKS()
 
+TINY_GSM_MODEM_POLL_SOCKS()
+
+TINY_GSM_MODEM_EVENTS()
+
   bool factoryDefault() {  // these commands aren't supported
     return false;
   }
@@ -225,7 +223,13 @@ TINY_GSM_MODEM_GET_INFO_ATI()
    * Power functions
    */
 
+TINY_GSM_MODEM_WAIT_FOR_READY()
+
   bool restart() {
+    TinyGsmTransaction transaction(at_lock);
+    identity.clear();
+    metrics.clear();
+    settings.clear();
     if (!testAT()) {
       return false;
     }
@@ -243,21 +247,25 @@ TINY_GSM_MODEM_GET_INFO_ATI()
     if (waitResponse(10000L) != 1) {
       return false;
     }
-    delay(3000);  //TODO:  Test this delay
+    if (!waitForReady()) {
+      return false;
+    }
     return init();
   }
 
   bool poweroff() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CPOWD=1"));
     return waitResponse(GF("NORMAL POWER DOWN")) == 1;
   }
 
   bool radioOff() {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.clear();
     sendAT(GF("+CFUN=0"));
     if (waitResponse(10000L) != 1) {
       return false;
     }
-    delay(3000);
     return true;
   }
 
@@ -268,6 +276,7 @@ TINY_GSM_MODEM_GET_INFO_ATI()
     The DTR-pin can then be released again.
   */
   bool sleepEnable(bool enable = true) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CSCLK="), enable);
     return waitResponse() == 1;
   }
@@ -282,27 +291,14 @@ TINY_GSM_MODEM_GET_SIMCCID_CCID()
 
 TINY_GSM_MODEM_GET_IMEI_GSN()
 
-  SimStatus getSimStatus(unsigned long timeout_ms = 10000L) {
-    for (unsigned long start = millis(); millis() - start < timeout_ms; ) {
-      sendAT(GF("+CPIN?"));
-      if (waitResponse(GF(GSM_NL "+CPIN:")) != 1) {
-        delay(1000);
-        continue;
-      }
-      int status = waitResponse(GF("READY"), GF("SIM PIN"), GF("SIM PUK"));
-      waitResponse();
-      switch (status) {
-        case 2:
-        case 3:  return SIM_LOCKED;
-        case 1:  return SIM_READY;
-        default: return SIM_ERROR;
-      }
-    }
-    return SIM_ERROR;
-  }
+TINY_GSM_MODEM_IDENTITY()
+
+TINY_GSM_MODEM_GET_SIM_STATUS_CPIN()
 
 TINY_GSM_MODEM_GET_REGISTRATION_XREG(CGREG)
 
+TINY_GSM_MODEM_NETWORK_EVENTS(CGREG)
+
 TINY_GSM_MODEM_GET_OPERATOR_COPS()
 
   /*
@@ -317,6 +313,7 @@ TINY_GSM_MODEM_GET_CSQ()
   }
 
   String getNetworkModes() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CNMP=?"));
     if (waitResponse(GF(GSM_NL "+CNMP:")) != 1) {
       return "";
@@ -326,9 +323,10 @@ TINY_GSM_MODEM_GET_CSQ()
     return res;
   }
 
-TINY_GSM_MODEM_WAIT_FOR_NETWORK()
+TINY_GSM_MODEM_WAIT_FOR_NETWORK_URC(CGREG)
 
   String setNetworkMode(uint8_t mode) {
+    TinyGsmTransaction transaction(at_lock);
       sendAT(GF("+CNMP="), mode);
       if (waitResponse(GF(GSM_NL "+CNMP:")) != 1) {
         return "OK";
@@ -339,6 +337,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   String getPreferredModes() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CMNB=?"));
     if (waitResponse(GF(GSM_NL "+CMNB:")) != 1) {
       return "";
@@ -349,6 +348,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   String setPreferredMode(uint8_t mode) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CMNB="), mode);
     if (waitResponse(GF(GSM_NL "+CMNB:")) != 1) {
       return "OK";
@@ -364,6 +364,8 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
    */
 
   bool gprsConnect(const char* apn, const char* user = NULL, const char* pwd = NULL) {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
     gprsDisconnect();
 
     // Set the Bearer for the IP
@@ -445,6 +447,8 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   bool gprsDisconnect() {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
     // Shut the TCP/IP connection
     sendAT(GF("+CIPSHUT"));
     if (waitResponse(60000L) != 1)
@@ -457,7 +461,8 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     return true;
   }
 
-  bool isGprsConnected() {
+  bool modemIsGprsConnected() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CGATT?"));
     if (waitResponse(GF(GSM_NL "+CGATT:")) != 1) {
       return false;
@@ -474,11 +479,14 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     return true;
   }
 
+TINY_GSM_MODEM_CACHED_GPRS()
+
   /*
    * IP Address functions
    */
 
   String getLocalIP() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CIFSR;E0"));
     String res;
     if (waitResponse(10000L, res) != 1) {
@@ -494,6 +502,8 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     return TinyGsmIpFromString(getLocalIP());
   }
 
+TINY_GSM_MODEM_DNS_CACHE()
+
   /*
    * Phone Call functions
    */
@@ -509,10 +519,9 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
    */
 
   String sendUSSD(const String& code) {
-    sendAT(GF("+CMGF=1"));
-    waitResponse();
-    sendAT(GF("+CSCS=\"HEX\""));
-    waitResponse();
+    TinyGsmTransaction transaction(at_lock);
+    modemSet(settings.cmgf, 1, GF("+CMGF=1"));
+    modemSet(settings.cscs, TinyGsmSettings::CSCS_HEX, GF("+CSCS=\"HEX\""));
     sendAT(GF("+CUSD=1,\""), code, GF("\""));
     if (waitResponse() != 1) {
       return "";
@@ -535,14 +544,13 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   bool sendSMS(const String& number, const String& text) {
+    TinyGsmTransaction transaction(at_lock);
 
     sendAT(GF("+AT+CSCA?"));
     waitResponse();
-    sendAT(GF("+CMGF=1"));
-    waitResponse();
+    modemSet(settings.cmgf, 1, GF("+CMGF=1"));
     //Set GSM 7 bit default alphabet (3GPP TS 23.038)
-    sendAT(GF("+CSCS=\"GSM\""));
-    waitResponse();
+    modemSet(settings.cscs, TinyGsmSettings::CSCS_GSM, GF("+CSCS=\"GSM\""));
     sendAT(GF("+CMGS=\""), number, GF("\""));
     if (waitResponse(GF(">")) != 1) {
       return false;
@@ -554,12 +562,10 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   bool sendSMS_UTF16(const String& number, const void* text, size_t len) {
-    sendAT(GF("+CMGF=1"));
-    waitResponse();
-    sendAT(GF("+CSCS=\"HEX\""));
-    waitResponse();
-    sendAT(GF("+CSMP=17,167,0,8"));
-    waitResponse();
+    TinyGsmTransaction transaction(at_lock);
+    modemSet(settings.cmgf, 1, GF("+CMGF=1"));
+    modemSet(settings.cscs, TinyGsmSettings::CSCS_HEX, GF("+CSCS=\"HEX\""));
+    modemSet(settings.csmp, 8, GF("+CSMP=17,167,0,8"));
 
     sendAT(GF("+CMGS=\""), number, GF("\""));
     if (waitResponse(GF(">")) != 1) {
@@ -586,6 +592,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
    */
 
   String getGsmLocation() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CIPGSMLOC=1,1"));
     if (waitResponse(10000L, GF(GSM_NL "+CIPGSMLOC:")) != 1) {
       return "";
@@ -603,6 +610,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
 
   // enable GPS
   bool enableGPS() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CGNSPWR=1"));
     if (waitResponse() != 1) {
       return false;
@@ -611,6 +619,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   bool disableGPS() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CGNSPWR=0"));
     if (waitResponse() != 1) {
       return false;
@@ -620,6 +629,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
 
   // get the RAW GPS output
   String getGPSraw() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CGNSINF"));
     if (waitResponse(GF(GSM_NL "+CGNSINF:")) != 1) {
       return "";
@@ -632,6 +642,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
 
   // get GPS informations
   bool getGPS(float *lat, float *lon, float *speed=0, int *alt=0, int *vsat=0, int *usat=0) {
+    TinyGsmTransaction transaction(at_lock);
     //String buffer = "";
     bool fix = false;
 
@@ -668,6 +679,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
    */
 
   String getGSMDateTime(TinyGSMDateTimeFormat format) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CCLK?"));
     if (waitResponse(2000L, GF(GSM_NL "+CCLK: \"")) != 1) {
       return "";
@@ -692,6 +704,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
 
   // get GPS time
   bool getGPSTime(int *year, int *month, int *day, int *hour, int *minute, int *second) {
+    TinyGsmTransaction transaction(at_lock);
     bool fix = false;
     char chr_buffer[12];
     sendAT(GF("+CGNSINF"));
@@ -741,48 +754,9 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
    * Battery & temperature functions
    */
 
-  // Use: float vBatt = modem.getBattVoltage() / 1000.0;
-  uint16_t getBattVoltage() {
+  bool modemGetBattStats(uint8_t &chargeState, int8_t &percent, uint16_t &milliVolts) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CBC"));
-    if (waitResponse(GF(GSM_NL "+CBC:")) != 1) {
-      return 0;
-    }
-    streamSkipUntil(','); // Skip battery charge status
-    streamSkipUntil(','); // Skip battery charge level
-    // return voltage in mV
-    uint16_t res = stream.readStringUntil(',').toInt();
-    // Wait for final OK
-    waitResponse();
-    return res;
-  }
-
-  int8_t getBattPercent() {
-    sendAT(GF("+CBC"));
-    if (waitResponse(GF(GSM_NL "+CBC:")) != 1) {
-      return false;
-    }
-    streamSkipUntil(','); // Skip battery charge status
-    // Read battery charge level
-    int res = stream.readStringUntil(',').toInt();
-    // Wait for final OK
-    waitResponse();
-    return res;
-  }
-
-  uint8_t getBattChargeState() {
-    sendAT(GF("+CBC?"));
-    if (waitResponse(GF(GSM_NL "+CBC:")) != 1) {
-      return false;
-    }
-    // Read battery charge status
-    int res = stream.readStringUntil(',').toInt();
-    // Wait for final OK
-    waitResponse();
-    return res;
-  }
-
-  bool getBattStats(uint8_t &chargeState, int8_t &percent, uint16_t &milliVolts) {
-    sendAT(GF("+CBC?"));
     if (waitResponse(GF(GSM_NL "+CBC:")) != 1) {
       return false;
     }
@@ -794,6 +768,8 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     return true;
   }
 
+TINY_GSM_MODEM_CACHED_BATT()
+
   float getTemperature() TINY_GSM_ATTR_NOT_AVAILABLE;
 
   /*
@@ -805,9 +781,13 @@ protected:
   bool modemConnect(const char* host, uint16_t port, uint8_t mux,
                     bool ssl = false, int timeout_s = 75)
  {
+    TinyGsmTransaction transaction(at_lock);
     int rsp;
     uint32_t timeout_ms = ((uint32_t)timeout_s)*1000;
-    sendAT(GF("+CIPSTART="), mux, ',', GF("\"TCP"), GF("\",\""), host, GF("\","), port);
+    // Secure connections keep the host name for the certificate check
+    char ipBuf[16];
+    const char* target = ssl ? host : resolvedHost(host, ipBuf);
+    sendAT(GF("+CIPSTART="), mux, ',', GF("\"TCP"), GF("\",\""), target, GF("\","), port);
     rsp = waitResponse(timeout_ms,
                        GF("CONNECT OK" GSM_NL),
                        GF("CONNECT FAIL" GSM_NL),
@@ -815,10 +795,34 @@ protected:
                        GF("ERROR" GSM_NL),
                        GF("CLOSE OK" GSM_NL)   // Happens when HTTPS handshake fails
                       );
+    if (rsp != 1 && target != host) {
+      dnsCache.remove(host);  // The address may have moved
+    }
     return (1 == rsp);
   }
 
+  String dnsIpQuery(const char* host) {
+    TinyGsmTransaction transaction(at_lock);
+    sendAT(GF("+CDNSGIP=\""), host, GF("\""));
+    if (waitResponse() != 1) {
+      return "";
+    }
+    if (waitResponse(10000L, GF(GSM_NL "+CDNSGIP:")) != 1) {
+      return "";
+    }
+    if (stream.readStringUntil(',').toInt() != 1) {
+      streamSkipUntil('\n');
+      return "";
+    }
+    streamSkipUntil(',');  // Skip the quoted host name
+    streamSkipUntil('"');
+    String res = stream.readStringUntil('"');
+    streamSkipUntil('\n');  // Skip any secondary address
+    return res;
+  }
+
   int16_t modemSend(const void* buff, size_t len, uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CIPSEND="), mux, ',', len);
     if (waitResponse(GF(">")) != 1) {
       return 0;
@@ -833,6 +837,7 @@ protected:
   }
 
   size_t modemRead(size_t size, uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
 #ifdef TINY_GSM_USE_HEX
     sendAT(GF("+CIPRXGET=3,"), mux, ',', size);
     if (waitResponse(GF("+CIPRXGET:")) != 1) {
@@ -874,6 +879,7 @@ protected:
   }
 
   size_t modemGetAvailable(uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CIPRXGET=4,"), mux);
     size_t result = 0;
     if (waitResponse(GF("+CIPRXGET:")) == 1) {
@@ -884,18 +890,41 @@ protected:
     }
     DBG("### Available:", result, "on", mux);
     if (!result) {
-      sockets[mux]->sock_connected = modemGetConnected(mux);
+      modemCheckConnected();
     }
     return result;
   }
 
   bool modemGetConnected(uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CIPSTATUS="), mux);
     int res = waitResponse(GF(",\"CONNECTED\""), GF(",\"CLOSED\""), GF(",\"CLOSING\""), GF(",\"INITIAL\""));
     waitResponse();
     return 1 == res;
   }
 
+  // A plain +CIPSTATUS lists all MUX_COUNT connections in one go, each on a
+  // line of its own before the final OK:
+  // STATE: <state>
+  // +CIPSTATUS: <n>,<bearer>,<TCP/UDP>,<IP address>,<port>,<client state>
+  void modemGetConnectedAll() {
+    TinyGsmTransaction transaction(at_lock);
+    sendAT(GF("+CIPSTATUS"));
+    for (int i = 0; i < MUX_COUNT; i++) {
+      if (waitResponse(GF(GSM_NL "+CIPSTATUS: "), GFP(GSM_OK), GFP(GSM_ERROR)) != 1) {
+        return;  // A shorter list, or an error
+      }
+      String line = stream.readStringUntil('\n');
+      int mux = line.toInt();
+      if (mux >= 0 && mux < MUX_COUNT && sockets[mux]) {
+        sockets[mux]->sock_connected = line.indexOf(GF("\"CONNECTED\"")) >= 0;
+      }
+    }
+    waitResponse();
+  }
+
+TINY_GSM_MODEM_CHECK_CONNECTED_THROTTLED()
+
 public:
 
   /*
@@ -915,6 +944,7 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
     String r4s(r4); r4s.trim();
     String r5s(r5); r5s.trim();
     DBG("### ..:", r1s, ",", r2s, ",", r3s, ",", r4s, ",", r5s);*/
+    at_lock.begin();
     data.reserve(64);
     int index = 0;
     unsigned long startMillis = millis();
@@ -944,7 +974,7 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
           String mode = stream.readStringUntil(',');
           if (mode.toInt() == 1) {
             int mux = stream.readStringUntil('\n').toInt();
-            if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
+            if (mux >= 0 && mux < MUX_COUNT && sockets[mux]) {
               sockets[mux]->got_data = true;
             }
             data = "";
@@ -955,7 +985,7 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
         } else if (data.endsWith(GF(GSM_NL "+RECEIVE:"))) {
           int mux = stream.readStringUntil(',').toInt();
           int len = stream.readStringUntil('\n').toInt();
-          if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
+          if (mux >= 0 && mux < MUX_COUNT && sockets[mux]) {
             sockets[mux]->got_data = true;
             sockets[mux]->sock_available = len;
           }
@@ -965,15 +995,28 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
           int nl = data.lastIndexOf(GSM_NL, data.length()-8);
           int coma = data.indexOf(',', nl+2);
           int mux = data.substring(nl+2, coma).toInt();
-          if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
+          if (mux >= 0 && mux < MUX_COUNT && sockets[mux]) {
             sockets[mux]->sock_connected = false;
           }
           data = "";
           DBG("### Closed: ", mux);
+        } else if (data.endsWith(GF(GSM_NL "+CGREG:"))) {
+          modemRegistrationUrc();
+          data = "";
+        } else if (data.endsWith(GF(GSM_NL "+CPIN:"))) {
+          modemSimUrc();
+          data = "";
+        } else if (data.endsWith(GF(GSM_NL "+PDP: DEACT"))) {
+          modemPdpDeactivatedUrc();
+          data = "";
+        } else if (data.endsWith(GF(GSM_NL "RDY" GSM_NL))) {
+          modemBootUrc();
+          data = "";
         }
       }
     } while (millis() - startMillis < timeout_ms);
 finish:
+    TINY_GSM_MODEM_END_TRANSACTION();
     if (!index) {
       data.trim();
       if (data.length()) {
@@ -1004,7 +1047,27 @@ public:
   Stream&       stream;
 
 protected:
-  GsmClient*    sockets[TINY_GSM_MUX_COUNT];
+  GsmClient*    sockets[MUX_COUNT];
+  TinyGsmModemEvents events;
+  TinyGsmIdentity    identity;
+  TinyGsmMetrics     metrics;
+  TinyGsmSettings    settings;
+  TinyGsmDnsCache<TINY_GSM_DNS_CACHE_SIZE> dnsCache;
+  TinyGsmTransactionLock at_lock;
+  uint32_t      prev_state_check;
 };
 
+// The first driver included also provides its registration states
+// unqualified, as when only one driver could be built
+#if !defined(TINY_GSM_REG_STATUS_DEFINED)
+#define TINY_GSM_REG_STATUS_DEFINED
+typedef TinyGsmSim7000::RegStatus RegStatus;
+static const RegStatus REG_UNREGISTERED = TinyGsmSim7000::REG_UNREGISTERED;
+static const RegStatus REG_SEARCHING    = TinyGsmSim7000::REG_SEARCHING;
+static const RegStatus REG_DENIED       = TinyGsmSim7000::REG_DENIED;
+static const RegStatus REG_OK_HOME      = TinyGsmSim7000::REG_OK_HOME;
+static const RegStatus REG_OK_ROAMING   = TinyGsmSim7000::REG_OK_ROAMING;
+static const RegStatus REG_UNKNOWN      = TinyGsmSim7000::REG_UNKNOWN;
+#endif
+
 #endif
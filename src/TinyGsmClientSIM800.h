@@ -13,23 +13,21 @@
 //#define TINY_GSM_DEBUG Serial
 //#define TINY_GSM_USE_HEX
 
-#if !defined(TINY_GSM_RX_BUFFER)
-  #define TINY_GSM_RX_BUFFER 64
-#endif
-
-#define TINY_GSM_MUX_COUNT 5
-
 #include <TinyGsmCommon.h>
 
+#undef GSM_NL
+#undef GSM_OK
+#undef GSM_ERROR
 #define GSM_NL "\r\n"
-static const char GSM_OK[] TINY_GSM_PROGMEM = "OK" GSM_NL;
-static const char GSM_ERROR[] TINY_GSM_PROGMEM = "ERROR" GSM_NL;
+#define GSM_OK GSM_CRLF_OK
+#define GSM_ERROR GSM_CRLF_ERROR
 
-enum SimStatus {
-  SIM_ERROR = 0,
-  SIM_READY = 1,
-  SIM_LOCKED = 2,
-};
+class TinyGsmSim800
+{
+
+public:
+
+enum { MUX_COUNT = 5 };
 
 enum RegStatus {
   REG_UNREGISTERED = 0,
@@ -40,21 +38,33 @@ enum RegStatus {
   REG_UNKNOWN      = 4,
 };
 
-enum TinyGSMDateTimeFormat {
-  DATE_FULL = 0,
-  DATE_TIME = 1,
-  DATE_DATE = 2
+// Settings that warmStart() found already in place
+enum {
+  CONFIG_MUX   = 0x01,
+  CONFIG_RXGET = 0x02,
+  CONFIG_QSEND = 0x04,
+  CONFIG_DNS   = 0x08,
+  CONFIG_TRANSPARENT = 0x10,  // +CIPMODE=1, which configureSockets() undoes
 };
 
-class TinyGsmSim800
-{
+// Stages of gprsConnect() that modemGprsProgress() found already done
+enum {
+  GPRS_BEARER   = 0x01,  // +SAPBR bearer open
+  GPRS_ATTACHED = 0x02,  // +CGATT: 1
+  GPRS_STARTED  = 0x04,  // +CSTT done, IP START
+  GPRS_ACTIVE   = 0x08,  // +CIICR done, IP GPRSACT
+  GPRS_HAS_IP   = 0x10,  // +CIFSR done, IP STATUS
+  GPRS_STALE    = 0x80,  // nothing can be kept, +CIPSHUT first
+};
 
-public:
+class GsmUdp;
 
 class GsmClient : public Client
 {
   friend class TinyGsmSim800;
-  typedef TinyGsmFifo<uint8_t, TINY_GSM_RX_BUFFER> RxFifo;
+  friend class GsmUdp;
+  typedef TinyGsmLockedFifo<uint8_t, TINY_GSM_RX_BUFFER_OR(64)> RxFifo;
+  typedef TinyGsmLockedFifo<uint16_t, TINY_GSM_UDP_PACKETS+1> PacketFifo;
 
 public:
   GsmClient() {}
@@ -69,9 +79,10 @@ public:
     sock_available = 0;
     prev_check = 0;
     sock_connected = false;
+    sock_udp = false;
     got_data = false;
 
-    at->sockets[mux] = this;
+    at->modemSetSocket(mux, this);
 
     return true;
   }
@@ -81,6 +92,7 @@ public:
     stop();
     TINY_GSM_YIELD();
     rx.clear();
+    sock_udp = false;
     sock_connected = at->modemConnect(host, port, mux, false, timeout_s);
     return sock_connected;
   }
@@ -104,6 +116,8 @@ TINY_GSM_CLIENT_CONNECT_OVERLOADS()
     at->sendAT(GF("+CIPCLOSE="), mux, GF(",1"));  // Quick close
     sock_connected = false;
     at->waitResponse();
+    rx.clear();
+    packets.clear();
   }
 
 TINY_GSM_CLIENT_WRITE()
@@ -114,6 +128,8 @@ TINY_GSM_CLIENT_READ_WITH_BUFFER_CHECK()
 
 TINY_GSM_CLIENT_PEEK_FLUSH_CONNECTED()
 
+TINY_GSM_CLIENT_EVENTS()
+
   /*
    * Extended API
    */
@@ -126,8 +142,11 @@ private:
   uint16_t        sock_available;
   uint32_t        prev_check;
   bool            sock_connected;
+  bool            sock_udp;
   bool            got_data;
   RxFifo          rx;
+  TinyGsmClientEvents events;
+  PacketFifo      packets;  // lengths of the datagrams in rx, UDP only
 };
 
 
@@ -151,11 +170,127 @@ public:
 };
 
 
+// A client for transparent mode (see setTransparentMode()): once connected the
+// socket's data streams straight over the UART without any AT framing.
+// While the data is flowing no other AT commands can be used; escape() returns
+// the modem to command mode with the connection still open and resume() (or
+// the next write) goes back to streaming.
+class GsmClientTransparent : public GsmClient
+{
+public:
+  GsmClientTransparent() {}
+
+  GsmClientTransparent(TinyGsmSim800& modem)
+    : GsmClient(modem, 0)
+  {}
+
+public:
+  virtual int connect(const char *host, uint16_t port, int timeout_s) {
+    stop();
+    TINY_GSM_YIELD();
+    rx.clear();
+    sock_connected = at->modemConnectTransparent(host, port, timeout_s);
+    return sock_connected;
+  }
+
+TINY_GSM_CLIENT_CONNECT_OVERLOADS()
+
+  virtual void stop() {
+    TINY_GSM_YIELD();
+    if (sock_connected) {
+      at->modemCloseTransparent();
+    }
+    sock_connected = false;
+    rx.clear();
+  }
+
+  virtual size_t write(const uint8_t *buf, size_t size) {
+    TINY_GSM_YIELD();
+    if (!sock_connected || (!at->dataMode && !resume())) {
+      return 0;
+    }
+    at->stream.write(buf, size);
+    at->stream.flush();
+    return size;
+  }
+
+TINY_GSM_CLIENT_AVAILABLE_NO_MODEM_FIFO()
+
+TINY_GSM_CLIENT_READ_NO_MODEM_FIFO()
+
+  bool escape() {
+    return at->modemEscape();
+  }
+
+  bool resume() {
+    return sock_connected && at->modemResume();
+  }
+};
+
+// Datagrams are pushed to us (+CIPRXGET=0), each with its own
+// +RECEIVE,<n>,<length>: header, as +CIPRXGET=2 would run them together.
+// The mode is the modem's, so while a GsmUdp is open the data of TCP
+// clients is pushed as well, and must fit in their fifo; the next
+// gprsConnect() goes back to +CIPRXGET=1.
+class GsmUdp : public UDP
+{
+  friend class TinyGsmSim800;
+
+public:
+  GsmUdp() {}
+
+  GsmUdp(TinyGsmSim800& modem, uint8_t mux = 1) {
+    init(&modem, mux);
+  }
+
+  bool init(TinyGsmSim800* modem, uint8_t mux = 1) {
+    this->at = modem;
+    peer_port = 0;
+    local_port = 0;
+    tx_len = 0;
+    tx_overflow = false;
+    rx_left = 0;
+    return sock.init(modem, mux);
+  }
+
+TINY_GSM_UDP_PACKET_FUNCTIONS()
+
+private:
+  bool connectPeer(const char *host, uint16_t port) {
+    sock.rx.clear();
+    sock.packets.clear();
+    sock.sock_udp = true;
+    sock.sock_connected = at->modemConnect(host, port, sock.mux, false, 75,
+                                           true, local_port);
+    return sock.sock_connected;
+  }
+
+  int16_t sendDatagram(const uint8_t* buf, size_t len) {
+    return at->modemSend(buf, len, sock.mux);
+  }
+
+  TinyGsmSim800*  at;
+  GsmClient       sock;
+  String          peer_host;
+  uint16_t        peer_port;
+  uint16_t        local_port;
+  uint16_t        tx_len;
+  bool            tx_overflow;
+  uint16_t        rx_left;
+  uint8_t         tx[TINY_GSM_UDP_TX_BUFFER];
+};
+
 public:
 
   TinyGsmSim800(Stream& stream)
     : stream(stream)
   {
+    prev_state_check = 0;
+    transparentMode = false;
+    dataMode = false;
+    configured = 0;
+    closedMatch = 0;
+    okMatch = false;
     memset(sockets, 0, sizeof(sockets));
   }
 
@@ -168,12 +303,15 @@ public:
   }
 
   bool init(const char* pin = NULL) {
+    TinyGsmTransaction transaction(at_lock);
     DBG(GF("### TinyGSM Version:"), TINYGSM_VERSION);
     if (!testAT()) {
       return false;
     }
+    settings.clear();
     sendAT(GF("&FZ"));  // Factory + Reset
     waitResponse();
+    configured = 0;
     sendAT(GF("E0"));   // Echo Off
     if (waitResponse() != 1) {
       return false;
@@ -183,7 +321,46 @@ public:
     return true;
   }
 
-  String getModemName() {
+  // For a modem that stayed powered (e.g. while the MCU was in deep sleep):
+  // instead of a factory reset, one query reads back echo and the socket and
+  // DNS settings, and only those that differ are sent again.  Falls back to
+  // init() if the modem won't answer the query.
+  bool warmStart(const char* pin = NULL) {
+    TinyGsmTransaction transaction(at_lock);
+    if (!testAT()) {
+      return false;
+    }
+    sendAT(GF("+CIPMUX?;+CIPRXGET?;+CIPQSEND?;+CIPMODE?;+CDNSCFG?"));
+    String data;
+    if (!modemReadAnswer(data, 2000L)) {
+      return init(pin);
+    }
+    configured = 0;
+    if (data.indexOf(GF("+CIPMODE: 1")) >= 0) configured |= CONFIG_TRANSPARENT;
+    if (data.indexOf(GF("+CIPMUX: 1")) >= 0) configured |= CONFIG_MUX;
+    if (data.indexOf(GF("+CIPRXGET: 1")) >= 0) configured |= CONFIG_RXGET;
+    if (data.indexOf(GF("+CIPQSEND: 1")) >= 0) configured |= CONFIG_QSEND;
+    if (data.indexOf(GF("PrimaryDns: 8.8.8.8")) >= 0 &&
+        data.indexOf(GF("SecondaryDns: 8.8.4.4")) >= 0) configured |= CONFIG_DNS;
+    DBG(GF("### Warm start, settings kept:"), configured);
+
+    // The query itself comes back if echo is on
+    if (data.indexOf(GF("AT+CIPMUX?")) >= 0) {
+      sendAT(GF("E0"));
+      if (waitResponse() != 1) {
+        return false;
+      }
+    }
+    // These can be refused while a connection is up; gprsConnect() then
+    // tries again
+    configureSockets();
+    configureDns();
+    getSimStatus();
+    return true;
+  }
+
+  String modemGetName() {
+    TinyGsmTransaction transaction(at_lock);
     String name = "";
     #if defined(TINY_GSM_MODEM_SIM800)
       name = "SIMCom SIM800";
@@ -213,11 +390,40 @@ TINY_GSM_MODEM_SET_BAUD_IPR()
 
 TINY_GSM_MODEM_TEST_AT()
 
-TINY_GSM_MODEM_MAINTAIN_CHECK_SOCKS()
+  void maintain() {
+    TinyGsmTransaction transaction(at_lock);
+    // In transparent mode everything on the UART is socket data
+    if (dataMode) {
+      modemReadTransparent();
+      modemDispatchEvents();
+      return;
+    }
+    for (int mux = 0; mux < MUX_COUNT; mux++) {
+      GsmClient* sock = sockets[mux];
+      if (sock && sock->got_data) {
+        sock->got_data = false;
+        // Pushed data (+CIPRXGET=0) is already in the fifo
+        if (configured & CONFIG_RXGET) {
+          sock->sock_available = modemGetAvailable(mux);
+        }
+      }
+    }
+    while (stream.available()) {
+      waitResponse(15, NULL, NULL);
+    }
+    modemDispatchEvents();
+  }
+
+TINY_GSM_MODEM_POLL_SOCKS()
+
+TINY_GSM_MODEM_EVENTS()
 
   bool factoryDefault() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("&FZE0&W"));  // Factory + Reset + Echo Off + Write
     waitResponse();
+    configured = 0;
+    settings.clear();
     sendAT(GF("+IPR=0"));   // Auto-baud
     waitResponse();
     sendAT(GF("+IFC=0,0")); // No Flow Control
@@ -233,6 +439,7 @@ TINY_GSM_MODEM_MAINTAIN_CHECK_SOCKS()
 TINY_GSM_MODEM_GET_INFO_ATI()
 
   bool hasSSL() {
+    TinyGsmTransaction transaction(at_lock);
 #if defined(TINY_GSM_MODEM_SIM900)
     return false;
 #else
@@ -256,7 +463,13 @@ TINY_GSM_MODEM_GET_INFO_ATI()
    * Power functions
    */
 
+TINY_GSM_MODEM_WAIT_FOR_READY()
+
   bool restart() {
+    TinyGsmTransaction transaction(at_lock);
+    identity.clear();
+    metrics.clear();
+    settings.clear();
     if (!testAT()) {
       return false;
     }
@@ -276,21 +489,25 @@ TINY_GSM_MODEM_GET_INFO_ATI()
     if (waitResponse(10000L) != 1) {
       return false;
     }
-    delay(3000);
+    if (!waitForReady()) {
+      return false;
+    }
     return init();
   }
 
   bool poweroff() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CPOWD=1"));
     return waitResponse(10000L, GF("NORMAL POWER DOWN")) == 1;
   }
 
   bool radioOff() {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.clear();
     sendAT(GF("+CFUN=0"));
     if (waitResponse(10000L) != 1) {
       return false;
     }
-    delay(3000);
     return true;
   }
 
@@ -300,6 +517,7 @@ TINY_GSM_MODEM_GET_INFO_ATI()
     The DTR-pin can then be released again.
   */
   bool sleepEnable(bool enable = true) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CSCLK="), enable);
     return waitResponse() == 1;
   }
@@ -314,27 +532,14 @@ TINY_GSM_MODEM_GET_SIMCCID_CCID()
 
 TINY_GSM_MODEM_GET_IMEI_GSN()
 
-  SimStatus getSimStatus(unsigned long timeout_ms = 10000L) {
-    for (unsigned long start = millis(); millis() - start < timeout_ms; ) {
-      sendAT(GF("+CPIN?"));
-      if (waitResponse(GF(GSM_NL "+CPIN:")) != 1) {
-        delay(1000);
-        continue;
-      }
-      int status = waitResponse(GF("READY"), GF("SIM PIN"), GF("SIM PUK"), GF("NOT INSERTED"), GF("NOT READY"));
-      waitResponse();
-      switch (status) {
-        case 2:
-        case 3:  return SIM_LOCKED;
-        case 1:  return SIM_READY;
-        default: return SIM_ERROR;
-      }
-    }
-    return SIM_ERROR;
-  }
+TINY_GSM_MODEM_IDENTITY()
+
+TINY_GSM_MODEM_GET_SIM_STATUS_CPIN()
 
 TINY_GSM_MODEM_GET_REGISTRATION_XREG(CREG)
 
+TINY_GSM_MODEM_NETWORK_EVENTS(CREG)
+
 TINY_GSM_MODEM_GET_OPERATOR_COPS()
 
   /*
@@ -348,100 +553,128 @@ TINY_GSM_MODEM_GET_CSQ()
     return (s == REG_OK_HOME || s == REG_OK_ROAMING);
   }
 
-TINY_GSM_MODEM_WAIT_FOR_NETWORK()
+TINY_GSM_MODEM_WAIT_FOR_NETWORK_URC(CREG)
 
   /*
    * GPRS functions
    */
 
+  // Carries on from wherever the modem already is: the stages found done
+  // for this APN are skipped, so after a dropped connection (or a restart of
+  // the MCU alone) only the missing ones are run again.  Transparent mode,
+  // and a modem in a state that can't be continued, start from scratch.
   bool gprsConnect(const char* apn, const char* user = NULL, const char* pwd = NULL) {
-    gprsDisconnect();
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
+    uint8_t done = transparentMode ? (uint8_t)GPRS_STALE : modemGprsProgress(apn, user, pwd);
+    if (done & GPRS_STALE) {
+      gprsDisconnect();
+      done = 0;
+    }
+    DBG(GF("### GPRS stages done:"), done);
 
-    // Set the Bearer for the IP
-    sendAT(GF("+SAPBR=3,1,\"Contype\",\"GPRS\""));  // Set the connection type to GPRS
-    waitResponse();
+    if (!(done & GPRS_BEARER)) {
+      // Set the Bearer for the IP
+      sendAT(GF("+SAPBR=3,1,\"Contype\",\"GPRS\""));  // Set the connection type to GPRS
+      waitResponse();
 
-    sendAT(GF("+SAPBR=3,1,\"APN\",\""), apn, '"');  // Set the APN
-    waitResponse();
+      sendAT(GF("+SAPBR=3,1,\"APN\",\""), apn, '"');  // Set the APN
+      waitResponse();
 
-    if (user && strlen(user) > 0) {
-      sendAT(GF("+SAPBR=3,1,\"USER\",\""), user, '"');  // Set the user name
+      // Set (or clear) the user name and password
+      sendAT(GF("+SAPBR=3,1,\"USER\",\""), user ? user : "", '"');
       waitResponse();
-    }
-    if (pwd && strlen(pwd) > 0) {
-      sendAT(GF("+SAPBR=3,1,\"PWD\",\""), pwd, '"');  // Set the password
+      sendAT(GF("+SAPBR=3,1,\"PWD\",\""), pwd ? pwd : "", '"');
       waitResponse();
-    }
-
-    // Define the PDP context
-    sendAT(GF("+CGDCONT=1,\"IP\",\""), apn, '"');
-    waitResponse();
 
-    // Activate the PDP context
-    sendAT(GF("+CGACT=1,1"));
-    waitResponse(60000L);
+      // Define the PDP context
+      sendAT(GF("+CGDCONT=1,\"IP\",\""), apn, '"');
+      waitResponse();
 
-    // Open the definied GPRS bearer context
-    sendAT(GF("+SAPBR=1,1"));
-    waitResponse(85000L);
-    // Query the GPRS bearer context status
-    sendAT(GF("+SAPBR=2,1"));
-    if (waitResponse(30000L) != 1)
-      return false;
+      // Activate the PDP context
+      sendAT(GF("+CGACT=1,1"));
+      waitResponse(60000L);
+
+      // Open the definied GPRS bearer context
+      sendAT(GF("+SAPBR=1,1"));
+      waitResponse(85000L);
+      // Query the GPRS bearer context status
+      sendAT(GF("+SAPBR=2,1"));
+      if (waitResponse(30000L) != 1)
+        return false;
+    }
 
-    // Attach to GPRS
-    sendAT(GF("+CGATT=1"));
-    if (waitResponse(60000L) != 1)
-      return false;
+    if (!(done & GPRS_ATTACHED)) {
+      // Attach to GPRS
+      sendAT(GF("+CGATT=1"));
+      if (waitResponse(60000L) != 1)
+        return false;
+    }
 
     // TODO: wait AT+CGATT?
 
-    // Set to multi-IP
-    sendAT(GF("+CIPMUX=1"));
-    if (waitResponse() != 1) {
-      return false;
-    }
+    if (transparentMode) {
+      // Transparent mode only works with a single connection
+      configured &= ~CONFIG_MUX;
+      sendAT(GF("+CIPMUX=0"));
+      if (waitResponse() != 1) {
+        return false;
+      }
 
-    // Put in "quick send" mode (thus no extra "Send OK")
-    sendAT(GF("+CIPQSEND=1"));
-    if (waitResponse() != 1) {
-      return false;
-    }
+      sendAT(GF("+CIPMODE=1"));
+      if (waitResponse() != 1) {
+        return false;
+      }
+      configured |= CONFIG_TRANSPARENT;
 
-    // Set to get data manually
-    sendAT(GF("+CIPRXGET=1"));
-    if (waitResponse() != 1) {
+      // Defaults, except that the +++ escape sequence is enabled
+      sendAT(GF("+CIPCCFG=5,2,1024,1,0,1460,50"));
+      if (waitResponse() != 1) {
+        return false;
+      }
+    } else if (!configureSockets()) {
       return false;
     }
 
-    // Start Task and Set APN, USER NAME, PASSWORD
-    sendAT(GF("+CSTT=\""), apn, GF("\",\""), user, GF("\",\""), pwd, GF("\""));
-    if (waitResponse(60000L) != 1) {
-      return false;
+    if (!(done & GPRS_STARTED)) {
+      // Start Task and Set APN, USER NAME, PASSWORD
+      sendAT(GF("+CSTT=\""), apn, GF("\",\""), user, GF("\",\""), pwd, GF("\""));
+      if (waitResponse(60000L) != 1) {
+        return false;
+      }
     }
 
-    // Bring Up Wireless Connection with GPRS or CSD
-    sendAT(GF("+CIICR"));
-    if (waitResponse(60000L) != 1) {
-      return false;
+    if (!(done & GPRS_ACTIVE)) {
+      // Bring Up Wireless Connection with GPRS or CSD
+      sendAT(GF("+CIICR"));
+      if (waitResponse(60000L) != 1) {
+        return false;
+      }
     }
 
-    // Get Local IP Address, only assigned after connection
-    sendAT(GF("+CIFSR;E0"));
-    if (waitResponse(10000L) != 1) {
-      return false;
+    if (!(done & GPRS_HAS_IP)) {
+      // Get Local IP Address, only assigned after connection
+      sendAT(GF("+CIFSR;E0"));
+      if (waitResponse(10000L) != 1) {
+        return false;
+      }
     }
 
-    // Configure Domain Name Server (DNS)
-    sendAT(GF("+CDNSCFG=\"8.8.8.8\",\"8.8.4.4\""));
-    if (waitResponse() != 1) {
-      return false;
-    }
+    return configureDns();
+  }
 
-    return true;
+  // Selects transparent mode, with a single GsmClientTransparent socket and
+  // no other clients, for the next gprsConnect()
+  void setTransparentMode(bool enable) {
+    transparentMode = enable;
   }
 
   bool gprsDisconnect() {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
+    if (dataMode) {
+      modemEscape();
+    }
     // Shut the TCP/IP connection
     // CIPSHUT will close *all* open connections
     sendAT(GF("+CIPSHUT"));
@@ -455,7 +688,8 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     return true;
   }
 
-  bool isGprsConnected() {
+  bool modemIsGprsConnected() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CGATT?"));
     if (waitResponse(GF(GSM_NL "+CGATT:")) != 1) {
       return false;
@@ -472,11 +706,14 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     return true;
   }
 
+TINY_GSM_MODEM_CACHED_GPRS()
+
   /*
    * IP Address functions
    */
 
   String getLocalIP() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CIFSR;E0"));
     String res;
     if (waitResponse(10000L, res) != 1) {
@@ -492,22 +729,27 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     return TinyGsmIpFromString(getLocalIP());
   }
 
+TINY_GSM_MODEM_DNS_CACHE()
+
   /*
    * Phone Call functions
    */
 
   bool setGsmBusy(bool busy = true) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+GSMBUSY="), busy ? 1 : 0);
     return waitResponse() == 1;
   }
 
   bool callAnswer() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("A"));
     return waitResponse() == 1;
   }
 
   // Returns true on pick-up, false on error/busy
   bool callNumber(const String& number) {
+    TinyGsmTransaction transaction(at_lock);
     if (number == GF("last")) {
       sendAT(GF("DL"));
     } else {
@@ -527,12 +769,14 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   bool callHangup() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("H"));
     return waitResponse() == 1;
   }
 
   // 0-9,*,#,A,B,C,D
   bool dtmfSend(char cmd, int duration_ms = 100) {
+    TinyGsmTransaction transaction(at_lock);
     duration_ms = constrain(duration_ms, 100, 1000);
 
     sendAT(GF("+VTD="), duration_ms / 100); // VTD accepts in 1/10 of a second
@@ -547,10 +791,9 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
    */
 
   String sendUSSD(const String& code) {
-    sendAT(GF("+CMGF=1"));
-    waitResponse();
-    sendAT(GF("+CSCS=\"HEX\""));
-    waitResponse();
+    TinyGsmTransaction transaction(at_lock);
+    modemSet(settings.cmgf, 1, GF("+CMGF=1"));
+    modemSet(settings.cscs, TinyGsmSettings::CSCS_HEX, GF("+CSCS=\"HEX\""));
     sendAT(GF("+CUSD=1,\""), code, GF("\""));
     if (waitResponse() != 1) {
       return "";
@@ -573,11 +816,10 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   bool sendSMS(const String& number, const String& text) {
-    sendAT(GF("+CMGF=1"));
-    waitResponse();
+    TinyGsmTransaction transaction(at_lock);
+    modemSet(settings.cmgf, 1, GF("+CMGF=1"));
     //Set GSM 7 bit default alphabet (3GPP TS 23.038)
-    sendAT(GF("+CSCS=\"GSM\""));
-    waitResponse();
+    modemSet(settings.cscs, TinyGsmSettings::CSCS_GSM, GF("+CSCS=\"GSM\""));
     sendAT(GF("+CMGS=\""), number, GF("\""));
     if (waitResponse(GF(">")) != 1) {
       return false;
@@ -589,12 +831,10 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   bool sendSMS_UTF16(const String& number, const void* text, size_t len) {
-    sendAT(GF("+CMGF=1"));
-    waitResponse();
-    sendAT(GF("+CSCS=\"HEX\""));
-    waitResponse();
-    sendAT(GF("+CSMP=17,167,0,8"));
-    waitResponse();
+    TinyGsmTransaction transaction(at_lock);
+    modemSet(settings.cmgf, 1, GF("+CMGF=1"));
+    modemSet(settings.cscs, TinyGsmSettings::CSCS_HEX, GF("+CSCS=\"HEX\""));
+    modemSet(settings.csmp, 8, GF("+CSMP=17,167,0,8"));
 
     sendAT(GF("+CMGS=\""), number, GF("\""));
     if (waitResponse(GF(">")) != 1) {
@@ -621,6 +861,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
    */
 
   String getGsmLocation() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CIPGSMLOC=1,1"));
     if (waitResponse(10000L, GF(GSM_NL "+CIPGSMLOC:")) != 1) {
       return "";
@@ -636,6 +877,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
    */
 
   String getGSMDateTime(TinyGSMDateTimeFormat format) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CCLK?"));
     if (waitResponse(2000L, GF(GSM_NL "+CCLK: \"")) != 1) {
       return "";
@@ -662,51 +904,12 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
    * Battery & temperature functions
    */
 
-  // Use: float vBatt = modem.getBattVoltage() / 1000.0;
-  uint16_t getBattVoltage() {
-    sendAT(GF("+CBC"));
-    if (waitResponse(GF(GSM_NL "+CBC:")) != 1) {
-      return 0;
-    }
-    streamSkipUntil(','); // Skip battery charge status
-    streamSkipUntil(','); // Skip battery charge level
-    // return voltage in mV
-    uint16_t res = stream.readStringUntil(',').toInt();
-    // Wait for final OK
-    waitResponse();
-    return res;
-  }
-
-  int8_t getBattPercent() {
+  bool modemGetBattStats(uint8_t &chargeState, int8_t &percent, uint16_t &milliVolts) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CBC"));
     if (waitResponse(GF(GSM_NL "+CBC:")) != 1) {
       return false;
     }
-    streamSkipUntil(','); // Skip battery charge status
-    // Read battery charge level
-    int res = stream.readStringUntil(',').toInt();
-    // Wait for final OK
-    waitResponse();
-    return res;
-  }
-
-  uint8_t getBattChargeState() {
-    sendAT(GF("+CBC?"));
-    if (waitResponse(GF(GSM_NL "+CBC:")) != 1) {
-      return false;
-    }
-    // Read battery charge status
-    int res = stream.readStringUntil(',').toInt();
-    // Wait for final OK
-    waitResponse();
-    return res;
-  }
-
-  bool getBattStats(uint8_t &chargeState, int8_t &percent, uint16_t &milliVolts) {
-    sendAT(GF("+CBC?"));
-    if (waitResponse(GF(GSM_NL "+CBC:")) != 1) {
-      return false;
-    }
     chargeState = stream.readStringUntil(',').toInt();
     percent = stream.readStringUntil(',').toInt();
     milliVolts = stream.readStringUntil('\n').toInt();
@@ -715,6 +918,8 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     return true;
   }
 
+TINY_GSM_MODEM_CACHED_BATT()
+
   float getTemperature() TINY_GSM_ATTR_NOT_AVAILABLE;
 
   /*
@@ -723,19 +928,175 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
 
 protected:
 
+  // Each setting the modem is known to have already is skipped
+  bool configureSockets() {
+    TinyGsmTransaction transaction(at_lock);
+    // Leave transparent mode, which would keep +CIPMUX=1 from being set
+    if (configured & CONFIG_TRANSPARENT) {
+      sendAT(GF("+CIPMODE=0"));
+      if (waitResponse() != 1) {
+        return false;
+      }
+      configured &= ~CONFIG_TRANSPARENT;
+    }
+
+    // Set to multi-IP
+    if (!(configured & CONFIG_MUX)) {
+      sendAT(GF("+CIPMUX=1"));
+      if (waitResponse() != 1) {
+        return false;
+      }
+      configured |= CONFIG_MUX;
+    }
+
+    // Put in "quick send" mode (thus no extra "Send OK")
+    if (!(configured & CONFIG_QSEND)) {
+      sendAT(GF("+CIPQSEND=1"));
+      if (waitResponse() != 1) {
+        return false;
+      }
+      configured |= CONFIG_QSEND;
+    }
+
+    // Set to get data manually
+    if (!(configured & CONFIG_RXGET)) {
+      sendAT(GF("+CIPRXGET=1"));
+      if (waitResponse() != 1) {
+        return false;
+      }
+      configured |= CONFIG_RXGET;
+    }
+    return true;
+  }
+
+  // Configure Domain Name Server (DNS)
+  bool configureDns() {
+    TinyGsmTransaction transaction(at_lock);
+    if (!(configured & CONFIG_DNS)) {
+      sendAT(GF("+CDNSCFG=\"8.8.8.8\",\"8.8.4.4\""));
+      if (waitResponse() != 1) {
+        return false;
+      }
+      configured |= CONFIG_DNS;
+    }
+    return true;
+  }
+
+  // Reads the answer to a query of several lines up to its final OK.  URC's
+  // that arrive in the middle of it are handled, and left out of data.
+  bool modemReadAnswer(String& data, uint32_t timeout_ms) {
+    TinyGsmTransaction transaction(at_lock);
+    data.reserve(128);
+    return waitResponse(timeout_ms, data) == 1;
+  }
+
+  // Whether the line starting with `name` in a query's answer holds `value`
+  // (NULL counting as empty)
+  static bool modemAnswerIs(const String& data, const String& name, const char* value) {
+    int start = data.indexOf(name);
+    if (start < 0) {
+      return false;
+    }
+    start += name.length();
+    int end = data.indexOf('\r', start);
+    String found = data.substring(start, end < 0 ? data.length() : end);
+    found.trim();
+    return found == (value ? value : "");
+  }
+
+  // Which GPRS_* stages the modem has been through for this APN and
+  // credentials, or GPRS_STALE if it is somewhere they can't be continued
+  // from.  The socket settings are read back on the way.
+  uint8_t modemGprsProgress(const char* apn, const char* user, const char* pwd) {
+    TinyGsmTransaction transaction(at_lock);
+    uint8_t pdpUrcs = events.pdp_urcs;
+    sendAT(GF("+CIPMUX?;+CIPRXGET?;+CIPQSEND?;+CIPMODE?;+CGATT?;+SAPBR=2,1;+SAPBR=4,1;+CSTT?"));
+    String data;
+    if (!modemReadAnswer(data, 10000L)) {
+      return GPRS_STALE;
+    }
+    configured &= ~(CONFIG_MUX | CONFIG_RXGET | CONFIG_QSEND | CONFIG_TRANSPARENT);
+    if (data.indexOf(GF("+CIPMUX: 1")) >= 0) configured |= CONFIG_MUX;
+    if (data.indexOf(GF("+CIPRXGET: 1")) >= 0) configured |= CONFIG_RXGET;
+    if (data.indexOf(GF("+CIPQSEND: 1")) >= 0) configured |= CONFIG_QSEND;
+    if (data.indexOf(GF("+CIPMODE: 1")) >= 0) configured |= CONFIG_TRANSPARENT;
+
+    uint8_t done = 0;
+    if (data.indexOf(GF("+SAPBR: 1,1,")) >= 0) {
+      // An open bearer can't be given other settings
+      if (!modemAnswerIs(data, GF("APN:"), apn) ||
+          !modemAnswerIs(data, GF("USER:"), user) ||
+          !modemAnswerIs(data, GF("PWD:"), pwd)) {
+        return GPRS_STALE;
+      }
+      done |= GPRS_BEARER;
+    }
+    if (data.indexOf(GF("+CGATT: 1")) >= 0) done |= GPRS_ATTACHED;
+
+    String state = modemGetIpState();
+    if (state == GF("PDP DEACT") || events.pdp_urcs != pdpUrcs) {
+      // The network dropped the context, maybe while we were asking, so
+      // the state read may be from before: the IP stack has to start over,
+      // but the attach and the bearer are still good
+      sendAT(GF("+CIPSHUT"));
+      return waitResponse(60000L) == 1 ? done : (uint8_t)GPRS_STALE;
+    }
+    if (state == GF("IP INITIAL")) {
+      return done;
+    }
+    // Past IP INITIAL, neither +CIPMUX, +CIPMODE nor the task can be changed
+    String task = GF("+CSTT: \"");
+    task += apn;
+    task += GF("\",\"");
+    task += user ? user : "";
+    task += GF("\",\"");
+    task += pwd ? pwd : "";
+    task += '"';
+    if (!(configured & CONFIG_MUX) || (configured & CONFIG_TRANSPARENT) ||
+        data.indexOf(task) < 0) {
+      return GPRS_STALE;
+    }
+    if (state == GF("IP START")) {
+      return done | GPRS_STARTED;
+    }
+    if (state == GF("IP GPRSACT")) {
+      return done | GPRS_STARTED | GPRS_ACTIVE;
+    }
+    if (state == GF("IP STATUS") || state == GF("IP PROCESSING")) {
+      return done | GPRS_STARTED | GPRS_ACTIVE | GPRS_HAS_IP;
+    }
+    // IP CONFIG (+CIICR still running), or no answer
+    return GPRS_STALE;
+  }
+
   bool modemConnect(const char* host, uint16_t port, uint8_t mux,
-                    bool ssl = false, int timeout_s = 75)
+                    bool ssl = false, int timeout_s = 75,
+                    bool udp = false, uint16_t localPort = 0)
  {
+    TinyGsmTransaction transaction(at_lock);
     int rsp;
     uint32_t timeout_ms = ((uint32_t)timeout_s)*1000;
 #if !defined(TINY_GSM_MODEM_SIM900)
-    sendAT(GF("+CIPSSL="), ssl);
-    rsp = waitResponse();
-    if (ssl && rsp != 1) {
+    if (!modemSet(settings.ssl, ssl, GF("+CIPSSL="), ssl) && ssl) {
       return false;
     }
 #endif
-    sendAT(GF("+CIPSTART="), mux, ',', GF("\"TCP"), GF("\",\""), host, GF("\","), port);
+    // Secure connections keep the host name for the certificate check
+    char ipBuf[16];
+    const char* target = ssl ? host : resolvedHost(host, ipBuf);
+    if (udp && (configured & CONFIG_RXGET)) {
+      sendAT(GF("+CIPRXGET=0"));
+      if (waitResponse() != 1) {
+        return false;
+      }
+      configured &= ~CONFIG_RXGET;
+    }
+    if (udp && localPort) {
+      sendAT(GF("+CLPORT="), mux, GF(",\"UDP\","), localPort);
+      waitResponse();
+    }
+    sendAT(GF("+CIPSTART="), mux, ',', udp ? GF("\"UDP") : GF("\"TCP"),
+           GF("\",\""), target, GF("\","), port);
     rsp = waitResponse(timeout_ms,
                        GF("CONNECT OK" GSM_NL),
                        GF("CONNECT FAIL" GSM_NL),
@@ -743,10 +1104,158 @@ protected:
                        GF("ERROR" GSM_NL),
                        GF("CLOSE OK" GSM_NL)   // Happens when HTTPS handshake fails
                       );
+    if (rsp != 1 && target != host) {
+      dnsCache.remove(host);  // The address may have moved
+    }
     return (1 == rsp);
   }
 
+  bool modemConnectTransparent(const char* host, uint16_t port, int timeout_s) {
+    TinyGsmTransaction transaction(at_lock);
+    uint32_t timeout_ms = ((uint32_t)timeout_s)*1000;
+    char ipBuf[16];
+    const char* target = resolvedHost(host, ipBuf);
+    sendAT(GF("+CIPSTART=\"TCP\",\""), target, GF("\","), port);
+    int rsp = waitResponse(timeout_ms,
+                           GF(GSM_NL "CONNECT" GSM_NL),
+                           GF("CONNECT FAIL" GSM_NL),
+                           GF("ALREADY CONNECT" GSM_NL),
+                           GF("ERROR" GSM_NL),
+                           GF("CLOSED" GSM_NL));
+    if (rsp != 1 && target != host) {
+      dnsCache.remove(host);  // The address may have moved
+    }
+    dataMode = (1 == rsp);
+    closedMatch = 0;
+    okMatch = false;
+    return dataMode;
+  }
+
+  // Switches back to command mode; needs a second of silence either side of
+  // the +++ sequence.  What the socket receives until the modem's OK still
+  // goes into its fifo.
+  bool modemEscape() {
+    TinyGsmTransaction transaction(at_lock);
+    if (!dataMode) {
+      return true;
+    }
+    for (uint32_t startMillis = millis(); millis() - startMillis < 1000; ) {
+      modemReadTransparent();
+      if (!dataMode) {
+        return true;  // Closed by the other end meanwhile
+      }
+      TINY_GSM_YIELD();
+    }
+    stream.print(GF("+++"));
+    stream.flush();
+    for (uint32_t startMillis = millis(); dataMode && millis() - startMillis < 2000; ) {
+      modemReadTransparent(true);
+      TINY_GSM_YIELD();
+    }
+    if (!dataMode) {
+      return true;
+    }
+    // The fifo is full; the rest is lost on the way to the OK
+    dataMode = false;
+    closedMatch = 0;
+    okMatch = false;
+    return waitResponse() == 1;
+  }
+
+  bool modemResume() {
+    TinyGsmTransaction transaction(at_lock);
+    if (dataMode) {
+      return true;
+    }
+    sendAT(GF("O"));
+    dataMode = waitResponse(GF(GSM_NL "CONNECT" GSM_NL), GF("NO CARRIER" GSM_NL),
+                            GFP(GSM_ERROR)) == 1;
+    closedMatch = 0;
+    okMatch = false;
+    return dataMode;
+  }
+
+  bool modemCloseTransparent() {
+    TinyGsmTransaction transaction(at_lock);
+    modemEscape();
+    sendAT(GF("+CIPCLOSE=1"));  // Quick close
+    return waitResponse(GF("CLOSE OK" GSM_NL), GFP(GSM_ERROR)) == 1;
+  }
+
+  // Moves the bytes waiting on the UART into the transparent socket's fifo.
+  // The modem marks a hang up by printing CLOSED and dropping back to
+  // command mode, and once `escaping` it answers the +++ with OK, so
+  // anything that could be the start of either is held back until it is
+  // clearly data (or the line goes quiet).
+  void modemReadTransparent(bool escaping = false) {
+    TinyGsmTransaction transaction(at_lock);
+    static const char closed[] = GSM_NL "CLOSED" GSM_NL;
+    static const char ok[] = GSM_NL "OK" GSM_NL;
+    GsmClient* sock = sockets[0];
+    if (!sock) {
+      return;
+    }
+    while (stream.available() && sock->rx.free() > closedMatch) {
+      char c = stream.read();
+      // Both start with the line break, so only the next byte tells them apart
+      if (escaping && closedMatch == 2 && c == ok[2]) {
+        okMatch = true;
+      }
+      const char* held = okMatch ? ok : closed;
+      if (c == held[closedMatch]) {
+        closedMatchMillis = millis();
+        if (held[++closedMatch] == '\0') {
+          closedMatch = 0;
+          dataMode = false;
+          if (okMatch) {
+            okMatch = false;
+            return;
+          }
+          DBG("### Closed in transparent mode");
+          sock->sock_connected = false;
+          return;
+        }
+        continue;
+      }
+      sock->rx.put((const uint8_t*)held, closedMatch);
+      closedMatch = 0;
+      okMatch = false;
+      if (c == closed[0]) {
+        closedMatch = 1;
+        closedMatchMillis = millis();
+        continue;
+      }
+      sock->rx.put(c);
+    }
+    if (closedMatch && !stream.available() && millis() - closedMatchMillis > 100) {
+      sock->rx.put((const uint8_t*)(okMatch ? ok : closed), closedMatch);
+      closedMatch = 0;
+      okMatch = false;
+    }
+  }
+
+  String dnsIpQuery(const char* host) {
+    TinyGsmTransaction transaction(at_lock);
+    sendAT(GF("+CDNSGIP=\""), host, GF("\""));
+    if (waitResponse() != 1) {
+      return "";
+    }
+    if (waitResponse(10000L, GF(GSM_NL "+CDNSGIP:")) != 1) {
+      return "";
+    }
+    if (stream.readStringUntil(',').toInt() != 1) {
+      streamSkipUntil('\n');
+      return "";
+    }
+    streamSkipUntil(',');  // Skip the quoted host name
+    streamSkipUntil('"');
+    String res = stream.readStringUntil('"');
+    streamSkipUntil('\n');  // Skip any secondary address
+    return res;
+  }
+
   int16_t modemSend(const void* buff, size_t len, uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CIPSEND="), mux, ',', len);
     if (waitResponse(GF(">")) != 1) {
       return 0;
@@ -761,6 +1270,7 @@ protected:
   }
 
   size_t modemRead(size_t size, uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
 #ifdef TINY_GSM_USE_HEX
     sendAT(GF("+CIPRXGET=3,"), mux, ',', size);
     if (waitResponse(GF("+CIPRXGET:")) != 1) {
@@ -801,7 +1311,22 @@ protected:
     return len_requested;
   }
 
+  size_t modemReadDatagram(uint8_t mux) {
+    GsmClient* sock = sockets[mux];
+    if (!sock) {
+      return 0;
+    }
+    // Datagrams are pushed to us with +RECEIVE, which maintain() picks up
+    if (!sock->packets.readable()) {
+      maintain();
+    }
+    uint16_t len = 0;
+    sock->packets.get(&len);
+    return len;
+  }
+
   size_t modemGetAvailable(uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CIPRXGET=4,"), mux);
     size_t result = 0;
     if (waitResponse(GF("+CIPRXGET:")) == 1) {
@@ -812,12 +1337,13 @@ protected:
     }
     DBG("### Available:", result, "on", mux);
     if (!result) {
-      sockets[mux]->sock_connected = modemGetConnected(mux);
+      modemCheckConnected();
     }
     return result;
   }
 
   bool modemGetConnected(uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CIPSTATUS="), mux);
     waitResponse(GF("+CIPSTATUS"));
     int res = waitResponse(GF(",\"CONNECTED\""), GF(",\"CLOSED\""), GF(",\"CLOSING\""),
@@ -826,6 +1352,40 @@ protected:
     return 1 == res;
   }
 
+  void modemGetConnectedAll() {
+    modemGetIpState();
+  }
+
+  // A plain +CIPSTATUS gives the state of the IP stack after the OK and,
+  // with multi-IP on, then lists connections 0-5 in one go:
+  // STATE: <state>
+  // C: <n>,<bearer>,<TCP/UDP>,<IP address>,<port>,<client state>
+  String modemGetIpState() {
+    TinyGsmTransaction transaction(at_lock);
+    sendAT(GF("+CIPSTATUS"));
+    if (waitResponse() != 1 || waitResponse(GF("STATE: ")) != 1) {
+      return "";
+    }
+    String state = stream.readStringUntil('\n');
+    state.trim();
+    if (!(configured & CONFIG_MUX)) {
+      return state;
+    }
+    for (int i = 0; i < 6; i++) {
+      if (waitResponse(GF(GSM_NL "C: ")) != 1) {
+        break;
+      }
+      String line = stream.readStringUntil('\n');
+      int mux = line.toInt();
+      if (mux >= 0 && mux < MUX_COUNT && sockets[mux]) {
+        sockets[mux]->sock_connected = line.indexOf(GF("\"CONNECTED\"")) >= 0;
+      }
+    }
+    return state;
+  }
+
+TINY_GSM_MODEM_CHECK_CONNECTED_THROTTLED()
+
 public:
 
   /*
@@ -835,6 +1395,7 @@ public:
 TINY_GSM_MODEM_STREAM_UTILITIES()
 
   // TODO: Optimize this!
+  // Each URC is cut out of data, so the lines of an answer around it stay.
   uint8_t waitResponse(uint32_t timeout_ms, String& data,
                        GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
                        GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
@@ -845,6 +1406,7 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
     String r4s(r4); r4s.trim();
     String r5s(r5); r5s.trim();
     DBG("### ..:", r1s, ",", r2s, ",", r3s, ",", r4s, ",", r5s);*/
+    at_lock.begin();
     data.reserve(64);
     int index = 0;
     unsigned long startMillis = millis();
@@ -870,39 +1432,88 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
           index = 5;
           goto finish;
         } else if (data.endsWith(GF(GSM_NL "+CIPRXGET:"))) {
-          String mode = stream.readStringUntil(',');
-          if (mode.toInt() == 1) {
-            int mux = stream.readStringUntil('\n').toInt();
-            if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
+          // "+CIPRXGET: 1,<mux>" announces data; "+CIPRXGET: 1" alone is
+          // the answer to +CIPRXGET?
+          String urc = stream.readStringUntil('\n');
+          int comma = urc.indexOf(',');
+          if (urc.toInt() == 1 && comma >= 0) {
+            int mux = urc.substring(comma + 1).toInt();
+            if (mux >= 0 && mux < MUX_COUNT && sockets[mux]) {
               sockets[mux]->got_data = true;
             }
-            data = "";
+            data.remove(data.lastIndexOf(GSM_NL));
             DBG("### Got Data:", mux);
           } else {
-            data += mode;
+            data += urc;
+            data += '\n';
           }
-        } else if (data.endsWith(GF(GSM_NL "+RECEIVE:"))) {
+        } else if (data.endsWith(GF(GSM_NL "+RECEIVE,"))) {
+          // Pushed data (+CIPRXGET=0), as a GsmUdp sets up
           int mux = stream.readStringUntil(',').toInt();
-          int len = stream.readStringUntil('\n').toInt();
-          if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
-            sockets[mux]->got_data = true;
-            sockets[mux]->sock_available = len;
+          int len = stream.readStringUntil(':').toInt();
+          int len_orig = len;
+          streamSkipUntil('\n');
+          if (mux < 0 || mux >= MUX_COUNT || !sockets[mux]) {
+            DBG("### Data dropped: ", len, "on", mux);
+            while (len-- > 0) {
+              uint32_t startMillis = millis();
+              while (!stream.available() && (millis() - startMillis < 1000)) { TINY_GSM_YIELD(); }
+              stream.read();
+            }
+            data.remove(data.lastIndexOf(GSM_NL));
+            continue;
+          }
+          if (sockets[mux]->sock_udp && (len > sockets[mux]->rx.free() ||
+                                         !sockets[mux]->packets.writeable())) {
+            // A datagram is delivered whole or not at all
+            DBG("### Datagram dropped: ", len, "on", mux);
+            while (len--) {
+              uint32_t startMillis = millis();
+              while (!stream.available() && (millis() - startMillis < sockets[mux]->_timeout)) { TINY_GSM_YIELD(); }
+              stream.read();
+            }
+            data.remove(data.lastIndexOf(GSM_NL));
+            continue;
+          }
+          if (len > sockets[mux]->rx.free()) {
+            DBG("### Buffer overflow: ", len, "received vs", sockets[mux]->rx.free(), "available");
+          } else {
+            DBG("### Got Data: ", len, "on", mux);
           }
-          data = "";
-          DBG("### Got Data:", len, "on", mux);
+          while (len--) {
+            TINY_GSM_MODEM_STREAM_TO_MUX_FIFO_WITH_DOUBLE_TIMEOUT
+          }
+          if (sockets[mux]->sock_udp) {
+            sockets[mux]->packets.put(len_orig);
+          }
+          data.remove(data.lastIndexOf(GSM_NL));
         } else if (data.endsWith(GF("CLOSED" GSM_NL))) {
           int nl = data.lastIndexOf(GSM_NL, data.length()-8);
           int coma = data.indexOf(',', nl+2);
           int mux = data.substring(nl+2, coma).toInt();
-          if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
+          if (mux >= 0 && mux < MUX_COUNT && sockets[mux]) {
             sockets[mux]->sock_connected = false;
           }
-          data = "";
+          data.remove(nl >= 0 ? nl : 0);
           DBG("### Closed: ", mux);
+        } else if (data.endsWith(GF(GSM_NL "+CREG:"))) {
+          modemRegistrationUrc();
+          data.remove(data.lastIndexOf(GSM_NL));
+        } else if (data.endsWith(GF(GSM_NL "+CPIN:"))) {
+          modemSimUrc();
+          data.remove(data.lastIndexOf(GSM_NL));
+        } else if (data.endsWith(GF(GSM_NL "+PDP: DEACT"))) {
+          modemPdpDeactivatedUrc();
+          data.remove(data.lastIndexOf(GSM_NL));
+        } else if (data.endsWith(GF(GSM_NL "RDY" GSM_NL))) {
+          modemBootUrc();
+          configured = 0;
+          data.remove(data.lastIndexOf(GSM_NL "RDY"));
         }
       }
     } while (millis() - startMillis < timeout_ms);
 finish:
+    TINY_GSM_MODEM_END_TRANSACTION();
     if (!index) {
       data.trim();
       if (data.length()) {
@@ -933,7 +1544,33 @@ public:
   Stream&       stream;
 
 protected:
-  GsmClient*    sockets[TINY_GSM_MUX_COUNT];
+  GsmClient*    sockets[MUX_COUNT];
+  TinyGsmModemEvents events;
+  TinyGsmIdentity    identity;
+  TinyGsmMetrics     metrics;
+  TinyGsmSettings    settings;
+  TinyGsmDnsCache<TINY_GSM_DNS_CACHE_SIZE> dnsCache;
+  TinyGsmTransactionLock at_lock;
+  uint32_t      prev_state_check;
+  bool          transparentMode;  // set up for a GsmClientTransparent socket
+  bool          dataMode;  // the transparent socket owns the UART
+  uint8_t       closedMatch;  // bytes held back that may be "CLOSED"...
+  bool          okMatch;  // ...or, after +++, the OK
+  uint32_t      closedMatchMillis;
+  uint8_t       configured;  // CONFIG_* settings the modem already has
 };
 
+// The first driver included also provides its registration states
+// unqualified, as when only one driver could be built
+#if !defined(TINY_GSM_REG_STATUS_DEFINED)
+#define TINY_GSM_REG_STATUS_DEFINED
+typedef TinyGsmSim800::RegStatus RegStatus;
+static const RegStatus REG_UNREGISTERED = TinyGsmSim800::REG_UNREGISTERED;
+static const RegStatus REG_SEARCHING    = TinyGsmSim800::REG_SEARCHING;
+static const RegStatus REG_DENIED       = TinyGsmSim800::REG_DENIED;
+static const RegStatus REG_OK_HOME      = TinyGsmSim800::REG_OK_HOME;
+static const RegStatus REG_OK_ROAMING   = TinyGsmSim800::REG_OK_ROAMING;
+static const RegStatus REG_UNKNOWN      = TinyGsmSim800::REG_UNKNOWN;
+#endif
+
 #endif
@@ -28,6 +28,7 @@ public:
 
   // enable GPS
   bool enableGPS() {
+    TinyGsmTransaction transaction(at_lock);
     // uint16_t state;
 
     sendAT(GF("+CGNSPWR=1"));
@@ -39,6 +40,7 @@ public:
   }
 
   bool disableGPS() {
+    TinyGsmTransaction transaction(at_lock);
     // uint16_t state;
 
     sendAT(GF("+CGNSPWR=0"));
@@ -52,6 +54,7 @@ public:
   // get the RAW GPS output
   // works only with ans SIM808 V2
   String getGPSraw() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CGNSINF"));
     if (waitResponse(GF(GSM_NL "+CGNSINF:")) != 1) {
       return "";
@@ -65,6 +68,7 @@ public:
   // get GPS informations
   // works only with ans SIM808 V2
   bool getGPS(float *lat, float *lon, float *speed=0, int *alt=0, int *vsat=0, int *usat=0) {
+    TinyGsmTransaction transaction(at_lock);
     //String buffer = "";
     // char chr_buffer[12];
     bool fix = false;
@@ -100,6 +104,7 @@ public:
   // get GPS time
   // works only with SIM808 V2
   bool getGPSTime(int *year, int *month, int *day, int *hour, int *minute, int *second) {
+    TinyGsmTransaction transaction(at_lock);
     bool fix = false;
     char chr_buffer[12];
     sendAT(GF("+CGNSINF"));
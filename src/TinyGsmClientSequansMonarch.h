@@ -12,32 +12,14 @@
 //#define TINY_GSM_DEBUG Serial
 //#define TINY_GSM_USE_HEX
 
-#if !defined(TINY_GSM_RX_BUFFER)
-  #define TINY_GSM_RX_BUFFER 64
-#endif
-
-#define TINY_GSM_MUX_COUNT 6
-
 #include <TinyGsmCommon.h>
 
+#undef GSM_NL
+#undef GSM_OK
+#undef GSM_ERROR
 #define GSM_NL "\r\n"
-static const char GSM_OK[] TINY_GSM_PROGMEM = "OK" GSM_NL;
-static const char GSM_ERROR[] TINY_GSM_PROGMEM = "ERROR" GSM_NL;
-
-enum SimStatus {
-  SIM_ERROR = 0,
-  SIM_READY = 1,
-  SIM_LOCKED = 2,
-};
-
-enum RegStatus {
-  REG_UNREGISTERED = 0,
-  REG_SEARCHING    = 2,
-  REG_DENIED       = 3,
-  REG_OK_HOME      = 1,
-  REG_OK_ROAMING   = 5,
-  REG_UNKNOWN      = 4,
-};
+#define GSM_OK GSM_CRLF_OK
+#define GSM_ERROR GSM_CRLF_ERROR
 
 enum SocketStatus {
   SOCK_CLOSED                 = 0,
@@ -55,10 +37,21 @@ class TinyGsmSequansMonarch
 
 public:
 
+enum { MUX_COUNT = 6 };
+
+enum RegStatus {
+  REG_UNREGISTERED = 0,
+  REG_SEARCHING    = 2,
+  REG_DENIED       = 3,
+  REG_OK_HOME      = 1,
+  REG_OK_ROAMING   = 5,
+  REG_UNKNOWN      = 4,
+};
+
 class GsmClient : public Client
 {
   friend class TinyGsmSequansMonarch;
-  typedef TinyGsmFifo<uint8_t, TINY_GSM_RX_BUFFER> RxFifo;
+  typedef TinyGsmLockedFifo<uint8_t, TINY_GSM_RX_BUFFER_OR(64)> RxFifo;
 
 public:
   GsmClient() {}
@@ -77,7 +70,7 @@ public:
 
     // adjust for zero indexed socket array vs Sequans' 1 indexed mux numbers
     // using modulus will force 6 back to 0
-    at->sockets[mux % TINY_GSM_MUX_COUNT] = this;
+    at->modemSetSocket(mux % MUX_COUNT, this);
 
     return true;
   }
@@ -120,6 +113,8 @@ TINY_GSM_CLIENT_READ_WITH_BUFFER_CHECK()
 
 TINY_GSM_CLIENT_PEEK_FLUSH_CONNECTED()
 
+TINY_GSM_CLIENT_EVENTS()
+
   /*
    * Extended API
    */
@@ -134,6 +129,7 @@ private:
   bool            sock_connected;
   bool            got_data;
   RxFifo          rx;
+  TinyGsmClientEvents events;
 };
 
 
@@ -187,6 +183,7 @@ public:
   TinyGsmSequansMonarch(Stream& stream)
     : stream(stream)
   {
+    prev_state_check = 0;
     memset(sockets, 0, sizeof(sockets));
   }
 
@@ -199,10 +196,12 @@ public:
   }
 
   bool init(const char* pin = NULL) {
+    TinyGsmTransaction transaction(at_lock);
     DBG(GF("### TinyGSM Version:"), TINYGSM_VERSION);
     if (!testAT()) {
       return false;
     }
+    settings.clear();
     sendAT(GF("E0"));   // Echo Off
     if (waitResponse() != 1) {
       return false;
@@ -211,7 +210,7 @@ public:
     return true;
   }
 
-  String getModemName() {
+  String modemGetName() {
     return "Sequans Monarch";
   }
 
@@ -220,21 +219,28 @@ TINY_GSM_MODEM_SET_BAUD_IPR()
 TINY_GSM_MODEM_TEST_AT()
 
   void maintain() {
-    for (int mux = 1; mux <= TINY_GSM_MUX_COUNT; mux++) {
-      GsmClient* sock = sockets[mux % TINY_GSM_MUX_COUNT];
+    TinyGsmTransaction transaction(at_lock);
+    for (int mux = 1; mux <= MUX_COUNT; mux++) {
+      GsmClient* sock = sockets[mux % MUX_COUNT];
       if (sock && sock->got_data) {
         sock->got_data = false;
         sock->sock_available = modemGetAvailable(mux);
-        // modemGetConnected() always checks the state of ALL socks
-        modemGetConnected();
+        // +SQNSS always checks the state of ALL socks
+        modemCheckConnected();
       }
     }
     while (stream.available()) {
       waitResponse(15, NULL, NULL);
+    }
+    modemDispatchEvents();
   }
-  }
+
+TINY_GSM_MODEM_POLL_SOCKS()
+
+TINY_GSM_MODEM_EVENTS()
 
   bool factoryDefault() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("&FZE0&W"));  // Factory + Reset + Echo Off + Write
     waitResponse();
     sendAT(GF("+IPR=0"));   // Auto-baud
@@ -259,7 +265,13 @@ TINY_GSM_MODEM_GET_INFO_ATI()
    * Power functions
    */
 
+TINY_GSM_MODEM_WAIT_FOR_READY()
+
   bool restart() {
+    TinyGsmTransaction transaction(at_lock);
+    identity.clear();
+    metrics.clear();
+    settings.clear();
     if (!testAT()) {
       return false;
     }
@@ -275,21 +287,25 @@ TINY_GSM_MODEM_GET_INFO_ATI()
     if (res != 1 && res != 3) {
       return false;
     }
-    delay(1000);
+    if (!waitForReady()) {
+      return false;
+    }
     return init();
   }
 
   bool poweroff() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+SQNSSHDN"));
     return waitResponse();
   }
 
   bool radioOff() {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.clear();
     sendAT(GF("+CFUN=0"));
     if (waitResponse(10000L) != 1) {
       return false;
     }
-    delay(3000);
     return true;
   }
 
@@ -301,6 +317,7 @@ TINY_GSM_MODEM_GET_INFO_ATI()
    as DTE set RTS line to OFF state (driver high level).
   */
   bool sleepEnable(bool enable = true) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+SQNIPSCFG="), enable);
     return waitResponse() == 1;
   }
@@ -311,7 +328,8 @@ TINY_GSM_MODEM_GET_INFO_ATI()
 
 TINY_GSM_MODEM_SIM_UNLOCK_CPIN()
 
-  String getSimCCID() {
+  String modemGetSimCCID() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+SQNCCID"));
     if (waitResponse(GF(GSM_NL "+SQNCCID:")) != 1) {
       return "";
@@ -324,27 +342,14 @@ TINY_GSM_MODEM_SIM_UNLOCK_CPIN()
 
 TINY_GSM_MODEM_GET_IMEI_GSN()
 
-  SimStatus getSimStatus(unsigned long timeout_ms = 10000L) {
-    for (unsigned long start = millis(); millis() - start < timeout_ms; ) {
-      sendAT(GF("+CPIN?"));
-      if (waitResponse(GF(GSM_NL "+CPIN:")) != 1) {
-        delay(1000);
-        continue;
-      }
-      int status = waitResponse(GF("READY"), GF("SIM PIN"), GF("SIM PUK"), GF("NOT INSERTED"));
-      waitResponse();
-      switch (status) {
-      case 2:
-      case 3:  return SIM_LOCKED;
-      case 1:  return SIM_READY;
-      default: return SIM_ERROR;
-      }
-    }
-    return SIM_ERROR;
-  }
+TINY_GSM_MODEM_IDENTITY()
+
+TINY_GSM_MODEM_GET_SIM_STATUS_CPIN()
 
 TINY_GSM_MODEM_GET_REGISTRATION_XREG(CEREG)
 
+TINY_GSM_MODEM_NETWORK_EVENTS(CEREG)
+
 TINY_GSM_MODEM_GET_OPERATOR_COPS()
 
   /*
@@ -363,13 +368,15 @@ TINY_GSM_MODEM_GET_CSQ()
     }
   }
 
-TINY_GSM_MODEM_WAIT_FOR_NETWORK()
+TINY_GSM_MODEM_WAIT_FOR_NETWORK_URC(CEREG)
 
   /*
    * GPRS functions
    */
 
   bool gprsConnect(const char* apn, const char* user = NULL, const char* pwd = NULL) {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
     gprsDisconnect();
 
     // Define the PDP context (This uses context #3!)
@@ -395,6 +402,8 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   bool gprsDisconnect() {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
     sendAT(GF("+CGATT=0"));
     if (waitResponse(60000L) != 1)
       return false;
@@ -402,7 +411,8 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     return true;
   }
 
-  bool isGprsConnected() {
+  bool modemIsGprsConnected() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CGATT?"));
     if (waitResponse(GF(GSM_NL "+CGATT:")) != 1) {
       return false;
@@ -415,12 +425,15 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
     return true;
   }
 
+TINY_GSM_MODEM_CACHED_GPRS()
+
 
   /*
    * IP Address functions
    */
 
   String getLocalIP() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CGPADDR=3"));
     if (waitResponse(10000L, GF("+CGPADDR: 3,\"")) != 1) {
       return "";
@@ -450,11 +463,10 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   String sendUSSD(const String& code) TINY_GSM_ATTR_NOT_IMPLEMENTED;
 
   bool sendSMS(const String& number, const String& text) {
-    sendAT(GF("+CMGF=1"));
-    waitResponse();
+    TinyGsmTransaction transaction(at_lock);
+    modemSet(settings.cmgf, 1, GF("+CMGF=1"));
     //Set GSM 7 bit default alphabet (3GPP TS 23.038)
-    sendAT(GF("+CSCS=\"GSM\""));
-    waitResponse();
+    modemSet(settings.cscs, TinyGsmSettings::CSCS_GSM, GF("+CSCS=\"GSM\""));
     sendAT(GF("+CMGS=\""), number, GF("\""));
     if (waitResponse(GF(">")) != 1) {
       return false;
@@ -484,6 +496,7 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   bool getBattStats(uint8_t &chargeState, int8_t &percent, uint16_t &milliVolts) TINY_GSM_ATTR_NOT_AVAILABLE;
 
   float getTemperature() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+SMDTH"));
     if (waitResponse(10000L, GF("+SMDTH: ")) != 1) {
       return (float)-9999;
@@ -503,6 +516,7 @@ protected:
   bool modemConnect(const char* host, uint16_t port, uint8_t mux,
                     bool ssl = false, int timeout_s = 75)
  {
+    TinyGsmTransaction transaction(at_lock);
     int rsp;
     unsigned long startMillis = millis();
     uint32_t timeout_ms = ((uint32_t)timeout_s)*1000;
@@ -570,7 +584,8 @@ protected:
 
 
   int modemSend(const void* buff, size_t len, uint8_t mux) {
-    if (sockets[mux % TINY_GSM_MUX_COUNT]->sock_connected == false) {
+    TinyGsmTransaction transaction(at_lock);
+    if (sockets[mux % MUX_COUNT]->sock_connected == false) {
       DBG("### Sock closed, cannot send data!");
       return 0;
     }
@@ -610,6 +625,7 @@ protected:
 
 
   size_t modemRead(size_t size, uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+SQNSRECV="), mux, ',', size);
     if (waitResponse(GF("+SQNSRECV: ")) != 1) {
       return 0;
@@ -618,17 +634,18 @@ protected:
     size_t len = stream.readStringUntil('\n').toInt();
     for (size_t i=0; i<len; i++) {
       uint32_t startMillis = millis(); \
-      while (!stream.available() && ((millis() - startMillis) < sockets[mux % TINY_GSM_MUX_COUNT]->_timeout)) { TINY_GSM_YIELD(); } \
+      while (!stream.available() && ((millis() - startMillis) < sockets[mux % MUX_COUNT]->_timeout)) { TINY_GSM_YIELD(); } \
       char c = stream.read(); \
-      sockets[mux % TINY_GSM_MUX_COUNT]->rx.put(c);
+      sockets[mux % MUX_COUNT]->rx.put(c);
     }
     DBG("### Read:", len, "from", mux);
     waitResponse();
-    sockets[mux % TINY_GSM_MUX_COUNT]->sock_available = modemGetAvailable(mux);
+    sockets[mux % MUX_COUNT]->sock_available = modemGetAvailable(mux);
     return len;
   }
 
   size_t modemGetAvailable(uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+SQNSI="), mux);
     size_t result = 0;
     if (waitResponse(GF("+SQNSI:")) == 1) {
@@ -643,10 +660,17 @@ protected:
   }
 
   bool modemGetConnected(uint8_t mux = 1) {
+    modemGetConnectedAll();
+    GsmClient* sock = sockets[mux % MUX_COUNT];
+    return sock && sock->sock_connected;
+  }
+
+  void modemGetConnectedAll() {
+    TinyGsmTransaction transaction(at_lock);
     // This single command always returns the connection status of all
     // six possible sockets.
     sendAT(GF("+SQNSS"));
-    for (int muxNo = 1; muxNo <= TINY_GSM_MUX_COUNT; muxNo++) {
+    for (int muxNo = 1; muxNo <= MUX_COUNT; muxNo++) {
       if (waitResponse(GFP(GSM_OK), GF(GSM_NL "+SQNSS: ")) != 2) {
         break;
       };
@@ -666,13 +690,18 @@ protected:
       // SOCK_LISTENING              = 4,
       // SOCK_INCOMING               = 5,
       // SOCK_OPENING                = 6,
-      sockets[muxNo % TINY_GSM_MUX_COUNT]->sock_connected = \
-        ((status != SOCK_CLOSED) && (status != SOCK_INCOMING) && (status != SOCK_OPENING));
+      GsmClient* sock = sockets[muxNo % MUX_COUNT];
+      if (sock) {
+        sock->sock_connected = ((status != SOCK_CLOSED) &&
+                                (status != SOCK_INCOMING) &&
+                                (status != SOCK_OPENING));
+      }
     }
     waitResponse();  // Should be an OK at the end
-    return sockets[mux % TINY_GSM_MUX_COUNT]->sock_connected;
   }
 
+TINY_GSM_MODEM_CHECK_CONNECTED_THROTTLED()
+
 public:
 
   /*
@@ -692,6 +721,7 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
     String r4s(r4); r4s.trim();
     String r5s(r5); r5s.trim();
     DBG("### ..:", r1s, ",", r2s, ",", r3s, ",", r4s, ",", r5s);*/
+    at_lock.begin();
     data.reserve(64);
     int index = 0;
     unsigned long startMillis = millis();
@@ -720,23 +750,33 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
         } else if (data.endsWith(GF(GSM_NL "+SQNSRING:"))) {
           int mux = stream.readStringUntil(',').toInt();
           int len = stream.readStringUntil('\n').toInt();
-          if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux % TINY_GSM_MUX_COUNT]) {
-            sockets[mux % TINY_GSM_MUX_COUNT]->got_data = true;
-            sockets[mux % TINY_GSM_MUX_COUNT]->sock_available = len;
+          if (mux >= 0 && mux < MUX_COUNT && sockets[mux % MUX_COUNT]) {
+            sockets[mux % MUX_COUNT]->got_data = true;
+            sockets[mux % MUX_COUNT]->sock_available = len;
           }
           data = "";
           DBG("### URC Data Received:", len, "on", mux);
         } else if (data.endsWith(GF("SQNSH: "))) {
           int mux = stream.readStringUntil('\n').toInt();
-          if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux % TINY_GSM_MUX_COUNT]) {
-            sockets[mux % TINY_GSM_MUX_COUNT]->sock_connected = false;
+          if (mux >= 0 && mux < MUX_COUNT && sockets[mux % MUX_COUNT]) {
+            sockets[mux % MUX_COUNT]->sock_connected = false;
           }
           data = "";
           DBG("### URC Sock Closed: ", mux);
+        } else if (data.endsWith(GF(GSM_NL "+CEREG:"))) {
+          modemRegistrationUrc();
+          data = "";
+        } else if (data.endsWith(GF(GSM_NL "+CPIN:"))) {
+          modemSimUrc();
+          data = "";
+        } else if (data.endsWith(GF(GSM_NL "+SYSSTART"))) {
+          modemBootUrc();
+          data = "";
         }
       }
     } while (millis() - startMillis < timeout_ms);
 finish:
+    TINY_GSM_MODEM_END_TRANSACTION();
     if (!index) {
       data.trim();
       if (data.length()) {
@@ -767,7 +807,26 @@ public:
   Stream&       stream;
 
 protected:
-  GsmClient*    sockets[TINY_GSM_MUX_COUNT];
+  GsmClient*    sockets[MUX_COUNT];
+  TinyGsmModemEvents events;
+  TinyGsmIdentity    identity;
+  TinyGsmMetrics     metrics;
+  TinyGsmSettings    settings;
+  uint32_t      prev_state_check;
+  TinyGsmTransactionLock at_lock;
 };
 
+// The first driver included also provides its registration states
+// unqualified, as when only one driver could be built
+#if !defined(TINY_GSM_REG_STATUS_DEFINED)
+#define TINY_GSM_REG_STATUS_DEFINED
+typedef TinyGsmSequansMonarch::RegStatus RegStatus;
+static const RegStatus REG_UNREGISTERED = TinyGsmSequansMonarch::REG_UNREGISTERED;
+static const RegStatus REG_SEARCHING    = TinyGsmSequansMonarch::REG_SEARCHING;
+static const RegStatus REG_DENIED       = TinyGsmSequansMonarch::REG_DENIED;
+static const RegStatus REG_OK_HOME      = TinyGsmSequansMonarch::REG_OK_HOME;
+static const RegStatus REG_OK_ROAMING   = TinyGsmSequansMonarch::REG_OK_ROAMING;
+static const RegStatus REG_UNKNOWN      = TinyGsmSequansMonarch::REG_UNKNOWN;
+#endif
+
 #endif
@@ -12,24 +12,24 @@
 
 //#define TINY_GSM_DEBUG Serial
 
-#if !defined(TINY_GSM_RX_BUFFER)
-  #define TINY_GSM_RX_BUFFER 64
-#endif
-
-#define TINY_GSM_MUX_COUNT 7
-
 #include <TinyGsmCommon.h>
 
+#undef GSM_NL
+#undef GSM_OK
+#undef GSM_ERROR
+#undef GSM_CME_ERROR
 #define GSM_NL "\r\n"
-static const char GSM_OK[] TINY_GSM_PROGMEM = "OK" GSM_NL;
-static const char GSM_ERROR[] TINY_GSM_PROGMEM = "ERROR" GSM_NL;
-static const char GSM_CME_ERROR[] TINY_GSM_PROGMEM = GSM_NL "+CME ERROR:";
-
-enum SimStatus {
-  SIM_ERROR = 0,
-  SIM_READY = 1,
-  SIM_LOCKED = 2,
-};
+#define GSM_OK GSM_CRLF_OK
+#define GSM_ERROR GSM_CRLF_ERROR
+#define GSM_CME_ERROR GSM_CRLF_CME_ERROR
+
+
+class TinyGsmUBLOX
+{
+
+public:
+
+enum { MUX_COUNT = 7 };
 
 enum RegStatus {
   REG_UNREGISTERED = 0,
@@ -40,16 +40,13 @@ enum RegStatus {
   REG_UNKNOWN      = 4,
 };
 
-
-class TinyGsmUBLOX
-{
-
-public:
+class GsmUdp;
 
 class GsmClient : public Client
 {
   friend class TinyGsmUBLOX;
-  typedef TinyGsmFifo<uint8_t, TINY_GSM_RX_BUFFER> RxFifo;
+  friend class GsmUdp;
+  typedef TinyGsmLockedFifo<uint8_t, TINY_GSM_RX_BUFFER_OR(64)> RxFifo;
 
 public:
   GsmClient() {}
@@ -66,7 +63,7 @@ public:
     sock_connected = false;
     got_data = false;
 
-    at->sockets[mux] = this;
+    at->modemSetSocket(mux, this);
 
     return true;
   }
@@ -81,9 +78,9 @@ public:
     sock_connected = at->modemConnect(host, port, &mux, false, timeout_s);
     if (mux != oldMux) {
         DBG("WARNING:  Mux number changed from", oldMux, "to", mux);
-        at->sockets[oldMux] = NULL;
+        at->modemSetSocket(oldMux, NULL);
     }
-    at->sockets[mux] = this;
+    at->modemSetSocket(mux, this);
     at->maintain();
 
     return sock_connected;
@@ -116,6 +113,8 @@ TINY_GSM_CLIENT_READ_WITH_BUFFER_CHECK() ;
 
 TINY_GSM_CLIENT_PEEK_FLUSH_CONNECTED()
 
+TINY_GSM_CLIENT_EVENTS()
+
   /*
    * Extended API
    */
@@ -130,6 +129,7 @@ private:
   bool            sock_connected;
   bool            got_data;
   RxFifo          rx;
+  TinyGsmClientEvents events;
 };
 
 
@@ -151,15 +151,68 @@ public:
     sock_connected = at->modemConnect(host, port, &mux, true, timeout_s);
     if (mux != oldMux) {
         DBG("WARNING:  Mux number changed from", oldMux, "to", mux);
-        at->sockets[oldMux] = NULL;
+        at->modemSetSocket(oldMux, NULL);
     }
-    at->sockets[mux] = this;
+    at->modemSetSocket(mux, this);
     at->maintain();
     return sock_connected;
   }
 };
 
 
+class GsmUdp : public UDP
+{
+  friend class TinyGsmUBLOX;
+
+public:
+  GsmUdp() {}
+
+  GsmUdp(TinyGsmUBLOX& modem, uint8_t mux = 0) {
+    init(&modem, mux);
+  }
+
+  bool init(TinyGsmUBLOX* modem, uint8_t mux = 0) {
+    this->at = modem;
+    peer_port = 0;
+    local_port = 0;
+    tx_len = 0;
+    tx_overflow = false;
+    rx_left = 0;
+    return sock.init(modem, mux);
+  }
+
+TINY_GSM_UDP_PACKET_FUNCTIONS()
+
+private:
+  bool connectPeer(const char *host, uint16_t port) {
+    sock.rx.clear();
+    uint8_t oldMux = sock.mux;
+    sock.sock_connected = at->modemConnect(host, port, &sock.mux, false, 120,
+                                           true, local_port);
+    if (sock.mux != oldMux) {
+        DBG("WARNING:  Mux number changed from", oldMux, "to", sock.mux);
+        at->modemSetSocket(oldMux, NULL);
+    }
+    at->modemSetSocket(sock.mux, &sock);
+    return sock.sock_connected;
+  }
+
+  int16_t sendDatagram(const uint8_t* buf, size_t len) {
+    return at->modemSend(buf, len, sock.mux);
+  }
+
+  TinyGsmUBLOX*   at;
+  GsmClient       sock;
+  String          peer_host;
+  uint16_t        peer_port;
+  uint16_t        local_port;
+  uint16_t        tx_len;
+  bool            tx_overflow;
+  uint16_t        rx_left;
+  uint8_t         tx[TINY_GSM_UDP_TX_BUFFER];
+};
+
+
 public:
 
   TinyGsmUBLOX(Stream& stream)
@@ -177,10 +230,12 @@ public:
   }
 
   bool init(const char* pin = NULL) {
+    TinyGsmTransaction transaction(at_lock);
     DBG(GF("### TinyGSM Version:"), TINYGSM_VERSION);
     if (!testAT()) {
       return false;
     }
+    settings.clear();
     sendAT(GF("E0"));   // Echo Off
     if (waitResponse() != 1) {
       return false;
@@ -207,7 +262,8 @@ public:
     }
   }
 
-  String getModemName() {
+  String modemGetName() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CGMI"));
     String res1;
     if (waitResponse(1000L, res1) != 1) {
@@ -242,7 +298,12 @@ TINY_GSM_MODEM_TEST_AT()
 
 TINY_GSM_MODEM_MAINTAIN_CHECK_SOCKS()
 
+TINY_GSM_MODEM_POLL_SOCKS()
+
+TINY_GSM_MODEM_EVENTS()
+
   bool factoryDefault() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+UFACTORY=0,1"));  // No factory restore, erase NVM
     waitResponse();
     sendAT(GF("+CFUN=16"));   // Reset
@@ -267,7 +328,13 @@ TINY_GSM_MODEM_GET_INFO_ATI()
    * Power functions
    */
 
+TINY_GSM_MODEM_WAIT_FOR_READY()
+
   bool restart() {
+    TinyGsmTransaction transaction(at_lock);
+    identity.clear();
+    metrics.clear();
+    settings.clear();
     if (!testAT()) {
       return false;
     }
@@ -275,21 +342,25 @@ TINY_GSM_MODEM_GET_INFO_ATI()
     if (waitResponse(10000L) != 1) {
       return false;
     }
-    delay(3000);  // TODO:  Verify delay timing here
+    if (!waitForReady()) {
+      return false;
+    }
     return init();
   }
 
   bool poweroff() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CPWROFF"));
     return waitResponse(40000L) == 1;
   }
 
   bool radioOff() {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.clear();
     sendAT(GF("+CFUN=0"));
     if (waitResponse(10000L) != 1) {
       return false;
     }
-    delay(3000);
     return true;
   }
 
@@ -303,7 +374,8 @@ TINY_GSM_MODEM_SIM_UNLOCK_CPIN()
 
 TINY_GSM_MODEM_GET_SIMCCID_CCID()
 
-  String getIMEI() {
+  String modemGetIMEI() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CGSN"));
     if (waitResponse(GF(GSM_NL)) != 1) {
       return "";
@@ -314,27 +386,14 @@ TINY_GSM_MODEM_GET_SIMCCID_CCID()
     return res;
   }
 
-  SimStatus getSimStatus(unsigned long timeout_ms = 10000L) {
-    for (unsigned long start = millis(); millis() - start < timeout_ms; ) {
-      sendAT(GF("+CPIN?"));
-      if (waitResponse(GF(GSM_NL "+CPIN:")) != 1) {
-        delay(1000);
-        continue;
-      }
-      int status = waitResponse(GF("READY"), GF("SIM PIN"), GF("SIM PUK"), GF("NOT INSERTED"));
-      waitResponse();
-      switch (status) {
-        case 2:
-        case 3:  return SIM_LOCKED;
-        case 1:  return SIM_READY;
-        default: return SIM_ERROR;
-      }
-    }
-    return SIM_ERROR;
-  }
+TINY_GSM_MODEM_IDENTITY()
+
+TINY_GSM_MODEM_GET_SIM_STATUS_CPIN()
 
 TINY_GSM_MODEM_GET_REGISTRATION_XREG(CGREG)
 
+TINY_GSM_MODEM_NETWORK_EVENTS(CGREG)
+
 TINY_GSM_MODEM_GET_OPERATOR_COPS()
 
   /*
@@ -352,13 +411,15 @@ TINY_GSM_MODEM_GET_CSQ()
     else return false;
   }
 
-TINY_GSM_MODEM_WAIT_FOR_NETWORK()
+TINY_GSM_MODEM_WAIT_FOR_NETWORK_URC(CGREG)
 
   /*
    * GPRS functions
    */
 
   bool gprsConnect(const char* apn, const char* user = NULL, const char* pwd = NULL) {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
     gprsDisconnect();
 
     sendAT(GF("+CGATT=1"));  // attach to GPRS
@@ -427,6 +488,8 @@ TINY_GSM_MODEM_WAIT_FOR_NETWORK()
   }
 
   bool gprsDisconnect() {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
     sendAT(GF("+UPSDA=0,4"));  // Deactivate the PDP context associated with profile 0
     if (waitResponse(360000L) != 1) {
       return false;
@@ -447,6 +510,7 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
    */
 
   String getLocalIP() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+UPSND=0,0"));
     if (waitResponse(GF(GSM_NL "+UPSND:")) != 1) {
       return "";
@@ -464,6 +528,8 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
     return TinyGsmIpFromString(getLocalIP());
   }
 
+TINY_GSM_MODEM_DNS_CACHE()
+
   /*
    * Phone Call functions
    */
@@ -483,10 +549,9 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
   String sendUSSD(const String& code) TINY_GSM_ATTR_NOT_IMPLEMENTED;
 
   bool sendSMS(const String& number, const String& text) {
-    sendAT(GF("+CSCS=\"GSM\""));  // Set GSM default alphabet
-    waitResponse();
-    sendAT(GF("+CMGF=1"));  // Set preferred message format to text mode
-    waitResponse();
+    TinyGsmTransaction transaction(at_lock);
+    modemSet(settings.cscs, TinyGsmSettings::CSCS_GSM, GF("+CSCS=\"GSM\""));  // Set GSM default alphabet
+    modemSet(settings.cmgf, 1, GF("+CMGF=1"));  // Set preferred message format to text mode
     sendAT(GF("+CMGS=\""), number, GF("\""));  // set the phone number
     if (waitResponse(GF(">")) != 1) {
       return false;
@@ -505,6 +570,7 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
    */
 
   String getGsmLocation() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+ULOC=2,3,0,120,1"));
     if (waitResponse(30000L, GF(GSM_NL "+UULOC:")) != 1) {
       return "";
@@ -522,6 +588,7 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
   uint16_t getBattVoltage() TINY_GSM_ATTR_NOT_AVAILABLE;
 
   int8_t getBattPercent() {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+CIND?"));
     if (waitResponse(GF(GSM_NL "+CIND:")) != 1) {
       return 0;
@@ -551,10 +618,21 @@ TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED()
 protected:
 
   bool modemConnect(const char* host, uint16_t port, uint8_t* mux,
-                    bool ssl = false, int timeout_s = 120)
+                    bool ssl = false, int timeout_s = 120,
+                    bool udp = false, uint16_t localPort = 0)
   {
+    TinyGsmTransaction transaction(at_lock);
     uint32_t timeout_ms = ((uint32_t)timeout_s)*1000;
-    sendAT(GF("+USOCR=6"));  // create a socket
+    // Secure connections keep the host name for the certificate check
+    char ipBuf[16];
+    const char* target = ssl ? host : resolvedHost(host, ipBuf);
+    if (udp && localPort) {
+      sendAT(GF("+USOCR=17,"), localPort);  // create a UDP socket
+    } else if (udp) {
+      sendAT(GF("+USOCR=17"));
+    } else {
+      sendAT(GF("+USOCR=6"));  // create a socket
+    }
     if (waitResponse(GF(GSM_NL "+USOCR:")) != 1) {  // reply is +USOCR: ## of socket created
       return false;
     }
@@ -567,8 +645,10 @@ protected:
     }
 
     // Enable NODELAY
-    sendAT(GF("+USOSO="), *mux, GF(",6,1,1"));
-    waitResponse();
+    if (!udp) {
+      sendAT(GF("+USOSO="), *mux, GF(",6,1,1"));
+      waitResponse();
+    }
 
     // Enable KEEPALIVE, 30 sec
     //sendAT(GF("+USOSO="), *mux, GF(",6,2,30000"));
@@ -577,12 +657,28 @@ protected:
     // connect on the allocated socket
     // TODO:  Use faster "asynchronous" connection?
     // We would have to wait for the +UUSOCO URC to verify connection
-    sendAT(GF("+USOCO="), *mux, ",\"", host, "\",", port);
+    sendAT(GF("+USOCO="), *mux, ",\"", target, "\",", port);
     int rsp = waitResponse(timeout_ms);
+    if (rsp != 1 && target != host) {
+      dnsCache.remove(host);  // The address may have moved
+    }
     return (1 == rsp);
   }
 
+  String dnsIpQuery(const char* host) {
+    TinyGsmTransaction transaction(at_lock);
+    sendAT(GF("+UDNSRN=0,\""), host, GF("\""));
+    if (waitResponse(70000L, GF(GSM_NL "+UDNSRN:")) != 1) {
+      return "";
+    }
+    streamSkipUntil('"');
+    String res = stream.readStringUntil('"');
+    waitResponse();
+    return res;
+  }
+
   bool modemDisconnect(uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     TINY_GSM_YIELD();
     if (!modemGetConnected(mux)) {
       sockets[mux]->sock_connected = false;
@@ -598,6 +694,7 @@ protected:
   }
 
   int16_t modemSend(const void* buff, size_t len, uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+USOWR="), mux, ',', len);
     if (waitResponse(GF("@")) != 1) {
       return 0;
@@ -616,6 +713,7 @@ protected:
   }
 
   size_t modemRead(size_t size, uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("+USORD="), mux, ',', size);
     if (waitResponse(GF(GSM_NL "+USORD:")) != 1) {
       return 0;
@@ -635,6 +733,7 @@ protected:
   }
 
   size_t modemGetAvailable(uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     // NOTE:  Querying a closed socket gives an error "operation not allowed"
     sendAT(GF("+USORD="), mux, ",0");
     size_t result = 0;
@@ -653,7 +752,10 @@ protected:
     return result;
   }
 
+TINY_GSM_MODEM_READ_DATAGRAM()
+
   bool modemGetConnected(uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
     // NOTE:  Querying a closed socket gives an error "operation not allowed"
     sendAT(GF("+USOCTL="), mux, ",10");
     uint8_t res = waitResponse(GF(GSM_NL "+USOCTL:"));
@@ -698,6 +800,7 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
     String r4s(r4); r4s.trim();
     String r5s(r5); r5s.trim();
     DBG("### ..:", r1s, ",", r2s, ",", r3s, ",", r4s, ",", r5s);*/
+    at_lock.begin();
     data.reserve(64);
     int index = 0;
     unsigned long startMillis = millis();
@@ -726,10 +829,11 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
         } else if (r5 && data.endsWith(r5)) {
           index = 5;
           goto finish;
-        } else if (data.endsWith(GF(GSM_NL "+UUSORD:"))) {
+        } else if (data.endsWith(GF(GSM_NL "+UUSORD:")) ||
+                   data.endsWith(GF(GSM_NL "+UUSORF:"))) {
           int mux = stream.readStringUntil(',').toInt();
           int len = stream.readStringUntil('\n').toInt();
-          if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
+          if (mux >= 0 && mux < MUX_COUNT && sockets[mux]) {
             sockets[mux]->got_data = true;
             sockets[mux]->sock_available = len;
           }
@@ -737,15 +841,25 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
           DBG("### URC Data Received:", len, "on", mux);
         } else if (data.endsWith(GF(GSM_NL "+UUSOCL:"))) {
           int mux = stream.readStringUntil('\n').toInt();
-          if (mux >= 0 && mux < TINY_GSM_MUX_COUNT && sockets[mux]) {
+          if (mux >= 0 && mux < MUX_COUNT && sockets[mux]) {
             sockets[mux]->sock_connected = false;
           }
           data = "";
           DBG("### URC Sock Closed: ", mux);
+        } else if (data.endsWith(GF(GSM_NL "+CGREG:"))) {
+          modemRegistrationUrc();
+          data = "";
+        } else if (data.endsWith(GF(GSM_NL "+CPIN:"))) {
+          modemSimUrc();
+          data = "";
+        } else if (data.endsWith(GF(GSM_NL "+UUPSDD:"))) {
+          modemPdpDeactivatedUrc();
+          data = "";
         }
       }
     } while (millis() - startMillis < timeout_ms);
 finish:
+    TINY_GSM_MODEM_END_TRANSACTION();
     if (!index) {
       data.trim();
       if (data.length()) {
@@ -776,7 +890,26 @@ public:
   Stream&       stream;
 
 protected:
-  GsmClient*    sockets[TINY_GSM_MUX_COUNT];
+  GsmClient*    sockets[MUX_COUNT];
+  TinyGsmModemEvents events;
+  TinyGsmIdentity    identity;
+  TinyGsmMetrics     metrics;
+  TinyGsmSettings    settings;
+  TinyGsmDnsCache<TINY_GSM_DNS_CACHE_SIZE> dnsCache;
+  TinyGsmTransactionLock at_lock;
 };
 
+// The first driver included also provides its registration states
+// unqualified, as when only one driver could be built
+#if !defined(TINY_GSM_REG_STATUS_DEFINED)
+#define TINY_GSM_REG_STATUS_DEFINED
+typedef TinyGsmUBLOX::RegStatus RegStatus;
+static const RegStatus REG_UNREGISTERED = TinyGsmUBLOX::REG_UNREGISTERED;
+static const RegStatus REG_SEARCHING    = TinyGsmUBLOX::REG_SEARCHING;
+static const RegStatus REG_DENIED       = TinyGsmUBLOX::REG_DENIED;
+static const RegStatus REG_OK_HOME      = TinyGsmUBLOX::REG_OK_HOME;
+static const RegStatus REG_OK_ROAMING   = TinyGsmUBLOX::REG_OK_ROAMING;
+static const RegStatus REG_UNKNOWN      = TinyGsmUBLOX::REG_UNKNOWN;
+#endif
+
 #endif
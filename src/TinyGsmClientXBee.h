@@ -12,23 +12,27 @@
 
 //#define TINY_GSM_DEBUG Serial
 
-// XBee's do not support multi-plexing in transparent/command mode
-// The much more complicated API mode is needed for multi-plexing
-#define TINY_GSM_MUX_COUNT 1
 // XBee's have a default guard time of 1 second (1000ms, 10 extra for safety here)
 #define TINY_GSM_XBEE_GUARD_TIME 1010
+// Number of configuration registers whose last written value is remembered
+#if !defined(TINY_GSM_XBEE_SHADOW_COUNT)
+  #define TINY_GSM_XBEE_SHADOW_COUNT 16
+#endif
 
 #include <TinyGsmCommon.h>
 
+#undef GSM_NL
+#undef GSM_OK
+#undef GSM_ERROR
 #define GSM_NL "\r"
-static const char GSM_OK[] TINY_GSM_PROGMEM = "OK" GSM_NL;
-static const char GSM_ERROR[] TINY_GSM_PROGMEM = "ERROR" GSM_NL;
+#define GSM_OK GSM_CR_OK
+#define GSM_ERROR GSM_CR_ERROR
 
 // Use this to avoid too many entrances and exits from command mode.
 // The cellular Bee's often freeze up and won't respond when attempting
 // to enter command mode too many times.
 #define XBEE_COMMAND_START_DECORATOR(nAttempts, failureReturn) \
-  bool wasInCommandMode = inCommandMode; \
+  bool wasInCommandMode = stillInCommandMode(); \
   if (!wasInCommandMode) {  /* don't re-enter command mode if already in it */ \
     if (!commandMode(nAttempts)) return failureReturn;  /* Return immediately if fails */ \
   }
@@ -38,21 +42,10 @@ static const char GSM_ERROR[] TINY_GSM_PROGMEM = "ERROR" GSM_NL;
   }
 
 
-enum SimStatus {
-  SIM_ERROR = 0,
-  SIM_READY = 1,
-  SIM_LOCKED = 2,
-};
-
-enum RegStatus {
-  REG_OK           = 0,
-  REG_UNREGISTERED = 1,
-  REG_SEARCHING    = 2,
-  REG_DENIED       = 3,
-  REG_UNKNOWN      = 4,
-};
-
 // These are responses to the HS command to get "hardware series"
+// (shared by both XBee drivers)
+#if !defined(TINY_GSM_XBEE_TYPE_DEFINED)
+#define TINY_GSM_XBEE_TYPE_DEFINED
 enum XBeeType {
   XBEE_UNKNOWN  = 0,
   XBEE_S6B_WIFI  = 0x601,  // Digi XBee® Wi-Fi
@@ -61,6 +54,13 @@ enum XBeeType {
   XBEE3_LTE1_ATT = 0xB06,  // Digi XBee3™ Cellular LTE CAT 1
   XBEE3_LTEM_ATT = 0xB08,  // Digi XBee3™ Cellular LTE-M
 };
+#endif
+
+// The last value known to be in one of the XBee's configuration registers
+struct XBeeRegister {
+  char   cmd[3];
+  String value;
+};
 
 
 class TinyGsmXBee
@@ -68,10 +68,22 @@ class TinyGsmXBee
 
 public:
 
+// XBee's do not support multi-plexing in transparent/command mode
+// The much more complicated API mode is needed for multi-plexing
+enum { MUX_COUNT = 1 };
+
+enum RegStatus {
+  REG_OK           = 0,
+  REG_UNREGISTERED = 1,
+  REG_SEARCHING    = 2,
+  REG_DENIED       = 3,
+  REG_UNKNOWN      = 4,
+};
+
 class GsmClient : public Client
 {
   friend class TinyGsmXBee;
-  // typedef TinyGsmFifo<uint8_t, TINY_GSM_RX_BUFFER> RxFifo;
+  // typedef TinyGsmLockedFifo<uint8_t, TINY_GSM_RX_BUFFER> RxFifo;
 
 public:
   GsmClient() {}
@@ -85,7 +97,7 @@ public:
     this->mux = mux;
     sock_connected = false;
 
-    at->sockets[mux] = this;
+    at->modemSetSocket(mux, this);
 
     return true;
   }
@@ -121,9 +133,12 @@ public:
     at->commandMode();
     // For WiFi models, there's no direct way to close the socket.  This is a
     // hack to shut the socket by setting the timeout to zero.
+    // NOTE:  These deliberately bypass the register shadow; the point is to
+    // (re)write the timeout, even if the value is unchanged.
     if (at->beeType == XBEE_S6B_WIFI) {
       at->sendAT(GF("TM0"));  // Set socket timeout (using Digi default of 10 seconds)
       at->waitResponse(5000);  // This response can be slow
+      at->pendingChanges = true;
       at->writeChanges();
     }
     // For cellular models, per documentation: If you change the TM (socket
@@ -131,6 +146,7 @@ public:
     // immediately closed.
     at->sendAT(GF("TM64"));  // Set socket timeout (using Digi default of 10 seconds)
     at->waitResponse(5000);  // This response can be slow
+    at->pendingChanges = true;
     at->writeChanges();
     at->exitCommand();
     at->streamClear();  // Empty anything remaining in the buffer
@@ -253,6 +269,67 @@ public:
 };
 
 
+// Holds the XBee in command mode for as long as it exists, so that any number
+// of queries and settings share a single (slow) entry into command mode.
+// Use:
+//   {
+//     TinyGsmXBee::CommandSession session(modem);
+//     int16_t csq = modem.getSignalQuality();
+//     String op = modem.getOperator();
+//   }  // <- leaves command mode here, applying any changes
+// Call end() instead to learn whether the changes were written.
+class CommandSession
+{
+public:
+  CommandSession(TinyGsmXBee& modem, uint8_t retries = 5)
+    : at(modem)
+  {
+    wasInCommandMode = at.stillInCommandMode();
+    active = wasInCommandMode || at.commandMode(retries);
+  }
+
+  ~CommandSession() {
+    end();
+  }
+
+  bool isActive() {
+    return active;
+  }
+
+  operator bool() { return active; }
+
+  // Writes any changed settings and leaves command mode, unless the modem was
+  // already in command mode when the session started.  If the XBee has left
+  // command mode on its own (its 10 s time-out, or a command that exited),
+  // nothing is sent, as it would go out as socket data; settings not yet
+  // written are then lost, and false is returned.
+  bool end() {
+    bool ok = true;
+    if (active && !wasInCommandMode) {
+      if (at.stillInCommandMode()) {
+        ok = at.writeChanges();
+        at.exitCommand();
+      } else {
+        at.inCommandMode = false;
+        if (at.pendingChanges) {
+          DBG("### Command mode timed out, settings not written");
+          at.pendingChanges = false;
+          at.clearShadow();  // We no longer know what the XBee holds
+          ok = false;
+        }
+      }
+    }
+    active = false;
+    return ok;
+  }
+
+private:
+  TinyGsmXBee&    at;
+  bool            wasInCommandMode;
+  bool            active;
+};
+
+
 public:
 
   TinyGsmXBee(Stream& stream)
@@ -263,8 +340,10 @@ public:
       resetPin = -1;
       savedIP = IPAddress(0,0,0,0);
       savedHost = "";
-      savedHostIP = IPAddress(0,0,0,0);
       inCommandMode = false;
+      lastCommandModeMillis = 0;
+      pendingChanges = false;
+      shadowNext = 0;
       memset(sockets, 0, sizeof(sockets));
   }
 
@@ -276,8 +355,10 @@ public:
       this->resetPin = resetPin;
       savedIP = IPAddress(0,0,0,0);
       savedHost = "";
-      savedHostIP = IPAddress(0,0,0,0);
       inCommandMode = false;
+      lastCommandModeMillis = 0;
+      pendingChanges = false;
+      shadowNext = 0;
       memset(sockets, 0, sizeof(sockets));
   }
 
@@ -290,6 +371,7 @@ public:
   }
 
   bool init(const char* pin = NULL) {
+    TinyGsmTransaction transaction(at_lock);
     DBG(GF("### TinyGSM Version:"), TINYGSM_VERSION);
 
     if (resetPin >= 0) {
@@ -299,57 +381,56 @@ public:
 
     XBEE_COMMAND_START_DECORATOR(10, false)
 
-    sendAT(GF("AP0"));  // Put in transparent mode
-    bool ret_val = waitResponse() == 1;
+    bool ret_val = setRegister("AP", "0");  // Put in transparent mode
 
-    sendAT(GF("GT64")); // shorten the guard time to 100ms
-    ret_val &= waitResponse() == 1;
+    ret_val &= setRegister("GT", "64"); // shorten the guard time to 100ms
     if (ret_val) guardTime = 110;
 
    // Make sure the command mode drop-out time is long enough that we won't fall
    // out of command mode without intentionally leaving it.  This is the default
    // drop out time of 0x64 x 100ms (10 seconds)
-    sendAT(GF("CT64"));
-    ret_val &= waitResponse() == 1;
+    ret_val &= setRegister("CT", "64");
     ret_val &= writeChanges();
 
-    getSeries();  // Get the "Hardware Series";
+    // The series can't change, so a re-init doesn't ask again
+    if (beeType == XBEE_UNKNOWN) getSeries();
 
     XBEE_COMMAND_END_DECORATOR
 
     return ret_val;
   }
 
-  String getModemName() {
+  String modemGetName() {
     return getBeeName();
   }
 
   void setBaud(unsigned long baud) {
+    TinyGsmTransaction transaction(at_lock);
     XBEE_COMMAND_START_DECORATOR(5, )
     switch(baud)
     {
-      case 2400: sendAT(GF("BD1")); break;
-      case 4800: sendAT(GF("BD2")); break;
-      case 9600: sendAT(GF("BD3")); break;
-      case 19200: sendAT(GF("BD4")); break;
-      case 38400: sendAT(GF("BD5")); break;
-      case 57600: sendAT(GF("BD6")); break;
-      case 115200: sendAT(GF("BD7")); break;
-      case 230400: sendAT(GF("BD8")); break;
-      case 460800: sendAT(GF("BD9")); break;
-      case 921600: sendAT(GF("BDA")); break;
+      case 2400: setRegister("BD", "1"); break;
+      case 4800: setRegister("BD", "2"); break;
+      case 9600: setRegister("BD", "3"); break;
+      case 19200: setRegister("BD", "4"); break;
+      case 38400: setRegister("BD", "5"); break;
+      case 57600: setRegister("BD", "6"); break;
+      case 115200: setRegister("BD", "7"); break;
+      case 230400: setRegister("BD", "8"); break;
+      case 460800: setRegister("BD", "9"); break;
+      case 921600: setRegister("BD", "A"); break;
       default: {
           DBG(GF("Specified baud rate is unsupported! Setting to 9600 baud."));
-          sendAT(GF("BD3")); // Set to default of 9600
+          setRegister("BD", "3"); // Set to default of 9600
           break;
       }
     }
-    waitResponse();
     writeChanges();
     XBEE_COMMAND_END_DECORATOR
   }
 
   bool testAT(unsigned long timeout_ms = 10000L) {
+    TinyGsmTransaction transaction(at_lock);
     unsigned long start = millis();
     bool success = false;
     while (!success && millis() - start < timeout_ms) {
@@ -371,6 +452,7 @@ public:
   }
 
   void maintain() {
+    TinyGsmTransaction transaction(at_lock);
     // this only happens OUTSIDE command mode, so if we're getting characters
     // they should be data received from the TCP connection
     // TINY_GSM_YIELD();
@@ -383,9 +465,12 @@ public:
   }
 
   bool factoryDefault() {
+    TinyGsmTransaction transaction(at_lock);
     XBEE_COMMAND_START_DECORATOR(5, false)
     sendAT(GF("RE"));
     bool ret_val = waitResponse() == 1;
+    clearShadow();  // Every register may have changed
+    pendingChanges = true;
     ret_val &= writeChanges();
     XBEE_COMMAND_END_DECORATOR
     // Make sure the guard time for the modem object is set back to default
@@ -394,7 +479,8 @@ public:
     return ret_val;
   }
 
-  String getModemInfo() {
+  String modemGetInfo() {
+    TinyGsmTransaction transaction(at_lock);
     return sendATGetString(GF("HS"));
   }
 
@@ -440,19 +526,24 @@ public:
       digitalWrite(resetPin, LOW);
       delay(1);
       digitalWrite(resetPin, HIGH);
+      clearShadow();  // Any changes not yet written to flash are lost
+      inCommandMode = false;
     }
   }
 
   bool restart() {
+    TinyGsmTransaction transaction(at_lock);
+    identity.clear();
+    metrics.clear();
 
     if (!commandMode()) return false;  // Return immediately
 
     if (beeType == XBEE_UNKNOWN) getSeries();  // how we restart depends on this
 
     if (beeType != XBEE_S6B_WIFI) {
-      sendAT(GF("AM1"));  // Digi suggests putting cellular modules into airplane mode before restarting
-                          // This allows the sockets and connections to close cleanly
-      if (waitResponse() != 1) return exitAndFail();
+      // Digi suggests putting cellular modules into airplane mode before restarting
+      // This allows the sockets and connections to close cleanly
+      if (!setRegister("AM", "1")) return exitAndFail();
       if (!writeChanges()) return exitAndFail();
     }
 
@@ -463,15 +554,14 @@ public:
     if (beeType == XBEE_S6B_WIFI) delay(2000);  // Wifi module actually resets about 2 seconds later
     else delay(100);  // cellular modules wait 100ms before reset happens
 
-    // Wait until reboot complete and responds to command mode call again
+    // Wait until reboot complete and responds to command mode call again;
+    // each try already waits out a guard time, so there is no extra delay
     for (unsigned long start = millis(); millis() - start < 60000L; ) {
       if (commandMode(1)) break;
-      delay(250);  // wait a litle before trying again
     }
 
     if (beeType != XBEE_S6B_WIFI) {
-      sendAT(GF("AM0"));  // Turn off airplane mode
-      if (waitResponse() != 1) return exitAndFail();
+      if (!setRegister("AM", "0")) return exitAndFail();  // Turn off airplane mode
       if (!writeChanges()) return exitAndFail();
     }
 
@@ -481,22 +571,20 @@ public:
   }
 
   void setupPinSleep(bool maintainAssociation = false) {
+    TinyGsmTransaction transaction(at_lock);
     XBEE_COMMAND_START_DECORATOR(5, )
 
     if (beeType == XBEE_UNKNOWN) getSeries();  // Command depends on series
 
-    sendAT(GF("SM"),1);  // Pin sleep
-    waitResponse();
+    setRegister("SM", "1");  // Pin sleep
 
     if (beeType == XBEE_S6B_WIFI && !maintainAssociation) {
-        sendAT(GF("SO"),200);  // For lowest power, dissassociated deep sleep
-        waitResponse();
+        setRegister("SO", "200");  // For lowest power, dissassociated deep sleep
     }
 
     else if (!maintainAssociation){
-        sendAT(GF("SO"),1);  // For supported cellular modules, maintain association
-                             // Not supported by all modules, will return "ERROR"
-        waitResponse();
+        setRegister("SO", "1");  // For supported cellular modules, maintain association
+                                 // Not supported by all modules, will return "ERROR"
     }
 
     writeChanges();
@@ -519,19 +607,24 @@ public:
     return false;
   }
 
-  String getSimCCID() {
+  String modemGetSimCCID() {
+    TinyGsmTransaction transaction(at_lock);
     return sendATGetString(GF("S#"));
   }
 
-  String getIMEI() {
+  String modemGetIMEI() {
+    TinyGsmTransaction transaction(at_lock);
     return sendATGetString(GF("IM"));
   }
 
+TINY_GSM_MODEM_IDENTITY()
+
   SimStatus getSimStatus(unsigned long timeout_ms = 10000L) {
     return SIM_READY;  // unsupported
   }
 
   RegStatus getRegistrationStatus() {
+    TinyGsmTransaction transaction(at_lock);
 
     XBEE_COMMAND_START_DECORATOR(5, REG_UNKNOWN)
 
@@ -593,14 +686,12 @@ public:
             stat = REG_DENIED;
             break;
           case  0x2A:  // 0x2A Airplane mode.
-            sendAT(GF("AM0"));  // Turn off airplane mode
-            waitResponse();
+            setRegister("AM", "0");  // Turn off airplane mode
             writeChanges();
             stat = REG_UNKNOWN;
             break;
           case 0x2F:  // 0x2F Bypass mode active.
-            sendAT(GF("AP0"));  // Set back to transparent mode
-            waitResponse();
+            setRegister("AP", "0");  // Set back to transparent mode
             writeChanges();
             stat = REG_UNKNOWN;
             break;
@@ -617,6 +708,7 @@ public:
   }
 
   String getOperator() {
+    TinyGsmTransaction transaction(at_lock);
     return sendATGetString(GF("MN"));
   }
 
@@ -624,7 +716,8 @@ public:
   * Generic network functions
   */
 
-  int16_t getSignalQuality() {
+  int16_t modemGetSignalQuality() {
+    TinyGsmTransaction transaction(at_lock);
 
     XBEE_COMMAND_START_DECORATOR(5, 0);
 
@@ -636,17 +729,21 @@ public:
 
     XBEE_COMMAND_END_DECORATOR
 
+    if (intRes == 0xFF) return 0;  // no answer
     if (beeType == XBEE3_LTEM_ATT && intRes == 105) intRes = 0;  // tends to reply with "69" when signal is unknown
     if (beeType == XBEE_S6B_WIFI) return -93 + intRes;  // the maximum sensitivity is -93dBm
     else return -1*intRes; // need to convert to negative number
   }
 
+TINY_GSM_MODEM_CACHED_CSQ(0)
+
   bool isNetworkConnected() {
     RegStatus s = getRegistrationStatus();
     return (s == REG_OK);
   }
 
   bool waitForNetwork(unsigned long timeout_ms = 60000L) {
+    TinyGsmTransaction transaction(at_lock);
     bool retVal = false;
     XBEE_COMMAND_START_DECORATOR(5, false)
     for (unsigned long start = millis(); millis() - start < timeout_ms; ) {
@@ -665,6 +762,8 @@ public:
    */
 
   bool networkConnect(const char* ssid, const char* pwd) {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
 
     bool retVal = true;
     XBEE_COMMAND_START_DECORATOR(5, false)
@@ -674,16 +773,13 @@ public:
 
     if (pwd != NULL)
     {
-      sendAT(GF("EE"), 2);  // Set security to WPA2
-      if (waitResponse() != 1) retVal = false;
-      sendAT(GF("PK"), pwd);
+      if (!setRegister("EE", "2")) retVal = false;  // Set security to WPA2
+      if (!setRegister("PK", pwd)) retVal = false;
     } else {
-      sendAT(GF("EE"), 0);  // Set No security
+      if (!setRegister("EE", "0")) retVal = false;  // Set No security
     }
-    if (waitResponse() != 1) retVal = false;
 
-    sendAT(GF("ID"), ssid);
-    if (waitResponse() != 1) retVal = false;
+    if (!setRegister("ID", ssid)) retVal = false;
 
     if (!writeChanges()) retVal = false;
 
@@ -693,6 +789,8 @@ public:
   }
 
   bool networkDisconnect() {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
     XBEE_COMMAND_START_DECORATOR(5, false)
     sendAT(GF("NR0"));  // Do a network reset in order to disconnect
     // WARNING:  On wifi modules, using a network reset will not
@@ -708,6 +806,7 @@ public:
    */
 
   String getLocalIP() {
+    TinyGsmTransaction transaction(at_lock);
     XBEE_COMMAND_START_DECORATOR(5, "")
     sendAT(GF("MY"));
     String IPaddr; IPaddr.reserve(16);
@@ -722,35 +821,40 @@ public:
     return TinyGsmIpFromString(getLocalIP());
   }
 
+TINY_GSM_MODEM_DNS_CACHE()
+
   /*
    * GPRS functions
    */
 
   bool gprsConnect(const char* apn, const char* user = NULL, const char* pwd = NULL) {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
     XBEE_COMMAND_START_DECORATOR(5, false)
-    sendAT(GF("AN"), apn);  // Set the APN
-    bool success = waitResponse() == 1;
+    bool success = setRegister("AN", apn);  // Set the APN
     writeChanges();
     XBEE_COMMAND_END_DECORATOR
     return success;
   }
 
   bool gprsDisconnect() {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
     XBEE_COMMAND_START_DECORATOR(5, false)
-    sendAT(GF("AM1"));  // Cheating and disconnecting by turning on airplane mode
-    int8_t res = (1 == waitResponse(5000));
+    int8_t res = setRegister("AM", "1", 5000);  // Cheating and disconnecting by turning on airplane mode
     writeChanges();
-    sendAT(GF("AM0"));  // Airplane mode off
-    waitResponse(5000);
+    setRegister("AM", "0", 5000);  // Airplane mode off
     writeChanges();
     XBEE_COMMAND_END_DECORATOR
     return res;
   }
 
-  bool isGprsConnected() {
+  bool modemIsGprsConnected() {
     return isNetworkConnected();
   }
 
+TINY_GSM_MODEM_CACHED_GPRS()
+
   /*
    * Messaging functions
    */
@@ -758,14 +862,13 @@ public:
   String sendUSSD(const String& code) TINY_GSM_ATTR_NOT_IMPLEMENTED;
 
   bool sendSMS(const String& number, const String& text) {
+    TinyGsmTransaction transaction(at_lock);
     if (!commandMode()) return false;  // Return immediately
 
-    sendAT(GF("IP"), 2);  // Put in text messaging mode
-    if (waitResponse() !=1) return exitAndFail();
-    sendAT(GF("PH"), number);  // Set the phone number
-    if (waitResponse() !=1) return exitAndFail();
-    sendAT(GF("TDD"));  // Set the text delimiter to the standard 0x0D (carriage return)
-    if (waitResponse() !=1) return exitAndFail();
+    if (!setRegister("IP", "2")) return exitAndFail();  // Put in text messaging mode
+    if (!setRegister("PH", number)) return exitAndFail();  // Set the phone number
+    // Set the text delimiter to the standard 0x0D (carriage return)
+    if (!setRegister("TD", "D")) return exitAndFail();
 
     if (!writeChanges()) return exitAndFail();
     // Get out of command mode to actually send the text
@@ -794,6 +897,7 @@ public:
   bool getBattStats(uint8_t &chargeState, int8_t &percent, uint16_t &milliVolts) TINY_GSM_ATTR_NOT_AVAILABLE;
 
   float getTemperature() {
+    TinyGsmTransaction transaction(at_lock);
     String res = sendATGetString(GF("TP"));
     if (res == "") {
       return (float)-9999;
@@ -811,6 +915,7 @@ public:
 protected:
 
   IPAddress getHostIP(const char* host, int timeout_s = 45) {
+    TinyGsmTransaction transaction(at_lock);
     String strIP; strIP.reserve(16);
     unsigned long startMillis = millis();
     uint32_t timeout_ms = ((uint32_t)timeout_s)*1000;
@@ -839,28 +944,41 @@ protected:
     else return IPAddress(0,0,0,0);
   }
 
+  String dnsIpQuery(const char* host) {
+    IPAddress ip = getHostIP(host);
+    if (ip == IPAddress(0,0,0,0)) {
+      return "";
+    }
+    char buf[16];
+    return TinyGsmIpToChars(ip, buf);
+  }
+
   bool modemConnect(const char* host, uint16_t port, uint8_t mux = 0,
                     bool ssl = false, int timeout_s = 75)
   {
+    TinyGsmTransaction transaction(at_lock);
     unsigned long startMillis = millis();
     uint32_t timeout_ms = ((uint32_t)timeout_s)*1000;
     bool retVal = false;
      XBEE_COMMAND_START_DECORATOR(5, false)
 
-    // If this is a new host name, replace the saved host and wipe out the saved host IP
-    if (this->savedHost != String(host)) {
-      this->savedHost = String(host);
-      savedHostIP = IPAddress(0,0,0,0);
-    }
+    this->savedHost = String(host);
 
-    // If we don't have a good IP for the host, we need to do a DNS search
-    if (savedHostIP == IPAddress(0,0,0,0)) {
-      savedHostIP = getHostIP(host, timeout_s);  // This will return 0.0.0.0 if lookup fails
+    // If we don't have a fresh IP for the host, we need to do a DNS search
+    IPAddress ip;
+    if (!dnsCache.lookup(host, ip)) {
+      ip = getHostIP(host, timeout_s);  // This will return 0.0.0.0 if lookup fails
+      if (ip != IPAddress(0,0,0,0)) {
+        dnsCache.store(host, ip);
+      }
     }
 
     // If we now have a valid IP address, use it to connect
-    if (savedHostIP != IPAddress(0,0,0,0)) {  // Only re-set connection information if we have an IP address
-      retVal = modemConnect(savedHostIP, port, mux, ssl, timeout_ms - (millis() - startMillis));
+    if (ip != IPAddress(0,0,0,0)) {  // Only re-set connection information if we have an IP address
+      retVal = modemConnect(ip, port, mux, ssl, timeout_ms - (millis() - startMillis));
+    }
+    if (!retVal) {
+      dnsCache.remove(host);  // The address may have moved
     }
 
     XBEE_COMMAND_END_DECORATOR
@@ -869,37 +987,34 @@ protected:
   }
 
   bool modemConnect(IPAddress ip, uint16_t port, uint8_t mux = 0, bool ssl = false, int timeout_s = 75) {
+    TinyGsmTransaction transaction(at_lock);
 
     bool success = true;
     uint32_t timeout_ms = ((uint32_t)timeout_s)*1000;
     XBEE_COMMAND_START_DECORATOR(5, false)
 
-    if (ip != savedIP) {  // Can skip almost everything if there's no change in the IP address
-      savedIP = ip;  // Set the newly requested IP address
-      String host; host.reserve(16);
-      host += ip[0];
-      host += ".";
-      host += ip[1];
-      host += ".";
-      host += ip[2];
-      host += ".";
-      host += ip[3];
-
-      if (ssl) {
-        sendAT(GF("IP"), 4);  // Put in SSL over TCP communication mode
-        success &= (1 == waitResponse());
-      } else {
-        sendAT(GF("IP"), 1);  // Put in TCP mode
-        success &= (1 == waitResponse());
-      }
+    // Only the settings that differ from what the XBee already has are sent,
+    // and nothing is written to flash at all if none of them changed
+    savedIP = ip;  // Set the newly requested IP address
+    String host; host.reserve(16);
+    host += ip[0];
+    host += ".";
+    host += ip[1];
+    host += ".";
+    host += ip[2];
+    host += ".";
+    host += ip[3];
+
+    if (ssl) {
+      success &= setRegister("IP", "4");  // Put in SSL over TCP communication mode
+    } else {
+      success &= setRegister("IP", "1");  // Put in TCP mode
+    }
 
-      sendAT(GF("DL"), host);  // Set the "Destination Address Low"
-      success &= (1 == waitResponse());
-      sendAT(GF("DE"), String(port, HEX));  // Set the destination port
-      success &= (1 == waitResponse());
+    success &= setRegister("DL", host);  // Set the "Destination Address Low"
+    success &= setRegister("DE", String(port, HEX));  // Set the destination port
 
-      success &= writeChanges();
-    }
+    success &= writeChanges();
 
     for (unsigned long start = millis(); millis() - start < timeout_ms; ) {
       if (modemGetConnected()) {
@@ -914,6 +1029,7 @@ protected:
   }
 
   int16_t modemSend(const void* buff, size_t len, uint8_t mux = 0) {
+    TinyGsmTransaction transaction(at_lock);
     stream.write((uint8_t*)buff, len);
     stream.flush();
     return len;
@@ -924,6 +1040,7 @@ protected:
   // really be open, but no data has yet been sent.  We return this unknown value
   // as true so there's a possibility it's wrong.
   bool modemGetConnected() {
+    TinyGsmTransaction transaction(at_lock);
     // If the IP address is 0, it's not valid so we can't be connected
     if (savedIP == IPAddress(0,0,0,0)) return false;
 
@@ -961,6 +1078,7 @@ protected:
           case 0x12:  // 0x12 = DNS query lookup failure
           case 0x25:  // 0x25 = Unknown server - DNS lookup failed (0x22 for UDP socket!)
             savedIP = IPAddress(0,0,0,0);  // force a lookup next time!
+            if (savedHost != "") dnsCache.remove(savedHost.c_str());  // ...and not from the cache
           default:  // If it's anything else (inc 0x02, 0x12, and 0x25)...
             sockets[0]->sock_connected = false;  // ...it's definitely NOT connected
             return false;
@@ -976,6 +1094,7 @@ public:
    */
 
   void streamClear(void) {
+    TinyGsmTransaction transaction(at_lock);
     while (stream.available()) {
       stream.read();
       TINY_GSM_YIELD();
@@ -998,6 +1117,7 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
     String r4s(r4); r4s.trim();
     String r5s(r5); r5s.trim();
     DBG("### ..:", r1s, ",", r2s, ",", r3s, ",", r4s, ",", r5s);*/
+    at_lock.begin();
     data.reserve(16);  // Should never be getting much here for the XBee
     int8_t index = 0;
     unsigned long startMillis = millis();
@@ -1027,6 +1147,7 @@ TINY_GSM_MODEM_STREAM_UTILITIES()
       }
     } while (millis() - startMillis < timeout_ms);
 finish:
+    TINY_GSM_MODEM_END_TRANSACTION();
     if (!index) {
       data.trim();
       data.replace(GSM_NL GSM_NL, GSM_NL);
@@ -1042,6 +1163,8 @@ finish:
       data.replace(GSM_NL, "\r\n    ");
       if (data.length()) {
       }
+      // Every command restarts the XBee's command mode time-out
+      if (inCommandMode) lastCommandModeMillis = millis();
     }
     //data.replace(GSM_NL, "/");
     //DBG('<', index, '>', data);
@@ -1063,9 +1186,10 @@ finish:
   }
 
   bool commandMode(uint8_t retries = 5) {
+    TinyGsmTransaction transaction(at_lock);
 
     // If we're already in command mode, move on
-    if (inCommandMode && (millis() - lastCommandModeMillis) < 10000L) return true;
+    if (stillInCommandMode()) return true;
 
     uint8_t triesMade = 0;
     uint8_t triesUntilReset = 4;  // only reset after 4 failures
@@ -1098,15 +1222,69 @@ finish:
     return success;
   }
 
+  // Whether the XBee is in command mode and hasn't timed out of it
+  bool stillInCommandMode() {
+    return inCommandMode && (millis() - lastCommandModeMillis) < 10000L;
+  }
+
   bool writeChanges(void) {
+    TinyGsmTransaction transaction(at_lock);
+    if (!pendingChanges) return true;  // Nothing has changed, so spare the flash
     sendAT(GF("WR"));  // Write changes to flash
     if (1 != waitResponse()) return false;
     sendAT(GF("AC"));  // Apply changes
     if (1 != waitResponse()) return false;
+    pendingChanges = false;
+    return true;
+  }
+
+  // Sets a configuration register, but only if it doesn't already hold the
+  // requested value.  The first time a register is set, its current value is
+  // read back from the XBee, so even after a reboot unchanged settings never
+  // cost a flash write.  Must be called in command mode.
+  bool setRegister(const char* cmd, const String& value, uint32_t timeout_ms = 1000L) {
+    TinyGsmTransaction transaction(at_lock);
+    XBeeRegister* reg = findRegister(cmd);
+    if (reg) {
+      if (reg->value.equalsIgnoreCase(value)) return true;
+    } else {
+      sendAT(cmd);
+      String current = readResponseString();
+      reg = &shadow[shadowNext];
+      shadowNext = (shadowNext + 1) % TINY_GSM_XBEE_SHADOW_COUNT;
+      reg->cmd[0] = cmd[0];
+      reg->cmd[1] = cmd[1];
+      reg->value = current;
+      if (current.equalsIgnoreCase(value)) return true;
+    }
+    sendAT(cmd, value);
+    if (waitResponse(timeout_ms) != 1) {
+      reg->cmd[0] = 0;  // We no longer know what it holds
+      return false;
+    }
+    reg->value = value;
+    pendingChanges = true;
     return true;
   }
 
+  XBeeRegister* findRegister(const char* cmd) {
+    for (uint8_t i = 0; i < TINY_GSM_XBEE_SHADOW_COUNT; i++) {
+      if (shadow[i].cmd[0] == cmd[0] && shadow[i].cmd[1] == cmd[1]) {
+        return &shadow[i];
+      }
+    }
+    return NULL;
+  }
+
+  void clearShadow(void) {
+    for (uint8_t i = 0; i < TINY_GSM_XBEE_SHADOW_COUNT; i++) {
+      shadow[i].cmd[0] = 0;
+      shadow[i].value = "";
+    }
+  }
+
   void exitCommand(void) {
+    TinyGsmTransaction transaction(at_lock);
     // NOTE:  Here we explicitely try to exit command mode
     // even if the internal flag inCommandMode was already false
     sendAT(GF("CN"));  // Exit command mode
@@ -1120,13 +1298,16 @@ finish:
   }
 
   void getSeries(void) {
+    TinyGsmTransaction transaction(at_lock);
     sendAT(GF("HS"));  // Get the "Hardware Series";
     int16_t intRes = readResponseInt();
     beeType = (XBeeType)intRes;
+    identity.name[0] = '\0';  // The name comes from the series
     DBG(GF("### Modem: "), getModemName());
   }
 
   String readResponseString(uint32_t timeout_ms = 1000) {
+    TinyGsmTransaction transaction(at_lock);
     TINY_GSM_YIELD();
     unsigned long startMillis = millis();
     while (!stream.available() && millis() - startMillis < timeout_ms) {};
@@ -1145,6 +1326,7 @@ finish:
   }
 
   String sendATGetString(GsmConstStr cmd) {
+    TinyGsmTransaction transaction(at_lock);
     XBEE_COMMAND_START_DECORATOR(5, "")
     sendAT(cmd);
     String res = readResponseString();
@@ -1153,8 +1335,8 @@ finish:
   }
 
   bool gotIPforSavedHost() {
-    if (savedHost != "" && savedHostIP != IPAddress(0,0,0,0)) return true;
-    else return false;
+    IPAddress ip;
+    return savedHost != "" && dnsCache.lookup(savedHost.c_str(), ip);
   }
 
 public:
@@ -1164,12 +1346,30 @@ protected:
   int16_t       guardTime;
   int8_t        resetPin;
   XBeeType      beeType;
+  TinyGsmIdentity identity;
+  TinyGsmMetrics  metrics;
   IPAddress     savedIP;
   String        savedHost;
-  IPAddress     savedHostIP;
   bool          inCommandMode;
   uint32_t      lastCommandModeMillis;
-  GsmClient*    sockets[TINY_GSM_MUX_COUNT];
+  bool          pendingChanges;  // registers changed, but not yet written
+  XBeeRegister  shadow[TINY_GSM_XBEE_SHADOW_COUNT];
+  uint8_t       shadowNext;
+  GsmClient*    sockets[MUX_COUNT];
+  TinyGsmDnsCache<TINY_GSM_DNS_CACHE_SIZE> dnsCache;
+  TinyGsmTransactionLock at_lock;
 };
 
+// The first driver included also provides its registration states
+// unqualified, as when only one driver could be built
+#if !defined(TINY_GSM_REG_STATUS_DEFINED)
+#define TINY_GSM_REG_STATUS_DEFINED
+typedef TinyGsmXBee::RegStatus RegStatus;
+static const RegStatus REG_OK           = TinyGsmXBee::REG_OK;
+static const RegStatus REG_UNREGISTERED = TinyGsmXBee::REG_UNREGISTERED;
+static const RegStatus REG_SEARCHING    = TinyGsmXBee::REG_SEARCHING;
+static const RegStatus REG_DENIED       = TinyGsmXBee::REG_DENIED;
+static const RegStatus REG_UNKNOWN      = TinyGsmXBee::REG_UNKNOWN;
+#endif
+
 #endif
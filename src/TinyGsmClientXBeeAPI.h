@@ -0,0 +1,1228 @@
+/**
+ * @file       TinyGsmClientXBeeAPI.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy, XBee module by Sara Damiano
+ * @date       Nov 2016
+ */
+
+#ifndef TinyGsmClientXBeeAPI_h
+#define TinyGsmClientXBeeAPI_h
+//#pragma message("TinyGSM:  TinyGsmClientXBeeAPI")
+
+//#define TINY_GSM_DEBUG Serial
+
+// This drives the XBee in API mode (AP1, without escapes) using the extended
+// socket frames of the XBee Cellular / XBee3 Cellular modules.  Unlike
+// transparent mode, API mode allows several sockets to be open at once and
+// AT commands to be issued without leaving data mode.
+// NOTE:  The XBee S6B Wi-Fi does not support the extended socket frames.
+
+// Space for the body of any frame other than received socket data (which is
+// written straight into the socket's fifo)
+#if !defined(TINY_GSM_XBEE_API_BUFFER)
+  #define TINY_GSM_XBEE_API_BUFFER 64
+#endif
+
+// Largest payload allowed in a single socket send frame
+#define TINY_GSM_XBEE_MAX_SEND 1500
+// XBee's have a default guard time of 1 second (1000ms, 10 extra for safety here)
+// This is only needed to switch a module over to API mode the first time
+#define TINY_GSM_XBEE_GUARD_TIME 1010
+
+#include <TinyGsmCommon.h>
+
+#undef GSM_NL
+#undef GSM_OK
+#undef GSM_ERROR
+#define GSM_NL "\r"
+#define GSM_OK GSM_CR_OK
+#define GSM_ERROR GSM_CR_ERROR
+
+// These are responses to the HS command to get "hardware series"
+// (shared by both XBee drivers)
+#if !defined(TINY_GSM_XBEE_TYPE_DEFINED)
+#define TINY_GSM_XBEE_TYPE_DEFINED
+enum XBeeType {
+  XBEE_UNKNOWN  = 0,
+  XBEE_S6B_WIFI  = 0x601,  // Digi XBee® Wi-Fi
+  XBEE_LTE1_VZN  = 0xB01,  // Digi XBee® Cellular LTE Cat 1
+  XBEE_3G        = 0xB02,  // Digi XBee® Cellular 3G
+  XBEE3_LTE1_ATT = 0xB06,  // Digi XBee3™ Cellular LTE CAT 1
+  XBEE3_LTEM_ATT = 0xB08,  // Digi XBee3™ Cellular LTE-M
+};
+#endif
+
+// API frame types used by this driver
+enum XBeeFrameType {
+  XBEE_FRAME_AT_COMMAND       = 0x08,
+  XBEE_FRAME_TX_SMS           = 0x1F,
+  XBEE_FRAME_SOCKET_CREATE    = 0x40,
+  XBEE_FRAME_SOCKET_CONNECT   = 0x42,
+  XBEE_FRAME_SOCKET_CLOSE     = 0x43,
+  XBEE_FRAME_SOCKET_SEND      = 0x44,
+  XBEE_FRAME_AT_RESPONSE      = 0x88,
+  XBEE_FRAME_TX_STATUS        = 0x89,
+  XBEE_FRAME_MODEM_STATUS     = 0x8A,
+  XBEE_FRAME_SOCKET_CREATED   = 0xC0,
+  XBEE_FRAME_SOCKET_CONNECTED = 0xC2,
+  XBEE_FRAME_SOCKET_CLOSED    = 0xC3,
+  XBEE_FRAME_SOCKET_RECEIVE   = 0xCD,
+  XBEE_FRAME_SOCKET_STATUS    = 0xCF,
+};
+
+// States of the incoming frame parser
+enum XBeeFrameState {
+  XBEE_RX_START = 0,
+  XBEE_RX_LENGTH_HI,
+  XBEE_RX_LENGTH_LO,
+  XBEE_RX_TYPE,
+  XBEE_RX_DATA,
+  XBEE_RX_CHECKSUM,
+};
+
+#define XBEE_NO_SOCKET 0xFF
+
+
+class TinyGsmXBeeAPI
+{
+
+public:
+
+// The cellular XBee's support up to 6 sockets at once
+enum { MUX_COUNT = 6 };
+
+enum RegStatus {
+  REG_OK           = 0,
+  REG_UNREGISTERED = 1,
+  REG_SEARCHING    = 2,
+  REG_DENIED       = 3,
+  REG_UNKNOWN      = 4,
+};
+
+class GsmClient : public Client
+{
+  friend class TinyGsmXBeeAPI;
+  typedef TinyGsmLockedFifo<uint8_t, TINY_GSM_RX_BUFFER_OR(256)> RxFifo;
+
+public:
+  GsmClient() {}
+
+  GsmClient(TinyGsmXBeeAPI& modem, uint8_t mux = 0) {
+    init(&modem, mux);
+  }
+
+  bool init(TinyGsmXBeeAPI* modem, uint8_t mux = 0) {
+    this->at = modem;
+    this->mux = mux;
+    sock_id = XBEE_NO_SOCKET;
+    sock_connected = false;
+
+    at->modemSetSocket(mux, this);
+
+    return true;
+  }
+
+public:
+  virtual int connect(const char *host, uint16_t port, int timeout_s) {
+    stop();
+    TINY_GSM_YIELD();
+    rx.clear();
+    sock_connected = at->modemConnect(host, port, mux, false, timeout_s);
+    return sock_connected;
+  }
+  virtual int connect(const char *host, uint16_t port) {
+    return connect(host, port, 75);
+  }
+
+  virtual int connect(IPAddress ip, uint16_t port, int timeout_s) {
+    stop();
+    TINY_GSM_YIELD();
+    rx.clear();
+    sock_connected = at->modemConnect(ip, port, mux, false, timeout_s);
+    return sock_connected;
+  }
+  virtual int connect(IPAddress ip, uint16_t port) {
+    return connect(ip, port, 75);
+  }
+
+  virtual void stop() {
+    TINY_GSM_YIELD();
+    at->modemClose(mux);
+    sock_connected = false;
+    rx.clear();
+  }
+
+TINY_GSM_CLIENT_WRITE()
+
+TINY_GSM_CLIENT_AVAILABLE_NO_MODEM_FIFO()
+
+TINY_GSM_CLIENT_READ_NO_MODEM_FIFO()
+
+TINY_GSM_CLIENT_PEEK_FLUSH_CONNECTED()
+
+TINY_GSM_CLIENT_EVENTS()
+
+  /*
+   * Extended API
+   */
+
+  String remoteIP() TINY_GSM_ATTR_NOT_IMPLEMENTED;
+
+private:
+  TinyGsmXBeeAPI* at;
+  uint8_t         mux;
+  uint8_t         sock_id;  // the socket ID assigned by the XBee
+  bool            sock_connected;
+  RxFifo          rx;
+  TinyGsmClientEvents events;
+};
+
+
+class GsmClientSecure : public GsmClient
+{
+public:
+  GsmClientSecure() {}
+
+  GsmClientSecure(TinyGsmXBeeAPI& modem, uint8_t mux = 0)
+    : GsmClient(modem, mux)
+  {}
+
+public:
+  virtual int connect(const char *host, uint16_t port, int timeout_s) {
+    stop();
+    TINY_GSM_YIELD();
+    rx.clear();
+    sock_connected = at->modemConnect(host, port, mux, true, timeout_s);
+    return sock_connected;
+  }
+
+  virtual int connect(IPAddress ip, uint16_t port, int timeout_s) {
+    stop();
+    TINY_GSM_YIELD();
+    rx.clear();
+    sock_connected = at->modemConnect(ip, port, mux, true, timeout_s);
+    return sock_connected;
+  }
+};
+
+
+public:
+
+  TinyGsmXBeeAPI(Stream& stream, int8_t resetPin = -1)
+    : stream(stream)
+  {
+      beeType = XBEE_UNKNOWN;  // Start not knowing what kind of bee it is
+      this->resetPin = resetPin;
+      frameId = 0;
+      rxState = XBEE_RX_START;
+      rxLength = 0;
+      rxCount = 0;
+      rxDropped = 0;
+      rxSum = 0;
+      rxType = 0;
+      rxSock = NULL;
+      modemStatus = 0xFF;
+      memset(sockets, 0, sizeof(sockets));
+  }
+
+  /*
+   * Basic functions
+   */
+
+  bool begin(const char* pin = NULL) {
+    return init(pin);
+  }
+
+  bool init(const char* pin = NULL) {
+    DBG(GF("### TinyGSM Version:"), TINYGSM_VERSION);
+
+    if (resetPin >= 0) {
+      pinMode(resetPin, OUTPUT);
+      digitalWrite(resetPin, HIGH);
+    }
+
+    if (!apiMode()) {
+      return false;
+    }
+
+    // The series can't change, so a re-init doesn't ask again
+    if (beeType == XBEE_UNKNOWN) getSeries();
+
+    return true;
+  }
+
+  String modemGetName() {
+    return getBeeName();
+  }
+
+  void setBaud(unsigned long baud) {
+    TinyGsmTransaction transaction(at_lock);
+    uint8_t rate;
+    switch(baud)
+    {
+      case 2400: rate = 1; break;
+      case 4800: rate = 2; break;
+      case 9600: rate = 3; break;
+      case 19200: rate = 4; break;
+      case 38400: rate = 5; break;
+      case 57600: rate = 6; break;
+      case 115200: rate = 7; break;
+      case 230400: rate = 8; break;
+      case 460800: rate = 9; break;
+      case 921600: rate = 0xA; break;
+      default: {
+          DBG(GF("Specified baud rate is unsupported! Setting to 9600 baud."));
+          rate = 3; // Set to default of 9600
+          break;
+      }
+    }
+    sendATFrame("BD", rate);
+    writeChanges();
+  }
+
+  bool testAT(unsigned long timeout_ms = 10000L) {
+    TinyGsmTransaction transaction(at_lock);
+    for (unsigned long start = millis(); millis() - start < timeout_ms; ) {
+      if (sendATFrame("AP", (const uint8_t*)NULL, 0, 500)) {
+        return true;
+      }
+      delay(100);
+    }
+    return false;
+  }
+
+  // Runs anything the XBee has sent through the frame parser, moving
+  // received socket data into the socket fifos
+  void maintain() {
+    TinyGsmTransaction transaction(at_lock);
+    while (stream.available()) {
+      readFrame(15);
+    }
+    modemDispatchEvents();
+  }
+
+TINY_GSM_MODEM_POLL_SOCKS_NO_MODEM_FIFO()
+
+TINY_GSM_MODEM_EVENTS_NO_MODEM_FIFO()
+
+  bool factoryDefault() {
+    TinyGsmTransaction transaction(at_lock);
+    bool ret_val = sendATFrame("RE");
+    // Restoring defaults drops the XBee back into transparent mode, so ask
+    // for API mode again before the settings are written
+    ret_val &= sendATFrame("AP", 1);
+    ret_val &= writeChanges();
+    return ret_val;
+  }
+
+  String modemGetInfo() {
+    TinyGsmTransaction transaction(at_lock);
+    int32_t series = sendATGetInt("HS");
+    if (series < 0) {
+      return "";
+    }
+    return String((unsigned)series, HEX);
+  }
+
+  bool hasSSL() {
+    if (beeType == XBEE_S6B_WIFI) return false;
+    else return true;
+  }
+
+  bool hasWifi() {
+    if (beeType == XBEE_S6B_WIFI) return true;
+    else return false;
+  }
+
+  bool hasGPRS() {
+    if (beeType == XBEE_S6B_WIFI) return false;
+    else return true;
+  }
+
+  XBeeType getBeeType() {
+    return beeType;
+  }
+
+  String getBeeName() {
+    switch (beeType){
+      case XBEE_S6B_WIFI: return "Digi XBee® Wi-Fi";
+      case XBEE_LTE1_VZN: return "Digi XBee® Cellular LTE Cat 1";
+      case XBEE_3G: return "Digi XBee® Cellular 3G";
+      case XBEE3_LTE1_ATT: return "Digi XBee3™ Cellular LTE CAT 1";
+      case XBEE3_LTEM_ATT: return "Digi XBee3™ Cellular LTE-M";
+      default:  return "Digi XBee®";
+    }
+  }
+
+  /*
+   * Power functions
+   */
+
+  // The XBee's have a bad habit of getting into an unresponsive funk
+  // This uses the board's hardware reset pin to force it to reset
+  void pinReset() {
+    if (resetPin >= 0) {
+      DBG("### Forcing a modem reset!\r\n");
+      digitalWrite(resetPin, LOW);
+      delay(1);
+      digitalWrite(resetPin, HIGH);
+    }
+  }
+
+  bool restart() {
+    TinyGsmTransaction transaction(at_lock);
+    identity.clear();
+    metrics.clear();
+    if (beeType == XBEE_UNKNOWN) getSeries();  // how we restart depends on this
+
+    if (beeType != XBEE_S6B_WIFI) {
+      // Digi suggests putting cellular modules into airplane mode before restarting
+      // This allows the sockets and connections to close cleanly
+      if (!sendATFrame("AM", 1)) return false;
+      if (!writeChanges()) return false;
+    }
+
+    modemStatus = 0xFF;
+    if (!sendATFrame("FR")) return false;
+
+    // Wait until reboot complete, which the XBee announces with a modem
+    // status frame, or until it responds to AT frames again
+    for (unsigned long start = millis(); millis() - start < 60000L; ) {
+      readFrame(250);
+      if (modemStatus == 0x00) break;  // 0x00 = Hardware reset
+      if (millis() - start > 2000L && testAT(250)) break;
+    }
+
+    if (beeType != XBEE_S6B_WIFI) {
+      if (!sendATFrame("AM", 0)) return false;  // Turn off airplane mode
+      if (!writeChanges()) return false;
+    }
+
+    return init();
+  }
+
+  void setupPinSleep(bool maintainAssociation = false) {
+    TinyGsmTransaction transaction(at_lock);
+    if (beeType == XBEE_UNKNOWN) getSeries();  // Command depends on series
+
+    sendATFrame("SM", 1);  // Pin sleep
+
+    if (beeType == XBEE_S6B_WIFI && !maintainAssociation) {
+        sendATFrame("SO", 200);  // For lowest power, dissassociated deep sleep
+    }
+
+    else if (!maintainAssociation){
+        sendATFrame("SO", 1);  // For supported cellular modules, maintain association
+                               // Not supported by all modules, will return "ERROR"
+    }
+
+    writeChanges();
+  }
+
+  bool poweroff() {  // Not supported
+    return false;
+  }
+
+  bool radioOff() TINY_GSM_ATTR_NOT_IMPLEMENTED;
+
+  bool sleepEnable(bool enable = true) TINY_GSM_ATTR_NOT_IMPLEMENTED;
+
+  /*
+   * SIM card functions
+   */
+
+  bool simUnlock(const char *pin) {  // Not supported
+    return false;
+  }
+
+  String modemGetSimCCID() {
+    TinyGsmTransaction transaction(at_lock);
+    return sendATGetString("S#");
+  }
+
+  String modemGetIMEI() {
+    TinyGsmTransaction transaction(at_lock);
+    return sendATGetString("IM");
+  }
+
+TINY_GSM_MODEM_IDENTITY()
+
+  SimStatus getSimStatus(unsigned long timeout_ms = 10000L) {
+    return SIM_READY;  // unsupported
+  }
+
+  RegStatus getRegistrationStatus() {
+    TinyGsmTransaction transaction(at_lock);
+
+    if (beeType == XBEE_UNKNOWN) getSeries();  // Need to know the bee type to interpret response
+
+    int32_t intRes = sendATGetInt("AI", 10000L);
+    RegStatus stat = REG_UNKNOWN;
+
+    switch (beeType){
+      case XBEE_S6B_WIFI: {
+        switch (intRes) {
+          case 0x00:  // 0x00 Successfully joined an access point, established IP addresses and IP listening sockets
+            stat = REG_OK;
+            break;
+          case 0x01:  // 0x01 Wi-Fi transceiver initialization in progress.
+          case 0x02:  // 0x02 Wi-Fi transceiver initialized, but not yet scanning for access point.
+          case 0x40:  // 0x40 Waiting for WPA or WPA2 Authentication.
+          case 0x41:  // 0x41 Device joined a network and is waiting for IP configuration to complete
+          case 0x42:  // 0x42 Device is joined, IP is configured, and listening sockets are being set up.
+          case 0xFF:  // 0xFF Device is currently scanning for the configured SSID.
+            stat = REG_SEARCHING;
+            break;
+          case 0x13:  // 0x13 Disconnecting from access point.
+            restart();  // Restart the device; the S6B tends to get stuck "disconnecting"
+            stat = REG_UNREGISTERED;
+            break;
+          case 0x23:  // 0x23 SSID not configured.
+            stat = REG_UNREGISTERED;
+            break;
+          case 0x24:  // 0x24 Encryption key invalid (either NULL or invalid length for WEP).
+          case 0x27:  // 0x27 SSID was found, but join failed.
+            stat = REG_DENIED;
+            break;
+          default:
+            stat = REG_UNKNOWN;
+            break;
+        }
+        break;
+      }
+      default: {  // Cellular XBee's
+        switch (intRes) {
+          case 0x00:  // 0x00 Connected to the Internet.
+            stat = REG_OK;
+            break;
+          case 0x22:  // 0x22 Registering to cellular network.
+          case 0x23:  // 0x23 Connecting to the Internet.
+          case 0xFF:  // 0xFF Initializing.
+            stat = REG_SEARCHING;
+          break;
+          case 0x24:  // 0x24 The cellular component is missing, corrupt, or otherwise in error.
+          case 0x2B:  // 0x2B USB Direct active.
+          case 0x2C:  // 0x2C Cellular component is in PSM (power save mode).
+            stat = REG_UNKNOWN;
+            break;
+          case 0x25:  // 0x25 Cellular network registration denied.
+            stat = REG_DENIED;
+            break;
+          case  0x2A:  // 0x2A Airplane mode.
+            sendATFrame("AM", 0);  // Turn off airplane mode
+            writeChanges();
+            stat = REG_UNKNOWN;
+            break;
+          case 0x2F:  // 0x2F Bypass mode active.
+            sendATFrame("AP", 1);  // Set back to API mode
+            writeChanges();
+            stat = REG_UNKNOWN;
+            break;
+          default:
+            stat = REG_UNKNOWN;
+            break;
+        }
+        break;
+      }
+    }
+
+    return stat;
+  }
+
+  String getOperator() {
+    TinyGsmTransaction transaction(at_lock);
+    return sendATGetString("MN");
+  }
+
+ /*
+  * Generic network functions
+  */
+
+  int16_t modemGetSignalQuality() {
+    TinyGsmTransaction transaction(at_lock);
+
+    if (beeType == XBEE_UNKNOWN) getSeries();  // Need to know what type of bee so we know how to ask
+
+    int32_t intRes;
+    if (beeType == XBEE_S6B_WIFI) intRes = sendATGetInt("LM");  // ask for the "link margin" - the dB above sensitivity
+    else intRes = sendATGetInt("DB");  // ask for the cell strength in dBm
+    if (intRes < 0) return 0;  // no answer
+
+    if (beeType == XBEE3_LTEM_ATT && intRes == 105) intRes = 0;  // tends to reply with "69" when signal is unknown
+    if (beeType == XBEE_S6B_WIFI) return -93 + intRes;  // the maximum sensitivity is -93dBm
+    else return -1*intRes; // need to convert to negative number
+  }
+
+TINY_GSM_MODEM_CACHED_CSQ(0)
+
+  bool isNetworkConnected() {
+    RegStatus s = getRegistrationStatus();
+    return (s == REG_OK);
+  }
+
+  bool waitForNetwork(unsigned long timeout_ms = 60000L) {
+    TinyGsmTransaction transaction(at_lock);
+    for (unsigned long start = millis(); millis() - start < timeout_ms; ) {
+      if (isNetworkConnected()) {
+        return true;
+      }
+      // Keep servicing the sockets while we wait
+      readFrame(250);
+    }
+    return false;
+  }
+
+  /*
+   * WiFi functions
+   */
+
+  bool networkConnect(const char* ssid, const char* pwd) {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
+
+    bool retVal = true;
+
+    //nh For no pwd don't set setscurity or pwd
+    if (ssid == NULL) retVal = false;
+
+    if (pwd != NULL)
+    {
+      if (!sendATFrame("EE", 2)) retVal = false;  // Set security to WPA2
+      if (!sendATFrame("PK", pwd)) retVal = false;
+    } else {
+      if (!sendATFrame("EE", 0)) retVal = false;  // Set No security
+    }
+
+    if (!sendATFrame("ID", ssid)) retVal = false;
+
+    if (!writeChanges()) retVal = false;
+
+    return retVal;
+  }
+
+  bool networkDisconnect() {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
+    // Do a network reset in order to disconnect
+    // WARNING:  On wifi modules, using a network reset will not
+    // allow the same ssid to re-join without rebooting the module.
+    bool res = sendATFrame("NR", 0, 5000L);
+    writeChanges();
+    return res;
+  }
+
+  /*
+   * IP Address functions
+   */
+
+  String getLocalIP() {
+    TinyGsmTransaction transaction(at_lock);
+    // this response can be very slow
+    if (!sendATFrame("MY", (const uint8_t*)NULL, 0, 30000L)) {
+      return "";
+    }
+    // In API mode the address comes back as four binary bytes
+    if (atDataLength() == 4) {
+      const uint8_t* ip = atData();
+      String IPaddr; IPaddr.reserve(16);
+      IPaddr += ip[0];
+      IPaddr += ".";
+      IPaddr += ip[1];
+      IPaddr += ".";
+      IPaddr += ip[2];
+      IPaddr += ".";
+      IPaddr += ip[3];
+      return IPaddr;
+    }
+    return atDataString();
+  }
+
+  IPAddress localIP() {
+    return TinyGsmIpFromString(getLocalIP());
+  }
+
+TINY_GSM_MODEM_DNS_CACHE()
+
+  /*
+   * GPRS functions
+   */
+
+  bool gprsConnect(const char* apn, const char* user = NULL, const char* pwd = NULL) {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
+    bool success = sendATFrame("AN", apn);  // Set the APN
+    writeChanges();
+    return success;
+  }
+
+  bool gprsDisconnect() {
+    TinyGsmTransaction transaction(at_lock);
+    metrics.expire(TinyGsmMetrics::GPRS);
+    bool res = sendATFrame("AM", 1, 5000L);  // Cheating and disconnecting by turning on airplane mode
+    writeChanges();
+    sendATFrame("AM", 0, 5000L);  // Airplane mode off
+    writeChanges();
+    return res;
+  }
+
+  bool modemIsGprsConnected() {
+    return isNetworkConnected();
+  }
+
+TINY_GSM_MODEM_CACHED_GPRS()
+
+  /*
+   * Messaging functions
+   */
+
+  String sendUSSD(const String& code) TINY_GSM_ATTR_NOT_IMPLEMENTED;
+
+  bool sendSMS(const String& number, const String& text) {
+    TinyGsmTransaction transaction(at_lock);
+    uint8_t head[22] = { nextFrameId(), 0x00, };  // Frame ID and options
+    // The phone number is sent as a 20 byte, null padded, field
+    strncpy((char*)&head[2], number.c_str(), 20);
+    sendFrame(XBEE_FRAME_TX_SMS, head, sizeof(head),
+              (const uint8_t*)text.c_str(), text.length());
+    if (!waitFrame(XBEE_FRAME_TX_STATUS, head[0], 60000L)) {
+      return false;
+    }
+    return rxBuf[1] == 0x00;  // Delivery status
+  }
+
+  /*
+   * Location functions
+   */
+
+  String getGsmLocation() TINY_GSM_ATTR_NOT_AVAILABLE;
+
+  /*
+   * Battery & temperature functions
+   */
+
+  // Use: float vBatt = modem.getBattVoltage() / 1000.0;
+  uint16_t getBattVoltage() TINY_GSM_ATTR_NOT_AVAILABLE;
+  int8_t getBattPercent() TINY_GSM_ATTR_NOT_AVAILABLE;
+  uint8_t getBattChargeState() TINY_GSM_ATTR_NOT_AVAILABLE;
+  bool getBattStats(uint8_t &chargeState, int8_t &percent, uint16_t &milliVolts) TINY_GSM_ATTR_NOT_AVAILABLE;
+
+  float getTemperature() {
+    TinyGsmTransaction transaction(at_lock);
+    int32_t intRes = sendATGetInt("TP");
+    if (intRes < 0) {
+      return (float)-9999;
+    }
+    return (float)(int8_t)intRes; // degrees Celsius in 8-bit two's complement format.
+  }
+
+  /*
+   * Client related functions
+   */
+
+protected:
+
+  bool modemConnect(const char* host, uint16_t port, uint8_t mux,
+                    bool ssl = false, int timeout_s = 75)
+  {
+    // Connect by address when the name resolves; the XBee would otherwise
+    // do its own DNS lookup for every connection.  Secure connections keep
+    // the host name for the certificate check.
+    IPAddress ip;
+    if (!ssl && resolveHost(host, ip)) {
+      if (modemConnect(ip, port, mux, ssl, timeout_s)) {
+        return true;
+      }
+      dnsCache.remove(host);  // The address may have moved
+      return false;
+    }
+    return modemConnect(0x01, (const uint8_t*)host, strlen(host), port, mux,
+                        ssl, timeout_s);
+  }
+
+  String dnsIpQuery(const char* host) {
+    TinyGsmTransaction transaction(at_lock);
+    // The lookup can take a while; the address comes back as four binary bytes
+    if (!sendATFrame("LA", host, 45000L) || atDataLength() != 4) {
+      return "";
+    }
+    char buf[16];
+    const uint8_t* ip = atData();
+    return TinyGsmIpToChars(IPAddress(ip[0], ip[1], ip[2], ip[3]), buf);
+  }
+
+  bool modemConnect(IPAddress ip, uint16_t port, uint8_t mux,
+                    bool ssl = false, int timeout_s = 75)
+  {
+    uint8_t addr[4] = { ip[0], ip[1], ip[2], ip[3] };
+    return modemConnect(0x00, addr, sizeof(addr), port, mux, ssl, timeout_s);
+  }
+
+  bool modemConnect(uint8_t addrType, const uint8_t* addr, size_t addrLen,
+                    uint16_t port, uint8_t mux, bool ssl, int timeout_s)
+  {
+    TinyGsmTransaction transaction(at_lock);
+    unsigned long startMillis = millis();
+    uint32_t timeout_ms = ((uint32_t)timeout_s)*1000;
+    GsmClient* sock = sockets[mux];
+
+    // Create the socket
+    uint8_t create[2] = { nextFrameId(), (uint8_t)(ssl ? 0x04 : 0x01) };  // SSL over TCP or TCP
+    sendFrame(XBEE_FRAME_SOCKET_CREATE, create, sizeof(create));
+    if (!waitFrame(XBEE_FRAME_SOCKET_CREATED, create[0], 5000L) || rxBuf[2] != 0x00) {
+      return false;
+    }
+    uint8_t id = rxBuf[1];
+    sock->sock_id = id;
+
+    // Ask it to connect
+    uint8_t head[5] = { nextFrameId(), id,
+                        (uint8_t)(port >> 8), (uint8_t)(port & 0xFF), addrType };
+    sendFrame(XBEE_FRAME_SOCKET_CONNECT, head, sizeof(head), addr, addrLen);
+    if (!waitFrame(XBEE_FRAME_SOCKET_CONNECTED, head[0], 5000L) || rxBuf[2] != 0x00) {
+      modemClose(mux);
+      return false;
+    }
+
+    // The connect response only says that the attempt has started; the
+    // socket status frame that follows says whether it worked
+    while (millis() - startMillis < timeout_ms) {
+      if (readFrame(100) == XBEE_FRAME_SOCKET_STATUS && rxBuf[0] == id) {
+        if (rxBuf[1] == 0x00) {
+          return true;
+        }
+        break;
+      }
+    }
+    modemClose(mux);
+    return false;
+  }
+
+  void modemClose(uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
+    GsmClient* sock = sockets[mux];
+    if (sock->sock_id == XBEE_NO_SOCKET) {
+      return;
+    }
+    uint8_t head[2] = { nextFrameId(), sock->sock_id };
+    sendFrame(XBEE_FRAME_SOCKET_CLOSE, head, sizeof(head));
+    waitFrame(XBEE_FRAME_SOCKET_CLOSED, head[0], 5000L);
+    sock->sock_id = XBEE_NO_SOCKET;
+  }
+
+  int16_t modemSend(const void* buff, size_t len, uint8_t mux) {
+    TinyGsmTransaction transaction(at_lock);
+    GsmClient* sock = sockets[mux];
+    if (sock->sock_id == XBEE_NO_SOCKET) {
+      return 0;
+    }
+    const uint8_t* data = (const uint8_t*)buff;
+    size_t sent = 0;
+    while (sent < len) {
+      size_t chunk = TinyGsmMin(len - sent, (size_t)TINY_GSM_XBEE_MAX_SEND);
+      uint8_t head[3] = { nextFrameId(), sock->sock_id, 0x00 };  // Frame ID, socket ID, options
+      sendFrame(XBEE_FRAME_SOCKET_SEND, head, sizeof(head), data + sent, chunk);
+      if (!waitFrame(XBEE_FRAME_TX_STATUS, head[0], 10000L) || rxBuf[1] != 0x00) {
+        break;
+      }
+      sent += chunk;
+    }
+    return sent;
+  }
+
+public:
+
+  /*
+   Utilities
+   */
+
+  void streamClear(void) {
+    TinyGsmTransaction transaction(at_lock);
+    while (stream.available()) {
+      stream.read();
+      TINY_GSM_YIELD();
+    }
+  }
+
+TINY_GSM_MODEM_STREAM_UTILITIES()
+
+  // NOTE:  This is only used for the text responses in transparent command
+  // mode, while switching the XBee over to API mode.
+  uint8_t waitResponse(uint32_t timeout_ms, String& data,
+                       GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
+                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
+  {
+    at_lock.begin();
+    data.reserve(16);  // Should never be getting much here for the XBee
+    int8_t index = 0;
+    unsigned long startMillis = millis();
+    do {
+      TINY_GSM_YIELD();
+      while (stream.available() > 0) {
+        TINY_GSM_YIELD();
+        int a = stream.read();
+        if (a <= 0) continue; // Skip 0x00 bytes, just in case
+        data += (char)a;
+        if (r1 && data.endsWith(r1)) {
+          index = 1;
+          goto finish;
+        } else if (r2 && data.endsWith(r2)) {
+          index = 2;
+          goto finish;
+        } else if (r3 && data.endsWith(r3)) {
+          index = 3;
+          goto finish;
+        } else if (r4 && data.endsWith(r4)) {
+          index = 4;
+          goto finish;
+        } else if (r5 && data.endsWith(r5)) {
+          index = 5;
+          goto finish;
+        }
+      }
+    } while (millis() - startMillis < timeout_ms);
+finish:
+    TINY_GSM_MODEM_END_TRANSACTION();
+    if (!index) {
+      data.trim();
+      if (data.length()) {
+        DBG("### Unhandled:", data, "\r\n");
+      } else {
+        DBG("### NO RESPONSE FROM MODEM!\r\n");
+      }
+    }
+    return index;
+  }
+
+  uint8_t waitResponse(uint32_t timeout_ms,
+                       GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
+                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
+  {
+    String data;
+    return waitResponse(timeout_ms, data, r1, r2, r3, r4, r5);
+  }
+
+  uint8_t waitResponse(GsmConstStr r1=GFP(GSM_OK), GsmConstStr r2=GFP(GSM_ERROR),
+                       GsmConstStr r3=NULL, GsmConstStr r4=NULL, GsmConstStr r5=NULL)
+  {
+    return waitResponse(1000, r1, r2, r3, r4, r5);
+  }
+
+  // Makes sure the XBee is in API mode, switching it over from transparent
+  // mode (and saving that to flash) the first time it's used
+  bool apiMode() {
+    TinyGsmTransaction transaction(at_lock);
+    if (testAT(1000L)) {
+      return true;
+    }
+    DBG(GF("### Switching XBee to API mode"));
+    for (uint8_t i = 0; i < 5; i++) {
+      streamClear();
+      // Cannot send anything for 1 "guard time" before entering command mode
+      delay(TINY_GSM_XBEE_GUARD_TIME + 10);
+      streamWrite(GF("+++"));  // enter command mode
+      if (waitResponse(TINY_GSM_XBEE_GUARD_TIME*2) == 1) {
+        sendAT(GF("AP1"));  // API mode, without escapes
+        bool success = waitResponse() == 1;
+        sendAT(GF("WR"));  // Write changes to flash
+        success &= waitResponse() == 1;
+        sendAT(GF("CN"));  // Exit command mode, applying the change
+        waitResponse();
+        if (success) {
+          return testAT(5000L);
+        }
+      }
+      if (i == 3) {
+        pinReset();  // if it's unresponsive, reset
+        delay(250);
+      }
+    }
+    return false;
+  }
+
+  bool writeChanges(void) {
+    TinyGsmTransaction transaction(at_lock);
+    if (!sendATFrame("WR")) return false;  // Write changes to flash
+    if (!sendATFrame("AC")) return false;  // Apply changes
+    return true;
+  }
+
+  void getSeries(void) {
+    TinyGsmTransaction transaction(at_lock);
+    int32_t intRes = sendATGetInt("HS");  // Get the "Hardware Series";
+    beeType = intRes < 0 ? XBEE_UNKNOWN : (XBeeType)intRes;
+    identity.name[0] = '\0';  // The name comes from the series
+    DBG(GF("### Modem: "), getModemName());
+  }
+
+  /*
+   * API frame engine
+   */
+
+  uint8_t nextFrameId() {
+    // Frame ID 0 means "no response", so never hand that out
+    if (++frameId == 0) frameId = 1;
+    return frameId;
+  }
+
+  // Writes out one complete API frame: the type, a header, and an optional
+  // payload, followed by the checksum
+  void sendFrame(uint8_t type, const uint8_t* head, size_t headLen,
+                 const uint8_t* data = NULL, size_t dataLen = 0)
+  {
+    TinyGsmTransaction transaction(at_lock);
+    uint16_t len = 1 + headLen + dataLen;
+    uint8_t sum = type;
+    for (size_t i = 0; i < headLen; i++) sum += head[i];
+    for (size_t i = 0; i < dataLen; i++) sum += data[i];
+    stream.write((uint8_t)0x7E);
+    stream.write((uint8_t)(len >> 8));
+    stream.write((uint8_t)(len & 0xFF));
+    stream.write(type);
+    stream.write(head, headLen);
+    if (dataLen) {
+      stream.write(data, dataLen);
+    }
+    stream.write((uint8_t)(0xFF - sum));
+    stream.flush();
+  }
+
+  // Reads from the stream until a complete frame has been received and
+  // handled, returning its type, or 0 if the time-out passes first
+  uint8_t readFrame(uint32_t timeout_ms) {
+    TinyGsmTransaction transaction(at_lock);
+    unsigned long startMillis = millis();
+    do {
+      TINY_GSM_YIELD();
+      while (stream.available() > 0) {
+        int a = stream.read();
+        if (a < 0) continue;
+        if (parseFrameByte(a)) {
+          return rxType;
+        }
+      }
+    } while (millis() - startMillis < timeout_ms);
+    return 0;
+  }
+
+  // Waits for a particular response frame, handling anything else that
+  // arrives in the meantime (like data for other sockets)
+  bool waitFrame(uint8_t type, uint8_t id, uint32_t timeout_ms) {
+    TinyGsmTransaction transaction(at_lock);
+    unsigned long startMillis = millis();
+    for (uint32_t elapsed = 0; elapsed < timeout_ms; elapsed = millis() - startMillis) {
+      if (readFrame(timeout_ms - elapsed) == type && rxBuf[0] == id) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool parseFrameByte(uint8_t b) {
+    switch (rxState) {
+      case XBEE_RX_START:
+        if (b == 0x7E) rxState = XBEE_RX_LENGTH_HI;
+        break;
+      case XBEE_RX_LENGTH_HI:
+        rxLength = (uint16_t)b << 8;
+        rxState = XBEE_RX_LENGTH_LO;
+        break;
+      case XBEE_RX_LENGTH_LO:
+        rxLength |= b;
+        rxState = rxLength ? XBEE_RX_TYPE : XBEE_RX_START;
+        break;
+      case XBEE_RX_TYPE:
+        rxType = b;
+        rxSum = b;
+        rxCount = 1;
+        rxDropped = 0;
+        if (rxSock) rxSock->rx.discard();  // Left over from a broken frame
+        rxSock = NULL;
+        rxState = rxCount < rxLength ? XBEE_RX_DATA : XBEE_RX_CHECKSUM;
+        break;
+      case XBEE_RX_DATA:
+        rxSum += b;
+        // Received socket data goes directly into the socket's fifo, but
+        // stays unreadable until the checksum passes; the frame ID, socket
+        // ID and status come before it
+        if (rxType == XBEE_FRAME_SOCKET_RECEIVE && rxCount > 3) {
+          if (rxSock && !rxSock->rx.stage(b)) rxDropped++;
+        } else if (rxCount <= TINY_GSM_XBEE_API_BUFFER) {
+          rxBuf[rxCount - 1] = b;
+          if (rxType == XBEE_FRAME_SOCKET_RECEIVE && rxCount == 2) {
+            rxSock = findSocket(b);
+          }
+        }
+        rxCount++;
+        if (rxCount >= rxLength) rxState = XBEE_RX_CHECKSUM;
+        break;
+      case XBEE_RX_CHECKSUM:
+        rxState = XBEE_RX_START;
+        if ((uint8_t)(rxSum + b) != 0xFF) {
+          DBG("### Bad frame checksum, type:", rxType);
+          if (rxSock) rxSock->rx.discard();
+          return false;
+        }
+        if (rxSock) {
+          rxSock->rx.commit();
+          if (rxDropped) {
+            DBG("### Buffer overflow:", rxDropped, "bytes dropped on", rxSock->mux);
+          }
+        }
+        handleFrame();
+        return true;
+    }
+    return false;
+  }
+
+  // Deals with frames the XBee sends without being asked
+  void handleFrame() {
+    switch (rxType) {
+      case XBEE_FRAME_SOCKET_STATUS: {
+        GsmClient* sock = findSocket(rxBuf[0]);
+        DBG("### Socket status:", rxBuf[1], "on", rxBuf[0]);
+        if (sock) {
+          sock->sock_connected = (rxBuf[1] == 0x00);
+          if (!sock->sock_connected) {
+            sock->sock_id = XBEE_NO_SOCKET;  // The XBee has freed it
+          }
+        }
+        break;
+      }
+      case XBEE_FRAME_SOCKET_RECEIVE:
+        DBG("### Got Data:", rxLength - 4, "on", rxBuf[1]);
+        break;
+      case XBEE_FRAME_MODEM_STATUS:
+        modemStatus = rxBuf[0];
+        DBG("### Modem status:", modemStatus);
+        break;
+      default:
+        break;
+    }
+  }
+
+  GsmClient* findSocket(uint8_t id) {
+    for (int mux = 0; mux < MUX_COUNT; mux++) {
+      if (sockets[mux] && sockets[mux]->sock_id == id) {
+        return sockets[mux];
+      }
+    }
+    return NULL;
+  }
+
+  // Sends a local AT command frame and waits for the response.  Any value
+  // returned is left in the frame buffer, see atData().
+  bool sendATFrame(const char* cmd, const uint8_t* param, size_t len,
+                   uint32_t timeout_ms = 5000L)
+  {
+    TinyGsmTransaction transaction(at_lock);
+    uint8_t head[3] = { nextFrameId(), (uint8_t)cmd[0], (uint8_t)cmd[1] };
+    sendFrame(XBEE_FRAME_AT_COMMAND, head, sizeof(head), param, len);
+    if (!waitFrame(XBEE_FRAME_AT_RESPONSE, head[0], timeout_ms)) {
+      return false;
+    }
+    return rxBuf[3] == 0x00;  // 0 = OK, 1 = ERROR, 2 = Invalid command, 3 = Invalid parameter
+  }
+
+  bool sendATFrame(const char* cmd) {
+    TinyGsmTransaction transaction(at_lock);
+    return sendATFrame(cmd, (const uint8_t*)NULL, 0);
+  }
+
+  // Sets a string parameter
+  bool sendATFrame(const char* cmd, const char* value, uint32_t timeout_ms = 5000L) {
+    TinyGsmTransaction transaction(at_lock);
+    return sendATFrame(cmd, (const uint8_t*)value, value ? strlen(value) : 0, timeout_ms);
+  }
+
+  // Sets a numeric parameter; in API mode these are big-endian binary
+  bool sendATFrame(const char* cmd, int value, uint32_t timeout_ms = 5000L) {
+    TinyGsmTransaction transaction(at_lock);
+    uint8_t buf[4];
+    uint8_t len = 0;
+    uint32_t v = value;
+    for (int8_t shift = 24; shift >= 0; shift -= 8) {
+      uint8_t b = v >> shift;
+      if (b || len || shift == 0) buf[len++] = b;
+    }
+    return sendATFrame(cmd, buf, len, timeout_ms);
+  }
+
+  const uint8_t* atData() {
+    return &rxBuf[4];
+  }
+
+  size_t atDataLength() {
+    size_t len = TinyGsmMin((size_t)rxLength, (size_t)TINY_GSM_XBEE_API_BUFFER + 1);
+    return len > 5 ? len - 5 : 0;  // Less frame type, ID, command and status
+  }
+
+  String atDataString() {
+    String res;
+    res.reserve(atDataLength());
+    for (size_t i = 0; i < atDataLength(); i++) {
+      res += (char)atData()[i];
+    }
+    res.trim();
+    return res;
+  }
+
+  String sendATGetString(const char* cmd) {
+    TinyGsmTransaction transaction(at_lock);
+    if (!sendATFrame(cmd)) {
+      return "";
+    }
+    return atDataString();
+  }
+
+  // Returns the numeric value of a parameter, or -1 if it couldn't be read
+  int32_t sendATGetInt(const char* cmd, uint32_t timeout_ms = 5000L) {
+    TinyGsmTransaction transaction(at_lock);
+    if (!sendATFrame(cmd, (const uint8_t*)NULL, 0, timeout_ms) || !atDataLength()) {
+      return -1;
+    }
+    int32_t res = 0;
+    for (size_t i = 0; i < atDataLength() && i < 4; i++) {
+      res = (res << 8) | atData()[i];
+    }
+    return res;
+  }
+
+public:
+  Stream&       stream;
+
+protected:
+  int8_t        resetPin;
+  XBeeType      beeType;
+  uint8_t       frameId;
+  uint8_t       modemStatus;
+  // Incoming frame parser state
+  XBeeFrameState rxState;
+  uint16_t      rxLength;
+  uint16_t      rxCount;
+  uint16_t      rxDropped;  // socket data that didn't fit in the fifo
+  uint8_t       rxSum;
+  uint8_t       rxType;
+  GsmClient*    rxSock;
+  uint8_t       rxBuf[TINY_GSM_XBEE_API_BUFFER];
+  GsmClient*    sockets[MUX_COUNT];
+  TinyGsmModemEvents events;
+  TinyGsmIdentity    identity;
+  TinyGsmMetrics     metrics;
+  TinyGsmDnsCache<TINY_GSM_DNS_CACHE_SIZE> dnsCache;
+  TinyGsmTransactionLock at_lock;
+};
+
+// The first driver included also provides its registration states
+// unqualified, as when only one driver could be built
+#if !defined(TINY_GSM_REG_STATUS_DEFINED)
+#define TINY_GSM_REG_STATUS_DEFINED
+typedef TinyGsmXBeeAPI::RegStatus RegStatus;
+static const RegStatus REG_OK           = TinyGsmXBeeAPI::REG_OK;
+static const RegStatus REG_UNREGISTERED = TinyGsmXBeeAPI::REG_UNREGISTERED;
+static const RegStatus REG_SEARCHING    = TinyGsmXBeeAPI::REG_SEARCHING;
+static const RegStatus REG_DENIED       = TinyGsmXBeeAPI::REG_DENIED;
+static const RegStatus REG_UNKNOWN      = TinyGsmXBeeAPI::REG_UNKNOWN;
+#endif
+
+#endif
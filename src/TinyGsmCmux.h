@@ -0,0 +1,483 @@
+/**
+ * @file       TinyGsmCmux.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+#ifndef TinyGsmCmux_h
+#define TinyGsmCmux_h
+
+#include <TinyGsmCommon.h>
+
+// Number of virtual channels (DLCI 1..N) opened on top of the control channel
+#if !defined(TINY_GSM_CMUX_CHANNELS)
+  #define TINY_GSM_CMUX_CHANNELS 2
+#endif
+
+// Largest information field we send (N1); 31 is the 27.010 default and is
+// accepted by every modem regardless of its own setting
+#if !defined(TINY_GSM_CMUX_FRAME)
+  #define TINY_GSM_CMUX_FRAME 31
+#endif
+
+#if !defined(TINY_GSM_CMUX_RX_BUFFER)
+  #define TINY_GSM_CMUX_RX_BUFFER 256
+#endif
+
+// 3GPP TS 27.010 multiplexer, basic option (AT+CMUX=0).
+// Splits one UART into several virtual serial ports that can each be handed
+// to a driver in place of the real Stream, e.g. one TinyGsm object on
+// channel(1) for status queries and another on channel(2) for a data session:
+//
+//   TinyGsmCmux cmux(SerialAT);
+//   cmux.begin();
+//   TinyGsm modem(cmux.channel(1));
+//   TinyGsm data(cmux.channel(2));
+//
+// Everything is driven from the channels' available()/read(), so as with the
+// drivers themselves nothing happens unless the sketch calls into them.
+class TinyGsmCmux
+{
+public:
+
+  class Channel : public Stream
+  {
+    friend class TinyGsmCmux;
+
+  public:
+    Channel()
+      : mux(NULL), dlci(0), open(false), stopped(false), throttled(false), tx_len(0)
+    {}
+
+    virtual size_t write(uint8_t c) {
+      tx[tx_len++] = c;
+      if (tx_len >= TINY_GSM_CMUX_FRAME) {
+        flush();
+      }
+      return 1;
+    }
+
+    virtual size_t write(const uint8_t *buf, size_t size) {
+      for (size_t i = 0; i < size; i++) {
+        write(buf[i]);
+      }
+      return size;
+    }
+
+    using Print::write;
+
+    // Sends whatever has been written as a single UIH frame
+    virtual void flush() {
+      if (!tx_len) {
+        return;
+      }
+      uint8_t len = tx_len;
+      tx_len = 0;
+      // Wait for the modem to lift flow control on this channel
+      uint32_t startMillis = millis();
+      while (stopped && millis() - startMillis < 1000L) {
+        TINY_GSM_YIELD();
+        mux->poll();
+      }
+      mux->sendFrame(dlci, TINY_GSM_CMUX_UIH, tx, len);
+    }
+
+    virtual int available() {
+      mux->poll();
+      return rx.size();
+    }
+
+    virtual int read() {
+      uint8_t c;
+      if (!rx.readable()) {
+        mux->poll();
+      }
+      if (!rx.get(&c)) {
+        return -1;
+      }
+      unthrottle();
+      return c;
+    }
+
+    virtual int peek() {
+      uint8_t c;
+      if (!rx.readable()) {
+        mux->poll();
+      }
+      if (!rx.peek(&c)) {
+        return -1;
+      }
+      return c;
+    }
+
+    bool isOpen() {
+      return open;
+    }
+
+  private:
+    // Restart the modem's transmission once the fifo has drained
+    void unthrottle() {
+      if (throttled && rx.size() < TINY_GSM_CMUX_RX_BUFFER / 4) {
+        throttled = false;
+        mux->sendModemStatus(dlci, false);
+      }
+    }
+
+  private:
+    TinyGsmCmux*  mux;
+    uint8_t       dlci;
+    bool          open;
+    bool          stopped;    // the modem has asked us to stop sending
+    bool          throttled;  // we have asked the modem to stop sending
+    uint8_t       tx_len;
+    uint8_t       tx[TINY_GSM_CMUX_FRAME];
+    TinyGsmFifo<uint8_t, TINY_GSM_CMUX_RX_BUFFER> rx;
+  };
+
+public:
+
+  TinyGsmCmux(Stream& stream)
+    : stream(stream)
+  {
+    for (uint8_t i = 0; i < TINY_GSM_CMUX_CHANNELS; i++) {
+      channels[i].mux = this;
+      channels[i].dlci = i + 1;
+    }
+    ctrl_open = false;
+    state = STATE_HUNT;
+  }
+
+  /*
+   * Enters multiplexer mode and opens the control channel and every virtual
+   * channel.  The modem must be in command mode and answering AT.
+   */
+  bool begin(uint32_t timeout_ms = 5000L) {
+    stream.print(GF("AT+CMUX=0\r\n"));
+    stream.flush();
+    if (!waitOk(timeout_ms)) {
+      return false;
+    }
+    state = STATE_HUNT;
+    if (!openDlci(0, timeout_ms)) {
+      return false;
+    }
+    for (uint8_t i = 0; i < TINY_GSM_CMUX_CHANNELS; i++) {
+      if (!openDlci(i + 1, timeout_ms)) {
+        return false;
+      }
+      // Raise the virtual DTR/RTS, some modems won't talk without them
+      sendModemStatus(i + 1, false);
+    }
+    return true;
+  }
+
+  /*
+   * Closes all channels and returns the UART to plain AT command mode.
+   */
+  void end() {
+    for (uint8_t i = 0; i < TINY_GSM_CMUX_CHANNELS; i++) {
+      if (channels[i].open) {
+        channels[i].flush();
+        sendFrame(i + 1, TINY_GSM_CMUX_DISC | TINY_GSM_CMUX_PF, NULL, 0);
+        channels[i].open = false;
+      }
+    }
+    if (ctrl_open) {
+      // Multiplexer close down (CLD) command
+      const uint8_t cld[] = { TINY_GSM_CMUX_MSG_CLD | TINY_GSM_CMUX_CR, 0x01 };
+      sendFrame(0, TINY_GSM_CMUX_UIH, cld, sizeof(cld));
+      ctrl_open = false;
+    }
+  }
+
+  // Virtual channel n, counting from 1
+  Channel& channel(uint8_t n) {
+    return channels[n - 1];
+  }
+
+  /*
+   * Sends what the channels have buffered and sorts whatever the modem has
+   * sent into the channels' fifos.
+   */
+  void poll() {
+    for (uint8_t i = 0; i < TINY_GSM_CMUX_CHANNELS; i++) {
+      if (channels[i].tx_len) {
+        channels[i].flush();
+      }
+    }
+    while (stream.available()) {
+      parse(stream.read());
+    }
+  }
+
+private:
+
+  enum {
+    TINY_GSM_CMUX_FLAG = 0xF9,
+    TINY_GSM_CMUX_EA   = 0x01,
+    TINY_GSM_CMUX_CR   = 0x02,
+    TINY_GSM_CMUX_PF   = 0x10,
+    // Frame types, without the P/F bit
+    TINY_GSM_CMUX_SABM = 0x2F,
+    TINY_GSM_CMUX_UA   = 0x63,
+    TINY_GSM_CMUX_DM   = 0x0F,
+    TINY_GSM_CMUX_DISC = 0x43,
+    TINY_GSM_CMUX_UIH  = 0xEF,
+    // Control channel message types, without the C/R bit
+    TINY_GSM_CMUX_MSG_CLD   = 0xC1,
+    TINY_GSM_CMUX_MSG_FCON  = 0xA1,
+    TINY_GSM_CMUX_MSG_FCOFF = 0x61,
+    TINY_GSM_CMUX_MSG_MSC   = 0xE1,
+    // V.24 signals in an MSC
+    TINY_GSM_CMUX_V24_FC  = 0x02,
+    TINY_GSM_CMUX_V24_RTC = 0x04,
+    TINY_GSM_CMUX_V24_RTR = 0x08,
+    TINY_GSM_CMUX_V24_DV  = 0x80,
+  };
+
+  enum {
+    STATE_HUNT,
+    STATE_ADDRESS,
+    STATE_CONTROL,
+    STATE_LENGTH,
+    STATE_LENGTH2,
+    STATE_DATA,
+    STATE_FCS,
+    STATE_END,
+  };
+
+  // FCS is the reversed CRC-8 of 27.010 (x^8 + x^2 + x + 1)
+  static uint8_t crc(uint8_t fcs, uint8_t c) {
+    fcs ^= c;
+    for (uint8_t i = 0; i < 8; i++) {
+      fcs = (fcs & 1) ? (fcs >> 1) ^ 0xE0 : (fcs >> 1);
+    }
+    return fcs;
+  }
+
+  void sendFrame(uint8_t dlci, uint8_t control, const uint8_t* data, uint8_t len) {
+    uint8_t hdr[4];
+    hdr[0] = TINY_GSM_CMUX_FLAG;
+    hdr[1] = (dlci << 2) | TINY_GSM_CMUX_CR | TINY_GSM_CMUX_EA;
+    hdr[2] = control;
+    hdr[3] = (len << 1) | TINY_GSM_CMUX_EA;
+    // UIH frames only protect the header; the others have no data anyway
+    uint8_t fcs = 0xFF;
+    for (uint8_t i = 1; i < 4; i++) {
+      fcs = crc(fcs, hdr[i]);
+    }
+    stream.write(hdr, sizeof(hdr));
+    if (len) {
+      stream.write(data, len);
+    }
+    stream.write((uint8_t)(0xFF - fcs));
+    stream.write((uint8_t)TINY_GSM_CMUX_FLAG);
+    stream.flush();
+  }
+
+  void sendModemStatus(uint8_t dlci, bool stop) {
+    uint8_t v24 = TINY_GSM_CMUX_V24_RTC | TINY_GSM_CMUX_V24_RTR | TINY_GSM_CMUX_V24_DV | TINY_GSM_CMUX_EA;
+    if (stop) {
+      v24 |= TINY_GSM_CMUX_V24_FC;
+    }
+    const uint8_t msc[] = {
+      TINY_GSM_CMUX_MSG_MSC | TINY_GSM_CMUX_CR,
+      (2 << 1) | TINY_GSM_CMUX_EA,
+      (uint8_t)((dlci << 2) | TINY_GSM_CMUX_CR | TINY_GSM_CMUX_EA),
+      v24
+    };
+    sendFrame(0, TINY_GSM_CMUX_UIH, msc, sizeof(msc));
+  }
+
+  bool openDlci(uint8_t dlci, uint32_t timeout_ms) {
+    sendFrame(dlci, TINY_GSM_CMUX_SABM | TINY_GSM_CMUX_PF, NULL, 0);
+    uint32_t startMillis = millis();
+    while (millis() - startMillis < timeout_ms) {
+      poll();
+      if (dlci ? channels[dlci - 1].open : ctrl_open) {
+        return true;
+      }
+      TINY_GSM_YIELD();
+    }
+    return false;
+  }
+
+  // The AT+CMUX answer still comes in plain text
+  bool waitOk(uint32_t timeout_ms) {
+    char prev = 0;
+    uint32_t startMillis = millis();
+    while (millis() - startMillis < timeout_ms) {
+      TINY_GSM_YIELD();
+      while (stream.available()) {
+        char c = stream.read();
+        if (prev == 'O' && c == 'K') {
+          stream.readStringUntil('\n');
+          return true;
+        }
+        if (prev == 'O' && c == 'R') {
+          // ERROR
+          return false;
+        }
+        prev = c;
+      }
+    }
+    return false;
+  }
+
+  void parse(uint8_t c) {
+    switch (state) {
+    case STATE_HUNT:
+      if (c == TINY_GSM_CMUX_FLAG) {
+        state = STATE_ADDRESS;
+      }
+      break;
+    case STATE_ADDRESS:
+      // Consecutive flags are allowed between frames
+      if (c == TINY_GSM_CMUX_FLAG) {
+        break;
+      }
+      rx_dlci = c >> 2;
+      rx_fcs = crc(0xFF, c);
+      state = STATE_CONTROL;
+      break;
+    case STATE_CONTROL:
+      rx_control = c;
+      rx_fcs = crc(rx_fcs, c);
+      state = STATE_LENGTH;
+      break;
+    case STATE_LENGTH:
+      rx_len = c >> 1;
+      rx_fcs = crc(rx_fcs, c);
+      rx_msg_len = 0;
+      if (!(c & TINY_GSM_CMUX_EA)) {
+        state = STATE_LENGTH2;
+      } else {
+        state = rx_len ? STATE_DATA : STATE_FCS;
+      }
+      break;
+    case STATE_LENGTH2:
+      rx_len |= (uint16_t)c << 7;
+      rx_fcs = crc(rx_fcs, c);
+      state = rx_len ? STATE_DATA : STATE_FCS;
+      break;
+    case STATE_DATA:
+      if (rx_dlci == 0) {
+        if (rx_msg_len < sizeof(rx_msg)) {
+          rx_msg[rx_msg_len++] = c;
+        }
+      } else if ((rx_control & ~TINY_GSM_CMUX_PF) == TINY_GSM_CMUX_UIH &&
+                 rx_dlci <= TINY_GSM_CMUX_CHANNELS)
+      {
+        // Data goes into the channel's fifo straight away, but can only be
+        // read once the FCS has confirmed the header it came with
+        Channel& ch = channels[rx_dlci - 1];
+        if (!ch.rx.stage(c)) {
+          DBG("### CMUX overflow on channel", rx_dlci);
+        }
+        if (!ch.throttled && ch.rx.free() < TINY_GSM_CMUX_RX_BUFFER / 2) {
+          ch.throttled = true;
+          sendModemStatus(rx_dlci, true);
+        }
+      }
+      if (--rx_len == 0) {
+        state = STATE_FCS;
+      }
+      break;
+    case STATE_FCS:
+      if (crc(rx_fcs, c) == 0xCF) {
+        if (rx_dlci && rx_dlci <= TINY_GSM_CMUX_CHANNELS) {
+          channels[rx_dlci - 1].rx.commit();
+        }
+        handleFrame();
+      } else {
+        DBG("### CMUX bad FCS on channel", rx_dlci);
+        if (rx_dlci && rx_dlci <= TINY_GSM_CMUX_CHANNELS) {
+          channels[rx_dlci - 1].rx.discard();
+        }
+      }
+      state = STATE_END;
+      break;
+    case STATE_END:
+      // The closing flag may also open the next frame
+      state = (c == TINY_GSM_CMUX_FLAG) ? STATE_ADDRESS : STATE_HUNT;
+      break;
+    }
+  }
+
+  void handleFrame() {
+    bool* open = &ctrl_open;
+    if (rx_dlci > TINY_GSM_CMUX_CHANNELS) {
+      return;
+    } else if (rx_dlci) {
+      open = &channels[rx_dlci - 1].open;
+    }
+    switch (rx_control & ~TINY_GSM_CMUX_PF) {
+    case TINY_GSM_CMUX_UA:
+      *open = true;
+      break;
+    case TINY_GSM_CMUX_DM:
+      *open = false;
+      break;
+    case TINY_GSM_CMUX_DISC:
+      *open = false;
+      sendFrame(rx_dlci, TINY_GSM_CMUX_UA | TINY_GSM_CMUX_PF, NULL, 0);
+      break;
+    case TINY_GSM_CMUX_UIH:
+      if (rx_dlci == 0) {
+        handleControl();
+      }
+      break;
+    }
+  }
+
+  // Messages from the modem on the control channel
+  void handleControl() {
+    if (rx_msg_len < 2 || !(rx_msg[0] & TINY_GSM_CMUX_CR)) {
+      return;  // too short, or a response to one of ours
+    }
+    uint8_t type = rx_msg[0] & ~TINY_GSM_CMUX_CR;
+    switch (type) {
+    case TINY_GSM_CMUX_MSG_MSC:
+      if (rx_msg_len >= 4) {
+        uint8_t dlci = rx_msg[2] >> 2;
+        if (dlci && dlci <= TINY_GSM_CMUX_CHANNELS) {
+          channels[dlci - 1].stopped = rx_msg[3] & TINY_GSM_CMUX_V24_FC;
+        }
+      }
+      break;
+    case TINY_GSM_CMUX_MSG_FCON:
+    case TINY_GSM_CMUX_MSG_FCOFF:
+      for (uint8_t i = 0; i < TINY_GSM_CMUX_CHANNELS; i++) {
+        channels[i].stopped = (type == TINY_GSM_CMUX_MSG_FCOFF);
+      }
+      break;
+    case TINY_GSM_CMUX_MSG_CLD:
+      ctrl_open = false;
+      for (uint8_t i = 0; i < TINY_GSM_CMUX_CHANNELS; i++) {
+        channels[i].open = false;
+      }
+      break;
+    default:
+      return;
+    }
+    // Acknowledge by echoing the message back as a response
+    rx_msg[0] = type;
+    sendFrame(0, TINY_GSM_CMUX_UIH, rx_msg, rx_msg_len);
+  }
+
+private:
+  Stream&       stream;
+  Channel       channels[TINY_GSM_CMUX_CHANNELS];
+  bool          ctrl_open;
+  uint8_t       state;
+  uint8_t       rx_dlci;
+  uint8_t       rx_control;
+  uint8_t       rx_fcs;
+  uint16_t      rx_len;
+  uint8_t       rx_msg[8];
+  uint8_t       rx_msg_len;
+};
+
+#endif
@@ -24,11 +24,86 @@
 
 #if defined(ARDUINO_DASH)
   #include <ArduinoCompat/Client.h>
+  #include <ArduinoCompat/Udp.h>
 #else
   #include <Client.h>
+  #include <Udp.h>
 #endif
 
 #include <TinyGsmFifo.h>
+#include <TinyGsmDnsCache.h>
+#include <TinyGsmLock.h>
+
+#ifndef TINY_GSM_DNS_CACHE_SIZE
+  #define TINY_GSM_DNS_CACHE_SIZE 4
+#endif
+
+#ifndef TINY_GSM_SOCK_STATE_MS
+  #define TINY_GSM_SOCK_STATE_MS 500L
+#endif
+
+// How often a wait for a registration or SIM URC asks again, in case the
+// URC was missed
+#ifndef TINY_GSM_URC_RECHECK_MS
+  #define TINY_GSM_URC_RECHECK_MS 5000L
+#endif
+
+// How often waitForReady() sends AT to a modem that is starting up
+#ifndef TINY_GSM_BOOT_POLL_MS
+  #define TINY_GSM_BOOT_POLL_MS 500L
+#endif
+
+// How long waitForReady() only listens before it sends the first AT; a modem
+// may still answer it until it actually begins to reset
+#ifndef TINY_GSM_BOOT_LISTEN_MS
+  #define TINY_GSM_BOOT_LISTEN_MS 2000L
+#endif
+
+// How long a reading of the battery, the signal quality and the GPRS
+// connection is reused; each getter also takes its own maximum age
+#ifndef TINY_GSM_BATT_TTL_MS
+  #define TINY_GSM_BATT_TTL_MS 10000L
+#endif
+#ifndef TINY_GSM_CSQ_TTL_MS
+  #define TINY_GSM_CSQ_TTL_MS 2000L
+#endif
+#ifndef TINY_GSM_GPRS_TTL_MS
+  #define TINY_GSM_GPRS_TTL_MS 1000L
+#endif
+
+// Room kept for getModemInfo(); longer answers are cut short
+#ifndef TINY_GSM_IDENTITY_INFO_LEN
+  #define TINY_GSM_IDENTITY_INFO_LEN 64
+#endif
+
+#ifndef TINY_GSM_UDP_TX_BUFFER
+  #define TINY_GSM_UDP_TX_BUFFER 128
+#endif
+
+// Number of received datagrams a UDP socket can hold before dropping more,
+// on modems that push them to us
+#ifndef TINY_GSM_UDP_PACKETS
+  #define TINY_GSM_UDP_PACKETS 4
+#endif
+
+// Line sent by echoTest() after a baud rate change
+#ifndef TINY_GSM_ECHO_PATTERN
+  #define TINY_GSM_ECHO_PATTERN "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz~U"
+#endif
+
+// How long TinyGsmAutoBaud() spends on each rate, and how often it sends AT
+#ifndef TINY_GSM_AUTOBAUD_RATE_MS
+  #define TINY_GSM_AUTOBAUD_RATE_MS 300
+#endif
+
+#ifndef TINY_GSM_AUTOBAUD_RETRY_MS
+  #define TINY_GSM_AUTOBAUD_RETRY_MS 100
+#endif
+
+// How long the modem has to be quiet after the OK before the rate is taken
+#ifndef TINY_GSM_AUTOBAUD_QUIET_MS
+  #define TINY_GSM_AUTOBAUD_QUIET_MS 50
+#endif
 
 #ifndef TINY_GSM_YIELD_MS
   #define TINY_GSM_YIELD_MS 0
@@ -53,6 +128,36 @@
   #define GF(x)  x
 #endif
 
+// Final result codes, for modems ending lines with "\r\n" and with "\r".
+// Each driver points GSM_OK and GSM_ERROR at the pair it needs, so drivers
+// for different modems can be built into the same program.
+static const char GSM_CRLF_OK[] TINY_GSM_PROGMEM = "OK\r\n";
+static const char GSM_CRLF_ERROR[] TINY_GSM_PROGMEM = "ERROR\r\n";
+static const char GSM_CRLF_CME_ERROR[] TINY_GSM_PROGMEM = "\r\n+CME ERROR:";
+static const char GSM_CR_OK[] TINY_GSM_PROGMEM = "OK\r";
+static const char GSM_CR_ERROR[] TINY_GSM_PROGMEM = "ERROR\r";
+
+// A TINY_GSM_RX_BUFFER defined by the sketch applies to every driver,
+// otherwise each one uses its own default
+#if defined(TINY_GSM_RX_BUFFER)
+  #define TINY_GSM_RX_BUFFER_OR(size) TINY_GSM_RX_BUFFER
+#else
+  #define TINY_GSM_RX_BUFFER_OR(size) size
+#endif
+
+enum SimStatus {
+  SIM_ERROR = 0,
+  SIM_READY = 1,
+  SIM_LOCKED = 2,
+  SIM_ANTITHEFT_LOCKED = 3,
+};
+
+enum TinyGSMDateTimeFormat {
+  DATE_FULL = 0,
+  DATE_TIME = 1,
+  DATE_DATE = 2
+};
+
 #ifdef TINY_GSM_DEBUG
 namespace {
   template<typename T>
@@ -92,25 +197,78 @@ const T& TinyGsmMax(const T& a, const T& b)
     return (b < a) ? a : b;
 }
 
+// Lets TinyGsmAutoBaud() try the rate that worked last time before any
+// other: load returns it (0 if unknown), save stores a newly found one,
+// e.g. in EEPROM or RTC memory
+typedef uint32_t (*TinyGsmBaudLoad)();
+typedef void (*TinyGsmBaudSave)(uint32_t rate);
+
+// Sends AT every TINY_GSM_AUTOBAUD_RETRY_MS and waits at most
+// TINY_GSM_AUTOBAUD_RATE_MS for an OK at one rate.  The rest of that answer,
+// and those to the other AT's sent, are read until the modem is quiet, so
+// the first command sent at the new rate doesn't get them instead.
 template<class T>
-uint32_t TinyGsmAutoBaud(T& SerialAT, uint32_t minimum = 9600, uint32_t maximum = 115200)
+bool TinyGsmProbeBaud(T& SerialAT, uint32_t rate)
 {
-  static uint32_t rates[] = { 115200, 57600, 38400, 19200, 9600, 74400, 74880, 230400, 460800, 2400, 4800, 14400, 28800 };
+  DBG("Trying baud rate", rate, "...");
+  SerialAT.begin(rate);
+  delay(10);
+  while (SerialAT.available()) {
+    SerialAT.read();  // whatever arrived at the previous rate
+  }
+  uint32_t start = millis();
+  uint32_t sent = 0;
+  bool first = true;
+  char prev = 0;
+  while (millis() - start < TINY_GSM_AUTOBAUD_RATE_MS) {
+    if (first || millis() - sent >= TINY_GSM_AUTOBAUD_RETRY_MS) {
+      SerialAT.print("AT\r\n");
+      sent = millis();
+      first = false;
+    }
+    if (!SerialAT.available()) {
+      TINY_GSM_YIELD();
+      continue;
+    }
+    char c = SerialAT.read();
+    if (prev == 'O' && c == 'K') {
+      DBG("Modem responded at rate", rate);
+      uint32_t drainStart = millis();
+      uint32_t quiet = drainStart;
+      while (millis() - quiet < TINY_GSM_AUTOBAUD_QUIET_MS &&
+             millis() - drainStart < TINY_GSM_AUTOBAUD_RATE_MS) {
+        if (SerialAT.available()) {
+          SerialAT.read();
+          quiet = millis();
+        } else {
+          TINY_GSM_YIELD();
+        }
+      }
+      return true;
+    }
+    prev = c;
+  }
+  return false;
+}
+
+template<class T>
+uint32_t TinyGsmAutoBaud(T& SerialAT, uint32_t minimum = 9600, uint32_t maximum = 115200,
+                         TinyGsmBaudLoad load = NULL, TinyGsmBaudSave save = NULL)
+{
+  static uint32_t rates[] = { 115200, 57600, 38400, 19200, 9600, 74400, 74880, 230400, 460800, 921600, 2400, 4800, 14400, 28800 };
+
+  uint32_t last = load ? load() : 0;
+  if (last >= minimum && last <= maximum && TinyGsmProbeBaud(SerialAT, last)) {
+    return last;
+  }
 
   for (unsigned i = 0; i < sizeof(rates)/sizeof(rates[0]); i++) {
     uint32_t rate = rates[i];
-    if (rate < minimum || rate > maximum) continue;
+    if (rate < minimum || rate > maximum || rate == last) continue;
 
-    DBG("Trying baud rate", rate, "...");
-    SerialAT.begin(rate);
-    delay(10);
-    for (int i=0; i<10; i++) {
-      SerialAT.print("AT\r\n");
-      String input = SerialAT.readString();
-      if (input.indexOf("OK") >= 0) {
-        DBG("Modem responded at rate", rate);
-        return rate;
-      }
+    if (TinyGsmProbeBaud(SerialAT, rate)) {
+      if (save) save(rate);
+      return rate;
     }
   }
   return 0;
@@ -138,6 +296,36 @@ IPAddress TinyGsmIpFromString(const String& strIP) {
   return IPAddress(Parts[0], Parts[1], Parts[2], Parts[3]);
 }
 
+// Checks for a strict dotted-quad IPv4 address, ie "a.b.c.d" with 0-255 parts
+static inline
+bool TinyGsmIsIpString(const char* str) {
+  if (str == NULL) return false;
+  int part = 0;
+  int digits = 0;
+  int value = 0;
+  for (; *str; str++) {
+    char c = *str;
+    if (c >= '0' && c <= '9') {
+      value = value * 10 + (c - '0');
+      if (++digits > 3 || value > 255) return false;
+    } else if (c == '.' && digits > 0 && part < 3) {
+      part++;
+      digits = 0;
+      value = 0;
+    } else {
+      return false;
+    }
+  }
+  return part == 3 && digits > 0;
+}
+
+// Writes the IP address as dotted text into buf, which needs 16 bytes
+static inline
+const char* TinyGsmIpToChars(const IPAddress& ip, char* buf) {
+  snprintf(buf, 16, "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+  return buf;
+}
+
 static inline
 String TinyGsmDecodeHex7bit(String &instr) {
   String result;
@@ -203,6 +391,154 @@ String TinyGsmDecodeHex16bit(String &instr) {
 }
 
 
+// Reconfigures the host's UART to talk to the modem
+typedef bool (*TinyGsmPortConfig)(uint32_t baud, bool rtscts);
+
+typedef void (*TinyGsmClientEvent)(Client& client);
+typedef void (*TinyGsmRegistrationEvent)(int status);
+typedef void (*TinyGsmModemEvent)();
+
+// A client's callbacks, and the state they were last fired for
+struct TinyGsmClientEvents {
+  TinyGsmClientEvents()
+    : data(NULL), close(NULL), connect(NULL), connected(false), readable(false)
+  {}
+
+  TinyGsmClientEvent  data;
+  TinyGsmClientEvent  close;
+  TinyGsmClientEvent  connect;
+  bool                connected;
+  bool                readable;
+};
+
+// The modem's callbacks, and what the URC handlers have seen since they
+// were last dispatched
+struct TinyGsmModemEvents {
+  TinyGsmModemEvents()
+    : registration(NULL), pdpDeactivated(NULL), reg_status(-1), sim_status(-1),
+      reg_urcs(0), sim_urcs(0), pdp_urcs(0), reg_changed(false), pdp_deactivated(false),
+      dispatching(false)
+  {}
+
+  TinyGsmRegistrationEvent registration;
+  TinyGsmModemEvent   pdpDeactivated;
+  int8_t              reg_status;
+  int8_t              sim_status;  // a SimStatus, or -1 while not known
+  uint8_t             reg_urcs;    // counts URC's, for waits to see new ones
+  uint8_t             sim_urcs;
+  uint8_t             pdp_urcs;
+  bool                reg_changed;
+  bool                pdp_deactivated;
+  bool                dispatching;
+};
+
+// What the modem is known to be set to, so that modemSet() only sends a
+// setting when it changes; -1 is unknown.  init() clears it, and an entry is
+// dropped when setting it fails.
+struct TinyGsmSettings {
+  enum {
+    CSCS_GSM = 0,
+    CSCS_HEX = 1,
+  };
+
+  TinyGsmSettings() {
+    clear();
+  }
+
+  void clear() {
+    cmgf = cscs = csmp = ssl = ssl_size = -1;
+  }
+
+  int8_t cmgf;      // SMS text (1) or PDU (0) mode
+  int8_t cscs;      // character set, CSCS_*
+  int8_t csmp;      // data coding scheme of text mode SMS
+  int8_t ssl;       // SSL on for the next connection
+  int8_t ssl_size;  // SSL buffer size set
+};
+
+// The modem's identity as read by TINY_GSM_MODEM_IDENTITY(), kept until
+// restart(); an empty field hasn't been read yet
+struct TinyGsmIdentity {
+  TinyGsmIdentity() {
+    clear();
+  }
+
+  void clear() {
+    imei[0] = ccid[0] = name[0] = info[0] = '\0';
+  }
+
+  // Whether an answer looks like what the field holds, before it is kept
+  static bool isImei(const String& s) {
+    return (s.length() == 15 || s.length() == 16) && isDigits(s, s.length());
+  }
+
+  // The last digit may be an F filler
+  static bool isCcid(const String& s) {
+    size_t len = s.length();
+    if (len != 19 && len != 20) {
+      return false;
+    }
+    char last = s[len - 1];
+    return isDigits(s, len - 1) &&
+           ((last >= '0' && last <= '9') || last == 'F' || last == 'f');
+  }
+
+  static bool isDigits(const String& s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+      if (s[i] < '0' || s[i] > '9') {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  char imei[17];  // 15 digit IMEI or 16 digit IMEISV
+  char ccid[23];
+  char name[40];
+  char info[TINY_GSM_IDENTITY_INFO_LEN];
+};
+
+// The last readings of the values sketches poll, and when they were taken.
+// URC's update or expire them, and restart() and radioOff() drop them all.
+struct TinyGsmMetrics {
+  enum {
+    BATT,
+    CSQ,
+    GPRS,
+    COUNT
+  };
+
+  TinyGsmMetrics() {
+    clear();
+  }
+
+  void clear() {
+    valid = 0;
+  }
+
+  bool fresh(uint8_t field, uint32_t maxAge_ms) const {
+    return (valid & (1 << field)) && millis() - taken[field] < maxAge_ms;
+  }
+
+  void stamp(uint8_t field) {
+    valid |= 1 << field;
+    taken[field] = millis();
+  }
+
+  void expire(uint8_t field) {
+    valid &= ~(1 << field);
+  }
+
+  uint32_t taken[COUNT];
+  uint8_t  valid;         // a bit for each field that has been read
+  uint16_t batt_mv;
+  int8_t   batt_percent;
+  uint8_t  batt_state;
+  int16_t  csq;
+  bool     gprs;
+};
+
+
 // Connect to a IP address given as an IPAddress object by
 // converting said IP address to text
 #define TINY_GSM_CLIENT_CONNECT_OVERLOADS() \
@@ -395,6 +731,163 @@ String TinyGsmDecodeHex16bit(String &instr) {
   }
 
 
+// The packet side of the Arduino UDP interface for a GsmUdp class built on
+// one of the modem's sockets (sock).  Outgoing datagrams are collected between
+// beginPacket() and endPacket() and sent in one piece; incoming datagrams are
+// taken one at a time from the modem's modemReadDatagram() and read out of
+// the socket's fifo.  The GsmUdp class provides connectPeer() to open the
+// socket towards a peer, and sendDatagram() to send to it.  A datagram that
+// overflows TINY_GSM_UDP_TX_BUFFER makes endPacket() fail.
+#define TINY_GSM_UDP_PACKET_FUNCTIONS() \
+  virtual uint8_t begin(uint16_t port) { \
+    local_port = port; \
+    return 1; \
+  } \
+  \
+  virtual void stop() { \
+    TINY_GSM_YIELD(); \
+    if (peer_port) { \
+      sock.stop(); \
+    } \
+    peer_host = ""; \
+    peer_port = 0; \
+    tx_len = 0; \
+    tx_overflow = false; \
+    rx_left = 0; \
+  } \
+  \
+  virtual int beginPacket(IPAddress ip, uint16_t port) { \
+    char buf[16]; \
+    return beginPacket(TinyGsmIpToChars(ip, buf), port); \
+  } \
+  \
+  virtual int beginPacket(const char *host, uint16_t port) { \
+    tx_len = 0; \
+    tx_overflow = false; \
+    /* The socket stays open for as long as the peer doesn't change */ \
+    if (sock.sock_connected && port == peer_port && peer_host == host) { \
+      return 1; \
+    } \
+    stop(); \
+    if (!connectPeer(host, port)) { \
+      return 0; \
+    } \
+    peer_host = host; \
+    peer_port = port; \
+    return 1; \
+  } \
+  \
+  virtual int endPacket() { \
+    TINY_GSM_YIELD(); \
+    size_t len = tx_len; \
+    bool overflow = tx_overflow; \
+    tx_len = 0; \
+    tx_overflow = false; \
+    /* A datagram cut short by TINY_GSM_UDP_TX_BUFFER is not sent at all */ \
+    if (overflow) { \
+      DBG("### Datagram too long:", TINY_GSM_UDP_TX_BUFFER, "bytes max"); \
+      return 0; \
+    } \
+    if (!len || !sock.sock_connected) { \
+      return 0; \
+    } \
+    int16_t sent = sendDatagram(tx, len); \
+    return sent > 0 && (size_t)sent == len; \
+  } \
+  \
+  virtual size_t write(uint8_t c) { \
+    return write(&c, 1); \
+  } \
+  \
+  virtual size_t write(const uint8_t *buf, size_t size) { \
+    size_t n = TinyGsmMin(size, (size_t)(TINY_GSM_UDP_TX_BUFFER - tx_len)); \
+    memcpy(&tx[tx_len], buf, n); \
+    tx_len += n; \
+    if (n < size) { \
+      tx_overflow = true; \
+    } \
+    return n; \
+  } \
+  \
+  using Print::write; \
+  \
+  virtual int parsePacket() { \
+    TINY_GSM_YIELD(); \
+    /* Whatever is left of the current packet is dropped */ \
+    uint8_t c; \
+    while (rx_left > 0 && sock.rx.get(&c)) { \
+      rx_left--; \
+    } \
+    rx_left = 0; \
+    if (!peer_port) { \
+      return 0; \
+    } \
+    rx_left = at->modemReadDatagram(sock.mux); \
+    return rx_left; \
+  } \
+  \
+  virtual int available() { \
+    return rx_left; \
+  } \
+  \
+  virtual int read(unsigned char* buf, size_t size) { \
+    size_t n = sock.rx.get(buf, TinyGsmMin(size, (size_t)rx_left)); \
+    rx_left -= n; \
+    return n; \
+  } \
+  \
+  virtual int read(char* buf, size_t size) { \
+    return read((unsigned char*)buf, size); \
+  } \
+  \
+  virtual int read() { \
+    uint8_t c; \
+    if (read(&c, 1) == 1) { \
+      return c; \
+    } \
+    return -1; \
+  } \
+  \
+  virtual int peek() { \
+    uint8_t c; \
+    if (rx_left && sock.rx.peek(&c)) { \
+      return c; \
+    } \
+    return -1; \
+  } \
+  \
+  virtual void flush() { at->stream.flush(); } \
+  \
+  virtual IPAddress remoteIP() { \
+    if (!TinyGsmIsIpString(peer_host.c_str())) { \
+      return IPAddress(0,0,0,0); \
+    } \
+    return TinyGsmIpFromString(peer_host); \
+  } \
+  \
+  virtual uint16_t remotePort() { \
+    return peer_port; \
+  }
+
+
+// Hands over the next datagram for a UDP socket on modems that keep received
+// data in their own buffer and return at most one datagram per read.
+// Returns the datagram's length once it is in the socket's fifo.
+#define TINY_GSM_MODEM_READ_DATAGRAM() \
+  size_t modemReadDatagram(uint8_t mux) { \
+    TinyGsmTransaction transaction(at_lock); \
+    GsmClient* sock = sockets[mux % MUX_COUNT]; \
+    if (!sock) { \
+      return 0; \
+    } \
+    maintain(); \
+    if (!sock->sock_available || sock->rx.size()) { \
+      return 0; \
+    } \
+    return modemRead(TinyGsmMin((uint16_t)sock->rx.free(), sock->sock_available), mux); \
+  }
+
+
 // The peek, flush, and connected functions
 #define TINY_GSM_CLIENT_PEEK_FLUSH_CONNECTED() \
   virtual int peek() { return -1; } /* TODO */ \
@@ -410,16 +903,148 @@ String TinyGsmDecodeHex16bit(String &instr) {
   virtual operator bool() { return connected(); }
 
 
+// Resolves host names through the modem's own DNS query, answering repeat
+// lookups from the DNS cache until the entry expires.
+// Requires a dnsIpQuery(host) function and a dnsCache member in the modem.
+#define TINY_GSM_MODEM_DNS_CACHE() \
+  bool resolveHost(const char* host, IPAddress& ip) { \
+    if (TinyGsmIsIpString(host)) { \
+      ip = TinyGsmIpFromString(host); \
+      return true; \
+    } \
+    if (dnsCache.lookup(host, ip)) { \
+      return true; \
+    } \
+    String res = dnsIpQuery(host); \
+    if (!TinyGsmIsIpString(res.c_str())) { \
+      return false; \
+    } \
+    ip = TinyGsmIpFromString(res); \
+    dnsCache.store(host, ip); \
+    return true; \
+  } \
+  \
+  void setDnsCacheTTL(uint32_t ttl_ms) { \
+    dnsCache.setTTL(ttl_ms); \
+  } \
+  \
+  void clearDnsCache() { \
+    dnsCache.clear(); \
+  } \
+  \
+  /* Returns the resolved address written into buf (16 bytes), or the host
+  name itself if it could not be resolved */ \
+  const char* resolvedHost(const char* host, char* buf) { \
+    IPAddress ip; \
+    if (!resolveHost(host, ip)) { \
+      return host; \
+    } \
+    return TinyGsmIpToChars(ip, buf); \
+  }
+
+
 // Set baud rate via the V.25TER standard IPR command
 #define TINY_GSM_MODEM_SET_BAUD_IPR() \
   void setBaud(unsigned long baud) { \
+    TinyGsmTransaction transaction(at_lock); \
     sendAT(GF("+IPR="), baud); \
+  } \
+  \
+  /* RTS/CTS hardware flow control in both directions, or none */ \
+  bool setFlowControl(bool rtscts) { \
+    TinyGsmTransaction transaction(at_lock); \
+    sendAT(GF("+IFC="), rtscts ? GF("2,2") : GF("0,0")); \
+    return waitResponse() == 1; \
+  } \
+  \
+  /* Turns echo on and sends a long line of mixed bits, to prove that the */ \
+  /* link carries bursts both ways at the current rate.  The line is a */ \
+  /* phonebook search, which changes nothing; whether it finds anything */ \
+  /* or fails with +CME ERROR (not found, no SIM), only the echo and an */ \
+  /* answer matter */ \
+  bool echoTest() { \
+    TinyGsmTransaction transaction(at_lock); \
+    sendAT(GF("E1")); \
+    if (waitResponse(1000L) != 1) { \
+      return false; \
+    } \
+    String data; \
+    sendAT(GF("+CPBF=\""), GF(TINY_GSM_ECHO_PATTERN), GF("\"")); \
+    uint8_t answer = waitResponse(1000L, data, GFP(GSM_OK), GFP(GSM_ERROR), \
+                                  GF("+CME ERROR:")); \
+    if (answer == 3) { \
+      streamSkipUntil('\n'); \
+    } \
+    bool ok = answer > 0 && data.indexOf(GF(TINY_GSM_ECHO_PATTERN)) >= 0; \
+    sendAT(GF("E0")); \
+    return waitResponse(1000L) == 1 && ok && testAT(1000L); \
+  } \
+  \
+  /* Enables RTS/CTS if both ends can, then steps the modem and the host */ \
+  /* port up to the fastest rate (up to maximum) that passes echoTest(), */ \
+  /* and saves it in the modem.  setPort reconfigures the host's UART, */ \
+  /* returning false if it can't run that way.  Any failure falls back to */ \
+  /* the last working setting.  Returns the rate in use, 0 if the modem */ \
+  /* was lost. */ \
+  uint32_t negotiateBaud(TinyGsmPortConfig setPort, uint32_t current, \
+                         uint32_t maximum = 921600, bool flowControl = true) { \
+    TinyGsmTransaction transaction(at_lock); \
+    static const uint32_t rates[] = { 921600, 460800, 230400, 115200, 57600 }; \
+    bool flow = false; \
+    if (flowControl && setFlowControl(true)) { \
+      flow = setPort(current, true) && testAT(1000L); \
+      if (!flow) { \
+        setPort(current, false); \
+        setFlowControl(false); \
+      } \
+    } \
+    uint32_t rate = current; \
+    for (unsigned i = 0; i < sizeof(rates)/sizeof(rates[0]); i++) { \
+      uint32_t next = rates[i]; \
+      if (next > maximum || next <= rate) continue; \
+      /* Make sure the host can do it before the modem changes */ \
+      bool hostOk = setPort(next, flow); \
+      setPort(rate, flow); \
+      if (!hostOk) continue; \
+      sendAT(GF("+IPR="), next); \
+      if (waitResponse() != 1) continue; \
+      setPort(next, flow); \
+      delay(50); \
+      if (echoTest()) { \
+        rate = next; \
+        break; \
+      } \
+      /* Back to the last good rate first: a modem that never moved (or */ \
+      /* can't be reached at the new one) is still listening there */ \
+      setPort(rate, flow); \
+      delay(50); \
+      sendAT(GF("+IPR="), rate); \
+      if (waitResponse(500L) != 1) { \
+        /* Otherwise ask it back at the rate it moved to */ \
+        setPort(next, flow); \
+        delay(50); \
+        sendAT(GF("+IPR="), rate); \
+        waitResponse(500L); \
+        setPort(rate, flow); \
+        delay(50); \
+      } \
+      if (!testAT(1000L)) { \
+        DBG("### Modem lost switching to", next); \
+        return 0; \
+      } \
+    } \
+    if (rate != current || flow) { \
+      sendAT(GF("&W")); \
+      waitResponse(); \
+    } \
+    return rate; \
   }
 
 
 // Test response to AT commands
 #define TINY_GSM_MODEM_TEST_AT() \
   bool testAT(unsigned long timeout_ms = 10000L) { \
+    TinyGsmTransaction transaction(at_lock); \
     for (unsigned long start = millis(); millis() - start < timeout_ms; ) { \
       sendAT(GF("")); \
       if (waitResponse(200) == 1) return true; \
@@ -429,11 +1054,58 @@ String TinyGsmDecodeHex16bit(String &instr) {
   }
 
 
+// Waits for the modem to take commands again after a reset.  It is ready as
+// soon as it sends one of the usual start-up lines (RDY, APP RDY, Call Ready,
+// SMS Ready, +CPIN: READY) or answers AT, which is sent every
+// TINY_GSM_BOOT_POLL_MS once TINY_GSM_BOOT_LISTEN_MS have passed, for modems
+// that send none of them (SIMCom only sends RDY at a fixed baud rate).  An OK
+// before that can only come from a modem that has not reset yet, so it
+// doesn't count.
+#define TINY_GSM_MODEM_WAIT_FOR_READY() \
+  bool waitForReady(unsigned long timeout_ms = 10000L) { \
+    TinyGsmTransaction transaction(at_lock); \
+    String line; \
+    line.reserve(32); \
+    unsigned long start = millis(); \
+    unsigned long asked = start; \
+    bool polling = false; \
+    while (millis() - start < timeout_ms) { \
+      if (polling ? millis() - asked >= TINY_GSM_BOOT_POLL_MS \
+                  : millis() - start >= TINY_GSM_BOOT_LISTEN_MS) { \
+        streamWrite("AT", GSM_NL); \
+        stream.flush(); \
+        asked = millis(); \
+        polling = true; \
+      } \
+      if (!stream.available()) { \
+        TINY_GSM_YIELD(); \
+        continue; \
+      } \
+      char c = stream.read(); \
+      if (c != '\n') { \
+        /* Whatever it sends while its baud rate settles is noise */ \
+        if (line.length() >= 32) line = ""; \
+        line += c; \
+        continue; \
+      } \
+      line.trim(); \
+      if ((polling && line == GF("OK")) || line.endsWith(GF("RDY")) || line == GF("Call Ready") || \
+          line == GF("SMS Ready") || line == GF("+CPIN: READY")) { \
+        DBG("### Ready after", millis() - start, "ms:", line); \
+        return true; \
+      } \
+      line = ""; \
+    } \
+    return false; \
+  }
+
+
 // Keeps listening for modem URC's and iterates through sockets
 // to see if any data is avaiable
 #define TINY_GSM_MODEM_MAINTAIN_CHECK_SOCKS() \
   void maintain() { \
-    for (int mux = 0; mux < TINY_GSM_MUX_COUNT; mux++) { \
+    TinyGsmTransaction transaction(at_lock); \
+    for (int mux = 0; mux < MUX_COUNT; mux++) { \
       GsmClient* sock = sockets[mux]; \
       if (sock && sock->got_data) { \
         sock->got_data = false; \
@@ -443,21 +1115,215 @@ String TinyGsmDecodeHex16bit(String &instr) {
     while (stream.available()) { \
       waitResponse(15, NULL, NULL); \
     } \
+    modemDispatchEvents(); \
+  }
+
+
+// Event callbacks for a client, called from the modem's maintain() (and so
+// from available(), read(), pollSockets(), ...) once a URC or a status query
+// has shown the change.  They never run in the middle of an AT command, so
+// they may use the client and the modem freely.
+#define TINY_GSM_CLIENT_EVENTS() \
+  void onData(TinyGsmClientEvent cb) { events.data = cb; } \
+  void onClose(TinyGsmClientEvent cb) { events.close = cb; } \
+  void onConnect(TinyGsmClientEvent cb) { events.connect = cb; }
+
+
+// Fires the callbacks for whatever has changed since the last call.  Data
+// fires when a socket goes from empty to readable, so one callback may be
+// followed by several reads.
+#define TINY_GSM_MODEM_EVENTS_IMPL(pending) \
+  void modemDispatchEvents() { \
+    if (events.dispatching) return; \
+    events.dispatching = true; \
+    for (int mux = 0; mux < MUX_COUNT; mux++) { \
+      GsmClient* sock = sockets[mux]; \
+      if (!sock) continue; \
+      TinyGsmClientEvents& ev = sock->events; \
+      bool connected = sock->sock_connected; \
+      bool readable = (pending) > 0; \
+      bool opened = connected && !ev.connected; \
+      bool arrived = readable && !ev.readable; \
+      bool closed = !connected && ev.connected; \
+      ev.connected = connected; \
+      ev.readable = readable; \
+      if (opened && ev.connect) ev.connect(*sock); \
+      if (arrived && ev.data) ev.data(*sock); \
+      if (closed && ev.close) ev.close(*sock); \
+    } \
+    if (events.reg_changed) { \
+      events.reg_changed = false; \
+      if (events.registration) events.registration(events.reg_status); \
+    } \
+    if (events.pdp_deactivated) { \
+      events.pdp_deactivated = false; \
+      if (events.pdpDeactivated) events.pdpDeactivated(); \
+    } \
+    events.dispatching = false; \
+  }
+
+#define TINY_GSM_MODEM_EVENTS() \
+  TINY_GSM_MODEM_EVENTS_IMPL(sock->rx.size() + sock->sock_available)
+
+#define TINY_GSM_MODEM_EVENTS_NO_MODEM_FIFO() \
+  TINY_GSM_MODEM_EVENTS_IMPL(sock->rx.size())
+
+
+// Network callbacks for modems whose waitResponse() hands the registration
+// URC to modemRegistrationUrc(), the SIM state URC (+CPIN:) to modemSimUrc(),
+// the PDP deactivation URC to modemPdpDeactivatedUrc() and, where the modem
+// announces a start-up (RDY), that to modemBootUrc().  Setting a
+// registration callback turns the URC on; so does waitForNetwork().
+// Clearing the callback leaves it on, as waitForNetwork() counts on it.
+#define TINY_GSM_MODEM_NETWORK_EVENTS(regCommand) \
+  void onRegistrationChange(TinyGsmRegistrationEvent cb) { \
+    TinyGsmTransaction transaction(at_lock); \
+    events.registration = cb; \
+    if (!cb) { \
+      return; \
+    } \
+    sendAT(GF("+" #regCommand "=2")); \
+    waitResponse(); \
+  } \
+  \
+  void onPdpDeactivated(TinyGsmModemEvent cb) { \
+    events.pdpDeactivated = cb; \
+  } \
+  \
+  void modemRegistrationUrc() { \
+    /* +xREG: <stat>[,<lac>,<ci>...] */ \
+    String urc = stream.readStringUntil('\n'); \
+    int comma = urc.indexOf(','); \
+    if (comma >= 0) urc.remove(comma); \
+    urc.trim(); \
+    /* A move to another cell is reported too, with the same <stat> */ \
+    if (urc.toInt() != events.reg_status) { \
+      events.reg_status = urc.toInt(); \
+      events.reg_changed = true; \
+      /* Attaching or losing the network changes the data connection */ \
+      metrics.expire(TinyGsmMetrics::GPRS); \
+    } \
+    events.reg_urcs++; \
+    DBG("### Registration:", events.reg_status); \
+  } \
+  \
+  void modemSimUrc() { \
+    /* +CPIN: <code> */ \
+    String urc = stream.readStringUntil('\n'); \
+    urc.trim(); \
+    if (urc == GF("READY")) { \
+      events.sim_status = SIM_READY; \
+    } else if (urc == GF("SIM PIN") || urc == GF("SIM PUK")) { \
+      events.sim_status = SIM_LOCKED; \
+    } else if (urc == GF("NOT READY")) { \
+      events.sim_status = -1; \
+    } else { \
+      events.sim_status = SIM_ERROR; \
+    } \
+    identity.ccid[0] = '\0'; \
+    events.sim_urcs++; \
+    DBG("### SIM:", urc); \
+  } \
+  \
+  /* Handles the URC's that have arrived, or yields if there are none */ \
+  void modemHandleUrcs() { \
+    if (stream.available()) { \
+      waitResponse(15, NULL, NULL); \
+    } else { \
+      TINY_GSM_YIELD(); \
+    } \
+  } \
+  \
+  /* The modem rebooted by itself: what it had been set to is gone */ \
+  void modemBootUrc() { \
+    settings.clear(); \
+    metrics.clear(); \
+    DBG("### Modem restarted"); \
+  } \
+  \
+  void modemPdpDeactivatedUrc() { \
+    streamSkipUntil('\n'); \
+    events.pdp_deactivated = true; \
+    events.pdp_urcs++; \
+    metrics.gprs = false; \
+    metrics.stamp(TinyGsmMetrics::GPRS); \
+    /* Every socket went down with the context */ \
+    for (int mux = 0; mux < MUX_COUNT; mux++) { \
+      if (sockets[mux]) sockets[mux]->sock_connected = false; \
+    } \
+    DBG("### PDP context deactivated"); \
+  }
+
+
+// Refreshes sock_connected for every socket with the modem's single status
+// query (modemGetConnectedAll()), at most once every TINY_GSM_SOCK_STATE_MS.
+// Closes reported by URC's still take effect straight away.
+#define TINY_GSM_MODEM_CHECK_CONNECTED_THROTTLED() \
+  void modemCheckConnected() { \
+    if (millis() - prev_state_check >= TINY_GSM_SOCK_STATE_MS) { \
+      modemGetConnectedAll(); \
+      prev_state_check = millis(); \
+    } \
+  }
+
+
+// Waits on several sockets at once, like select(): URC's are serviced with
+// one maintain() pass per round rather than one per socket.  Bit i of each
+// mask stands for clients[i] (so at most 16 clients); any mask may be NULL.
+// Returns the number of sockets that are readable or closed, 0 on timeout.
+#define TINY_GSM_MODEM_POLL_SOCKS_IMPL(pending) \
+  int pollSockets(GsmClient* clients[], uint8_t count, uint16_t* readable, \
+                  uint16_t* writable, uint16_t* closed, uint32_t timeout_ms) { \
+    uint32_t startMillis = millis(); \
+    for (;;) { \
+      maintain(); \
+      uint16_t r = 0, w = 0, c = 0; \
+      int ready = 0; \
+      for (uint8_t i = 0; i < count && i < 16; i++) { \
+        GsmClient* sock = clients[i]; \
+        if (!sock) continue; \
+        bool hasData = (pending) > 0; \
+        if (hasData) r |= 1 << i; \
+        if (sock->sock_connected) w |= 1 << i; \
+        else c |= 1 << i; \
+        if (hasData || !sock->sock_connected) ready++; \
+      } \
+      if (ready || millis() - startMillis >= timeout_ms) { \
+        if (readable) *readable = r; \
+        if (writable) *writable = w; \
+        if (closed) *closed = c; \
+        return ready; \
+      } \
+      /* Nothing to do until the modem says something */ \
+      while (!stream.available() && millis() - startMillis < timeout_ms) { \
+        TINY_GSM_YIELD(); \
+      } \
+    } \
   }
 
+#define TINY_GSM_MODEM_POLL_SOCKS() \
+  TINY_GSM_MODEM_POLL_SOCKS_IMPL(sock->rx.size() + sock->sock_available)
+
+// For modems that push all data to us as it arrives
+#define TINY_GSM_MODEM_POLL_SOCKS_NO_MODEM_FIFO() \
+  TINY_GSM_MODEM_POLL_SOCKS_IMPL(sock->rx.size())
+
 
 // Keeps listening for modem URC's - doesn't check socks because
 // modem has no internal fifo
 #define TINY_GSM_MODEM_MAINTAIN_LISTEN() \
   void maintain() { \
+    TinyGsmTransaction transaction(at_lock); \
     waitResponse(100, NULL, NULL); \
+    modemDispatchEvents(); \
   }
 
 
 // Asks for modem information via the V.25TER standard ATI command
 // NOTE:  The actual value and style of the response is quite varied
 #define TINY_GSM_MODEM_GET_INFO_ATI() \
-  String getModemInfo() { \
+  String modemGetInfo() { \
+    TinyGsmTransaction transaction(at_lock); \
     sendAT(GF("I")); \
     String res; \
     if (waitResponse(1000L, res) != 1) { \
@@ -473,6 +1339,7 @@ String TinyGsmDecodeHex16bit(String &instr) {
 // Unlocks a sim via the 3GPP TS command AT+CPIN
 #define TINY_GSM_MODEM_SIM_UNLOCK_CPIN() \
   bool simUnlock(const char *pin) { \
+    TinyGsmTransaction transaction(at_lock); \
     sendAT(GF("+CPIN=\""), pin, GF("\"")); \
     return waitResponse() == 1; \
   }
@@ -480,7 +1347,8 @@ String TinyGsmDecodeHex16bit(String &instr) {
 
 // Gets the CCID of a sim card via AT+CCID
 #define TINY_GSM_MODEM_GET_SIMCCID_CCID() \
-  String getSimCCID() { \
+  String modemGetSimCCID() { \
+    TinyGsmTransaction transaction(at_lock); \
     sendAT(GF("+CCID")); \
     if (waitResponse(GF(GSM_NL "+CCID:")) != 1) { \
       return ""; \
@@ -494,7 +1362,8 @@ String TinyGsmDecodeHex16bit(String &instr) {
 
 // Asks for TA Serial Number Identification (IMEI) via the V.25TER standard AT+GSN command
 #define TINY_GSM_MODEM_GET_IMEI_GSN() \
-  String getIMEI() { \
+  String modemGetIMEI() { \
+    TinyGsmTransaction transaction(at_lock); \
     sendAT(GF("+GSN")); \
     if (waitResponse(GF(GSM_NL)) != 1) { \
       return ""; \
@@ -506,12 +1375,63 @@ String TinyGsmDecodeHex16bit(String &instr) {
   }
 
 
+// The identity getters, each asking the modem (with the driver's
+// modemGet...()) only while its field is still empty.  restart() clears
+// them all, and a SIM URC clears the CCID, as the card may have been swapped.
+// An IMEI or CCID that doesn't look like one (an error, a stray URC) is not
+// kept, and comes back empty.
+#define TINY_GSM_MODEM_IDENTITY() \
+  String getIMEI() { \
+    if (!identity.imei[0]) { \
+      String imei = modemGetIMEI(); \
+      if (TinyGsmIdentity::isImei(imei)) { \
+        imei.toCharArray(identity.imei, sizeof(identity.imei)); \
+      } \
+    } \
+    return identity.imei; \
+  } \
+  \
+  String getSimCCID() { \
+    if (!identity.ccid[0]) { \
+      String ccid = modemGetSimCCID(); \
+      if (TinyGsmIdentity::isCcid(ccid)) { \
+        ccid.toCharArray(identity.ccid, sizeof(identity.ccid)); \
+      } \
+    } \
+    return identity.ccid; \
+  } \
+  \
+  String getModemName() { \
+    if (!identity.name[0]) { \
+      modemGetName().toCharArray(identity.name, sizeof(identity.name)); \
+    } \
+    return identity.name; \
+  } \
+  \
+  String getModemInfo() { \
+    if (!identity.info[0]) { \
+      modemGetInfo().toCharArray(identity.info, sizeof(identity.info)); \
+    } \
+    return identity.info; \
+  } \
+  \
+  /* Reads whatever isn't known yet; the fields can then be used directly */ \
+  const TinyGsmIdentity& getIdentity() { \
+    getIMEI(); \
+    getSimCCID(); \
+    getModemName(); \
+    getModemInfo(); \
+    return identity; \
+  }
+
+
 // Gets the modem's registration status via CREG/CGREG/CEREG
 // CREG = Generic network registration
 // CGREG = GPRS service registration
 // CEREG = EPS registration for LTE modules
 #define TINY_GSM_MODEM_GET_REGISTRATION_XREG(regCommand) \
   RegStatus getRegistrationStatus() { \
+    TinyGsmTransaction transaction(at_lock); \
     sendAT(GF("+" #regCommand "?")); \
     if (waitResponse(GF(GSM_NL "+" #regCommand ":")) != 1) { \
       return REG_UNKNOWN; \
@@ -526,6 +1446,7 @@ String TinyGsmDecodeHex16bit(String &instr) {
 // Gets the current network operator via the 3GPP TS command AT+COPS
 #define TINY_GSM_MODEM_GET_OPERATOR_COPS() \
   String getOperator() { \
+    TinyGsmTransaction transaction(at_lock); \
     sendAT(GF("+COPS?")); \
     if (waitResponse(GF(GSM_NL "+COPS:")) != 1) { \
       return ""; \
@@ -550,9 +1471,79 @@ String TinyGsmDecodeHex16bit(String &instr) {
   }
 
 
+// Waits for network attachment on a modem with TINY_GSM_MODEM_NETWORK_EVENTS:
+// it asks once, then turns the registration URC on and returns as soon as
+// one reports home or roaming.  It only asks again every
+// TINY_GSM_URC_RECHECK_MS.
+#define TINY_GSM_MODEM_WAIT_FOR_NETWORK_URC(regCommand) \
+  bool waitForNetwork(unsigned long timeout_ms = 60000L) { \
+    sendAT(GF("+" #regCommand "=2")); \
+    waitResponse(); \
+    unsigned long start = millis(); \
+    unsigned long asked = start - TINY_GSM_URC_RECHECK_MS; \
+    uint8_t seen = events.reg_urcs; \
+    while (millis() - start < timeout_ms) { \
+      if (events.reg_urcs != seen) { \
+        seen = events.reg_urcs; \
+        if (events.reg_status == REG_OK_HOME || events.reg_status == REG_OK_ROAMING) { \
+          return true; \
+        } \
+      } \
+      if (millis() - asked >= TINY_GSM_URC_RECHECK_MS) { \
+        if (isNetworkConnected()) { \
+          return true; \
+        } \
+        asked = millis(); \
+      } \
+      modemHandleUrcs(); \
+    } \
+    return false; \
+  }
+
+
+// Gets the SIM state with +CPIN?.  While the modem is starting up and can't
+// tell yet, it waits for the +CPIN: URC that comes once the SIM has been
+// read, only asking again every TINY_GSM_URC_RECHECK_MS.
+#define TINY_GSM_MODEM_GET_SIM_STATUS_CPIN() \
+  SimStatus getSimStatus(unsigned long timeout_ms = 10000L) { \
+    unsigned long start = millis(); \
+    unsigned long asked = start - TINY_GSM_URC_RECHECK_MS; \
+    uint8_t seen = events.sim_urcs; \
+    while (millis() - start < timeout_ms) { \
+      if (events.sim_urcs != seen) { \
+        seen = events.sim_urcs; \
+        if (events.sim_status >= 0) { \
+          return (SimStatus)events.sim_status; \
+        } \
+      } \
+      if (millis() - asked >= TINY_GSM_URC_RECHECK_MS) { \
+        TinyGsmTransaction transaction(at_lock); \
+        asked = millis(); \
+        sendAT(GF("+CPIN?")); \
+        if (waitResponse(GF(GSM_NL "+CPIN:")) == 1) { \
+          /* "NOT READY" first, or it would be taken for "READY" */ \
+          int status = waitResponse(GF("NOT READY"), GF("READY"), GF("SIM PIN"), \
+                                    GF("SIM PUK"), GF("NOT INSERTED")); \
+          waitResponse(); \
+          switch (status) { \
+            case 3: \
+            case 4:  return SIM_LOCKED; \
+            case 2:  return SIM_READY; \
+            case 1:  break; /* Still reading the SIM */ \
+            default: return SIM_ERROR; \
+          } \
+        } \
+      } \
+      modemHandleUrcs(); \
+    } \
+    return SIM_ERROR; \
+  }
+
+
 // Checks if current attached to GPRS/EPS service
 #define TINY_GSM_MODEM_GET_GPRS_IP_CONNECTED() \
-  bool isGprsConnected() { \
+  bool modemIsGprsConnected() { \
+    TinyGsmTransaction transaction(at_lock); \
     sendAT(GF("+CGATT?")); \
     if (waitResponse(GF(GSM_NL "+CGATT:")) != 1) { \
       return false; \
@@ -563,12 +1554,15 @@ String TinyGsmDecodeHex16bit(String &instr) {
       return false; \
   \
     return localIP() != IPAddress(0,0,0,0); \
-  }
+  } \
+  \
+TINY_GSM_MODEM_CACHED_GPRS()
 
 
 // Gets signal quality report according to 3GPP TS command AT+CSQ
 #define TINY_GSM_MODEM_GET_CSQ() \
-  int16_t getSignalQuality() { \
+  int16_t modemGetSignalQuality() { \
+    TinyGsmTransaction transaction(at_lock); \
     sendAT(GF("+CSQ")); \
     if (waitResponse(GF(GSM_NL "+CSQ:")) != 1) { \
       return 99; \
@@ -576,6 +1570,79 @@ String TinyGsmDecodeHex16bit(String &instr) {
     int res = stream.readStringUntil(',').toInt(); \
     waitResponse(); \
     return res; \
+  } \
+  \
+TINY_GSM_MODEM_CACHED_CSQ(99)
+
+
+// The metrics getters, answering from the driver's last modemGet...()
+// reading while it is younger than maxAge_ms; a maxAge_ms of 0 always asks
+// the modem.  Only a reading that was had is kept: a signal quality of
+// `unknown` (what modemGetSignalQuality() returns when it gets no answer)
+// and a GPRS connection that wasn't confirmed are asked for again next time.
+#define TINY_GSM_MODEM_CACHED_CSQ(unknown) \
+  int16_t getSignalQuality(uint32_t maxAge_ms = TINY_GSM_CSQ_TTL_MS) { \
+    if (!metrics.fresh(TinyGsmMetrics::CSQ, maxAge_ms)) { \
+      metrics.csq = modemGetSignalQuality(); \
+      if (metrics.csq == (unknown)) { \
+        metrics.expire(TinyGsmMetrics::CSQ); \
+      } else { \
+        metrics.stamp(TinyGsmMetrics::CSQ); \
+      } \
+    } \
+    return metrics.csq; \
+  }
+
+#define TINY_GSM_MODEM_CACHED_GPRS() \
+  bool isGprsConnected(uint32_t maxAge_ms = TINY_GSM_GPRS_TTL_MS) { \
+    if (!metrics.fresh(TinyGsmMetrics::GPRS, maxAge_ms)) { \
+      metrics.gprs = modemIsGprsConnected(); \
+      if (metrics.gprs) { \
+        metrics.stamp(TinyGsmMetrics::GPRS); \
+      } else { \
+        metrics.expire(TinyGsmMetrics::GPRS); \
+      } \
+    } \
+    return metrics.gprs; \
+  }
+
+// One modemGetBattStats() fills all of the battery getters
+#define TINY_GSM_MODEM_CACHED_BATT() \
+  bool getBattStats(uint8_t &chargeState, int8_t &percent, uint16_t &milliVolts, \
+                    uint32_t maxAge_ms = TINY_GSM_BATT_TTL_MS) { \
+    if (!metrics.fresh(TinyGsmMetrics::BATT, maxAge_ms)) { \
+      if (!modemGetBattStats(metrics.batt_state, metrics.batt_percent, metrics.batt_mv)) { \
+        metrics.expire(TinyGsmMetrics::BATT); \
+        return false; \
+      } \
+      metrics.stamp(TinyGsmMetrics::BATT); \
+    } \
+    chargeState = metrics.batt_state; \
+    percent = metrics.batt_percent; \
+    milliVolts = metrics.batt_mv; \
+    return true; \
+  } \
+  \
+  /* Use: float vBatt = modem.getBattVoltage() / 1000.0; */ \
+  uint16_t getBattVoltage(uint32_t maxAge_ms = TINY_GSM_BATT_TTL_MS) { \
+    uint8_t chargeState; \
+    int8_t percent; \
+    uint16_t milliVolts; \
+    return getBattStats(chargeState, percent, milliVolts, maxAge_ms) ? milliVolts : 0; \
+  } \
+  \
+  int8_t getBattPercent(uint32_t maxAge_ms = TINY_GSM_BATT_TTL_MS) { \
+    uint8_t chargeState; \
+    int8_t percent; \
+    uint16_t milliVolts; \
+    return getBattStats(chargeState, percent, milliVolts, maxAge_ms) ? percent : 0; \
+  } \
+  \
+  uint8_t getBattChargeState(uint32_t maxAge_ms = TINY_GSM_BATT_TTL_MS) { \
+    uint8_t chargeState; \
+    int8_t percent; \
+    uint16_t milliVolts; \
+    return getBattStats(chargeState, percent, milliVolts, maxAge_ms) ? chargeState : 0; \
   }
 
 
@@ -604,6 +1671,7 @@ String TinyGsmDecodeHex16bit(String &instr) {
   \
   template<typename... Args> \
   void sendAT(Args... cmd) { \
+    at_lock.begin(); \
     streamWrite("AT", cmd..., GSM_NL); \
     stream.flush(); \
     TINY_GSM_YIELD(); \
@@ -621,7 +1689,41 @@ String TinyGsmDecodeHex16bit(String &instr) {
       } \
     } \
     return false; \
+  } \
+  \
+  /* Sends a setting unless `known` says the modem has it already */ \
+  template<typename... Args> \
+  bool modemSet(int8_t& known, int8_t value, Args... cmd) { \
+    TinyGsmTransaction transaction(at_lock); \
+    if (known == value) { \
+      return true; \
+    } \
+    sendAT(cmd...); \
+    known = waitResponse() == 1 ? value : -1; \
+    return known == value; \
+  } \
+  \
+  /* Lets a pump skip its turn rather than break into a transaction */ \
+  bool tryLockAT() { \
+    return at_lock.tryLock(); \
+  } \
+  \
+  void unlockAT() { \
+    at_lock.unlock(); \
+  } \
+  \
+  /* Waits for any transaction that may be walking the socket table */ \
+  void modemSetSocket(uint8_t mux, GsmClient* sock) { \
+    at_lock.lock(); \
+    sockets[mux] = sock; \
+    at_lock.unlock(); \
   }
 
 
+// Ends the transaction started by sendAT() when waitResponse() returns,
+// unless a TinyGsmTransaction holds it for the rest of the exchange
+#define TINY_GSM_MODEM_END_TRANSACTION() \
+  at_lock.end()
+
+
 #endif
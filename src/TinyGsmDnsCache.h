@@ -0,0 +1,115 @@
+/**
+ * @file       TinyGsmDnsCache.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+#ifndef TinyGsmDnsCache_h
+#define TinyGsmDnsCache_h
+
+#ifndef TINY_GSM_DNS_HOST_LEN
+  #define TINY_GSM_DNS_HOST_LEN 64
+#endif
+
+#ifndef TINY_GSM_DNS_TTL_MS
+  #define TINY_GSM_DNS_TTL_MS 300000L
+#endif
+
+// A small fixed-size table of host name -> IP address resolutions.
+// Entries expire after the TTL; when the table is full the least recently
+// used entry is replaced.  Host names longer than TINY_GSM_DNS_HOST_LEN-1
+// characters are never cached.
+template <unsigned N>
+class TinyGsmDnsCache
+{
+public:
+    TinyGsmDnsCache()
+        : _ttl(TINY_GSM_DNS_TTL_MS), _tick(0)
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        for (unsigned i = 0; i < N; i++) {
+            _e[i].host[0] = '\0';
+        }
+    }
+
+    void setTTL(uint32_t ttl_ms)
+    {
+        _ttl = ttl_ms;
+    }
+
+    bool lookup(const char* host, IPAddress& ip)
+    {
+        int i = _find(host);
+        if (i < 0)
+            return false;
+        if (millis() - _e[i].stored > _ttl) {
+            _e[i].host[0] = '\0';
+            return false;
+        }
+        _e[i].used = ++_tick;
+        ip = _e[i].ip;
+        return true;
+    }
+
+    void store(const char* host, const IPAddress& ip)
+    {
+        if (host == NULL || strlen(host) >= TINY_GSM_DNS_HOST_LEN)
+            return;
+        int i = _find(host);
+        if (i < 0) {
+            // Take a free slot if there is one, otherwise evict the LRU entry
+            i = 0;
+            for (unsigned j = 0; j < N; j++) {
+                if (!_e[j].host[0]) {
+                    i = j;
+                    break;
+                }
+                if (_tick - _e[j].used > _tick - _e[i].used)
+                    i = j;
+            }
+            strcpy(_e[i].host, host);
+        }
+        _e[i].ip = ip;
+        _e[i].stored = millis();
+        _e[i].used = ++_tick;
+    }
+
+    void remove(const char* host)
+    {
+        int i = _find(host);
+        if (i >= 0)
+            _e[i].host[0] = '\0';
+    }
+
+private:
+    int _find(const char* host)
+    {
+        if (host == NULL)
+            return -1;
+        for (unsigned i = 0; i < N; i++) {
+            if (_e[i].host[0] && !strcmp(_e[i].host, host))
+                return i;
+        }
+        return -1;
+    }
+
+    struct Entry
+    {
+        char      host[TINY_GSM_DNS_HOST_LEN];
+        IPAddress ip;
+        uint32_t  stored;
+        uint32_t  used;  // _tick at the last store or lookup
+    };
+
+    Entry    _e[N];
+    uint32_t _ttl;
+    uint32_t _tick;
+};
+
+#endif
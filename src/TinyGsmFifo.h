@@ -14,6 +14,7 @@ public:
     {
         _r = 0;
         _w = 0;
+        _s = 0;
     }
 
     // writing thread/context API
@@ -29,7 +30,7 @@ public:
         int s = _r - _w;
         if (s <= 0)
             s += N;
-        return s - 1;
+        return s - 1 - _s;
     }
 
     bool put(const T& c)
@@ -69,6 +70,31 @@ public:
         return n - c;
     }
 
+    // Writes c after the items staged since the last commit(), but keeps
+    // them all from being read until then; put() must not be used meanwhile
+    bool stage(const T& c)
+    {
+        int i = _inc(_w, _s);
+        if (_inc(i) == _r) // full
+            return false;
+        _b[i] = c;
+        _s++;
+        return true;
+    }
+
+    // Makes the staged items readable
+    void commit()
+    {
+        _w = _inc(_w, _s);
+        _s = 0;
+    }
+
+    // Drops the staged items
+    void discard()
+    {
+        _s = 0;
+    }
+
     // reading thread/context API
     // --------------------------------------------------------
 
@@ -95,6 +121,15 @@ public:
         return true;
     }
 
+    bool peek(T* p)
+    {
+        int r = _r;
+        if (r == _w) // !readable()
+            return false;
+        *p = _b[r];
+        return true;
+    }
+
     int get(T* p, int n, bool t = false)
     {
         int c = n;
@@ -131,6 +166,7 @@ private:
     T    _b[N];
     int  _w;
     int  _r;
+    int  _s;  // staged, not yet readable
 };
 
 #endif
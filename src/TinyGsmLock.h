@@ -0,0 +1,302 @@
+/**
+ * @file       TinyGsmLock.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+#ifndef TinyGsmLock_h
+#define TinyGsmLock_h
+
+#include <TinyGsmFifo.h>
+
+// Lock policy, chosen at compile time:
+//   TINY_GSM_LOCK_NONE      - single task, nothing is locked (the default)
+//   TINY_GSM_LOCK_FREERTOS  - FreeRTOS recursive mutexes
+//   TINY_GSM_LOCK_STD       - std::recursive_mutex, e.g. on Linux
+// A background pump on ESP32 needs a real lock, so it selects FreeRTOS.
+#if !defined(TINY_GSM_LOCK_NONE) && !defined(TINY_GSM_LOCK_FREERTOS) && !defined(TINY_GSM_LOCK_STD)
+  #if defined(TINY_GSM_BACKGROUND_PUMP) && defined(ESP32)
+    #define TINY_GSM_LOCK_FREERTOS
+  #else
+    #define TINY_GSM_LOCK_NONE
+  #endif
+#endif
+
+#if defined(TINY_GSM_LOCK_FREERTOS)
+
+#if defined(ESP32)
+  #include <freertos/FreeRTOS.h>
+  #include <freertos/semphr.h>
+#else
+  #include <FreeRTOS.h>
+  #include <semphr.h>
+#endif
+
+// A recursive mutex, so the task holding a transaction may start another
+class TinyGsmMutex
+{
+public:
+    TinyGsmMutex()
+        : _h(xSemaphoreCreateRecursiveMutex())
+    {}
+
+    void lock()
+    {
+        xSemaphoreTakeRecursive(_h, portMAX_DELAY);
+    }
+
+    bool tryLock()
+    {
+        return xSemaphoreTakeRecursive(_h, 0) == pdTRUE;
+    }
+
+    void unlock()
+    {
+        xSemaphoreGiveRecursive(_h);
+    }
+
+private:
+    TinyGsmMutex(const TinyGsmMutex&);
+    TinyGsmMutex& operator=(const TinyGsmMutex&);
+
+    SemaphoreHandle_t _h;
+};
+
+#elif defined(TINY_GSM_LOCK_STD)
+
+#include <mutex>
+
+class TinyGsmMutex
+{
+public:
+    void lock()
+    {
+        _m.lock();
+    }
+
+    bool tryLock()
+    {
+        return _m.try_lock();
+    }
+
+    void unlock()
+    {
+        _m.unlock();
+    }
+
+private:
+    std::recursive_mutex _m;
+};
+
+#else
+
+// Single context: nothing can interrupt a transaction, so there is nothing to lock
+class TinyGsmMutex
+{
+public:
+    void lock() {}
+    bool tryLock() { return true; }
+    void unlock() {}
+};
+
+#endif
+
+class TinyGsmLockGuard
+{
+public:
+    explicit TinyGsmLockGuard(TinyGsmMutex& m)
+        : _m(m)
+    {
+        _m.lock();
+    }
+
+    ~TinyGsmLockGuard()
+    {
+        _m.unlock();
+    }
+
+private:
+    TinyGsmMutex& _m;
+};
+
+// A socket's receive FIFO.  The modem fills it from whichever task holds the
+// AT transaction while the socket's owner reads it, so every call takes the
+// socket's own mutex, held only for the copy and never across an AT command.
+template <class T, unsigned N>
+class TinyGsmLockedFifo
+{
+public:
+    void clear()
+    {
+        TinyGsmLockGuard g(_m);
+        _f.clear();
+    }
+
+    bool writeable()
+    {
+        TinyGsmLockGuard g(_m);
+        return _f.writeable();
+    }
+
+    int free()
+    {
+        TinyGsmLockGuard g(_m);
+        return _f.free();
+    }
+
+    bool put(const T& c)
+    {
+        TinyGsmLockGuard g(_m);
+        return _f.put(c);
+    }
+
+    int put(const T* p, int n)
+    {
+        TinyGsmLockGuard g(_m);
+        return _f.put(p, n);
+    }
+
+    bool stage(const T& c)
+    {
+        TinyGsmLockGuard g(_m);
+        return _f.stage(c);
+    }
+
+    void commit()
+    {
+        TinyGsmLockGuard g(_m);
+        _f.commit();
+    }
+
+    void discard()
+    {
+        TinyGsmLockGuard g(_m);
+        _f.discard();
+    }
+
+    bool readable()
+    {
+        TinyGsmLockGuard g(_m);
+        return _f.readable();
+    }
+
+    size_t size()
+    {
+        TinyGsmLockGuard g(_m);
+        return _f.size();
+    }
+
+    bool get(T* p)
+    {
+        TinyGsmLockGuard g(_m);
+        return _f.get(p);
+    }
+
+    bool peek(T* p)
+    {
+        TinyGsmLockGuard g(_m);
+        return _f.peek(p);
+    }
+
+    int get(T* p, int n)
+    {
+        TinyGsmLockGuard g(_m);
+        return _f.get(p, n);
+    }
+
+private:
+    TinyGsmFifo<T, N> _f;
+    TinyGsmMutex      _m;
+};
+
+// Guards the AT command/response transactions.  sendAT() and waitResponse()
+// call begin(); waitResponse() calls end() once it returns.  A function that
+// runs more than one step of an exchange (a prompt and its data, a response
+// read line by line after waitResponse() has matched it) holds the modem for
+// the whole of it with a TinyGsmTransaction, which releases it on every
+// return path; inside one, end() leaves the mutex alone.
+class TinyGsmTransactionLock
+{
+public:
+    TinyGsmTransactionLock()
+        : _held(false), _scopes(0)
+    {}
+
+    void begin()
+    {
+        _m.lock();
+        if (_held || _scopes)
+            _m.unlock();
+        else
+            _held = true;
+    }
+
+    void end()
+    {
+        if (_held && !_scopes) {
+            _held = false;
+            _m.unlock();
+        }
+    }
+
+    // Used by TinyGsmTransaction
+    void enter()
+    {
+        _m.lock();
+        _scopes++;
+    }
+
+    void leave()
+    {
+        if (--_scopes == 0 && _held) {
+            _held = false;
+            _m.unlock();
+        }
+        _m.unlock();
+    }
+
+    // Holds the modem for something that is not an AT command, such as
+    // changing the socket table
+    void lock()
+    {
+        _m.lock();
+    }
+
+    // For a pump that must not wait behind (or break into) a transaction
+    bool tryLock()
+    {
+        return _m.tryLock();
+    }
+
+    void unlock()
+    {
+        _m.unlock();
+    }
+
+private:
+    TinyGsmMutex _m;
+    bool         _held;
+    uint8_t      _scopes;
+};
+
+class TinyGsmTransaction
+{
+public:
+    explicit TinyGsmTransaction(TinyGsmTransactionLock& lock)
+        : _lock(lock)
+    {
+        _lock.enter();
+    }
+
+    ~TinyGsmTransaction()
+    {
+        _lock.leave();
+    }
+
+private:
+    TinyGsmTransactionLock& _lock;
+};
+
+#endif
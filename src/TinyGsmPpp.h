@@ -0,0 +1,681 @@
+/**
+ * @file       TinyGsmPpp.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+#ifndef TinyGsmPpp_h
+#define TinyGsmPpp_h
+
+#include <TinyGsmCommon.h>
+
+// Largest packet we accept from the modem; anything else than 1500 is
+// negotiated with the peer
+#if !defined(TINY_GSM_PPP_MRU)
+  #define TINY_GSM_PPP_MRU 1500
+#endif
+
+#if !defined(TINY_GSM_PPP_RESTART_MS)
+  #define TINY_GSM_PPP_RESTART_MS 3000L
+#endif
+
+#if !defined(TINY_GSM_PPP_MAX_CONFIGURE)
+  #define TINY_GSM_PPP_MAX_CONFIGURE 10
+#endif
+
+// The IP stack on top of the PPP link.  pppInput() receives every IPv4
+// datagram from the network; datagrams go the other way with
+// TinyGsmPpp::send().
+class TinyGsmPppNetif
+{
+public:
+  virtual ~TinyGsmPppNetif() {}
+
+  virtual void pppInput(const uint8_t* packet, uint16_t len) = 0;
+  virtual void pppUp(IPAddress /*local*/, IPAddress /*dns*/) {}
+  virtual void pppDown() {}
+};
+
+// PPP over serial (RFC 1661/1662) with PAP and IPCP, bypassing the modem's
+// own TCP/IP stack.  This is the link layer only: sockets come from the
+// TinyGsmPppNetif that is plugged in (lwIP's netif on ESP32 and the like).
+// The Stream can be the modem's UART or one of TinyGsmCmux's channels, which
+// keeps AT commands available on another channel while PPP is up.
+//
+//   TinyGsmPpp ppp(SerialAT);
+//   ppp.setNetif(&myStack);
+//   ppp.connect(apn);
+//   ...
+//   ppp.maintain();  // as often as possible
+class TinyGsmPpp
+{
+public:
+
+  TinyGsmPpp(Stream& stream)
+    : stream(stream), netif(NULL)
+  {
+    phase = PHASE_DEAD;
+    next_id = 0;
+    rx_len = 0;
+  }
+
+  void setNetif(TinyGsmPppNetif* netif) {
+    this->netif = netif;
+  }
+
+  /*
+   * Sets up the PDP context, dials *99# and negotiates the link.  The modem
+   * must be registered on the network and answering AT.
+   */
+  bool connect(const char* apn, const char* user = NULL, const char* pwd = NULL,
+               uint32_t timeout_ms = 30000L)
+  {
+    stream.print(GF("AT+CGDCONT=1,\"IP\",\""));
+    stream.print(apn);
+    stream.print(GF("\"\r\n"));
+    stream.flush();
+    if (!waitLine(GF("OK"), 5000L)) {
+      return false;
+    }
+    stream.print(GF("ATD*99#\r\n"));
+    stream.flush();
+    if (!waitLine(GF("CONNECT"), 30000L)) {
+      return false;
+    }
+
+    this->user = user ? user : "";
+    this->pwd = pwd ? pwd : "";
+    rx_len = 0;
+    rx_fcs = 0xFFFF;
+    rx_escaped = false;
+    magic = millis() ^ 0x5A5AA5A5;
+    lcp_opts = LCP_OPT_MAGIC | (TINY_GSM_PPP_MRU != 1500 ? LCP_OPT_MRU : 0);
+    ipcp_opts = IPCP_OPT_ADDRESS | IPCP_OPT_DNS1 | IPCP_OPT_DNS2;
+    local_ip = IPAddress(0, 0, 0, 0);
+    dns1 = IPAddress(0, 0, 0, 0);
+    dns2 = IPAddress(0, 0, 0, 0);
+    need_pap = false;
+    enterPhase(PHASE_LCP);
+
+    uint32_t startMillis = millis();
+    while (phase != PHASE_UP && phase != PHASE_DEAD &&
+           millis() - startMillis < timeout_ms)
+    {
+      maintain();
+      TINY_GSM_YIELD();
+    }
+    if (phase != PHASE_UP) {
+      enterPhase(PHASE_DEAD);
+      return false;
+    }
+    return true;
+  }
+
+  /*
+   * Terminates the link; the modem then hangs up and goes back to command mode.
+   */
+  void disconnect(uint32_t timeout_ms = 3000L) {
+    if (phase == PHASE_DEAD) {
+      return;
+    }
+    sendControl(PPP_LCP, CODE_TERMINATE_REQUEST, ++next_id, NULL, 0);
+    enterPhase(PHASE_TERMINATE);
+    uint32_t startMillis = millis();
+    while (phase != PHASE_DEAD && millis() - startMillis < timeout_ms) {
+      maintain();
+      TINY_GSM_YIELD();
+    }
+    enterPhase(PHASE_DEAD);
+  }
+
+  bool isConnected() {
+    return phase == PHASE_UP;
+  }
+
+  IPAddress localIP() {
+    return local_ip;
+  }
+
+  IPAddress dnsIP(uint8_t n = 0) {
+    return n ? dns2 : dns1;
+  }
+
+  // Sends one IPv4 datagram
+  bool send(const uint8_t* packet, uint16_t len) {
+    if (phase != PHASE_UP) {
+      return false;
+    }
+    frameStart(PPP_IP);
+    frameWrite(packet, len);
+    frameEnd();
+    return true;
+  }
+
+  // Reads what the modem has sent and restarts negotiation that has stalled
+  void maintain() {
+    while (stream.available()) {
+      receive(stream.read());
+    }
+    if ((phase == PHASE_LCP || phase == PHASE_AUTH || phase == PHASE_IPCP) &&
+        millis() - sent_millis > TINY_GSM_PPP_RESTART_MS)
+    {
+      if (++retries > TINY_GSM_PPP_MAX_CONFIGURE) {
+        DBG("### PPP negotiation timed out");
+        enterPhase(PHASE_DEAD);
+      } else {
+        sendRequest();
+      }
+    }
+  }
+
+private:
+
+  enum {
+    PPP_FLAG   = 0x7E,
+    PPP_ESCAPE = 0x7D,
+    PPP_IP     = 0x0021,
+    PPP_IPCP   = 0x8021,
+    PPP_LCP    = 0xC021,
+    PPP_PAP    = 0xC023,
+
+    CODE_CONFIGURE_REQUEST = 1,
+    CODE_CONFIGURE_ACK     = 2,
+    CODE_CONFIGURE_NAK     = 3,
+    CODE_CONFIGURE_REJECT  = 4,
+    CODE_TERMINATE_REQUEST = 5,
+    CODE_TERMINATE_ACK     = 6,
+    CODE_PROTOCOL_REJECT   = 8,
+    CODE_ECHO_REQUEST      = 9,
+    CODE_ECHO_REPLY        = 10,
+
+    // Bits for the options we put in our own configure requests
+    LCP_OPT_MRU      = 0x01,
+    LCP_OPT_MAGIC    = 0x02,
+    IPCP_OPT_ADDRESS = 0x01,
+    IPCP_OPT_DNS1    = 0x02,
+    IPCP_OPT_DNS2    = 0x04,
+  };
+
+  enum {
+    PHASE_DEAD,
+    PHASE_LCP,
+    PHASE_AUTH,
+    PHASE_IPCP,
+    PHASE_UP,
+    PHASE_TERMINATE,
+  };
+
+  // RFC 1662 FCS-16
+  static uint16_t fcs16(uint16_t fcs, uint8_t c) {
+    fcs ^= c;
+    for (uint8_t i = 0; i < 8; i++) {
+      fcs = (fcs & 1) ? (fcs >> 1) ^ 0x8408 : (fcs >> 1);
+    }
+    return fcs;
+  }
+
+  /*
+   * Framing
+   */
+
+  void framePut(uint8_t c) {
+    tx_fcs = fcs16(tx_fcs, c);
+    // Control characters are always escaped, so the peer's ACCM doesn't matter
+    if (c < 0x20 || c == PPP_FLAG || c == PPP_ESCAPE) {
+      stream.write((uint8_t)PPP_ESCAPE);
+      c ^= 0x20;
+    }
+    stream.write(c);
+  }
+
+  void frameWrite(const uint8_t* data, uint16_t len) {
+    while (len--) {
+      framePut(*data++);
+    }
+  }
+
+  void frameStart(uint16_t protocol) {
+    tx_fcs = 0xFFFF;
+    stream.write((uint8_t)PPP_FLAG);
+    framePut(0xFF);
+    framePut(0x03);
+    framePut(protocol >> 8);
+    framePut(protocol & 0xFF);
+  }
+
+  void frameEnd() {
+    uint16_t fcs = ~tx_fcs;
+    framePut(fcs & 0xFF);
+    framePut(fcs >> 8);
+    stream.write((uint8_t)PPP_FLAG);
+    stream.flush();
+  }
+
+  void controlStart(uint16_t protocol, uint8_t code, uint8_t id, uint16_t len) {
+    frameStart(protocol);
+    framePut(code);
+    framePut(id);
+    framePut((len + 4) >> 8);
+    framePut((len + 4) & 0xFF);
+  }
+
+  void sendControl(uint16_t protocol, uint8_t code, uint8_t id,
+                   const uint8_t* data, uint16_t len)
+  {
+    controlStart(protocol, code, id, len);
+    frameWrite(data, len);
+    frameEnd();
+  }
+
+  void receive(uint8_t c) {
+    if (c == PPP_FLAG) {
+      if (rx_len >= 4 && rx_fcs == 0xF0B8) {
+        handleFrame(rx, rx_len - 2);
+      }
+      rx_len = 0;
+      rx_fcs = 0xFFFF;
+      rx_escaped = false;
+      return;
+    }
+    if (c == PPP_ESCAPE) {
+      rx_escaped = true;
+      return;
+    }
+    if (rx_escaped) {
+      c ^= 0x20;
+      rx_escaped = false;
+    }
+    if (rx_len < sizeof(rx)) {
+      rx[rx_len++] = c;
+      rx_fcs = fcs16(rx_fcs, c);
+    } else {
+      rx_fcs = 0;  // too long, drop it
+    }
+  }
+
+  void handleFrame(const uint8_t* p, uint16_t len) {
+    // Address and control may be left out, and the protocol shortened
+    if (len >= 2 && p[0] == 0xFF && p[1] == 0x03) {
+      p += 2;
+      len -= 2;
+    }
+    if (len < 1) {
+      return;
+    }
+    uint16_t protocol = p[0];
+    if (protocol & 1) {
+      p += 1;
+      len -= 1;
+    } else if (len >= 2) {
+      protocol = (protocol << 8) | p[1];
+      p += 2;
+      len -= 2;
+    } else {
+      return;
+    }
+
+    if (protocol == PPP_IP) {
+      if (phase == PHASE_UP && netif) {
+        netif->pppInput(p, len);
+      }
+      return;
+    }
+
+    if (len < 4) {
+      return;
+    }
+    uint8_t code = p[0];
+    uint8_t id = p[1];
+    uint16_t plen = ((uint16_t)p[2] << 8) | p[3];
+    if (plen < 4 || plen > len) {
+      return;
+    }
+    const uint8_t* data = p + 4;
+    plen -= 4;
+
+    switch (protocol) {
+    case PPP_LCP:  handleLcp(code, id, data, plen);  break;
+    case PPP_PAP:  handlePap(code);                  break;
+    case PPP_IPCP: handleIpcp(code, id, data, plen); break;
+    default:
+      if (phase != PHASE_DEAD) {
+        // Tell the peer we don't speak it (the rejected packet is truncated)
+        uint8_t rej[2] = { (uint8_t)(protocol >> 8), (uint8_t)(protocol & 0xFF) };
+        uint16_t n = len < 32 ? len : 32;
+        controlStart(PPP_LCP, CODE_PROTOCOL_REJECT, ++next_id, 2 + n);
+        frameWrite(rej, 2);
+        frameWrite(p, n);
+        frameEnd();
+      }
+      break;
+    }
+  }
+
+  /*
+   * Negotiation
+   */
+
+  void enterPhase(uint8_t next) {
+    bool wasUp = (phase == PHASE_UP);
+    phase = next;
+    retries = 0;
+    local_ok = false;
+    peer_ok = false;
+    if (phase == PHASE_LCP || phase == PHASE_AUTH || phase == PHASE_IPCP) {
+      sendRequest();
+    } else if (phase == PHASE_UP) {
+      DBG("### PPP up:", local_ip);
+      if (netif) {
+        netif->pppUp(local_ip, dns1);
+      }
+    }
+    if (wasUp && phase != PHASE_UP && netif) {
+      netif->pppDown();
+    }
+  }
+
+  // Moves on once both sides have acknowledged each other's configuration
+  void checkOpened() {
+    if (!local_ok || !peer_ok) {
+      return;
+    }
+    if (phase == PHASE_LCP) {
+      enterPhase(need_pap ? PHASE_AUTH : PHASE_IPCP);
+    } else if (phase == PHASE_IPCP) {
+      enterPhase(PHASE_UP);
+    }
+  }
+
+  void sendRequest() {
+    sent_millis = millis();
+    req_id = ++next_id;
+    uint8_t opts[18];
+    uint8_t len = 0;
+    if (phase == PHASE_LCP) {
+      if (lcp_opts & LCP_OPT_MRU) {
+        opts[len++] = 1;
+        opts[len++] = 4;
+        opts[len++] = TINY_GSM_PPP_MRU >> 8;
+        opts[len++] = TINY_GSM_PPP_MRU & 0xFF;
+      }
+      if (lcp_opts & LCP_OPT_MAGIC) {
+        opts[len++] = 5;
+        opts[len++] = 6;
+        for (int8_t i = 24; i >= 0; i -= 8) {
+          opts[len++] = magic >> i;
+        }
+      }
+      sendControl(PPP_LCP, CODE_CONFIGURE_REQUEST, req_id, opts, len);
+    } else if (phase == PHASE_AUTH) {
+      // PAP numbers its authenticate request, ack and nak like LCP's
+      // configure packets
+      uint8_t ulen = strlen(user);
+      uint8_t plen = strlen(pwd);
+      controlStart(PPP_PAP, CODE_CONFIGURE_REQUEST, req_id, 2 + ulen + plen);
+      framePut(ulen);
+      frameWrite((const uint8_t*)user, ulen);
+      framePut(plen);
+      frameWrite((const uint8_t*)pwd, plen);
+      frameEnd();
+    } else if (phase == PHASE_IPCP) {
+      len = ipcpOption(opts, len, IPCP_OPT_ADDRESS, 3, local_ip);
+      len = ipcpOption(opts, len, IPCP_OPT_DNS1, 129, dns1);
+      len = ipcpOption(opts, len, IPCP_OPT_DNS2, 131, dns2);
+      sendControl(PPP_IPCP, CODE_CONFIGURE_REQUEST, req_id, opts, len);
+    }
+  }
+
+  uint8_t ipcpOption(uint8_t* opts, uint8_t len, uint8_t bit, uint8_t type,
+                     IPAddress& ip)
+  {
+    if (ipcp_opts & bit) {
+      opts[len++] = type;
+      opts[len++] = 6;
+      for (uint8_t i = 0; i < 4; i++) {
+        opts[len++] = ip[i];
+      }
+    }
+    return len;
+  }
+
+  // Answers a peer's configure request: the options we don't know are
+  // rejected, the ones with values we can't accept get a nak, and otherwise
+  // the whole lot is acknowledged.
+  void answerRequest(uint16_t protocol, uint8_t id, const uint8_t* data, uint16_t len) {
+    uint8_t answer = CODE_CONFIGURE_ACK;
+    uint16_t answer_len = 0;
+    for (uint8_t pass = 0; pass < 2; pass++) {
+      if (pass) {
+        controlStart(protocol, answer, id, answer_len);
+      }
+      for (uint16_t i = 0; i + 2 <= len && data[i + 1] >= 2 && i + data[i + 1] <= len;
+           i += data[i + 1])
+      {
+        const uint8_t* opt = data + i;
+        uint8_t verdict = judgeOption(protocol, opt);
+        if (!pass) {
+          if (verdict > answer) {
+            answer = verdict;
+            answer_len = 0;
+          }
+          if (verdict == answer) {
+            answer_len += (verdict == CODE_CONFIGURE_NAK) ? 4 : opt[1];
+          }
+        } else if (verdict == answer) {
+          if (answer == CODE_CONFIGURE_NAK) {
+            // The only thing we nak is authentication other than PAP
+            const uint8_t pap[] = { 3, 4, PPP_PAP >> 8, PPP_PAP & 0xFF };
+            frameWrite(pap, sizeof(pap));
+          } else {
+            frameWrite(opt, opt[1]);
+          }
+        }
+      }
+    }
+    frameEnd();
+    if (answer == CODE_CONFIGURE_ACK) {
+      peer_ok = true;
+      checkOpened();
+    }
+  }
+
+  uint8_t judgeOption(uint16_t protocol, const uint8_t* opt) {
+    if (protocol == PPP_IPCP) {
+      // Only the peer's own address; no header compression
+      return (opt[0] == 3) ? CODE_CONFIGURE_ACK : CODE_CONFIGURE_REJECT;
+    }
+    switch (opt[0]) {
+    case 1:  // MRU
+    case 2:  // ACCM
+    case 5:  // magic number
+    case 7:  // protocol field compression
+    case 8:  // address and control field compression
+      return CODE_CONFIGURE_ACK;
+    case 3:  // authentication
+      if (opt[1] >= 4 && opt[2] == (PPP_PAP >> 8) && opt[3] == (PPP_PAP & 0xFF)) {
+        need_pap = true;
+        return CODE_CONFIGURE_ACK;
+      }
+      return CODE_CONFIGURE_NAK;
+    default:
+      return CODE_CONFIGURE_REJECT;
+    }
+  }
+
+  void handleLcp(uint8_t code, uint8_t id, const uint8_t* data, uint16_t len) {
+    switch (code) {
+    case CODE_CONFIGURE_REQUEST:
+      if (phase == PHASE_LCP) {
+        need_pap = false;
+        answerRequest(PPP_LCP, id, data, len);
+      } else if (phase != PHASE_DEAD && phase != PHASE_TERMINATE) {
+        // The peer restarted the link
+        enterPhase(PHASE_LCP);
+        answerRequest(PPP_LCP, id, data, len);
+      }
+      break;
+    case CODE_CONFIGURE_ACK:
+      if (phase == PHASE_LCP && id == req_id) {
+        local_ok = true;
+        checkOpened();
+      }
+      break;
+    case CODE_CONFIGURE_NAK:
+    case CODE_CONFIGURE_REJECT:
+      if (phase == PHASE_LCP && id == req_id) {
+        for (uint16_t i = 0; i + 2 <= len && data[i + 1] >= 2; i += data[i + 1]) {
+          if (data[i] == 5) {
+            if (code == CODE_CONFIGURE_NAK) {
+              magic = magic * 1103515245 + 12345;
+            } else {
+              lcp_opts &= ~LCP_OPT_MAGIC;
+            }
+          } else if (data[i] == 1) {
+            lcp_opts &= ~LCP_OPT_MRU;
+          }
+        }
+        sendRequest();
+      }
+      break;
+    case CODE_TERMINATE_REQUEST:
+      sendControl(PPP_LCP, CODE_TERMINATE_ACK, id, NULL, 0);
+      enterPhase(PHASE_DEAD);
+      break;
+    case CODE_TERMINATE_ACK:
+      if (phase == PHASE_TERMINATE) {
+        enterPhase(PHASE_DEAD);
+      }
+      break;
+    case CODE_ECHO_REQUEST:
+      if (phase >= PHASE_AUTH && len >= 4) {
+        uint8_t m[4] = { (uint8_t)(magic >> 24), (uint8_t)(magic >> 16),
+                         (uint8_t)(magic >> 8), (uint8_t)magic };
+        controlStart(PPP_LCP, CODE_ECHO_REPLY, id, len);
+        frameWrite(m, 4);
+        frameWrite(data + 4, len - 4);
+        frameEnd();
+      }
+      break;
+    }
+  }
+
+  void handlePap(uint8_t code) {
+    if (phase != PHASE_AUTH) {
+      return;
+    }
+    if (code == CODE_CONFIGURE_ACK) {
+      enterPhase(PHASE_IPCP);
+    } else if (code == CODE_CONFIGURE_NAK) {
+      DBG("### PPP authentication failed");
+      disconnect();
+    }
+  }
+
+  void handleIpcp(uint8_t code, uint8_t id, const uint8_t* data, uint16_t len) {
+    if (phase != PHASE_IPCP && phase != PHASE_UP) {
+      return;
+    }
+    switch (code) {
+    case CODE_CONFIGURE_REQUEST:
+      answerRequest(PPP_IPCP, id, data, len);
+      break;
+    case CODE_CONFIGURE_ACK:
+      if (id == req_id) {
+        local_ok = true;
+        checkOpened();
+      }
+      break;
+    case CODE_CONFIGURE_NAK:
+    case CODE_CONFIGURE_REJECT:
+      if (id != req_id) {
+        break;
+      }
+      // A nak carries the addresses we should be using
+      for (uint16_t i = 0; i + 2 <= len && data[i + 1] >= 2; i += data[i + 1]) {
+        const uint8_t* opt = data + i;
+        uint8_t bit = 0;
+        IPAddress* ip = NULL;
+        if (opt[0] == 3) {
+          bit = IPCP_OPT_ADDRESS;
+          ip = &local_ip;
+        } else if (opt[0] == 129) {
+          bit = IPCP_OPT_DNS1;
+          ip = &dns1;
+        } else if (opt[0] == 131) {
+          bit = IPCP_OPT_DNS2;
+          ip = &dns2;
+        }
+        if (!bit) {
+          continue;
+        }
+        if (code == CODE_CONFIGURE_REJECT) {
+          ipcp_opts &= ~bit;
+        } else if (opt[1] == 6) {
+          *ip = IPAddress(opt[2], opt[3], opt[4], opt[5]);
+        }
+      }
+      sendRequest();
+      break;
+    case CODE_TERMINATE_REQUEST:
+      sendControl(PPP_IPCP, CODE_TERMINATE_ACK, id, NULL, 0);
+      enterPhase(PHASE_IPCP);
+      break;
+    }
+  }
+
+  // Waits for a line starting with the expected text; fails on ERROR or
+  // NO CARRIER
+  bool waitLine(GsmConstStr expected, uint32_t timeout_ms) {
+    String line;
+    uint32_t startMillis = millis();
+    while (millis() - startMillis < timeout_ms) {
+      TINY_GSM_YIELD();
+      while (stream.available()) {
+        char c = stream.read();
+        if (c != '\n') {
+          if (c != '\r') {
+            line += c;
+          }
+          continue;
+        }
+        if (line.startsWith(expected)) {
+          return true;
+        }
+        if (line.startsWith(GF("ERROR")) || line.startsWith(GF("NO CARRIER"))) {
+          return false;
+        }
+        line = "";
+      }
+    }
+    return false;
+  }
+
+private:
+  Stream&       stream;
+  TinyGsmPppNetif* netif;
+  const char*   user;
+  const char*   pwd;
+  uint8_t       phase;
+  uint8_t       next_id;
+  uint8_t       req_id;     // id of our outstanding configure request
+  uint8_t       retries;
+  uint32_t      sent_millis;
+  bool          local_ok;   // the peer has acked our request
+  bool          peer_ok;    // we have acked the peer's request
+  bool          need_pap;
+  uint32_t      magic;
+  uint8_t       lcp_opts;
+  uint8_t       ipcp_opts;
+  IPAddress     local_ip;
+  IPAddress     dns1;
+  IPAddress     dns2;
+  uint16_t      tx_fcs;
+  uint16_t      rx_fcs;
+  bool          rx_escaped;
+  uint16_t      rx_len;
+  uint8_t       rx[TINY_GSM_PPP_MRU + 8];  // address, control, protocol, FCS
+};
+
+#endif
@@ -0,0 +1,174 @@
+/**
+ * @file       TinyGsmPump.h
+ * @author     Volodymyr Shymanskyy
+ * @license    LGPL-3.0
+ * @copyright  Copyright (c) 2016 Volodymyr Shymanskyy
+ * @date       Nov 2016
+ */
+
+#ifndef TinyGsmPump_h
+#define TinyGsmPump_h
+
+#include <TinyGsmCommon.h>
+
+// Bytes buffered between the UART and the driver
+#if !defined(TINY_GSM_PUMP_BUFFER)
+  #define TINY_GSM_PUMP_BUFFER 1024
+#endif
+
+#if !defined(TINY_GSM_PUMP_PERIOD_MS)
+  #define TINY_GSM_PUMP_PERIOD_MS 10
+#endif
+
+#if !defined(TINY_GSM_PUMP_STACK)
+  #define TINY_GSM_PUMP_STACK 4096
+#endif
+
+// A Stream that sits between the UART and the driver and keeps draining the
+// UART into a larger buffer, so that URCs and socket data arriving while the
+// sketch is busy elsewhere don't overflow the (usually 64 or 128 byte) UART
+// receive buffer.  Give it to the modem in place of the serial port:
+//
+//   TinyGsmPumpStream pumped(SerialAT);
+//   TinyGsm modem(pumped);
+//
+// pump() may be called from serialEvent(), a timer task or TinyGsmPump below;
+// the driver's own reads pump as well.  It must not be called from an
+// interrupt handler.
+class TinyGsmPumpStream : public Stream
+{
+public:
+  explicit TinyGsmPumpStream(Stream& uart)
+    : uart(uart)
+  {}
+
+  void pump() {
+    // Only one context may move bytes at a time, or they could be reordered
+    if (!pumping.tryLock()) {
+      return;
+    }
+    while (rx.writeable() && uart.available() > 0) {
+      int c = uart.read();
+      if (c < 0) break;
+      rx.put(c);
+    }
+    pumping.unlock();
+  }
+
+  virtual int available() {
+    pump();
+    return rx.size();
+  }
+
+  virtual int read() {
+    pump();
+    uint8_t c;
+    if (!rx.get(&c)) {
+      return -1;
+    }
+    return c;
+  }
+
+  virtual int peek() {
+    pump();
+    uint8_t c;
+    if (!rx.peek(&c)) {
+      return -1;
+    }
+    return c;
+  }
+
+  virtual size_t write(uint8_t c) {
+    return uart.write(c);
+  }
+
+  virtual size_t write(const uint8_t *buf, size_t size) {
+    return uart.write(buf, size);
+  }
+
+  using Print::write;
+
+  virtual void flush() {
+    uart.flush();
+  }
+
+public:
+  Stream& uart;
+
+private:
+  TinyGsmFifo<uint8_t, TINY_GSM_PUMP_BUFFER+1> rx;
+  TinyGsmMutex pumping;
+};
+
+// Runs a modem's maintain() outside the sketch's own calls, so URCs are
+// parsed, socket states and FIFOs are updated and the event callbacks fire
+// without the sketch having to poll.  It never breaks into an AT command:
+// while another task is in the middle of a call to the modem poll() only
+// drains the UART.
+//
+// Call poll() from serialEvent() (or anywhere else in the main loop), or, on
+// ESP32 with TINY_GSM_BACKGROUND_PUMP defined, begin() a FreeRTOS task that
+// calls it every TINY_GSM_PUMP_PERIOD_MS.  In that case the event callbacks
+// run on the pump task.
+template <class Modem>
+class TinyGsmPump
+{
+public:
+  TinyGsmPump(Modem& modem, TinyGsmPumpStream& serial)
+    : modem(modem), serial(serial)
+  {
+#if defined(TINY_GSM_BACKGROUND_PUMP) && defined(ESP32)
+    task = NULL;
+    running = false;
+#endif
+  }
+
+  void poll() {
+    serial.pump();
+    if (!modem.tryLockAT()) {
+      return;
+    }
+    modem.maintain();
+    modem.unlockAT();
+  }
+
+#if defined(TINY_GSM_BACKGROUND_PUMP) && defined(ESP32)
+  bool begin(UBaseType_t priority = 2, uint32_t stack = TINY_GSM_PUMP_STACK) {
+    if (running) {
+      return true;
+    }
+    running = true;
+    if (xTaskCreate(taskMain, "TinyGsmPump", stack, this, priority, &task) != pdPASS) {
+      running = false;
+      return false;
+    }
+    return true;
+  }
+
+  // The task finishes its current pass and deletes itself, so it never
+  // dies holding the modem's lock
+  void end() {
+    running = false;
+  }
+
+private:
+  static void taskMain(void* arg) {
+    TinyGsmPump* self = static_cast<TinyGsmPump*>(arg);
+    while (self->running) {
+      self->poll();
+      vTaskDelay(pdMS_TO_TICKS(TINY_GSM_PUMP_PERIOD_MS));
+    }
+    self->task = NULL;
+    vTaskDelete(NULL);
+  }
+
+  TaskHandle_t  task;
+  volatile bool running;
+#endif
+
+private:
+  Modem&             modem;
+  TinyGsmPumpStream& serial;
+};
+
+#endif
@@ -23,6 +23,7 @@
 // #define TINY_GSM_MODEM_MC60E
 // #define TINY_GSM_MODEM_ESP8266
 // #define TINY_GSM_MODEM_XBEE
+// #define TINY_GSM_MODEM_XBEE_API
 
 // Set serial for debug console (to the Serial Monitor, speed 115200)
 #define SerialMon Serial
@@ -6,6 +6,14 @@
 // #define TINY_GSM_MODEM_SIM800
 
 #include <TinyGsmClient.h>
+#if defined(TINY_GSM_MODEM_HAS_CMUX)
+  #include <TinyGsmCmux.h>
+#endif
+#if defined(TINY_GSM_MODEM_HAS_PPP)
+  #include <TinyGsmPpp.h>
+#endif
+#include <TinyGsmPump.h>
+#include <TinyGsmBond.h>
 
 TinyGsm modem(Serial);
 TinyGsmClient client(modem);
@@ -14,13 +22,61 @@ TinyGsmClient client(modem);
   TinyGsmClientSecure client_secure(modem);
 #endif
 
+#if defined(TINY_GSM_MODEM_HAS_UDP)
+  TinyGsmUdp udp(modem, 2);
+#endif
+
+#if defined(TINY_GSM_MODEM_HAS_TRANSPARENT)
+  TinyGsmClientTransparent raw(modem);
+#endif
+
 char server[] = "somewhere";
 char resource[] = "something";
 
+int readChunk(uint32_t offset, uint8_t* buf, size_t len, void* ctx) {
+  memset(buf, 0, len);
+  return len;
+}
+
+bool writeChunk(uint32_t offset, const uint8_t* buf, size_t len, void* ctx) {
+  return true;
+}
+
+#if !defined(TINY_GSM_MODEM_XBEE)
+  void onClientData(Client& c) {
+    c.read();
+  }
+
+  void onClientClose(Client& c) {
+    c.stop();
+  }
+#endif
+
+#if defined(TINY_GSM_MODEM_HAS_NETWORK_EVENTS)
+  void onRegistration(int status) {
+  }
+
+  void onPdpDeactivated() {
+  }
+#endif
+
 void setup() {
   Serial.begin(115200);
   delay(3000);
   modem.restart();
+
+  #if defined(TINY_GSM_MODEM_HAS_WARM_START)
+    modem.warmStart();
+  #endif
+
+  #if !defined(TINY_GSM_MODEM_XBEE)
+    client.onData(onClientData);
+    client.onClose(onClientClose);
+  #endif
+  #if defined(TINY_GSM_MODEM_HAS_NETWORK_EVENTS)
+    modem.onRegistrationChange(onRegistration);
+    modem.onPdpDeactivated(onPdpDeactivated);
+  #endif
 }
 
 void loop() {
@@ -69,8 +125,81 @@ void loop() {
     }
   }
 
+  #if !defined(TINY_GSM_MODEM_XBEE)
+    TinyGsmClient* socks[] = { &client };
+    uint16_t readable = 0;
+    if (modem.pollSockets(socks, 1, &readable, NULL, NULL, 1000) && readable) {
+      client.read();
+    }
+  #endif
+
   client.stop();
 
+  #if defined(TINY_GSM_MODEM_HAS_UDP)
+    udp.begin(5000);
+    udp.beginPacket(server, 5000);
+    udp.print("ping");
+    udp.endPacket();
+    if (udp.parsePacket()) {
+      while (udp.available()) {
+        udp.read();
+      }
+    }
+    udp.stop();
+  #endif
+
+  #if defined(TINY_GSM_MODEM_HAS_TRANSPARENT)
+    modem.setTransparentMode(true);
+    raw.connect(server, 80);
+    raw.print("ping");
+    raw.escape();
+    raw.resume();
+    while (raw.available()) {
+      raw.read();
+    }
+    raw.stop();
+    modem.setTransparentMode(false);
+  #endif
+
+  #if defined(TINY_GSM_MODEM_HAS_CMUX)
+    {
+      TinyGsmCmux cmux(Serial);
+      if (cmux.begin()) {
+        TinyGsm control(cmux.channel(1));
+        control.getSignalQuality();
+        cmux.end();
+      }
+    }
+  #endif
+
+  #if defined(TINY_GSM_MODEM_HAS_PPP)
+    {
+      TinyGsmPpp ppp(Serial);
+      if (ppp.connect("YourAPN")) {
+        uint8_t packet[20] = { 0x45 };
+        ppp.send(packet, sizeof(packet));
+        ppp.maintain();
+        ppp.disconnect();
+      }
+    }
+  #endif
+
+  #if !defined(TINY_GSM_MODEM_XBEE)
+    {
+      TinyGsmPumpStream pumped(Serial);
+      TinyGsm pumpedModem(pumped);
+      TinyGsmPump<TinyGsm> pump(pumpedModem, pumped);
+      pump.poll();
+    }
+  #endif
+
+  {
+    TinyGsmBond bond;
+    bond.addLink(client, 2000);
+    bond.upload(server, 9000, 1, 4096, readChunk, NULL);
+    bond.download(server, 80, resource, writeChunk, NULL);
+  }
+
   #if defined(TINY_GSM_MODEM_HAS_GPRS)
     modem.gprsDisconnect();
   #endif